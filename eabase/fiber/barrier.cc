@@ -0,0 +1,63 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#include <errno.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/fiber/fiber.h"
+
+extern "C" {
+
+int fiber_barrier_init(fiber_barrier_t* __restrict barrier,
+                       const fiber_barrierattr_t* __restrict,
+                       unsigned count) {
+    if (count == 0) {
+        return EINVAL;
+    }
+    int rc = fiber_sem_init(&barrier->sems[0], 0);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = fiber_sem_init(&barrier->sems[1], 0);
+    if (rc != 0) {
+        fiber_sem_destroy(&barrier->sems[0]);
+        return rc;
+    }
+    barrier->count = count;
+    barrier->narrival = 0;
+    return 0;
+}
+
+int fiber_barrier_destroy(fiber_barrier_t* barrier) {
+    fiber_sem_destroy(&barrier->sems[0]);
+    fiber_sem_destroy(&barrier->sems[1]);
+    return 0;
+}
+
+int fiber_barrier_wait(fiber_barrier_t* barrier) {
+    eabase::atomic<uint64_t>* narrival =
+        (eabase::atomic<uint64_t>*)&barrier->narrival;
+    const uint64_t n = narrival->fetch_add(1, eabase::memory_order_acq_rel);
+    const uint64_t round = n / barrier->count;
+    fiber_sem_t* sem = &barrier->sems[round & 1];
+    if (n % barrier->count == barrier->count - 1) {
+        // The last one of the round releases others.
+        fiber_sem_post_n(sem, barrier->count - 1);
+        return FIBER_BARRIER_SERIAL_THREAD;
+    }
+    return fiber_sem_wait(sem);
+}
+
+}  // extern "C"
@@ -76,6 +76,7 @@ enum WaiterState {
 };
 
 struct Butex;
+struct ButexWaitAny;
 
 struct ButexWaiter : public eabase::LinkNode<ButexWaiter> {
     // tids of pthreads are 0
@@ -84,6 +85,10 @@ struct ButexWaiter : public eabase::LinkNode<ButexWaiter> {
     // Erasing node from middle of LinkedList is thread-unsafe, we need
     // to hold its container's lock.
     eabase::atomic<Butex*> container;
+
+    // Not NULL iff the waiter is blocking in butex_wait_any(), or is one
+    // of the nodes queued by the function.
+    ButexWaitAny* wait_any;
 };
 
 // non_pthread_task allocates this structure on stack and queue it in
@@ -104,6 +109,42 @@ struct ButexPthreadWaiter : public ButexWaiter {
     eabase::atomic<int> sig;
 };
 
+// butex_wait_any() queues one node per butex, all nodes share one
+// ButexWaitAny and the waiter is woken up by whoever resolves it first.
+struct ButexWaitAnyNode : public ButexWaiter {
+    Butex* butex;
+    int index;
+};
+
+enum ButexWaitAnyResult {
+    // Values >= 0 are indexes of the butex that woke up the waiter.
+    WAIT_ANY_NOT_QUEUED = -1,
+    WAIT_ANY_PENDING = -2,
+    WAIT_ANY_TIMEDOUT = -3,
+    WAIT_ANY_INTERRUPTED = -4,
+};
+
+struct ButexWaitAny {
+    // Only one of wakers, TimerThread and interruption changes the result
+    // from WAIT_ANY_PENDING, which is the one to wake up `waiter'.
+    bool resolve(int r) {
+        int expected = WAIT_ANY_PENDING;
+        return result.compare_exchange_strong(
+            expected, r, eabase::memory_order_acq_rel,
+            eabase::memory_order_relaxed);
+    }
+
+    eabase::atomic<int> result;
+    // ButexFiberWaiter or ButexPthreadWaiter blocking in butex_wait_any().
+    ButexWaiter* waiter;
+    ButexWaitAnyNode* nodes;
+    const int* expected_values;
+    size_t n;
+    // Distinct butexes of the nodes sorted by address, locked in order.
+    Butex* butexes[BUTEX_WAIT_ANY_MAX];
+    size_t nbutex;
+};
+
 typedef eabase::LinkedList<ButexWaiter> ButexWaiterList;
 
 enum ButexPthreadSignal { PTHREAD_NOT_SIGNALLED, PTHREAD_SIGNALLED };
@@ -120,6 +161,25 @@ struct EA_CACHELINE_ALIGNMENT Butex {
     static_assert(offsetof(Butex, value) == 0, "offsetof_value_must_0");
     static_assert(sizeof(Butex) == BAIDU_CACHELINE_SIZE, "butex_fits_in_one_cacheline");
 
+// Remove `bw' which is the head of its butex, whose waiter_lock is held.
+// Returns the waiter to wake up, NULL if `bw' is a node of a butex_wait_any()
+// which was already resolved by another butex, timeout or interruption.
+inline ButexWaiter* detach_waiter(ButexWaiter* bw) {
+    bw->RemoveFromList();
+    ButexWaitAny* const wa = bw->wait_any;
+    if (wa == NULL) {
+        bw->container.store(NULL, eabase::memory_order_relaxed);
+        return bw;
+    }
+    ButexWaiter* const waiter = wa->waiter;
+    const bool resolved =
+        wa->resolve(static_cast<ButexWaitAnyNode*>(bw)->index);
+    // butex_wait_any() may return and invalidate `bw' and `wa' as soon as
+    // it sees the NULL container, don't touch them after the store.
+    bw->container.store(NULL, eabase::memory_order_release);
+    return resolved ? waiter : NULL;
+}
+
 static void wakeup_pthread(ButexPthreadWaiter* pw) {
     // release fence makes wait_pthread see changes before wakeup.
     pw->sig.store(PTHREAD_SIGNALLED, eabase::memory_order_release);
@@ -176,7 +236,8 @@ int wait_pthread(ButexPthreadWaiter& pw, const timespec* abstime) {
 }
 
 extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
-extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group_nosignal;
+extern TaskGroup* get_task_group_nosignal(TaskControl* c);
+extern void set_task_group_nosignal(TaskControl* c, TaskGroup* g);
 
 // Returns 0 when no need to unschedule or successfully unscheduled,
 // -1 otherwise.
@@ -270,11 +331,12 @@ void butex_destroy(void* butex) {
 inline TaskGroup* get_task_group(TaskControl* c, bool nosignal = false) {
     TaskGroup* g = tls_task_group;
     if (nosignal) {
-        if (NULL == tls_task_group_nosignal) {
+        TaskGroup* cached = get_task_group_nosignal(c);
+        if (NULL == cached) {
             g = g ? g : c->choose_one_group();
-            tls_task_group_nosignal = g;
+            set_task_group_nosignal(c, g);
         } else {
-            g = tls_task_group_nosignal;
+            g = cached;
         }
     } else {
         g = g ? g : c->choose_one_group();
@@ -295,13 +357,14 @@ int butex_wake(void* arg, bool nosignal) {
     ButexWaiter* front = NULL;
     {
         BAIDU_SCOPED_LOCK(b->waiter_lock);
-        if (b->waiters.empty()) {
-            return 0;
-        }
-        front = b->waiters.head()->value();
-        front->RemoveFromList();
-        front->container.store(NULL, eabase::memory_order_relaxed);
+        do {
+            if (b->waiters.empty()) {
+                return 0;
+            }
+            front = detach_waiter(b->waiters.head()->value());
+        } while (front == NULL);
     }
+    trace_sched_event(SCHED_TRACE_BUTEX_WAKE, front->tid, (uint64_t)arg);
     if (front->tid == 0) {
         wakeup_pthread(static_cast<ButexPthreadWaiter*>(front));
         return 1;
@@ -318,21 +381,28 @@ int butex_wake(void* arg, bool nosignal) {
 }
 
 int butex_wake_all(void* arg, bool nosignal) {
+    return butex_wake_n(arg, 0, nosignal);
+}
+
+int butex_wake_n(void* arg, size_t n, bool nosignal) {
     Butex* b = container_of(static_cast<eabase::atomic<int>*>(arg), Butex, value);
 
     ButexWaiterList fiber_waiters;
     ButexWaiterList pthread_waiters;
     {
+        size_t nwaiter = 0;
         BAIDU_SCOPED_LOCK(b->waiter_lock);
-        while (!b->waiters.empty()) {
-            ButexWaiter* bw = b->waiters.head()->value();
-            bw->RemoveFromList();
-            bw->container.store(NULL, eabase::memory_order_relaxed);
+        while (!b->waiters.empty() && (n == 0 || nwaiter < n)) {
+            ButexWaiter* bw = detach_waiter(b->waiters.head()->value());
+            if (bw == NULL) {
+                continue;
+            }
             if (bw->tid) {
                 fiber_waiters.Append(bw);
             } else {
                 pthread_waiters.Append(bw);
             }
+            ++nwaiter;
         }
     }
 
@@ -341,6 +411,7 @@ int butex_wake_all(void* arg, bool nosignal) {
         ButexPthreadWaiter* bw = static_cast<ButexPthreadWaiter*>(
             pthread_waiters.head()->value());
         bw->RemoveFromList();
+        trace_sched_event(SCHED_TRACE_BUTEX_WAKE, 0, (uint64_t)arg);
         wakeup_pthread(bw);
         ++nwakeup;
     }
@@ -351,6 +422,7 @@ int butex_wake_all(void* arg, bool nosignal) {
     ButexFiberWaiter* next = static_cast<ButexFiberWaiter*>(
         fiber_waiters.head()->value());
     next->RemoveFromList();
+    trace_sched_event(SCHED_TRACE_BUTEX_WAKE, next->tid, (uint64_t)arg);
     unsleep_if_necessary(next, get_global_timer_thread());
     ++nwakeup;
     TaskGroup* g = get_task_group(next->control, nosignal);
@@ -360,6 +432,7 @@ int butex_wake_all(void* arg, bool nosignal) {
         ButexFiberWaiter* w = static_cast<ButexFiberWaiter*>(
             fiber_waiters.tail()->value());
         w->RemoveFromList();
+        trace_sched_event(SCHED_TRACE_BUTEX_WAKE, w->tid, (uint64_t)arg);
         unsleep_if_necessary(w, get_global_timer_thread());
         g->ready_to_run_general(w->tid, true);
         ++nwakeup;
@@ -381,27 +454,31 @@ int butex_wake_except(void* arg, fiber_t excluded_fiber) {
     ButexWaiterList fiber_waiters;
     ButexWaiterList pthread_waiters;
     {
-        ButexWaiter* excluded_waiter = NULL;
+        // More than one node if the excluded fiber is in butex_wait_any().
+        ButexWaiterList excluded_waiters;
         BAIDU_SCOPED_LOCK(b->waiter_lock);
         while (!b->waiters.empty()) {
             ButexWaiter* bw = b->waiters.head()->value();
-            bw->RemoveFromList();
-
+            if (bw->tid && bw->tid == excluded_fiber) {
+                bw->RemoveFromList();
+                excluded_waiters.Append(bw);
+                continue;
+            }
+            bw = detach_waiter(bw);
+            if (bw == NULL) {
+                continue;
+            }
             if (bw->tid) {
-                if (bw->tid != excluded_fiber) {
-                    fiber_waiters.Append(bw);
-                    bw->container.store(NULL, eabase::memory_order_relaxed);
-                } else {
-                    excluded_waiter = bw;
-                }
+                fiber_waiters.Append(bw);
             } else {
-                bw->container.store(NULL, eabase::memory_order_relaxed);
                 pthread_waiters.Append(bw);
             }
         }
 
-        if (excluded_waiter) {
-            b->waiters.Append(excluded_waiter);
+        while (!excluded_waiters.empty()) {
+            ButexWaiter* bw = excluded_waiters.head()->value();
+            bw->RemoveFromList();
+            b->waiters.Append(bw);
         }
     }
 
@@ -410,6 +487,7 @@ int butex_wake_except(void* arg, fiber_t excluded_fiber) {
         ButexPthreadWaiter* bw = static_cast<ButexPthreadWaiter*>(
             pthread_waiters.head()->value());
         bw->RemoveFromList();
+        trace_sched_event(SCHED_TRACE_BUTEX_WAKE, 0, (uint64_t)arg);
         wakeup_pthread(bw);
         ++nwakeup;
     }
@@ -427,6 +505,7 @@ int butex_wake_except(void* arg, fiber_t excluded_fiber) {
         ButexFiberWaiter* w = static_cast<ButexFiberWaiter*>(
             fiber_waiters.tail()->value());
         w->RemoveFromList();
+        trace_sched_event(SCHED_TRACE_BUTEX_WAKE, w->tid, (uint64_t)arg);
         unsleep_if_necessary(w, get_global_timer_thread());
         g->ready_to_run_general(w->tid, true);
         ++nwakeup;
@@ -446,13 +525,12 @@ int butex_requeue(void* arg, void* arg2) {
         std::unique_lock<internal::FastPthreadMutex> lck1(b->waiter_lock, std::defer_lock);
         std::unique_lock<internal::FastPthreadMutex> lck2(m->waiter_lock, std::defer_lock);
         eabase::double_lock(lck1, lck2);
-        if (b->waiters.empty()) {
-            return 0;
-        }
-
-        front = b->waiters.head()->value();
-        front->RemoveFromList();
-        front->container.store(NULL, eabase::memory_order_relaxed);
+        do {
+            if (b->waiters.empty()) {
+                return 0;
+            }
+            front = detach_waiter(b->waiters.head()->value());
+        } while (front == NULL);
 
         while (!b->waiters.empty()) {
             ButexWaiter* bw = b->waiters.head()->value();
@@ -462,6 +540,7 @@ int butex_requeue(void* arg, void* arg2) {
         }
     }
 
+    trace_sched_event(SCHED_TRACE_BUTEX_WAKE, front->tid, (uint64_t)arg);
     if (front->tid == 0) {  // which is a pthread
         wakeup_pthread(static_cast<ButexPthreadWaiter*>(front));
         return 1;
@@ -479,7 +558,17 @@ int butex_requeue(void* arg, void* arg2) {
 
 // Callable from multiple threads, at most one thread may wake up the waiter.
 static void erase_from_butex_and_wakeup(void* arg) {
-    erase_from_butex(static_cast<ButexWaiter*>(arg), true, WAITER_STATE_TIMEDOUT);
+    ButexWaiter* bw = static_cast<ButexWaiter*>(arg);
+    TaskGroup* g = tls_task_group;
+    if (g != NULL && bw->tid) {
+        // Run by TimerQueue of the worker which suspended the waiter, the
+        // worker picks it up right after without signalling others.
+        if (erase_from_butex(bw, false, WAITER_STATE_TIMEDOUT)) {
+            g->push_rq(bw->tid);
+        }
+        return;
+    }
+    erase_from_butex(bw, true, WAITER_STATE_TIMEDOUT);
 }
 
 // Used in task_group.cpp
@@ -494,7 +583,16 @@ inline bool erase_from_butex(ButexWaiter* bw, bool wakeup, WaiterState state) {
     bool erased = false;
     Butex* b;
     int saved_errno = errno;
-    while ((b = bw->container.load(eabase::memory_order_acquire))) {
+    if (bw->wait_any) {
+        // The waiter of butex_wait_any() is not queued itself, its nodes are
+        // dequeued by the waiter after waking up.
+        erased = bw->wait_any->resolve(state == WAITER_STATE_TIMEDOUT ?
+                                       WAIT_ANY_TIMEDOUT : WAIT_ANY_INTERRUPTED);
+        if (erased && bw->tid) {
+            static_cast<ButexFiberWaiter*>(bw)->waiter_state = state;
+        }
+    }
+    while (!erased && (b = bw->container.load(eabase::memory_order_acquire))) {
         // b can be NULL when the waiter is scheduled but queued.
         BAIDU_SCOPED_LOCK(b->waiter_lock);
         if (b == bw->container.load(eabase::memory_order_relaxed)) {
@@ -546,7 +644,7 @@ static void wait_for_butex(void* arg) {
             b->waiters.Append(bw);
             bw->container.store(b, eabase::memory_order_relaxed);
             if (bw->abstime != NULL) {
-                bw->sleep_id = get_global_timer_thread()->schedule(
+                bw->sleep_id = tls_task_group->schedule_timer(
                     erase_from_butex_and_wakeup, bw, *bw->abstime);
                 if (!bw->sleep_id) {  // TimerThread stopped.
                     errno = ESTOP;
@@ -580,6 +678,7 @@ static int butex_wait_from_pthread(TaskGroup* g, Butex* b, int expected_value,
     TaskMeta* task = NULL;
     ButexPthreadWaiter pw;
     pw.tid = 0;
+    pw.wait_any = NULL;
     pw.sig.store(PTHREAD_NOT_SIGNALLED, eabase::memory_order_relaxed);
     int rc = 0;
     
@@ -639,6 +738,8 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime) {
         return -1;
     }
     TaskGroup* g = tls_task_group;
+    trace_sched_event(SCHED_TRACE_BUTEX_WAIT, (g ? g->current_tid() : 0),
+                      (uint64_t)arg);
     if (NULL == g || g->is_current_pthread_task()) {
         return butex_wait_from_pthread(g, b, expected_value, abstime);
     }
@@ -646,6 +747,7 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime) {
     // tid is 0 iff the thread is non-fiber
     bbw.tid = g->current_tid();
     bbw.container.store(NULL, eabase::memory_order_relaxed);
+    bbw.wait_any = NULL;
     bbw.task_meta = g->current_task();
     bbw.sleep_id = 0;
     bbw.waiter_state = WAITER_STATE_READY;
@@ -709,6 +811,226 @@ int butex_wait(void* arg, int expected_value, const timespec* abstime) {
     return 0;
 }
 
+// Remove `bw' from the butex it's queued in, if any. After this function,
+// no waker touches `bw' anymore.
+static void dequeue_waiter(ButexWaiter* bw) {
+    Butex* b;
+    while ((b = bw->container.load(eabase::memory_order_acquire))) {
+        BAIDU_SCOPED_LOCK(b->waiter_lock);
+        if (b == bw->container.load(eabase::memory_order_relaxed)) {
+            bw->RemoveFromList();
+            bw->container.store(NULL, eabase::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+// Called with all butexes of `wa' locked. Returns true if the nodes are
+// queued and someone else will wake up the waiter, otherwise wa->result
+// tells why the waiter should not block.
+static bool queue_wait_any_nodes(ButexWaitAny* wa, TaskMeta* task) {
+    for (size_t i = 0; i < wa->n; ++i) {
+        if (wa->nodes[i].butex->value.load(eabase::memory_order_relaxed) !=
+            wa->expected_values[i]) {
+            wa->result.store(i, eabase::memory_order_relaxed);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < wa->n; ++i) {
+        ButexWaitAnyNode* node = &wa->nodes[i];
+        node->butex->waiters.Append(node);
+        node->container.store(node->butex, eabase::memory_order_relaxed);
+    }
+    // Pairs with setting `interrupted' before resolving the waiter in
+    // TaskGroup::interrupt(): either we see the flag or the interrupter
+    // sees WAIT_ANY_PENDING.
+    wa->result.store(WAIT_ANY_PENDING, eabase::memory_order_seq_cst);
+    if (task != NULL && task->interrupted) {
+        // The queued nodes are skipped by wakers and dequeued by the waiter.
+        // If resolving fails, the interrupter is waking up the waiter.
+        return !wa->resolve(WAIT_ANY_INTERRUPTED);
+    }
+    return true;
+}
+
+inline void lock_wait_any_butexes(ButexWaitAny* wa) {
+    for (size_t i = 0; i < wa->nbutex; ++i) {
+        wa->butexes[i]->waiter_lock.lock();
+    }
+}
+
+static void wait_for_butexes(void* arg) {
+    ButexWaitAny* const wa = static_cast<ButexWaitAny*>(arg);
+    ButexFiberWaiter* const bw = static_cast<ButexFiberWaiter*>(wa->waiter);
+    const fiber_t tid = bw->tid;
+    const size_t nbutex = wa->nbutex;
+    Butex* const* const butexes = wa->butexes;
+    lock_wait_any_butexes(wa);
+    const bool queued = queue_wait_any_nodes(wa, bw->task_meta);
+    if (queued && bw->abstime != NULL) {
+        bw->sleep_id = tls_task_group->schedule_timer(
+            erase_from_butex_and_wakeup, bw, *bw->abstime);
+        if (!bw->sleep_id) {  // TimerThread stopped.
+            errno = ESTOP;
+            erase_from_butex_and_wakeup(bw);
+        }
+    }
+    // The waiter may be woken up through a butex as soon as it's unlocked,
+    // but it has to lock the butexes still held to dequeue its nodes, so
+    // `wa' on its stack is valid until the last unlock.
+    for (size_t i = 0; i < nbutex; ++i) {
+        butexes[i]->waiter_lock.unlock();
+    }
+    if (!queued) {
+        tls_task_group->ready_to_run(tid);
+    }
+}
+
+static void butex_wait_any_from_pthread(TaskGroup* g, ButexWaitAny* wa,
+                                        const timespec* abstime) {
+    TaskMeta* task = NULL;
+    ButexPthreadWaiter pw;
+    pw.tid = 0;
+    pw.container.store(NULL, eabase::memory_order_relaxed);
+    pw.wait_any = wa;
+    pw.sig.store(PTHREAD_NOT_SIGNALLED, eabase::memory_order_relaxed);
+    wa->waiter = &pw;
+    if (g) {
+        task = g->current_task();
+        task->current_waiter.store(&pw, eabase::memory_order_release);
+    }
+    lock_wait_any_butexes(wa);
+    const bool queued = queue_wait_any_nodes(wa, task);
+    for (size_t i = 0; i < wa->nbutex; ++i) {
+        wa->butexes[i]->waiter_lock.unlock();
+    }
+    if (queued) {
+#ifdef SHOW_FIBER_BUTEX_WAITER_COUNT_IN_VARS
+        eabase::Adder<int64_t>& num_waiters = butex_waiter_count();
+        num_waiters << 1;
+#endif
+        wait_pthread(pw, abstime);
+#ifdef SHOW_FIBER_BUTEX_WAITER_COUNT_IN_VARS
+        num_waiters << -1;
+#endif
+    }
+    if (task) {
+        // If current_waiter is NULL, TaskGroup::interrupt() is running and
+        // using pw, spin until current_waiter != NULL.
+        BT_LOOP_WHEN(task->current_waiter.exchange(
+                         NULL, eabase::memory_order_acquire) == NULL,
+                     30/*nops before sched_yield*/);
+    }
+}
+
+int butex_wait_any(void* const* butexes, const int* expected_values,
+                   size_t n, const timespec* abstime) {
+    if (n == 0 || n > BUTEX_WAIT_ANY_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        Butex* b = container_of(
+            static_cast<eabase::atomic<int>*>(butexes[i]), Butex, value);
+        if (b->value.load(eabase::memory_order_relaxed) != expected_values[i]) {
+            // Same as butex_wait(), see changes before changing the butex.
+            eabase::atomic_thread_fence(eabase::memory_order_acquire);
+            return i;
+        }
+    }
+    if (abstime != NULL &&
+        eabase::timespec_to_microseconds(*abstime) <
+        (eabase::gettimeofday_us() + MIN_SLEEP_US)) {
+        errno = ETIMEDOUT;
+        return -1;
+    }
+
+    ButexWaitAnyNode nodes[BUTEX_WAIT_ANY_MAX];
+    ButexWaitAny wa;
+    wa.result.store(WAIT_ANY_NOT_QUEUED, eabase::memory_order_relaxed);
+    wa.nodes = nodes;
+    wa.expected_values = expected_values;
+    wa.n = n;
+    wa.nbutex = 0;
+    TaskGroup* g = tls_task_group;
+    const bool from_pthread = (NULL == g || g->is_current_pthread_task());
+    const fiber_t tid = from_pthread ? 0 : g->current_tid();
+    for (size_t i = 0; i < n; ++i) {
+        Butex* b = container_of(
+            static_cast<eabase::atomic<int>*>(butexes[i]), Butex, value);
+        nodes[i].tid = tid;
+        nodes[i].container.store(NULL, eabase::memory_order_relaxed);
+        nodes[i].wait_any = &wa;
+        nodes[i].butex = b;
+        nodes[i].index = i;
+        // Insertion sort, n is small.
+        size_t j = wa.nbutex;
+        while (j > 0 && wa.butexes[j - 1] > b) {
+            --j;
+        }
+        if (j > 0 && wa.butexes[j - 1] == b) {
+            continue;
+        }
+        for (size_t k = wa.nbutex; k > j; --k) {
+            wa.butexes[k] = wa.butexes[k - 1];
+        }
+        wa.butexes[j] = b;
+        ++wa.nbutex;
+    }
+
+    TaskMeta* task = NULL;
+    if (from_pthread) {
+        butex_wait_any_from_pthread(g, &wa, abstime);
+        task = g ? g->current_task() : NULL;
+    } else {
+        ButexFiberWaiter bbw;
+        bbw.tid = tid;
+        bbw.container.store(NULL, eabase::memory_order_relaxed);
+        bbw.wait_any = &wa;
+        bbw.task_meta = g->current_task();
+        bbw.sleep_id = 0;
+        bbw.waiter_state = WAITER_STATE_READY;
+        bbw.expected_value = 0;
+        bbw.initial_butex = NULL;
+        bbw.control = g->control();
+        bbw.abstime = abstime;
+        wa.waiter = &bbw;
+        task = bbw.task_meta;
+#ifdef SHOW_FIBER_BUTEX_WAITER_COUNT_IN_VARS
+        eabase::Adder<int64_t>& num_waiters = butex_waiter_count();
+        num_waiters << 1;
+#endif
+        bbw.task_meta->current_waiter.store(&bbw, eabase::memory_order_release);
+        g->set_remained(wait_for_butexes, &wa);
+        TaskGroup::sched(&g);
+
+        BT_LOOP_WHEN(unsleep_if_necessary(&bbw, get_global_timer_thread()) < 0,
+                     30/*nops before sched_yield*/);
+        BT_LOOP_WHEN(bbw.task_meta->current_waiter.exchange(
+                         NULL, eabase::memory_order_acquire) == NULL,
+                     30/*nops before sched_yield*/);
+#ifdef SHOW_FIBER_BUTEX_WAITER_COUNT_IN_VARS
+        num_waiters << -1;
+#endif
+    }
+    for (size_t i = 0; i < n; ++i) {
+        dequeue_waiter(&nodes[i]);
+    }
+
+    const int result = wa.result.load(eabase::memory_order_acquire);
+    if (result >= 0) {
+        // A pending interruption is kept and reported by next blocking call.
+        return result;
+    }
+    if (result == WAIT_ANY_INTERRUPTED) {
+        task->interrupted = false;
+        errno = EINTR;
+    } else {
+        errno = ETIMEDOUT;
+    }
+    return -1;
+}
+
 }  // namespace eabase
 
 namespace eabase {
@@ -18,6 +18,7 @@
 #define FIBER_BUTEX_H_
 
 #include <errno.h>                               // users need to check errno
+#include <stddef.h>                              // size_t
 #include <time.h>                                // timespec
 #include "eabase/utility/macros.h"                         // BAIDU_CASSERT
 #include "eabase/fiber/types.h"                       // fiber_t
@@ -47,6 +48,11 @@ int butex_wake(void* butex, bool nosignal = false);
 // Returns # of threads woken up.
 int butex_wake_all(void* butex, bool nosignal = false);
 
+// Wake up at most |n| threads waiting on |butex| in one pass, all of them
+// if |n| is 0.
+// Returns # of threads woken up.
+int butex_wake_n(void* butex, size_t n, bool nosignal = false);
+
 // Wake up all threads waiting on |butex| except a fiber whose identifier
 // is |excluded_fibers|. This function does not yield.
 // Returns # of threads woken up.
@@ -65,6 +71,65 @@ int butex_requeue(void* butex1, void* butex2);
 // Returns 0 on success, -1 otherwise and errno is set.
 int butex_wait(void* butex, int expected_value, const timespec* abstime);
 
+// Max number of butexes waited by one butex_wait_any().
+static const size_t BUTEX_WAIT_ANY_MAX = 16;
+
+// Atomically wait on all of the |n| butexes if *butexes[i] equals
+// expected_values[i] for each i, until any of them is woken up by
+// butex_wake*, or CLOCK_REALTIME reached |abstime| if abstime is not NULL.
+// The caller is removed from all of the butexes before returning, a butex
+// appearing more than once is fine.
+// Returns index of the butex that woke the caller up or whose value did not
+// match, -1 otherwise and errno is set to ETIMEDOUT, EINTR(interrupted by
+// fiber_interrupt) or EINVAL(n is 0 or greater than BUTEX_WAIT_ANY_MAX).
+int butex_wait_any(void* const* butexes, const int* expected_values,
+                   size_t n, const timespec* abstime);
+
+// C++ wrapper of butex_wait_any() to wait for the first of several events,
+// say a response, a cancellation and a deadline, in one fiber:
+//   eabase::ButexSelector selector;
+//   const int response = selector.add(response_butex, *response_butex);
+//   const int cancel = selector.add(cancel_butex, *cancel_butex);
+//   const int rc = selector.wait(&deadline);
+//   if (rc == response) { ... } else if (rc == cancel) { ... }
+//   else if (errno == ETIMEDOUT) { ... }
+// Values of butexes should be re-read and updated by set_expected_value()
+// before waiting again.
+class ButexSelector {
+public:
+    ButexSelector() : _n(0) {}
+
+    // Add |butex| to wait on when *butex equals |expected_value|.
+    // Returns index of the butex in the selector, -1 when it's full.
+    int add(void* butex, int expected_value) {
+        if (_n >= BUTEX_WAIT_ANY_MAX) {
+            return -1;
+        }
+        _butexes[_n] = butex;
+        _expected_values[_n] = expected_value;
+        return _n++;
+    }
+
+    void set_expected_value(int index, int expected_value) {
+        _expected_values[index] = expected_value;
+    }
+
+    void clear() { _n = 0; }
+    size_t size() const { return _n; }
+
+    // Same as butex_wait_any() on the added butexes.
+    int wait(const timespec* abstime = NULL) {
+        return butex_wait_any(_butexes, _expected_values, _n, abstime);
+    }
+
+private:
+    EA_DISALLOW_COPY_AND_ASSIGN(ButexSelector);
+
+    void* _butexes[BUTEX_WAIT_ANY_MAX];
+    int _expected_values[BUTEX_WAIT_ANY_MAX];
+    size_t _n;
+};
+
 }  // namespace eabase
 
 #endif  // FIBER_BUTEX_H_
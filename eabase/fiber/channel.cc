@@ -0,0 +1,162 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#include "eabase/utility/fast_rand.h"
+#include "eabase/utility/logging.h"
+#include "eabase/fiber/butex.h"
+#include "eabase/fiber/channel.h"
+
+namespace eabase {
+
+ChannelBase::ChannelBase(size_t capacity)
+    : _closed(false)
+    , _capacity(capacity) {
+    for (int i = 0; i < 2; ++i) {
+        _butex[i] = butex_create_checked<int>();
+        CHECK(_butex[i] != NULL) << "Fail to create butex";
+        *_butex[i] = 0;
+        _nwaiter[i].store(0, eabase::memory_order_relaxed);
+    }
+}
+
+ChannelBase::~ChannelBase() {
+    butex_destroy(_butex[RECV_SIDE]);
+    butex_destroy(_butex[SEND_SIDE]);
+}
+
+void ChannelBase::close() {
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_closed) {
+            return;
+        }
+        _closed = true;
+    }
+    notify(RECV_SIDE, 0);
+    notify(SEND_SIDE, 0);
+}
+
+bool ChannelBase::closed() const {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return _closed;
+}
+
+void ChannelBase::notify(Side side, size_t n) {
+    eabase::atomic<int>* seq = (eabase::atomic<int>*)_butex[side];
+    // Either the waiter sees the new sequence or we see the waiter.
+    seq->fetch_add(1, eabase::memory_order_seq_cst);
+    if (_nwaiter[side].load(eabase::memory_order_seq_cst) > 0) {
+        butex_wake_n(seq, n);
+    }
+}
+
+int ChannelBase::wait_and_retry(Side side, TryFn try_op, void* arg,
+                                const timespec* abstime) {
+    eabase::atomic<int>* seq = (eabase::atomic<int>*)_butex[side];
+    _nwaiter[side].fetch_add(1, eabase::memory_order_seq_cst);
+    int rc = 0;
+    while (true) {
+        const int expected_seq = seq->load(eabase::memory_order_seq_cst);
+        rc = try_op(this, arg);
+        if (rc != EAGAIN) {
+            break;
+        }
+        // Retry when woken up, or the sequence changed, or interrupted.
+        if (butex_wait(seq, expected_seq, abstime) < 0 &&
+            errno == ETIMEDOUT) {
+            rc = ETIMEDOUT;
+            break;
+        }
+    }
+    _nwaiter[side].fetch_sub(1, eabase::memory_order_relaxed);
+    return rc;
+}
+
+int ChannelSelector::add(ChannelBase* channel, ChannelBase::Side side,
+                         ChannelBase::TryFn try_op, void* arg) {
+    Operation op = { channel, side, try_op, arg };
+    _ops.push_back(op);
+    return _ops.size() - 1;
+}
+
+int ChannelSelector::select(const timespec* abstime) {
+    return do_select(abstime, true);
+}
+
+int ChannelSelector::try_select() {
+    return do_select(NULL, false);
+}
+
+int ChannelSelector::do_select(const timespec* abstime, bool block) {
+    const size_t n = _ops.size();
+    if (n == 0 || n > BUTEX_WAIT_ANY_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    void* butexes[BUTEX_WAIT_ANY_MAX];
+    int expected_seqs[BUTEX_WAIT_ANY_MAX];
+    for (size_t i = 0; i < n; ++i) {
+        butexes[i] = _ops[i].channel->_butex[_ops[i].side];
+        if (block) {
+            _ops[i].channel->_nwaiter[_ops[i].side].fetch_add(
+                1, eabase::memory_order_seq_cst);
+        }
+    }
+    const size_t start = fast_rand_less_than(n);
+    int selected = -1;
+    int woken = -1;
+    while (true) {
+        for (size_t i = 0; i < n; ++i) {
+            expected_seqs[i] = ((eabase::atomic<int>*)butexes[i])->load(
+                eabase::memory_order_seq_cst);
+        }
+        for (size_t k = 0; k < n; ++k) {
+            const size_t i = (start + k) % n;
+            const int rc = _ops[i].try_op(_ops[i].channel, _ops[i].arg);
+            if (rc != EAGAIN) {
+                selected = i;
+                _last_error = rc;
+                break;
+            }
+        }
+        if (selected >= 0) {
+            break;
+        }
+        if (!block) {
+            errno = EAGAIN;
+            break;
+        }
+        woken = butex_wait_any(butexes, expected_seqs, n, abstime);
+        if (woken < 0 && errno == ETIMEDOUT) {
+            break;
+        }
+    }
+    if (block) {
+        for (size_t i = 0; i < n; ++i) {
+            _ops[i].channel->_nwaiter[_ops[i].side].fetch_sub(
+                1, eabase::memory_order_relaxed);
+        }
+    }
+    if (woken >= 0 && selected >= 0 && butexes[woken] != butexes[selected]) {
+        // Woken up by a channel but did another operation, pass the wakeup
+        // on to another waiter of the channel, which may be blocking
+        // forever otherwise.
+        butex_wake(butexes[woken]);
+    }
+    return selected;
+}
+
+}  // namespace eabase
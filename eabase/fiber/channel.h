@@ -0,0 +1,232 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#ifndef FIBER_CHANNEL_H_
+#define FIBER_CHANNEL_H_
+
+#include <time.h>                                 // timespec
+#include <vector>
+#include "eabase/utility/atomicops.h"             // eabase::atomic
+#include "eabase/utility/macros.h"
+#include "eabase/fiber/mutex.h"                   // FastPthreadMutex
+
+namespace eabase {
+
+class ChannelSelector;
+
+// Non-template part of Channel<T>: the lock, the closing state and the
+// butexes that blocked senders and receivers park on.
+class ChannelBase {
+friend class ChannelSelector;
+public:
+    size_t capacity() const { return _capacity; }
+
+    // Close the channel: all blocked and following sends fail with EPIPE,
+    // receivers get the remaining values and EPIPE afterwards.
+    void close();
+
+    bool closed() const;
+
+protected:
+    // Returns 0 on success, EAGAIN to wait and retry, EPIPE when the
+    // channel is closed.
+    typedef int (*TryFn)(ChannelBase* channel, void* arg);
+
+    enum Side {
+        // Receivers wait for values being sent.
+        RECV_SIDE = 0,
+        // Senders wait for room being freed by receivers.
+        SEND_SIDE = 1,
+    };
+
+    explicit ChannelBase(size_t capacity);
+    ~ChannelBase();
+
+    // Run |try_op| until it returns non-EAGAIN, parking the calling fiber
+    // or pthread on the butex of |side| in between.
+    // Returns what |try_op| returns or ETIMEDOUT.
+    int wait_and_retry(Side side, TryFn try_op, void* arg,
+                       const timespec* abstime);
+
+    // Wake up at most |n| waiters of |side| whose condition may change.
+    void notify(Side side, size_t n);
+
+    mutable internal::FastPthreadMutex _mutex;
+    bool _closed;
+    const size_t _capacity;
+
+private:
+    EA_DISALLOW_COPY_AND_ASSIGN(ChannelBase);
+
+    // Value of the butex is a sequence number increased by every change
+    // that a waiter of the side may be interested in.
+    int* _butex[2];
+    eabase::atomic<int> _nwaiter[2];
+};
+
+// A bounded MPMC channel passing values of type |T| between fibers or
+// pthreads, similar to buffered channels of Go. Senders block while the
+// channel is full and receivers block while it's empty, both park on
+// butexes instead of spinning.
+//
+// Example:
+//   eabase::Channel<Request*> chan(1024);
+//   // producers
+//   if (chan.send(req) != 0) { /* closed */ }
+//   // consumers
+//   Request* batch[32];
+//   size_t n = 0;
+//   while (chan.recv_batch(batch, 32, &n) == 0) { process(batch, n); }
+//   // shutdown
+//   chan.close();
+//
+// Blocking methods never return EINTR. The channel must outlive all of
+// the operations on it, namely destroy it after joining users.
+template <typename T>
+class Channel : public ChannelBase {
+friend class ChannelSelector;
+public:
+    // |capacity| must be positive.
+    explicit Channel(size_t capacity);
+    ~Channel();
+
+    // Send |value|, blocking while the channel is full.
+    // Returns 0 on success, EPIPE if the channel is closed.
+    int send(const T& value);
+    int send(T&& value);
+
+    // Returns 0 on success, EAGAIN if the channel is full, EPIPE if the
+    // channel is closed.
+    int try_send(const T& value);
+    int try_send(T&& value);
+
+    // Same as send() but returns ETIMEDOUT when CLOCK_REALTIME reached
+    // |abstime| and the channel is still full.
+    int timed_send(const T& value, const timespec& abstime);
+    int timed_send(T&& value, const timespec& abstime);
+
+    // Receive a value into |value|, blocking while the channel is empty.
+    // Returns 0 on success, EPIPE if the channel is closed and empty.
+    int recv(T* value);
+
+    // Returns 0 on success, EAGAIN if the channel is empty, EPIPE if the
+    // channel is closed and empty.
+    int try_recv(T* value);
+
+    // Same as recv() but returns ETIMEDOUT when CLOCK_REALTIME reached
+    // |abstime| and the channel is still empty.
+    int timed_recv(T* value, const timespec& abstime);
+
+    // Block until the channel is not empty, then receive at most
+    // |max_count| values into |values| at once and set |*count| to the
+    // number of received values. |abstime| works as in timed_recv().
+    // Returns 0 on success, EPIPE if the channel is closed and empty,
+    // ETIMEDOUT, or EINVAL if |max_count| is 0.
+    int recv_batch(T* values, size_t max_count, size_t* count,
+                   const timespec* abstime = NULL);
+
+    // Number of values in the channel.
+    size_t size() const;
+
+private:
+    struct RecvBatchArg {
+        T* values;
+        size_t max_count;
+        size_t count;
+    };
+
+    template <typename U> int try_push(U&& value);
+    int try_pop(T* values, size_t max_count, size_t* count);
+
+    // |arg| is the T* to move from.
+    static int try_send_thunk(ChannelBase* channel, void* arg);
+    // |arg| is the T* to receive into.
+    static int try_recv_thunk(ChannelBase* channel, void* arg);
+    // |arg| is RecvBatchArg*.
+    static int try_recv_batch_thunk(ChannelBase* channel, void* arg);
+
+    // Ring buffer of _capacity values, constructed in place.
+    T* _items;
+    size_t _head;
+    size_t _size;
+};
+
+// Wait for the first of send/recv operations on several channels to
+// complete, similar to select of Go.
+//
+// Example:
+//   eabase::ChannelSelector selector;
+//   const int data = selector.add_recv(&data_chan, &msg);
+//   const int stop = selector.add_recv(&stop_chan, &dummy);
+//   const int rc = selector.select(&deadline);
+//   if (rc == data) { ... } else if (rc == stop) { ... }
+//   else if (errno == ETIMEDOUT) { ... }
+//
+// At most one of the operations is done by each select(). Ready operations
+// are tried from a random position so that no channel is starved.
+class ChannelSelector {
+public:
+    ChannelSelector() : _last_error(0) {}
+
+    // Receive a value into |value| from |channel|.
+    // Returns index of the operation in the selector.
+    template <typename T> int add_recv(Channel<T>* channel, T* value);
+
+    // Send |*value| to |channel|, the value is moved from only if the
+    // operation is done.
+    // Returns index of the operation in the selector.
+    template <typename T> int add_send(Channel<T>* channel, T* value);
+
+    // Returns index of the operation which is done or whose channel is
+    // closed (see last_error()), blocking until there's one or CLOCK_REALTIME
+    // reached |abstime| if abstime is not NULL. -1 otherwise and errno is
+    // set to ETIMEDOUT or EINVAL(no operations or more than
+    // BUTEX_WAIT_ANY_MAX).
+    int select(const timespec* abstime = NULL);
+
+    // Same as select() but sets errno to EAGAIN instead of blocking.
+    int try_select();
+
+    // 0 if the operation returned by last select() is done, EPIPE if its
+    // channel is closed.
+    int last_error() const { return _last_error; }
+
+    void clear() { _ops.clear(); }
+    size_t size() const { return _ops.size(); }
+
+private:
+    EA_DISALLOW_COPY_AND_ASSIGN(ChannelSelector);
+
+    struct Operation {
+        ChannelBase* channel;
+        ChannelBase::Side side;
+        ChannelBase::TryFn try_op;
+        void* arg;
+    };
+
+    int add(ChannelBase* channel, ChannelBase::Side side,
+            ChannelBase::TryFn try_op, void* arg);
+    int do_select(const timespec* abstime, bool block);
+
+    std::vector<Operation> _ops;
+    int _last_error;
+};
+
+}  // namespace eabase
+
+#include "eabase/fiber/channel_inl.h"
+
+#endif  // FIBER_CHANNEL_H_
@@ -0,0 +1,209 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#ifndef FIBER_CHANNEL_INL_H_
+#define FIBER_CHANNEL_INL_H_
+
+#include <stdlib.h>                               // malloc
+#include <algorithm>                              // std::min
+#include <new>                                    // placement new
+#include <utility>                                // std::move
+#include "eabase/utility/logging.h"               // CHECK
+#include "eabase/utility/scoped_lock.h"           // BAIDU_SCOPED_LOCK
+
+namespace eabase {
+
+template <typename T>
+Channel<T>::Channel(size_t capacity)
+    : ChannelBase(capacity)
+    , _items(NULL)
+    , _head(0)
+    , _size(0) {
+    CHECK_GT(capacity, 0u) << "capacity of Channel must be positive";
+    _items = static_cast<T*>(malloc(sizeof(T) * capacity));
+    CHECK(_items != NULL) << "Fail to allocate " << capacity << " items";
+}
+
+template <typename T>
+Channel<T>::~Channel() {
+    for (size_t i = 0; i < _size; ++i) {
+        _items[(_head + i) % _capacity].~T();
+    }
+    free(_items);
+}
+
+template <typename T> template <typename U>
+int Channel<T>::try_push(U&& value) {
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_closed) {
+            return EPIPE;
+        }
+        if (_size == _capacity) {
+            return EAGAIN;
+        }
+        new (&_items[(_head + _size) % _capacity]) T(std::forward<U>(value));
+        ++_size;
+    }
+    notify(RECV_SIDE, 1);
+    return 0;
+}
+
+template <typename T>
+int Channel<T>::try_pop(T* values, size_t max_count, size_t* count) {
+    size_t n = 0;
+    {
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_size == 0) {
+            return _closed ? EPIPE : EAGAIN;
+        }
+        n = std::min(_size, max_count);
+        for (size_t i = 0; i < n; ++i) {
+            T* item = &_items[_head];
+            values[i] = std::move(*item);
+            item->~T();
+            _head = (_head + 1) % _capacity;
+        }
+        _size -= n;
+    }
+    *count = n;
+    notify(SEND_SIDE, n);
+    return 0;
+}
+
+template <typename T>
+int Channel<T>::try_send_thunk(ChannelBase* channel, void* arg) {
+    return static_cast<Channel<T>*>(channel)->try_push(
+        std::move(*static_cast<T*>(arg)));
+}
+
+template <typename T>
+int Channel<T>::try_recv_thunk(ChannelBase* channel, void* arg) {
+    size_t count = 0;
+    return static_cast<Channel<T>*>(channel)->try_pop(
+        static_cast<T*>(arg), 1, &count);
+}
+
+template <typename T>
+int Channel<T>::try_recv_batch_thunk(ChannelBase* channel, void* arg) {
+    RecvBatchArg* a = static_cast<RecvBatchArg*>(arg);
+    return static_cast<Channel<T>*>(channel)->try_pop(
+        a->values, a->max_count, &a->count);
+}
+
+template <typename T>
+int Channel<T>::send(const T& value) {
+    T copy(value);
+    return send(std::move(copy));
+}
+
+template <typename T>
+int Channel<T>::send(T&& value) {
+    const int rc = try_push(std::move(value));
+    if (rc != EAGAIN) {
+        return rc;
+    }
+    return wait_and_retry(SEND_SIDE, try_send_thunk, &value, NULL);
+}
+
+template <typename T>
+int Channel<T>::try_send(const T& value) {
+    return try_push(value);
+}
+
+template <typename T>
+int Channel<T>::try_send(T&& value) {
+    return try_push(std::move(value));
+}
+
+template <typename T>
+int Channel<T>::timed_send(const T& value, const timespec& abstime) {
+    T copy(value);
+    return timed_send(std::move(copy), abstime);
+}
+
+template <typename T>
+int Channel<T>::timed_send(T&& value, const timespec& abstime) {
+    const int rc = try_push(std::move(value));
+    if (rc != EAGAIN) {
+        return rc;
+    }
+    return wait_and_retry(SEND_SIDE, try_send_thunk, &value, &abstime);
+}
+
+template <typename T>
+int Channel<T>::recv(T* value) {
+    size_t count = 0;
+    const int rc = try_pop(value, 1, &count);
+    if (rc != EAGAIN) {
+        return rc;
+    }
+    return wait_and_retry(RECV_SIDE, try_recv_thunk, value, NULL);
+}
+
+template <typename T>
+int Channel<T>::try_recv(T* value) {
+    size_t count = 0;
+    return try_pop(value, 1, &count);
+}
+
+template <typename T>
+int Channel<T>::timed_recv(T* value, const timespec& abstime) {
+    size_t count = 0;
+    const int rc = try_pop(value, 1, &count);
+    if (rc != EAGAIN) {
+        return rc;
+    }
+    return wait_and_retry(RECV_SIDE, try_recv_thunk, value, &abstime);
+}
+
+template <typename T>
+int Channel<T>::recv_batch(T* values, size_t max_count, size_t* count,
+                           const timespec* abstime) {
+    *count = 0;
+    if (max_count == 0) {
+        return EINVAL;
+    }
+    RecvBatchArg arg = { values, max_count, 0 };
+    int rc = try_pop(values, max_count, &arg.count);
+    if (rc == EAGAIN) {
+        rc = wait_and_retry(RECV_SIDE, try_recv_batch_thunk, &arg, abstime);
+    }
+    *count = arg.count;
+    return rc;
+}
+
+template <typename T>
+size_t Channel<T>::size() const {
+    BAIDU_SCOPED_LOCK(_mutex);
+    return _size;
+}
+
+template <typename T>
+int ChannelSelector::add_recv(Channel<T>* channel, T* value) {
+    return add(channel, ChannelBase::RECV_SIDE,
+               Channel<T>::try_recv_thunk, value);
+}
+
+template <typename T>
+int ChannelSelector::add_send(Channel<T>* channel, T* value) {
+    return add(channel, ChannelBase::SEND_SIDE,
+               Channel<T>::try_send_thunk, value);
+}
+
+}  // namespace eabase
+
+#endif  // FIBER_CHANNEL_INL_H_
@@ -0,0 +1,245 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+
+#include <dlfcn.h>                                // dladdr
+#include <string.h>                               // strrchr
+#include <pthread.h>
+#include <inttypes.h>                             // PRId64
+#include <new>                                    // std::nothrow
+#include <algorithm>                              // std::sort
+#include <map>
+#include <gflags/gflags.h>
+#include "eabase/utility/scoped_lock.h"           // BAIDU_SCOPED_LOCK
+#include "eabase/utility/string_printf.h"         // string_printf
+#include "eabase/utility/third_party/murmurhash3/murmurhash3.h" // fmix64
+#include "eabase/utility/class_name.h"            // demangle
+#include "eabase/var/var.h"
+#include "eabase/fiber/cpu_accounting.h"
+
+namespace eabase {
+
+static bool pass_bool(const char*, bool) { return true; }
+
+DEFINE_bool(fiber_cpu_accounting, false, "Accumulate cpu time, runs and "
+            "queueing delay of fibers by their entry functions or labels "
+            "set by fiber_set_cpu_label(), shown in /vars/fiber_cpu_top");
+const bool ALLOW_UNUSED dummy_fiber_cpu_accounting =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_cpu_accounting,
+                                       pass_bool);
+
+static bool validate_fiber_cpu_accounting_top_n(const char*, int32_t val) {
+    return val > 0;
+}
+DEFINE_int32(fiber_cpu_accounting_top_n, 10, "Number of entries with the "
+             "most cpu time shown in /vars/fiber_cpu_top");
+const bool ALLOW_UNUSED dummy_fiber_cpu_accounting_top_n =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_cpu_accounting_top_n,
+                                       validate_fiber_cpu_accounting_top_n);
+
+// Protects all fields below.
+static pthread_mutex_t s_table_mutex = PTHREAD_MUTEX_INITIALIZER;
+// All tables ever created.
+static std::vector<CpuAccountingTable*>* s_tables = NULL;
+static std::vector<CpuAccountingTable*>* s_free_tables = NULL;
+
+CpuAccountingTable::CpuAccountingTable() {
+    for (size_t i = 0; i < NSLOT; ++i) {
+        Slot& s = _slots[i];
+        s.key.store(NULL, eabase::memory_order_relaxed);
+        s.is_label = false;
+        s.cputime_ns.store(0, eabase::memory_order_relaxed);
+        s.nrun.store(0, eabase::memory_order_relaxed);
+        s.queue_ns.store(0, eabase::memory_order_relaxed);
+        s.nqueue.store(0, eabase::memory_order_relaxed);
+    }
+    _others.key.store(NULL, eabase::memory_order_relaxed);
+    _others.is_label = true;
+    _others.cputime_ns.store(0, eabase::memory_order_relaxed);
+    _others.nrun.store(0, eabase::memory_order_relaxed);
+    _others.queue_ns.store(0, eabase::memory_order_relaxed);
+    _others.nqueue.store(0, eabase::memory_order_relaxed);
+}
+
+inline void CpuAccountingTable::add_to(Slot* s, int64_t cputime_ns,
+                                       int64_t queue_ns) {
+    // Single writer, plain loads and stores are enough.
+    s->cputime_ns.store(s->cputime_ns.load(eabase::memory_order_relaxed)
+                        + cputime_ns, eabase::memory_order_relaxed);
+    s->nrun.store(s->nrun.load(eabase::memory_order_relaxed) + 1,
+                  eabase::memory_order_relaxed);
+    if (queue_ns >= 0) {
+        s->queue_ns.store(s->queue_ns.load(eabase::memory_order_relaxed)
+                          + queue_ns, eabase::memory_order_relaxed);
+        s->nqueue.store(s->nqueue.load(eabase::memory_order_relaxed) + 1,
+                        eabase::memory_order_relaxed);
+    }
+}
+
+void CpuAccountingTable::add(const void* key, bool is_label,
+                             int64_t cputime_ns, int64_t queue_ns) {
+    size_t index = eabase::fmix64((uint64_t)key) & (NSLOT - 1);
+    for (size_t i = 0; i < MAX_PROBE; ++i) {
+        Slot* s = &_slots[index];
+        const void* cur = s->key.load(eabase::memory_order_relaxed);
+        if (cur == key) {
+            return add_to(s, cputime_ns, queue_ns);
+        }
+        if (cur == NULL) {
+            s->is_label = is_label;
+            // Readers see is_label once they see the key.
+            s->key.store(key, eabase::memory_order_release);
+            return add_to(s, cputime_ns, queue_ns);
+        }
+        index = (index + 1) & (NSLOT - 1);
+    }
+    add_to(&_others, cputime_ns, queue_ns);
+}
+
+void CpuAccountingTable::collect_slot(const Slot& s, const std::string& name,
+                                      std::vector<FiberCpuUsage>* out) {
+    FiberCpuUsage u;
+    u.name = name;
+    u.cputime_ns = s.cputime_ns.load(eabase::memory_order_relaxed);
+    u.nrun = s.nrun.load(eabase::memory_order_relaxed);
+    u.queue_ns = s.queue_ns.load(eabase::memory_order_relaxed);
+    u.nqueue = s.nqueue.load(eabase::memory_order_relaxed);
+    if (u.nrun != 0) {
+        out->push_back(u);
+    }
+}
+
+static std::string key_name(const void* key, bool is_label) {
+    if (is_label) {
+        return (const char*)key;
+    }
+    // Symbols of functions not exported are not found, which are shown as
+    // offsets in modules for addr2line.
+    Dl_info info;
+    if (dladdr(key, &info) == 0) {
+        return eabase::string_printf("%p", key);
+    }
+    if (info.dli_sname != NULL && info.dli_saddr == key) {
+        return eabase::demangle(info.dli_sname);
+    }
+    const char* module = strrchr(info.dli_fname, '/');
+    return eabase::string_printf(
+        "%s+%#lx", (module ? module + 1 : info.dli_fname),
+        (unsigned long)((const char*)key - (const char*)info.dli_fbase));
+}
+
+void CpuAccountingTable::collect(std::vector<FiberCpuUsage>* out) const {
+    for (size_t i = 0; i < NSLOT; ++i) {
+        const Slot& s = _slots[i];
+        const void* key = s.key.load(eabase::memory_order_acquire);
+        if (key != NULL) {
+            collect_slot(s, key_name(key, s.is_label), out);
+        }
+    }
+    collect_slot(_others, "<others>", out);
+}
+
+CpuAccountingTable* acquire_cpu_accounting_table() {
+    BAIDU_SCOPED_LOCK(s_table_mutex);
+    if (s_tables == NULL) {
+        s_tables = new std::vector<CpuAccountingTable*>;
+        s_free_tables = new std::vector<CpuAccountingTable*>;
+    }
+    if (!s_free_tables->empty()) {
+        CpuAccountingTable* t = s_free_tables->back();
+        s_free_tables->pop_back();
+        return t;
+    }
+    CpuAccountingTable* t = new (std::nothrow) CpuAccountingTable;
+    if (t != NULL) {
+        s_tables->push_back(t);
+    }
+    return t;
+}
+
+void release_cpu_accounting_table(CpuAccountingTable* t) {
+    if (t != NULL) {
+        BAIDU_SCOPED_LOCK(s_table_mutex);
+        s_free_tables->push_back(t);
+    }
+}
+
+static bool more_cputime(const FiberCpuUsage& a, const FiberCpuUsage& b) {
+    return a.cputime_ns > b.cputime_ns;
+}
+
+void get_fiber_cpu_usage(std::vector<FiberCpuUsage>* out) {
+    out->clear();
+    std::vector<CpuAccountingTable*> tables;
+    {
+        BAIDU_SCOPED_LOCK(s_table_mutex);
+        if (s_tables != NULL) {
+            tables = *s_tables;
+        }
+    }
+    std::vector<FiberCpuUsage> all;
+    for (size_t i = 0; i < tables.size(); ++i) {
+        tables[i]->collect(&all);
+    }
+    // Merge the same functions or labels from different workers.
+    std::map<std::string, size_t> index;
+    for (size_t i = 0; i < all.size(); ++i) {
+        const FiberCpuUsage& u = all[i];
+        std::map<std::string, size_t>::iterator it = index.find(u.name);
+        if (it == index.end()) {
+            index[u.name] = out->size();
+            out->push_back(u);
+        } else {
+            FiberCpuUsage& v = (*out)[it->second];
+            v.cputime_ns += u.cputime_ns;
+            v.nrun += u.nrun;
+            v.queue_ns += u.queue_ns;
+            v.nqueue += u.nqueue;
+        }
+    }
+    std::sort(out->begin(), out->end(), more_cputime);
+}
+
+void print_fiber_cpu_usage(std::ostream& os, size_t top_n) {
+    std::vector<FiberCpuUsage> usages;
+    get_fiber_cpu_usage(&usages);
+    int64_t total_ns = 0;
+    for (size_t i = 0; i < usages.size(); ++i) {
+        total_ns += usages[i].cputime_ns;
+    }
+    const size_t n = std::min(top_n, usages.size());
+    for (size_t i = 0; i < n; ++i) {
+        const FiberCpuUsage& u = usages[i];
+        if (i) {
+            os << '\n';
+        }
+        os << eabase::string_printf(
+            "cpu=%.2fms(%.1f%%) runs=%" PRId64 " avg_queue=%.1fus %s",
+            u.cputime_ns / 1000000.0,
+            (total_ns ? u.cputime_ns * 100.0 / total_ns : 0.0), u.nrun,
+            (u.nqueue ? u.queue_ns / 1000.0 / u.nqueue : 0.0),
+            u.name.c_str());
+    }
+}
+
+static void print_fiber_cpu_top(std::ostream& os, void*) {
+    print_fiber_cpu_usage(os, FLAGS_fiber_cpu_accounting_top_n);
+}
+
+static eabase::PassiveStatus<std::string> var_fiber_cpu_top(
+    "fiber_cpu_top", print_fiber_cpu_top, NULL);
+
+}  // namespace eabase
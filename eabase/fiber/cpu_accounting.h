@@ -0,0 +1,107 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+
+#ifndef FIBER_CPU_ACCOUNTING_H_
+#define FIBER_CPU_ACCOUNTING_H_
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <gflags/gflags_declare.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/macros.h"             // EA_DISALLOW_COPY_AND_ASSIGN
+
+namespace eabase {
+
+DECLARE_bool(fiber_cpu_accounting);
+
+// Resource usage of fibers sharing an entry function or a label set by
+// fiber_set_cpu_label().
+struct FiberCpuUsage {
+    // Label, symbol of the entry function, or <module>+<offset> of it when
+    // the symbol is not exported.
+    std::string name;
+    // Time spent in running the fibers.
+    int64_t cputime_ns;
+    // Times that the fibers were switched in.
+    int64_t nrun;
+    // Sum of time that the fibers stayed in runqueues before being run,
+    // measured `nqueue' times.
+    int64_t queue_ns;
+    int64_t nqueue;
+};
+
+// Usage of fibers run by one worker, keyed by entry functions or labels.
+// Only the worker updates the table so that no atomic read-modify-write is
+// needed, readers see values updated a moment ago.
+class CpuAccountingTable {
+public:
+    CpuAccountingTable();
+
+    // Add a run of `cputime_ns' to `key', which is a label if `is_label' is
+    // true or an entry function otherwise. `queue_ns' is the time that the
+    // run stayed in a runqueue, negative if it's not measured.
+    void add(const void* key, bool is_label, int64_t cputime_ns,
+             int64_t queue_ns);
+
+    // Append usages in this table to `out', one for each key.
+    void collect(std::vector<FiberCpuUsage>* out) const;
+
+private:
+    EA_DISALLOW_COPY_AND_ASSIGN(CpuAccountingTable);
+
+    static const size_t NSLOT = 512;
+    static const size_t MAX_PROBE = 16;
+
+    struct Slot {
+        // Set once, NULL if the slot is unused.
+        eabase::atomic<const void*> key;
+        bool is_label;
+        eabase::atomic<int64_t> cputime_ns;
+        eabase::atomic<int64_t> nrun;
+        eabase::atomic<int64_t> queue_ns;
+        eabase::atomic<int64_t> nqueue;
+    };
+
+    static void add_to(Slot* s, int64_t cputime_ns, int64_t queue_ns);
+    static void collect_slot(const Slot& s, const std::string& name,
+                             std::vector<FiberCpuUsage>* out);
+
+    Slot _slots[NSLOT];
+    // Keys not fitting in _slots.
+    Slot _others;
+};
+
+// Get a table for a worker, tables of quitted workers are reused.
+CpuAccountingTable* acquire_cpu_accounting_table();
+// Give back the table got from acquire_cpu_accounting_table(). Usages in
+// the table keep being reported.
+void release_cpu_accounting_table(CpuAccountingTable* table);
+
+// Put usages accumulated by all workers into `out', sorted by cputime_ns
+// in descending order.
+void get_fiber_cpu_usage(std::vector<FiberCpuUsage>* out);
+
+// Print the `top_n' entries of get_fiber_cpu_usage() into `os', one line
+// for each, e.g.
+//   cpu=52.31ms(35.2%) runs=1204 avg_queue=12.6us flush_index_loop
+void print_fiber_cpu_usage(std::ostream& os, size_t top_n);
+
+}  // namespace eabase
+
+#endif  // FIBER_CPU_ACCOUNTING_H_
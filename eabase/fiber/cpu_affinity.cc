@@ -0,0 +1,168 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#include <errno.h>
+#include <sched.h>                                // cpu_set_t
+#include <stdlib.h>                               // strtol
+#include <algorithm>                              // std::sort
+#include <gflags/gflags.h>
+#include "eabase/utility/macros.h"
+#include "eabase/utility/string_splitter.h"
+#include "eabase/fiber/numa.h"                    // parse_cpulist
+#include "eabase/fiber/cpu_affinity.h"
+
+DEFINE_string(fiber_service_cpus, "", "Cpus in format of kernel cpulist(like "
+              "0-1) that the timer thread is pinned to. Workers of tags with "
+              "exclude_service in -fiber_tag_affinity don't run on these cpus. "
+              "Only read when fiber starts");
+
+namespace eabase {
+
+static bool validate_fiber_service_cpus(const char*, const std::string& val) {
+    std::vector<int> cpus;
+    return parse_cpulist(val, &cpus) == 0;
+}
+const int ALLOW_UNUSED register_FLAGS_fiber_service_cpus =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_service_cpus,
+                                       validate_fiber_service_cpus);
+
+int TagAffinity::from(const fiber_affinity_t& affinity) {
+    cpus.clear();
+    if (affinity.cpus && parse_cpulist(affinity.cpus, &cpus) != 0) {
+        return -1;
+    }
+    pin_per_core = affinity.pin_per_core;
+    exclude_service_cpus = affinity.exclude_service_cpus;
+    return 0;
+}
+
+void split_tag_spec(const std::string& spec,
+                    std::vector<std::vector<std::string> >* entries) {
+    entries->clear();
+    for (StringSplitter e(spec.c_str(), ';'); e; ++e) {
+        const std::string entry(e.field(), e.length());
+        entries->push_back(std::vector<std::string>());
+        std::vector<std::string>& fields = entries->back();
+        size_t fb = 0;
+        while (true) {
+            const size_t fe = entry.find(':', fb);
+            fields.push_back(entry.substr(fb, fe == std::string::npos ?
+                                          std::string::npos : fe - fb));
+            if (fe == std::string::npos) {
+                break;
+            }
+            fb = fe + 1;
+        }
+    }
+}
+
+// Entries are separated by ';', each of them is
+// <tag>:<cpulist>[:pin][:exclude_service]
+int parse_tag_affinity(const std::string& spec,
+                       std::vector<std::pair<fiber_tag_t, TagAffinity> >* out) {
+    out->clear();
+    std::vector<std::vector<std::string> > entries;
+    split_tag_spec(spec, &entries);
+    for (size_t e = 0; e < entries.size(); ++e) {
+        const std::vector<std::string>& fields = entries[e];
+        if (fields.size() < 2 || fields[0].empty()) {
+            return -1;
+        }
+        char* endptr = NULL;
+        const long tag = strtol(fields[0].c_str(), &endptr, 10);
+        if (*endptr != '\0' || tag < FIBER_TAG_DEFAULT) {
+            return -1;
+        }
+        TagAffinity a;
+        if (parse_cpulist(fields[1], &a.cpus) != 0) {
+            return -1;
+        }
+        for (size_t i = 2; i < fields.size(); ++i) {
+            if (fields[i] == "pin") {
+                a.pin_per_core = true;
+            } else if (fields[i] == "exclude_service") {
+                a.exclude_service_cpus = true;
+            } else {
+                return -1;
+            }
+        }
+        out->push_back(std::make_pair((fiber_tag_t)tag, a));
+    }
+    return 0;
+}
+
+std::string format_cpulist(const std::vector<int>& cpus_in) {
+    std::vector<int> cpus(cpus_in);
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    std::string out;
+    for (size_t i = 0; i < cpus.size();) {
+        size_t j = i;
+        while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) {
+            ++j;
+        }
+        if (!out.empty()) {
+            out.push_back(',');
+        }
+        out.append(std::to_string(cpus[i]));
+        if (j != i) {
+            out.push_back('-');
+            out.append(std::to_string(cpus[j]));
+        }
+        i = j + 1;
+    }
+    return out;
+}
+
+std::vector<int> service_cpus() {
+    std::vector<int> cpus;
+    parse_cpulist(FLAGS_fiber_service_cpus, &cpus);
+    return cpus;
+}
+
+int get_thread_cpus(pthread_t th, std::vector<int>* cpus) {
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    const int rc = pthread_getaffinity_np(th, sizeof(cs), &cs);
+    if (rc) {
+        return rc;
+    }
+    cpus->clear();
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+        if (CPU_ISSET(i, &cs)) {
+            cpus->push_back(i);
+        }
+    }
+    return 0;
+}
+
+int set_thread_cpus(pthread_t th, const std::vector<int>& cpus) {
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    int n = 0;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) {
+            CPU_SET(cpus[i], &cs);
+            ++n;
+        }
+    }
+    if (n == 0) {
+        return EINVAL;
+    }
+    return pthread_setaffinity_np(th, sizeof(cs), &cs);
+}
+
+}  // namespace eabase
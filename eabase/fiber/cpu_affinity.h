@@ -0,0 +1,71 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#ifndef FIBER_CPU_AFFINITY_H_
+#define FIBER_CPU_AFFINITY_H_
+
+#include <pthread.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "eabase/fiber/types.h"
+
+namespace eabase {
+
+// Where workers of a tag are allowed to run.
+struct TagAffinity {
+    TagAffinity() : pin_per_core(false), exclude_service_cpus(false) {}
+
+    // Converted from the C struct, returns -1 if affinity->cpus is malformed.
+    int from(const fiber_affinity_t& affinity);
+
+    // No policy was set, workers are placed by the defaults.
+    bool empty() const
+    { return cpus.empty() && !pin_per_core && !exclude_service_cpus; }
+
+    // Empty means all cpus that the worker was allowed to run on.
+    std::vector<int> cpus;
+    // Pin each worker to a single cpu.
+    bool pin_per_core;
+    // Don't run on cpus of -fiber_service_cpus.
+    bool exclude_service_cpus;
+};
+
+// Split per-tag specs like -fiber_tag_affinity into entries separated by
+// ';', each of them into fields separated by ':'. Empty entries are skipped,
+// empty fields are kept.
+void split_tag_spec(const std::string& spec,
+                    std::vector<std::vector<std::string> >* entries);
+
+// Parse specs of -fiber_tag_affinity, see its description for the format.
+// Returns 0 on success, -1 otherwise.
+int parse_tag_affinity(const std::string& spec,
+                       std::vector<std::pair<fiber_tag_t, TagAffinity> >* out);
+
+// Format `cpus' into a kernel cpulist like "0-3,8".
+std::string format_cpulist(const std::vector<int>& cpus);
+
+// Cpus configured by -fiber_service_cpus, which run the timer thread.
+std::vector<int> service_cpus();
+
+// Get/Set cpus that thread `th' is allowed to run on.
+// Returns 0 on success, error code otherwise.
+int get_thread_cpus(pthread_t th, std::vector<int>* cpus);
+int set_thread_cpus(pthread_t th, const std::vector<int>& cpus);
+
+}  // namespace eabase
+
+#endif  // FIBER_CPU_AFFINITY_H_
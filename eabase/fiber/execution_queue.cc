@@ -16,6 +16,7 @@
 
 #include "eabase/fiber/execution_queue.h"
 
+#include <gflags/gflags.h>
 #include "eabase/utility/memory/singleton_on_pthread_once.h"
 #include "eabase/utility/object_pool.h"           // eabase::get_object
 #include "eabase/utility/resource_pool.h"         // eabase::get_resource
@@ -23,6 +24,19 @@
 
 namespace eabase {
 
+static bool pass_bool(const char*, bool) { return true; }
+
+DEFINE_bool(show_execution_queue_latency_in_vars, false, "When this flags is "
+            "on, the time from execution_queue_execute to the task being run "
+            "will be recorded and shown in /vars/fiber_execq_queue_latency, "
+            "and the queue depth in /vars/fiber_execq_queued_task_count");
+const bool ALLOW_UNUSED dummy_show_execution_queue_latency_in_vars =
+    ::GFLAGS_NS::RegisterFlagValidator(
+        &FLAGS_show_execution_queue_latency_in_vars, pass_bool);
+
+// Set in _npending_butex by stop() to fail blocked and later producers.
+static const int NPENDING_STOPPED = (1 << 30);
+
 //May be false on different platforms
 //BAIDU_CASSERT(sizeof(TaskNode) == 128, sizeof_TaskNode_must_be_128);
 //BAIDU_CASSERT(offsetof(TaskNode, static_task_mem) + sizeof(TaskNode().static_task_mem) == 128, sizeof_TaskNode_must_be_128);
@@ -47,14 +61,27 @@ struct ExecutionQueueVars {
     eabase::Adder<int64_t> running_task_count;
     eabase::Adder<int64_t> execq_count;
     eabase::Adder<int64_t> execq_active_count;
-    
+    // Tasks executed but not run by consumers yet, namely the queue depth.
+    // Only maintained with -show_execution_queue_latency_in_vars.
+    eabase::Adder<int64_t> queued_task_count;
+    // Tasks run by each call to the execute function of consumers.
+    eabase::IntRecorder batch_size;
+    eabase::LatencyRecorder queue_latency;
+    eabase::Adder<int64_t> rejected_count;
+    eabase::Adder<int64_t> blocked_count;
+
     ExecutionQueueVars();
 };
 
 ExecutionQueueVars::ExecutionQueueVars()
     : running_task_count("fiber_execq_running_task_count")
     , execq_count("fiber_execq_count")
-    , execq_active_count("fiber_execq_active_count") {
+    , execq_active_count("fiber_execq_active_count")
+    , queued_task_count("fiber_execq_queued_task_count")
+    , batch_size("fiber_execq_batch_size")
+    , queue_latency("fiber_execq_queue_latency")
+    , rejected_count("fiber_execq_rejected_count")
+    , blocked_count("fiber_execq_blocked_count") {
 }
 
 inline ExecutionQueueVars* get_execq_vars() {
@@ -65,6 +92,11 @@ void ExecutionQueueBase::start_execute(TaskNode* node) {
     node->next = TaskNode::UNCONNECTED;
     node->status = UNEXECUTED;
     node->iterated = false;
+    node->enqueue_time_us = 0;
+    if (FLAGS_show_execution_queue_latency_in_vars && !node->stop_task) {
+        node->enqueue_time_us = eabase::cpuwide_time_us();
+        get_execq_vars()->queued_task_count << 1;
+    }
     if (node->high_priority) {
         // Add _high_priority_tasks before pushing this task into queue to
         // make sure that _execute_tasks sees the newest number when this 
@@ -226,9 +258,65 @@ void* ExecutionQueueBase::_execute_tasks_pthread(void* arg) {
 }
 
 void ExecutionQueueBase::return_task_node(TaskNode* node) {
+    const bool counted = !node->stop_task && _options.capacity != 0;
     node->clear_before_return(_clear_func);
     eabase::return_object<TaskNode>(node);
     get_execq_vars()->running_task_count << -1;
+    if (counted) {
+        release_capacity();
+    }
+}
+
+int ExecutionQueueBase::reserve_capacity() {
+    const int capacity = (int)_options.capacity;
+    int npending = _npending_butex->load(eabase::memory_order_relaxed);
+    while (npending < capacity) {
+        if (_npending_butex->compare_exchange_weak(
+                npending, npending + 1, eabase::memory_order_relaxed)) {
+            return 0;
+        }
+    }
+    if (npending & NPENDING_STOPPED) {
+        return EINVAL;
+    }
+    ExecutionQueueVars* const vars = get_execq_vars();
+    if (_options.full_policy != EXECUTION_QUEUE_FULL_BLOCK) {
+        vars->rejected_count << 1;
+        return EAGAIN;
+    }
+    vars->blocked_count << 1;
+    // Either release_capacity() sees the blocked producer or the producer
+    // sees the decreased _npending_butex.
+    _nblocked.fetch_add(1, eabase::memory_order_seq_cst);
+    int rc = 0;
+    while (true) {
+        npending = _npending_butex->load(eabase::memory_order_seq_cst);
+        if (npending & NPENDING_STOPPED) {
+            rc = EINVAL;
+            break;
+        }
+        if (npending < capacity) {
+            if (_npending_butex->compare_exchange_weak(
+                    npending, npending + 1, eabase::memory_order_relaxed)) {
+                break;
+            }
+            continue;
+        }
+        if (butex_wait(_npending_butex, npending, NULL) < 0 &&
+            errno != EWOULDBLOCK && errno != EINTR) {
+            rc = errno;
+            break;
+        }
+    }
+    _nblocked.fetch_sub(1, eabase::memory_order_relaxed);
+    return rc;
+}
+
+void ExecutionQueueBase::release_capacity() {
+    _npending_butex->fetch_sub(1, eabase::memory_order_seq_cst);
+    if (_nblocked.load(eabase::memory_order_seq_cst) > 0) {
+        butex_wake(_npending_butex);
+    }
 }
 
 void ExecutionQueueBase::_on_recycle() {
@@ -285,6 +373,12 @@ int ExecutionQueueBase::stop() {
                     eabase::memory_order_relaxed)) {
             // Set _stopped to make lattern execute() fail immediately
             _stopped.store(true, eabase::memory_order_release);
+            if (_options.capacity != 0) {
+                // Wake up producers blocked by the full queue.
+                _npending_butex->fetch_or(NPENDING_STOPPED,
+                                          eabase::memory_order_seq_cst);
+                butex_wake_all(_npending_butex);
+            }
             // Deref additionally which is added at creation so that this
             // queue's reference will hit 0(recycle) when no one addresses it.
             _release_additional_reference();
@@ -311,6 +405,13 @@ int ExecutionQueueBase::_execute(TaskNode* head, bool high_priority, int* nitera
     if (iter) {
         _execute_func(_meta, _type_specific_function, iter);
     }
+    if (iter.num_iterated() > 0) {
+        ExecutionQueueVars* const vars = get_execq_vars();
+        if (iter.num_counted() > 0) {
+            vars->queued_task_count << -iter.num_counted();
+        }
+        vars->batch_size << iter.num_iterated();
+    }
     // We must assign |niterated| with num_iterated even if we couldn't peek
     // any task to execute at the begining, in which case all the iterated 
     // tasks have been cancelled at this point. And we must return the 
@@ -385,6 +486,9 @@ int ExecutionQueueBase::create(uint64_t* id, const ExecutionQueueOptions* option
     if (execute_func == NULL || clear_func == NULL) {
         return EINVAL;
     }
+    if (options != NULL && options->capacity >= (size_t)NPENDING_STOPPED) {
+        return EINVAL;
+    }
 
     slot_id_t slot;
     ExecutionQueueBase* const m = eabase::get_resource(&slot, Forbidden());
@@ -407,6 +511,8 @@ int ExecutionQueueBase::create(uint64_t* id, const ExecutionQueueOptions* option
         *id = m->_this_id;
         m->_pthread_started = false;
         m->_current_head = NULL;
+        m->_npending_butex->store(0, eabase::memory_order_relaxed);
+        m->_nblocked.store(0, eabase::memory_order_relaxed);
         get_execq_vars()->execq_count << 1;
         return 0;
     }
@@ -438,8 +544,16 @@ void TaskIteratorBase::operator++() {
             if (!_cur_node->iterated && _cur_node->peek_to_execute()) {
                 ++_num_iterated;
                 _cur_node->iterated = true;
+                // Timestamped at enqueue only while the flag was on.
+                if (_cur_node->enqueue_time_us != 0) {
+                    ++_num_counted;
+                    get_execq_vars()->queue_latency <<
+                        eabase::cpuwide_time_us() - _cur_node->enqueue_time_us;
+                }
                 return;
             }
+            _num_counted += (!_cur_node->iterated &&
+                             _cur_node->enqueue_time_us != 0);
             _num_iterated += !_cur_node->iterated;
             _cur_node->iterated = true;
         }
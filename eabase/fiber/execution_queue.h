@@ -53,7 +53,7 @@ namespace eabase {
         TaskIteratorBase(TaskNode *head, ExecutionQueueBase *queue,
                          bool is_stopped, bool high_priority)
                 : _cur_node(head), _head(head), _q(queue), _is_stopped(is_stopped), _high_priority(high_priority),
-                  _should_break(false), _num_iterated(0) { operator++(); }
+                  _should_break(false), _num_iterated(0), _num_counted(0) { operator++(); }
 
         ~TaskIteratorBase();
 
@@ -63,6 +63,8 @@ namespace eabase {
 
     private:
         int num_iterated() const { return _num_iterated; }
+        // Iterated tasks that were counted in fiber_execq_queued_task_count.
+        int num_counted() const { return _num_counted; }
 
         bool should_break_for_high_priority_tasks();
 
@@ -73,6 +75,7 @@ namespace eabase {
         bool _high_priority;
         bool _should_break;
         int _num_iterated;
+        int _num_counted;
     };
 
 // Iterate over the given tasks
@@ -148,6 +151,16 @@ namespace eabase {
         virtual int submit(void *(*fn)(void *), void *args) = 0;
     };
 
+    // What execution_queue_execute does when the queue is full.
+    enum ExecutionQueueFullPolicy {
+        // Fail immediately with EAGAIN.
+        EXECUTION_QUEUE_FULL_REJECT = 0,
+        // Block the calling fiber (or pthread) until a task is done. Never use
+        // it to execute tasks into the queue from its own consumer, which
+        // deadlocks when the queue is full.
+        EXECUTION_QUEUE_FULL_BLOCK = 1,
+    };
+
     struct ExecutionQueueOptions {
         ExecutionQueueOptions();
 
@@ -162,6 +175,13 @@ namespace eabase {
         // Note that TaskOptions.in_place_if_possible = false will not work, if implementation of
         // Executor is in-place(synchronous).
         Executor *executor;
+
+        // Max number of tasks which are executed but not done yet, the queue
+        // never grows beyond it. 0 means unlimited. default: 0
+        size_t capacity;
+
+        // Works when capacity is not 0. default: EXECUTION_QUEUE_FULL_REJECT
+        ExecutionQueueFullPolicy full_policy;
     };
 
     // Start an ExecutionQueue. If |options| is NULL, the queue will be created with
@@ -190,13 +210,16 @@ namespace eabase {
     template<typename T>
     int execution_queue_join(ExecutionQueueId<T> id);
 
-    // Thread-safe and Wait-free.
+    // Thread-safe and Wait-free unless the queue is full.
     // Execute a task with default TaskOptions (normal task);
+    // Returns 0 on success, EINVAL if the queue is stopped, EAGAIN if the
+    // queue reached ExecutionQueueOptions.capacity and full_policy is
+    // EXECUTION_QUEUE_FULL_REJECT, errno otherwise.
     template<typename T>
     int execution_queue_execute(ExecutionQueueId<T> id,
                                 typename eabase::add_const_reference<T>::type task);
 
-    // Thread-safe and Wait-free.
+    // Thread-safe and Wait-free unless the queue is full.
     // Execute a task with options. e.g
     // eabase::execution_queue_execute(queue, task, &eabase::TASK_OPTIONS_URGENT)
     // If |options| is NULL, we will use default options (normal task)
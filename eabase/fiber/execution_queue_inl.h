@@ -53,6 +53,7 @@ struct EA_CACHELINE_ALIGNMENT TaskNode {
         , in_place(false) 
         , next(UNCONNECTED)
         , q(NULL)
+        , enqueue_time_us(0)
     {}
     ~TaskNode() {}
     int cancel(int64_t expected_version) {
@@ -87,8 +88,11 @@ struct EA_CACHELINE_ALIGNMENT TaskNode {
     bool in_place;
     TaskNode* next;
     ExecutionQueueBase* q;
+    // cpuwide_time_us() when the task is executed, 0 unless
+    // -show_execution_queue_latency_in_vars was on.
+    int64_t enqueue_time_us;
     union {
-        char static_task_mem[56];  // Make sizeof TaskNode exactly 128 bytes
+        char static_task_mem[48];  // Make sizeof TaskNode exactly 128 bytes
         char* dynamic_task_mem;
     };
 
@@ -169,10 +173,14 @@ public:
         , _current_head(NULL) {
         _join_butex = butex_create_checked<eabase::atomic<int> >();
         _join_butex->store(0, eabase::memory_order_relaxed);
+        _npending_butex = butex_create_checked<eabase::atomic<int> >();
+        _npending_butex->store(0, eabase::memory_order_relaxed);
+        _nblocked.store(0, eabase::memory_order_relaxed);
     }
 
     ~ExecutionQueueBase() {
         butex_destroy(_join_butex);
+        butex_destroy(_npending_butex);
     }
 
     bool stopped() const { return _stopped.load(eabase::memory_order_acquire); }
@@ -190,6 +198,11 @@ protected:
     void start_execute(TaskNode* node);
     TaskNode* allocate_node();
     void return_task_node(TaskNode* node);
+    // Take one of ExecutionQueueOptions.capacity for a new task.
+    // Returns 0 on success, EAGAIN when full, EINVAL when stopped.
+    int reserve_capacity();
+    void release_capacity();
+    bool has_capacity() const { return _options.capacity != 0; }
 
 private:
 
@@ -234,6 +247,12 @@ private:
     ExecutionQueueOptions _options;
     eabase::atomic<int>* _join_butex;
 
+    // Number of not-done tasks counted against _options.capacity, or'ed
+    // with NPENDING_STOPPED after stop(). Producers blocked by a full queue
+    // wait on it.
+    eabase::atomic<int>* _npending_butex;
+    eabase::atomic<int> _nblocked;
+
     // For pthread mode.
     pthread_t _pid;
     bool _pthread_started;
@@ -309,17 +328,27 @@ public:
         if (stopped()) {
             return EINVAL;
         }
+        if (has_capacity()) {
+            const int rc = reserve_capacity();
+            if (rc != 0) {
+                return rc;
+            }
+        }
         TaskNode* node = allocate_node();
         if (BAIDU_UNLIKELY(node == NULL)) {
+            if (has_capacity()) {
+                release_capacity();
+            }
             return ENOMEM;
         }
+        // return_task_node() releases capacity of non-stop tasks.
+        node->stop_task = false;
         void* const mem = allocator::allocate(node);
         if (BAIDU_UNLIKELY(!mem)) {
             return_task_node(node);
             return ENOMEM;
         }
         new (mem) T(std::forward<T>(task));
-        node->stop_task = false;
         TaskOptions opt;
         if (options) {
             opt = *options;
@@ -339,6 +368,8 @@ inline ExecutionQueueOptions::ExecutionQueueOptions()
     : use_pthread(false)
     , fiber_attr(FIBER_ATTR_NORMAL)
     , executor(NULL)
+    , capacity(0)
+    , full_policy(EXECUTION_QUEUE_FULL_REJECT)
 {}
 
 template <typename T>
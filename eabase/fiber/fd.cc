@@ -26,9 +26,46 @@
 #include "eabase/utility/fd_utility.h"                     // make_non_blocking
 #include "eabase/utility/logging.h"
 #include "eabase/utility/third_party/murmurhash3/murmurhash3.h"   // fmix32
+#include "eabase/utility/string_printf.h"
+#include "eabase/var/var.h"
 #include "eabase/fiber/butex.h"                       // butex_*
 #include "eabase/fiber/task_group.h"                  // TaskGroup
 #include "eabase/fiber/fiber.h"                             // fiber_start
+#include "eabase/fiber/io_uring.h"                    // IoUring
+#include <gflags/gflags.h>
+
+DEFINE_bool(fiber_fd_wait_use_io_uring, false, "Wait for events of fds in "
+            "fibers with IORING_OP_POLL_ADD of io_uring instead of epoll, "
+            "which saves the epoll_ctl() of each wait. Falls back to epoll "
+            "when io_uring is not supported. Errors of the fd (e.g. EBADF) "
+            "are reported by following I/O on the fd instead of the wait");
+
+static const int FIBER_MAX_EPOLL_THREAD_NUM = 64;
+
+static bool validate_fiber_epoll_thread_num(const char*, int32_t val) {
+    return val >= 1 && val <= FIBER_MAX_EPOLL_THREAD_NUM;
+}
+DEFINE_int32(fiber_epoll_thread_num, FIBER_EPOLL_THREAD_NUM, "Number of "
+             "epoll threads serving fiber_fd_wait, fds are sharded among "
+             "them by hash. At most 64. Only read when fiber_fd_wait is "
+             "called for the first time");
+const bool ALLOW_UNUSED dummy_fiber_epoll_thread_num =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_epoll_thread_num,
+                                       validate_fiber_epoll_thread_num);
+
+DEFINE_bool(fiber_epoll_thread_per_tag, false, "Run -fiber_epoll_thread_num "
+            "epoll threads in workers of each tag, fds are watched by the "
+            "epoll threads of the tag of the fiber waiting on them. Only read "
+            "when fiber_fd_wait is called for the first time");
+
+DEFINE_bool(fiber_fd_wait_edge_triggered, false, "Add fds into epoll with "
+            "EPOLLET once when they're waited for the first time instead of "
+            "re-arming them for each wait. Readiness is latched until the "
+            "next fiber_fd_wait, which returns without any syscall if the fd "
+            "is already ready. Such fds must be closed by fiber_close. Not "
+            "used by the io_uring backend");
+
+DECLARE_int32(task_group_ntags);
 
 // Implement fiber functions on file descriptors
 
@@ -36,10 +73,10 @@ namespace eabase {
 
 extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
 
-template <typename T, size_t NBLOCK, size_t BLOCK_SIZE>
+template <typename T, size_t NBLOCK, size_t NITEM_PER_BLOCK>
 class LazyArray {
     struct Block {
-        eabase::atomic<T> items[BLOCK_SIZE];
+        eabase::atomic<T> items[NITEM_PER_BLOCK];
     };
 
 public:
@@ -48,11 +85,11 @@ public:
     }
 
     eabase::atomic<T>* get_or_new(size_t index) {
-        const size_t block_index = index / BLOCK_SIZE;
+        const size_t block_index = index / NITEM_PER_BLOCK;
         if (block_index >= NBLOCK) {
             return NULL;
         }
-        const size_t block_offset = index - block_index * BLOCK_SIZE;
+        const size_t block_offset = index - block_index * NITEM_PER_BLOCK;
         Block* b = _blocks[block_index].load(eabase::memory_order_consume);
         if (b != NULL) {
             return b->items + block_offset;
@@ -63,7 +100,7 @@ public:
             return (b ? b->items + block_offset : NULL);
         }
         // Set items to default value of T.
-        std::fill(b->items, b->items + BLOCK_SIZE, T());
+        std::fill(b->items, b->items + NITEM_PER_BLOCK, T());
         Block* expected = NULL;
         if (_blocks[block_index].compare_exchange_strong(
                 expected, b, eabase::memory_order_release,
@@ -75,9 +112,9 @@ public:
     }
 
     eabase::atomic<T>* get(size_t index) const {
-        const size_t block_index = index / BLOCK_SIZE;
+        const size_t block_index = index / NITEM_PER_BLOCK;
         if (__builtin_expect(block_index < NBLOCK, 1)) {
-            const size_t block_offset = index - block_index * BLOCK_SIZE;
+            const size_t block_offset = index - block_index * NITEM_PER_BLOCK;
             Block* const b = _blocks[block_index].load(eabase::memory_order_consume);
             if (__builtin_expect(b != NULL, 1)) {
                 return b->items + block_offset;
@@ -94,12 +131,77 @@ typedef eabase::atomic<int> EpollButex;
 
 static EpollButex* const CLOSING_GUARD = (EpollButex*)(intptr_t)-1L;
 
+// Lowest bits of EpollButex are states of fds in edge-triggered mode, see
+// -fiber_fd_wait_edge_triggered. The rest counts events so that waiters of
+// previous values are not blocked.
+static const int FD_READABLE_LATCHED = 1;
+static const int FD_WRITABLE_LATCHED = 2;
+static const int FD_EDGE_TRIGGERED = 4;
+static const int FD_STATE_MASK = 7;
+static const int FD_EVENT_SEQ = 8;
+
+// Bump the sequence and clear states of the fd which is being closed.
+static void reset_fd_butex(EpollButex* butex) {
+    int val = butex->load(eabase::memory_order_relaxed);
+    while (!butex->compare_exchange_weak(
+               val, (val & ~FD_STATE_MASK) + FD_EVENT_SEQ,
+               eabase::memory_order_relaxed)) {
+    }
+}
+
+#if defined(OS_LINUX)
+// Latched bits of readiness matching epoll `events'.
+static int fd_latched_bits(uint32_t events) {
+    int bits = 0;
+    if (events & (EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) {
+        bits |= FD_READABLE_LATCHED;
+    }
+    if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+        bits |= FD_WRITABLE_LATCHED;
+    }
+    return bits;
+}
+#endif
+
 #ifndef NDEBUG
 eabase::static_atomic<int> break_nums = BUTIL_STATIC_ATOMIC_INIT(0);
 #endif
 
 // Able to address 67108864 file descriptors, should be enough.
-LazyArray<EpollButex*, 262144/*NBLOCK*/, 256/*BLOCK_SIZE*/> fd_butexes;
+LazyArray<EpollButex*, 262144/*NBLOCK*/, 256/*NITEM_PER_BLOCK*/> fd_butexes;
+
+// Get the butex for waiting on `fd', NULL on error and errno is set.
+static EpollButex* get_fd_butex(int fd) {
+    eabase::atomic<EpollButex*>* p = fd_butexes.get_or_new(fd);
+    if (NULL == p) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    EpollButex* butex = p->load(eabase::memory_order_consume);
+    if (NULL == butex) {
+        // It is rare to wait on one file descriptor from multiple threads
+        // simultaneously. Creating singleton by optimistic locking here
+        // saves mutexes for each butex.
+        butex = butex_create_checked<EpollButex>();
+        butex->store(0, eabase::memory_order_relaxed);
+        EpollButex* expected = NULL;
+        if (!p->compare_exchange_strong(expected, butex,
+                                        eabase::memory_order_release,
+                                        eabase::memory_order_consume)) {
+            butex_destroy(butex);
+            butex = expected;
+        }
+    }
+
+    while (butex == CLOSING_GUARD) {  // fiber_close() is running.
+        if (sched_yield() < 0) {
+            return NULL;
+        }
+        butex = p->load(eabase::memory_order_consume);
+    }
+    return butex;
+}
 
 static const int FIBER_DEFAULT_EPOLL_SIZE = 65536;
 
@@ -108,10 +210,12 @@ public:
     EpollThread()
         : _epfd(-1)
         , _stop(false)
-        , _tid(0) {
+        , _tid(0)
+        , _nevent_second(&_nevent) {
     }
 
-    int start(int epoll_size) {
+    // Watch fds in a fiber of `tag', vars are exposed with `var_prefix'.
+    int start(int epoll_size, fiber_tag_t tag, const std::string& var_prefix) {
         if (started()) {
             return -1;
         }
@@ -131,8 +235,12 @@ public:
             PLOG(FATAL) << "Fail to epoll_create/kqueue";
             return -1;
         }
+        _nevent_second.expose_as(var_prefix, "event_second");
+        _wakeup_latency.expose(var_prefix + "_wakeup");
+        fiber_attr_t attr = FIBER_ATTR_NORMAL;
+        attr.tag = tag;
         if (fiber_start_lazy(
-                &_tid, NULL, EpollThread::run_this, this) != 0) {
+                &_tid, &attr, EpollThread::run_this, this) != 0) {
             close(_epfd);
             _epfd = -1;
             LOG(FATAL) << "Fail to create epoll fiber";
@@ -192,33 +300,9 @@ public:
     }
 
     int fd_wait(int fd, unsigned events, const timespec* abstime) {
-        eabase::atomic<EpollButex*>* p = fd_butexes.get_or_new(fd);
-        if (NULL == p) {
-            errno = ENOMEM;
-            return -1;
-        }
-
-        EpollButex* butex = p->load(eabase::memory_order_consume);
+        EpollButex* butex = get_fd_butex(fd);
         if (NULL == butex) {
-            // It is rare to wait on one file descriptor from multiple threads
-            // simultaneously. Creating singleton by optimistic locking here
-            // saves mutexes for each butex.
-            butex = butex_create_checked<EpollButex>();
-            butex->store(0, eabase::memory_order_relaxed);
-            EpollButex* expected = NULL;
-            if (!p->compare_exchange_strong(expected, butex,
-                                            eabase::memory_order_release,
-                                            eabase::memory_order_consume)) {
-                butex_destroy(butex);
-                butex = expected;
-            }
-        }
-        
-        while (butex == CLOSING_GUARD) {  // fiber_close() is running.
-            if (sched_yield() < 0) {
-                return -1;
-            }
-            butex = p->load(eabase::memory_order_consume);
+            return -1;
         }
         // Save value of butex before adding to epoll because the butex may
         // be changed before butex_wait. No memory fence because EPOLL_CTL_MOD
@@ -226,6 +310,10 @@ public:
         const int expected_val = butex->load(eabase::memory_order_relaxed);
 
 #if defined(OS_LINUX)
+        if ((expected_val & FD_EDGE_TRIGGERED) ||
+            FLAGS_fiber_fd_wait_edge_triggered) {
+            return fd_wait_edge_triggered(fd, butex, events, abstime);
+        }
 # ifdef BAIDU_KERNEL_FIXED_EPOLLONESHOT_BUG
         epoll_event evt = { events | EPOLLONESHOT, { butex } };
         if (epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &evt) < 0) {
@@ -261,27 +349,83 @@ public:
         return 0;
     }
 
-    int fd_close(int fd) {
-        if (fd < 0) {
-            // what close(-1) returns
-            errno = EBADF;
+#if defined(OS_LINUX)
+    int fd_wait_edge_triggered(int fd, EpollButex* butex, unsigned events,
+                               const timespec* abstime) {
+        const int want = fd_latched_bits(events);
+        if (want == 0) {
+            // What epoll_ctl returns.
+            errno = EINVAL;
             return -1;
         }
-        eabase::atomic<EpollButex*>* pbutex = eabase::fd_butexes.get(fd);
-        if (NULL == pbutex) {
-            // Did not call fiber_fd functions, close directly.
-            return close(fd);
+        int val = butex->load(eabase::memory_order_acquire);
+        while (true) {
+            if (val & want) {
+                // Ready since last wait, consume it without any syscall.
+                if (butex->compare_exchange_weak(
+                        val, val & ~want, eabase::memory_order_acquire)) {
+                    return 0;
+                }
+                continue;
+            }
+            if (!(val & FD_EDGE_TRIGGERED)) {
+                // Only one waiter adds the fd.
+                if (!butex->compare_exchange_weak(
+                        val, val | FD_EDGE_TRIGGERED,
+                        eabase::memory_order_relaxed)) {
+                    continue;
+                }
+                if (add_edge_triggered(fd, butex) != 0) {
+                    butex->fetch_and(~FD_EDGE_TRIGGERED,
+                                     eabase::memory_order_relaxed);
+                    return -1;
+                }
+                // Current readiness is reported as an edge after adding.
+                val = butex->load(eabase::memory_order_acquire);
+                continue;
+            }
+            if (butex_wait(butex, val, abstime) < 0) {
+                if (errno == EWOULDBLOCK) {
+                    val = butex->load(eabase::memory_order_acquire);
+                    continue;
+                }
+                return (errno == EINTR ? 0 : -1);
+            }
+            // Woken up by an event or fiber_close().
+            val = butex->load(eabase::memory_order_acquire);
+            if (val & want) {
+                butex->compare_exchange_strong(val, val & ~want,
+                                               eabase::memory_order_acquire);
+            }
+            return 0;
         }
-        EpollButex* butex = pbutex->exchange(
-            CLOSING_GUARD, eabase::memory_order_relaxed);
-        if (butex == CLOSING_GUARD) {
-            // concurrent double close detected.
-            errno = EBADF;
-            return -1;
+    }
+
+    // Watch all events of `fd' with EPOLLET until it's closed.
+    int add_edge_triggered(int fd, EpollButex* butex) {
+        epoll_event evt;
+        evt.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+# ifdef BAIDU_KERNEL_FIXED_EPOLLONESHOT_BUG
+        evt.data.ptr = butex;
+# else
+        evt.data.fd = fd;
+# endif
+        if (epoll_ctl(_epfd, EPOLL_CTL_ADD, fd, &evt) < 0) {
+            // Left by waits before -fiber_fd_wait_edge_triggered was on.
+            if (errno != EEXIST ||
+                epoll_ctl(_epfd, EPOLL_CTL_MOD, fd, &evt) < 0) {
+                PLOG(FATAL) << "Fail to add fd=" << fd << " into epfd=" << _epfd;
+                return -1;
+            }
         }
-        if (butex != NULL) {
-            butex->fetch_add(1, eabase::memory_order_relaxed);
-            butex_wake_all(butex);
+        return 0;
+    }
+#endif
+
+    // Stop watching `fd' which is about to be closed.
+    void remove_fd(int fd) {
+        if (!started()) {
+            return;
         }
 #if defined(OS_LINUX)
         epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL);
@@ -292,9 +436,6 @@ public:
         EV_SET(&evt, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
         kevent(_epfd, &evt, 1, NULL, 0, NULL);
 #endif
-        const int rc = close(fd);
-        pbutex->exchange(butex, eabase::memory_order_relaxed);
-        return rc;
     }
 
     bool started() const {
@@ -352,10 +493,21 @@ private:
                 PLOG(INFO) << "Fail to epoll epfd=" << epfd;
                 break;
             }
+            _nevent << n;
+            const int64_t wakeup_us = eabase::cpuwide_time_us();
 
 #if defined(OS_LINUX)
 # ifndef BAIDU_KERNEL_FIXED_EPOLLONESHOT_BUG
             for (int i = 0; i < n; ++i) {
+                eabase::atomic<EpollButex*>* pbutex = fd_butexes.get(e[i].data.fd);
+                EpollButex* butex = pbutex ?
+                    pbutex->load(eabase::memory_order_consume) : NULL;
+                if (butex != NULL && butex != CLOSING_GUARD &&
+                    (butex->load(eabase::memory_order_relaxed) &
+                     FD_EDGE_TRIGGERED)) {
+                    // Added once and kept until closed.
+                    continue;
+                }
                 epoll_ctl(epfd, EPOLL_CTL_DEL, e[i].data.fd, NULL);
             }
 # endif
@@ -373,9 +525,27 @@ private:
                 EpollButex* butex = static_cast<EpollButex*>(e[i].udata);
 #endif
                 if (butex != NULL && butex != CLOSING_GUARD) {
-                    butex->fetch_add(1, eabase::memory_order_relaxed);
+#if defined(OS_LINUX)
+                    const int bits = fd_latched_bits(e[i].events);
+                    int val = butex->load(eabase::memory_order_relaxed);
+                    while (true) {
+                        int new_val = val + FD_EVENT_SEQ;
+                        if (val & FD_EDGE_TRIGGERED) {
+                            // Latched until next wait.
+                            new_val |= bits;
+                        }
+                        if (butex->compare_exchange_weak(
+                                val, new_val, eabase::memory_order_release)) {
+                            break;
+                        }
+                    }
+#else
+                    butex->fetch_add(FD_EVENT_SEQ, eabase::memory_order_relaxed);
+#endif
                     butex_wake_all(butex);
                 }
+                // Events later in the batch wait for earlier ones.
+                _wakeup_latency << eabase::cpuwide_time_us() - wakeup_us;
             }
         }
 
@@ -389,31 +559,329 @@ private:
     bool _stop;
     fiber_t _tid;
     eabase::Mutex _start_mutex;
+    // Events returned by epoll_wait.
+    eabase::Adder<int64_t> _nevent;
+    eabase::PerSecond<eabase::Adder<int64_t> > _nevent_second;
+    // From epoll_wait() returning to waking up waiters of each event.
+    eabase::LatencyRecorder _wakeup_latency;
 };
 
-EpollThread epoll_thread[FIBER_EPOLL_THREAD_NUM];
+// -fiber_epoll_thread_num threads, for each tag if
+// -fiber_epoll_thread_per_tag is on. Never deleted.
+static EpollThread* epoll_threads = NULL;
+static int nepoll_thread = 0;
+// Tags having their own epoll threads, 1 unless -fiber_epoll_thread_per_tag.
+// Snapshotted with the flags so that later changes of -task_group_ntags
+// never index past `epoll_threads'.
+static int nepoll_tag = 1;
+static bool epoll_thread_per_tag = false;
+static pthread_once_t epoll_threads_once = PTHREAD_ONCE_INIT;
+
+static void create_epoll_threads() {
+    nepoll_thread = FLAGS_fiber_epoll_thread_num;
+    epoll_thread_per_tag = FLAGS_fiber_epoll_thread_per_tag;
+    nepoll_tag = (epoll_thread_per_tag ? FLAGS_task_group_ntags : 1);
+    epoll_threads = new EpollThread[nepoll_tag * nepoll_thread];
+}
+
+// The EpollThread watching `fd' waited by fibers of `tag', which may be
+// not started. Tags without epoll threads of their own share the ones of
+// FIBER_TAG_DEFAULT.
+static inline EpollThread& epoll_thread_of(int fd, fiber_tag_t tag) {
+    pthread_once(&epoll_threads_once, create_epoll_threads);
+    int index = 0;
+    if (nepoll_thread > 1) {
+        index = eabase::fmix32(fd) % nepoll_thread;
+    }
+    if (epoll_thread_per_tag && tag >= 0 && tag < nepoll_tag) {
+        index += tag * nepoll_thread;
+    }
+    return epoll_threads[index];
+}
 
 static inline EpollThread& get_epoll_thread(int fd) {
-    if (FIBER_EPOLL_THREAD_NUM == 1UL) {
-        EpollThread& et = epoll_thread[0];
-        et.start(FIBER_DEFAULT_EPOLL_SIZE);
-        return et;
+    fiber_tag_t tag = FIBER_TAG_DEFAULT;
+    if (tls_task_group != NULL) {
+        tag = tls_task_group->tag();
+    }
+    EpollThread& et = epoll_thread_of(fd, tag);
+    if (!et.started()) {
+        // The tag which `et' belongs to.
+        const int index = (int)(&et - epoll_threads);
+        tag = (epoll_thread_per_tag ? index / nepoll_thread : FIBER_TAG_DEFAULT);
+        std::string var_prefix = "fiber_epoll_thread_";
+        if (epoll_thread_per_tag) {
+            eabase::string_appendf(&var_prefix, "%d_", tag);
+        }
+        eabase::string_appendf(&var_prefix, "%d", index % nepoll_thread);
+        et.start(FIBER_DEFAULT_EPOLL_SIZE, tag, var_prefix);
     }
-
-    EpollThread& et = epoll_thread[eabase::fmix32(fd) % FIBER_EPOLL_THREAD_NUM];
-    et.start(FIBER_DEFAULT_EPOLL_SIZE);
     return et;
 }
 
+#ifdef FIBER_HAS_IO_URING
+
+#ifndef IORING_ASYNC_CANCEL_FD
+#define IORING_ASYNC_CANCEL_ALL (1U << 0)
+#define IORING_ASYNC_CANCEL_FD  (1U << 1)
+#endif
+
+static const unsigned FIBER_IO_URING_ENTRIES = 4096;
+
+// Wait for fds with IORING_OP_POLL_ADD. A wait costs one submission which
+// is combined with concurrent ones, instead of an epoll_ctl() per wait.
+// Completions are reaped by a fiber like EpollThread.
+class IoUringPollThread {
+public:
+    IoUringPollThread()
+        : _start_rc(-1)
+        , _stop(false)
+        , _tid(0) {
+    }
+
+    // Start the thread if it's not started.
+    // Returns 0 on success, errno otherwise. Failures are not retried.
+    int start() {
+        if (_start_rc.load(eabase::memory_order_acquire) >= 0) {
+            return _start_rc.load(eabase::memory_order_relaxed);
+        }
+        BAIDU_SCOPED_LOCK(_start_mutex);
+        if (_start_rc.load(eabase::memory_order_relaxed) < 0) {
+            const int rc = start_unlocked();
+            if (rc != 0) {
+                LOG(WARNING) << "Fail to start io_uring for fd waits, "
+                             << berror(rc) << ", use epoll instead";
+            }
+            _start_rc.store(rc, eabase::memory_order_release);
+        }
+        return _start_rc.load(eabase::memory_order_relaxed);
+    }
+
+    bool started() const {
+        return _start_rc.load(eabase::memory_order_acquire) == 0;
+    }
+
+    int stop_and_join() {
+        if (!started() || _stop) {
+            return 0;
+        }
+        _stop = true;
+        // Wake up the reaping fiber with a NOP.
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_NOP;
+        if (_ring.submit(sqe) != 0) {
+            LOG(FATAL) << "Fail to wake up io_uring poller";
+            return -1;
+        }
+        const int rc = fiber_join(_tid, NULL);
+        if (rc) {
+            LOG(FATAL) << "Fail to join io_uring poller, " << berror(rc);
+            return -1;
+        }
+        return 0;
+    }
+
+    int fd_wait(int fd, unsigned events, const timespec* abstime) {
+        const unsigned poll_events = events &
+            (EPOLLIN | EPOLLPRI | EPOLLOUT | EPOLLRDNORM | EPOLLRDBAND |
+             EPOLLWRNORM | EPOLLWRBAND | EPOLLMSG | EPOLLERR | EPOLLHUP |
+             EPOLLRDHUP);
+        if (poll_events == 0) {
+            // What epoll_ctl returns.
+            errno = EINVAL;
+            return -1;
+        }
+        EpollButex* butex = get_fd_butex(fd);
+        if (NULL == butex) {
+            return -1;
+        }
+        // Completions are reaped after submission which has full fence.
+        const int expected_val = butex->load(eabase::memory_order_relaxed);
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_POLL_ADD;
+        sqe.fd = fd;
+        sqe.poll32_events = poll_events;
+        sqe.user_data = (uint64_t)butex;
+        const int rc = _ring.submit(sqe);
+        if (rc != 0) {
+            errno = rc;
+            return -1;
+        }
+        if (butex_wait(butex, expected_val, abstime) < 0 &&
+            errno != EWOULDBLOCK && errno != EINTR) {
+            if (errno == ETIMEDOUT) {
+                // Don't leave the poll in the kernel, it holds the file.
+                sqe.opcode = IORING_OP_POLL_REMOVE;
+                sqe.fd = -1;
+                sqe.poll32_events = 0;
+                sqe.addr = (uint64_t)butex;
+                sqe.user_data = 0;
+                _ring.submit(sqe);
+                errno = ETIMEDOUT;
+            }
+            return -1;
+        }
+        return 0;
+    }
+
+    // Cancel polls of `fd' which is about to be closed.
+    void remove_fd(int fd) {
+        if (!started()) {
+            return;
+        }
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_ASYNC_CANCEL;
+        sqe.fd = fd;
+        sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        _ring.submit(sqe);
+    }
+
+private:
+    int start_unlocked() {
+        int rc = _ring.init(FIBER_IO_URING_ENTRIES);
+        if (rc != 0) {
+            return rc;
+        }
+        // Polls of closed fds are cancelled by fd, which needs linux 5.19+.
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_ASYNC_CANCEL;
+        sqe.fd = _ring.fd();
+        sqe.cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        rc = _ring.submit(sqe);
+        if (rc != 0) {
+            return rc;
+        }
+        int probe_res = 0;
+        if (_ring.reap(1, get_result, &probe_res) < 0) {
+            return errno;
+        }
+        if (probe_res == -EINVAL) {
+            return ENOTSUP;
+        }
+        if (fiber_start_lazy(&_tid, NULL, run_this, this) != 0) {
+            LOG(FATAL) << "Fail to create io_uring poller";
+            return ENOMEM;
+        }
+        return 0;
+    }
+
+    static void get_result(void* arg, const io_uring_cqe& cqe) {
+        *static_cast<int*>(arg) = cqe.res;
+    }
+
+    static void wake_waiters(void*, const io_uring_cqe& cqe) {
+        EpollButex* butex = (EpollButex*)cqe.user_data;
+        if (butex != NULL) {
+            butex->fetch_add(FD_EVENT_SEQ, eabase::memory_order_relaxed);
+            butex_wake_all(butex);
+        }
+    }
+
+    static void* run_this(void* arg) {
+        return static_cast<IoUringPollThread*>(arg)->run();
+    }
+
+    void* run() {
+        while (!_stop) {
+            if (_ring.reap(1, wake_waiters, NULL) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                PLOG(INFO) << "Fail to reap io_uring=" << _ring.fd();
+                break;
+            }
+        }
+        DLOG(INFO) << "io_uring poller=" << _tid << " is about to stop";
+        return NULL;
+    }
+
+    IoUring _ring;
+    // -1: not started yet, 0: started, errno of the failure otherwise.
+    eabase::atomic<int> _start_rc;
+    bool _stop;
+    fiber_t _tid;
+    eabase::Mutex _start_mutex;
+};
+
+IoUringPollThread io_uring_poll_thread;
+
+// NULL if io_uring is not chosen or not supported.
+static inline IoUringPollThread* get_io_uring_poll_thread() {
+    if (!FLAGS_fiber_fd_wait_use_io_uring ||
+        io_uring_poll_thread.start() != 0) {
+        return NULL;
+    }
+    return &io_uring_poll_thread;
+}
+
+#endif  // FIBER_HAS_IO_URING
+
+static int fd_wait(int fd, unsigned events, const timespec* abstime) {
+#ifdef FIBER_HAS_IO_URING
+    IoUringPollThread* t = get_io_uring_poll_thread();
+    if (t != NULL) {
+        return t->fd_wait(fd, events, abstime);
+    }
+#endif
+    return get_epoll_thread(fd).fd_wait(fd, events, abstime);
+}
+
+static int fd_close(int fd) {
+    if (fd < 0) {
+        // what close(-1) returns
+        errno = EBADF;
+        return -1;
+    }
+    eabase::atomic<EpollButex*>* pbutex = eabase::fd_butexes.get(fd);
+    if (NULL == pbutex) {
+        // Did not call fiber_fd functions, close directly.
+        return close(fd);
+    }
+    EpollButex* butex = pbutex->exchange(
+        CLOSING_GUARD, eabase::memory_order_relaxed);
+    if (butex == CLOSING_GUARD) {
+        // concurrent double close detected.
+        errno = EBADF;
+        return -1;
+    }
+    if (butex != NULL) {
+        reset_fd_butex(butex);
+        butex_wake_all(butex);
+    }
+    // The fd may be waited by both backends if the flag was changed, or by
+    // epoll threads of different tags.
+    pthread_once(&epoll_threads_once, create_epoll_threads);
+    for (int tag = 0; tag < nepoll_tag; ++tag) {
+        epoll_thread_of(fd, tag).remove_fd(fd);
+    }
+#ifdef FIBER_HAS_IO_URING
+    io_uring_poll_thread.remove_fd(fd);
+#endif
+    const int rc = close(fd);
+    pbutex->exchange(butex, eabase::memory_order_relaxed);
+    return rc;
+}
+
 //TODO(zhujiashun): change name
 int stop_and_join_epoll_threads() {
     // Returns -1 if any epoll thread failed to stop.
     int rc = 0;
-    for (size_t i = 0; i < FIBER_EPOLL_THREAD_NUM; ++i) {
-        if (epoll_thread[i].stop_and_join() < 0) {
-            rc = -1;
+    if (epoll_threads != NULL) {
+        for (int i = 0; i < nepoll_tag * nepoll_thread; ++i) {
+            if (epoll_threads[i].stop_and_join() < 0) {
+                rc = -1;
+            }
         }
     }
+#ifdef FIBER_HAS_IO_URING
+    if (io_uring_poll_thread.stop_and_join() < 0) {
+        rc = -1;
+    }
+#endif
     return rc;
 }
 
@@ -493,8 +961,7 @@ int fiber_fd_wait(int fd, unsigned events) {
     }
     eabase::TaskGroup* g = eabase::tls_task_group;
     if (NULL != g && !g->is_current_pthread_task()) {
-        return eabase::get_epoll_thread(fd).fd_wait(
-            fd, events, NULL);
+        return eabase::fd_wait(fd, events, NULL);
     }
     return eabase::pthread_fd_wait(fd, events, NULL);
 }
@@ -510,8 +977,7 @@ int fiber_fd_timedwait(int fd, unsigned events,
     }
     eabase::TaskGroup* g = eabase::tls_task_group;
     if (NULL != g && !g->is_current_pthread_task()) {
-        return eabase::get_epoll_thread(fd).fd_wait(
-            fd, events, abstime);
+        return eabase::fd_wait(fd, events, abstime);
     }
     return eabase::pthread_fd_wait(fd, events, abstime);
 }
@@ -551,7 +1017,7 @@ int fiber_connect(int sockfd, const sockaddr* serv_addr,
 
 // This does not wake pthreads calling fiber_fd_*wait.
 int fiber_close(int fd) {
-    return eabase::get_epoll_thread(fd).fd_close(fd);
+    return eabase::fd_close(fd);
 }
 
 }  // extern "C"
@@ -14,6 +14,10 @@
 //
 //
 
+#include <string.h>                                       // memcpy
+#include <algorithm>                                      // std::min
+#include <fstream>
+#include <sstream>
 #include <gflags/gflags.h>
 #include "eabase/utility/macros.h"                       // BAIDU_CASSERT
 #include "eabase/utility/logging.h"
@@ -21,6 +25,10 @@
 #include "eabase/fiber/task_control.h"              // TaskControl
 #include "eabase/fiber/timer_thread.h"
 #include "eabase/fiber/list_of_abafree_id.h"
+#include "eabase/fiber/cpu_affinity.h"
+#include "eabase/fiber/idle_spin.h"
+#include "eabase/fiber/sched_trace.h"
+#include "eabase/fiber/cpu_accounting.h"
 #include "eabase/fiber/fiber.h"
 
 namespace eabase {
@@ -38,6 +46,22 @@ DEFINE_int32(fiber_current_tag, FIBER_TAG_DEFAULT, "Set fiber concurrency for th
 DEFINE_int32(fiber_concurrency_by_tag, 0,
              "Number of pthread workers of FLAGS_fiber_current_tag");
 
+DEFINE_string(fiber_tag_affinity, "", "Cpu placement of workers by tag. "
+              "Entries are separated by ';', each of them is "
+              "<tag>:<cpulist>[:pin][:exclude_service]. e.g. "
+              "\"0:0-3;1:4-11:pin:exclude_service\" lets workers of tag 0 run "
+              "on cpu 0-3 and pins each worker of tag 1 to one of cpu 4-11 "
+              "that is not in -fiber_service_cpus. An empty cpulist means "
+              "all cpus");
+
+DEFINE_string(fiber_tag_spin_policy, "", "How idle workers spin before "
+              "parking by tag. Entries are separated by ';', each of them is "
+              "<tag>:<none|fixed|adaptive>[:<max_spin_us>[:<max_cpu_percent>]]."
+              " e.g. \"0:adaptive:50:10\" lets idle workers of tag 0 spin up "
+              "to 50us when they are usually woken up within that time, "
+              "spending at most 10% of their time on spinning. Tags not "
+              "listed park directly");
+
 static bool never_set_fiber_concurrency = true;
 static bool never_set_fiber_concurrency_by_tag = true;
 
@@ -52,6 +76,18 @@ const int ALLOW_UNUSED register_FLAGS_fiber_concurrency =
 
 static bool validate_fiber_min_concurrency(const char*, int32_t val);
 
+static bool validate_fiber_tag_affinity(const char*, const std::string& val);
+
+const int ALLOW_UNUSED register_FLAGS_fiber_tag_affinity =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_tag_affinity,
+                                       validate_fiber_tag_affinity);
+
+static bool validate_fiber_tag_spin_policy(const char*, const std::string& val);
+
+const int ALLOW_UNUSED register_FLAGS_fiber_tag_spin_policy =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_tag_spin_policy,
+                                       validate_fiber_tag_spin_policy);
+
 const int ALLOW_UNUSED register_FLAGS_fiber_min_concurrency =
     ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_min_concurrency,
                                     validate_fiber_min_concurrency);
@@ -119,6 +155,26 @@ static int add_workers_for_each_tag(int num) {
     return added;
 }
 
+// Retire workers from tags having most workers.
+static int remove_workers_for_each_tag(int num) {
+    int removed = 0;
+    auto c = get_task_control();
+    for (auto i = 0; i < num; ++i) {
+        fiber_tag_t tag = FIBER_TAG_DEFAULT;
+        for (int t = 1; t < FLAGS_task_group_ntags; ++t) {
+            if (c->concurrency(t) > c->concurrency(tag)) {
+                tag = t;
+            }
+        }
+        const int n = c->remove_workers(1, tag);
+        if (n == 0) {
+            break;
+        }
+        removed += n;
+    }
+    return removed;
+}
+
 static bool validate_fiber_min_concurrency(const char*, int32_t val) {
     if (val <= 0) {
         return true;
@@ -140,6 +196,52 @@ static bool validate_fiber_min_concurrency(const char*, int32_t val) {
     }
 }
 
+static bool validate_fiber_tag_affinity(const char*, const std::string& val) {
+    std::vector<std::pair<fiber_tag_t, TagAffinity> > affinities;
+    if (parse_tag_affinity(val, &affinities) != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < affinities.size(); ++i) {
+        if (affinities[i].first >= FLAGS_task_group_ntags) {
+            return false;
+        }
+    }
+    BAIDU_SCOPED_LOCK(g_task_control_mutex);
+    auto c = get_task_control();
+    if (c == NULL) {
+        // Read by TaskControl::init().
+        return true;
+    }
+    for (size_t i = 0; i < affinities.size(); ++i) {
+        if (c->set_tag_affinity(affinities[i].first, affinities[i].second) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool validate_fiber_tag_spin_policy(const char*, const std::string& val) {
+    std::vector<std::pair<fiber_tag_t, TagSpinPolicy> > policies;
+    if (parse_tag_spin_policy(val, &policies) != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < policies.size(); ++i) {
+        if (policies[i].first >= FLAGS_task_group_ntags) {
+            return false;
+        }
+    }
+    BAIDU_SCOPED_LOCK(g_task_control_mutex);
+    auto c = get_task_control();
+    if (c == NULL) {
+        // Read by TaskControl::init().
+        return true;
+    }
+    for (size_t i = 0; i < policies.size(); ++i) {
+        c->set_tag_spin_policy(policies[i].first, policies[i].second);
+    }
+    return true;
+}
+
 static bool validate_fiber_current_tag(const char*, int32_t val) {
     if (val < FIBER_TAG_DEFAULT || val >= FLAGS_task_group_ntags) {
         return false;
@@ -159,6 +261,23 @@ static bool validate_fiber_concurrency_by_tag(const char*, int32_t val) {
 }
 
 __thread TaskGroup* tls_task_group_nosignal = NULL;
+static __thread int64_t tls_task_group_nosignal_version = 0;
+
+// Returns the TaskGroup that NOSIGNAL tasks of this pthread were inserted
+// into, NULL if there's none or workers were retired since then, in which
+// case the group may be destroyed.
+TaskGroup* get_task_group_nosignal(TaskControl* c) {
+    if (tls_task_group_nosignal != NULL &&
+        tls_task_group_nosignal_version != c->retire_version()) {
+        tls_task_group_nosignal = NULL;
+    }
+    return tls_task_group_nosignal;
+}
+
+void set_task_group_nosignal(TaskControl* c, TaskGroup* g) {
+    tls_task_group_nosignal = g;
+    tls_task_group_nosignal_version = c->retire_version();
+}
 
 BUTIL_FORCE_INLINE int
 start_from_non_worker(fiber_t* __restrict tid,
@@ -178,10 +297,10 @@ start_from_non_worker(fiber_t* __restrict tid,
         // 1. NOSIGNAL is often for creating many fibers in batch,
         //    inserting into the same TaskGroup maximizes the batch.
         // 2. fiber_flush() needs to know which TaskGroup to flush.
-        auto g = tls_task_group_nosignal;
+        auto g = get_task_group_nosignal(c);
         if (NULL == g) {
             g = c->choose_one_group(tag);
-            tls_task_group_nosignal = g;
+            set_task_group_nosignal(c, g);
         }
         return g->start_background<true>(tid, attr, fn, arg);
     }
@@ -249,12 +368,60 @@ int fiber_start_lazy(fiber_t* __restrict tid,
     return eabase::start_from_non_worker(tid, attr, fn, arg);
 }
 
+int fiber_start_batch(size_t n,
+                      fiber_t* __restrict tids,
+                      const fiber_attr_t* __restrict attrs,
+                      void* (*const* fns)(void*),
+                      void* const* args) {
+    if (n == 0) {
+        return 0;
+    }
+    if (tids == NULL || fns == NULL || args == NULL) {
+        return EINVAL;
+    }
+    bool nosignal = true;
+    if (attrs != NULL) {
+        for (size_t i = 0; i < n; ++i) {
+            if (attrs[i].tag != attrs[0].tag) {
+                return EINVAL;
+            }
+            nosignal = nosignal && (attrs[i].flags & FIBER_NOSIGNAL);
+        }
+    } else {
+        nosignal = false;
+    }
+    eabase::TaskGroup* g = eabase::tls_task_group;
+    if (g && eabase::can_run_thread_local(attrs)) {
+        return g->start_background_batch<false>(n, tids, attrs, fns, args);
+    }
+    eabase::TaskControl* c = eabase::get_or_new_task_control();
+    if (NULL == c) {
+        return ENOMEM;
+    }
+    fiber_tag_t tag = FIBER_TAG_DEFAULT;
+    if (attrs != NULL && attrs[0].tag != FIBER_TAG_INVALID) {
+        tag = attrs[0].tag;
+    }
+    if (nosignal) {
+        // Same as start_from_non_worker().
+        g = eabase::get_task_group_nosignal(c);
+        if (NULL == g) {
+            g = c->choose_one_group(tag);
+            eabase::set_task_group_nosignal(c, g);
+        }
+    } else {
+        g = c->choose_one_group(tag);
+    }
+    return g->start_background_batch<true>(n, tids, attrs, fns, args);
+}
+
 void fiber_flush() {
     eabase::TaskGroup* g = eabase::tls_task_group;
     if (g) {
         return g->flush_nosignal_tasks();
     }
-    g = eabase::tls_task_group_nosignal;
+    eabase::TaskControl* c = eabase::get_task_control();
+    g = (c ? eabase::get_task_group_nosignal(c) : NULL);
     if (g) {
         // NOSIGNAL tasks were created in this non-worker.
         eabase::tls_task_group_nosignal = NULL;
@@ -332,16 +499,18 @@ int fiber_setconcurrency(int num) {
         if (eabase::never_set_fiber_concurrency) {
             eabase::never_set_fiber_concurrency = false;
         }
+        BAIDU_SCOPED_LOCK(eabase::g_task_control_mutex);
         eabase::FLAGS_fiber_concurrency = num;
+        eabase::TaskControl* c = eabase::get_task_control();
+        if (c != NULL && num < c->concurrency()) {
+            // Workers added on demand are retired as well.
+            eabase::remove_workers_for_each_tag(c->concurrency() - num);
+        }
         return 0;
     }
     eabase::TaskControl* c = eabase::get_task_control();
-    if (c != NULL) {
-        if (num < c->concurrency()) {
-            return EPERM;
-        } else if (num == c->concurrency()) {
-            return 0;
-        }
+    if (c != NULL && num == c->concurrency()) {
+        return 0;
     }
     BAIDU_SCOPED_LOCK(eabase::g_task_control_mutex);
     c = eabase::get_task_control();
@@ -364,6 +533,10 @@ int fiber_setconcurrency(int num) {
         // Create more workers if needed.
         auto added = eabase::add_workers_for_each_tag(num - eabase::FLAGS_fiber_concurrency);
         eabase::FLAGS_fiber_concurrency += added;
+    } else if (num < eabase::FLAGS_fiber_concurrency) {
+        // Retire workers, they quit asynchronously.
+        auto removed = eabase::remove_workers_for_each_tag(eabase::FLAGS_fiber_concurrency - num);
+        eabase::FLAGS_fiber_concurrency -= removed;
     }
     return (num == eabase::FLAGS_fiber_concurrency ? 0 : EPERM);
 }
@@ -482,6 +655,113 @@ int fiber_set_tagged_worker_startfn(void (*start_fn)(fiber_tag_t)) {
     return 0;
 }
 
+int fiber_set_tag_affinity(fiber_tag_t tag, const fiber_affinity_t* affinity) {
+    if (tag < FIBER_TAG_DEFAULT || tag >= FLAGS_task_group_ntags ||
+        affinity == NULL) {
+        return EINVAL;
+    }
+    eabase::TagAffinity a;
+    if (a.from(*affinity) != 0) {
+        return EINVAL;
+    }
+    eabase::TaskControl* c = eabase::get_or_new_task_control();
+    if (c == NULL) {
+        return ENOMEM;
+    }
+    return c->set_tag_affinity(tag, a);
+}
+
+int fiber_set_tag_spin_policy(fiber_tag_t tag,
+                              const fiber_spin_policy_t* policy) {
+    if (tag < FIBER_TAG_DEFAULT || tag >= FLAGS_task_group_ntags ||
+        policy == NULL) {
+        return EINVAL;
+    }
+    eabase::TagSpinPolicy p;
+    if (p.from(*policy) != 0) {
+        return EINVAL;
+    }
+    eabase::TaskControl* c = eabase::get_or_new_task_control();
+    if (c == NULL) {
+        return ENOMEM;
+    }
+    c->set_tag_spin_policy(tag, p);
+    return 0;
+}
+
+int fiber_get_tag_placement(fiber_tag_t tag, char* buf, size_t len) {
+    if (tag < FIBER_TAG_DEFAULT || tag >= FLAGS_task_group_ntags) {
+        errno = EINVAL;
+        return -1;
+    }
+    std::string out;
+    eabase::TaskControl* c = eabase::get_task_control();
+    if (c != NULL) {
+        std::vector<std::vector<int> > placement;
+        c->get_tag_placement(tag, &placement);
+        for (size_t i = 0; i < placement.size(); ++i) {
+            if (i) {
+                out.push_back(' ');
+            }
+            out.append(eabase::format_cpulist(placement[i]));
+        }
+    }
+    if (buf != NULL && len > 0) {
+        const size_t n = std::min(len - 1, out.size());
+        memcpy(buf, out.data(), n);
+        buf[n] = '\0';
+    }
+    return (int)out.size();
+}
+
+int fiber_set_cpu_label(const char* label) {
+    eabase::TaskGroup* g = eabase::tls_task_group;
+    if (g == NULL) {
+        return EPERM;
+    }
+    g->current_task()->cpu_label = label;
+    return 0;
+}
+
+int fiber_get_cpu_report(char* buf, size_t len, int top_n) {
+    if (top_n <= 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    std::ostringstream os;
+    eabase::print_fiber_cpu_usage(os, top_n);
+    const std::string out = os.str();
+    if (buf != NULL && len > 0) {
+        const size_t n = std::min(len - 1, out.size());
+        memcpy(buf, out.data(), n);
+        buf[n] = '\0';
+    }
+    return (int)out.size();
+}
+
+int fiber_trace_dump(const char* path, int64_t window_us) {
+    if (path == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    std::ofstream os(path, std::ios::out | std::ios::trunc);
+    if (!os) {
+        return -1;
+    }
+    const int64_t end_us = eabase::monotonic_time_us();
+    const int64_t begin_us = (window_us > 0 ? end_us - window_us : 0);
+    if (eabase::dump_sched_trace(os, begin_us, end_us) != 0) {
+        errno = EIO;
+        return -1;
+    }
+    os.close();
+    if (!os) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
 void fiber_stop_world() {
     eabase::TaskControl* c = eabase::get_task_control();
     if (c != NULL) {
@@ -52,6 +52,20 @@ extern int fiber_start_lazy(fiber_t *__restrict tid,
                                     void *(*fn)(void *),
                                     void *__restrict args);
 
+// Create `n' fibers `fns[i](args[i])' with attributes `attrs[i]' at once and
+// put the identifiers into `tids[0...n-1]'. Default attributes are used for
+// all fibers if `attrs' is NULL, otherwise all attrs must have the same tag.
+// Behaves like calling fiber_start_lazy() `n' times, but TaskMetas are
+// allocated in bulk, the fibers are pushed into runqueues with one operation
+// and idle workers are woken up once for the whole batch. Either all fibers
+// are created or none of them is.
+// Returns 0 on success, errno otherwise.
+extern int fiber_start_batch(size_t n,
+                             fiber_t *__restrict tids,
+                             const fiber_attr_t *__restrict attrs,
+                             void *(*const *fns)(void *),
+                             void *const *args);
+
 // Wake up operations blocking the thread. Different functions may behave
 // differently:
 //   fiber_usleep(): returns -1 and sets errno to ESTOP if fiber_stop()
@@ -275,16 +289,50 @@ extern int fiber_rwlockattr_setkind_np(fiber_rwlockattr_t *attr,
                                          int pref);
 
 
+// ----------------------------------------------
+// Functions for handling counting semaphores.
+// ----------------------------------------------
+
+// Initialize semaphore `sem' with `value' permits.
+// Returns 0 on success, error code otherwise.
+extern int fiber_sem_init(fiber_sem_t* sem, unsigned value);
+
+// Destroy semaphore `sem'.
+extern int fiber_sem_destroy(fiber_sem_t* sem);
+
+// Take a permit without blocking.
+// Returns 0 on success, EAGAIN if there's no permit.
+extern int fiber_sem_trywait(fiber_sem_t* sem);
+
+// Take a permit, blocking until one is posted.
+// Returns 0 on success, error code otherwise.
+extern int fiber_sem_wait(fiber_sem_t* sem);
+
+// Take a permit or return ETIMEDOUT after CLOCK_REALTIME reached `abstime'.
+extern int fiber_sem_timedwait(fiber_sem_t* __restrict sem,
+                               const struct timespec* __restrict abstime);
+
+// Add a permit and wake up a waiter.
+extern int fiber_sem_post(fiber_sem_t* sem);
+
+// Add `n' permits and wake up at most `n' waiters in one pass.
+extern int fiber_sem_post_n(fiber_sem_t* sem, unsigned n);
+
 // ----------------------------------------------------------------------
 // Functions for handling barrier which is a new feature in 1003.1j-2000.
 // ----------------------------------------------------------------------
 
+// Initialize `barrier' for rounds of `count' threads. `attr' is ignored.
+// Returns 0 on success, EINVAL if count is 0.
 extern int fiber_barrier_init(fiber_barrier_t *__restrict barrier,
                                 const fiber_barrierattr_t *__restrict attr,
                                 unsigned count);
 
 extern int fiber_barrier_destroy(fiber_barrier_t *barrier);
 
+// Block until `count' threads called this function in the round, which
+// is reusable afterwards. Returns FIBER_BARRIER_SERIAL_THREAD to the last
+// arriving thread and 0 to others, error code otherwise.
 extern int fiber_barrier_wait(fiber_barrier_t *barrier);
 
 // ---------------------------------------------------------------------
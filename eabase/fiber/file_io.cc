@@ -0,0 +1,389 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>                              // memset
+#include <unistd.h>                              // fsync
+#include <sys/uio.h>                             // preadv, pwritev
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/logging.h"
+#include "eabase/utility/scoped_lock.h"
+#include "eabase/utility/threading/platform_thread.h"
+#include "eabase/var/var.h"
+#include "eabase/fiber/butex.h"                       // butex_*
+#include "eabase/fiber/task_group.h"                  // TaskGroup
+#include "eabase/fiber/io_uring.h"                    // IoUring
+#include "eabase/fiber/unstable.h"
+#include <gflags/gflags.h>
+
+DEFINE_bool(fiber_file_io_use_io_uring, true, "Run fiber_pread/pwrite/fsync "
+            "with io_uring when it's supported, otherwise they're run by "
+            "-fiber_file_io_thread_num offload pthreads");
+
+static const int FIBER_MAX_FILE_IO_THREAD_NUM = 256;
+
+static bool validate_fiber_file_io_thread_num(const char*, int32_t val) {
+    return val >= 1 && val <= FIBER_MAX_FILE_IO_THREAD_NUM;
+}
+DEFINE_int32(fiber_file_io_thread_num, 8, "Number of pthreads running "
+             "fiber_pread/pwrite/fsync when io_uring is not used, which "
+             "bounds concurrent blocking file I/O. At most 256. Only read "
+             "when the threads are created for the first time");
+const bool ALLOW_UNUSED dummy_fiber_file_io_thread_num =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_file_io_thread_num,
+                                       validate_fiber_file_io_thread_num);
+
+namespace eabase {
+
+extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
+
+enum FileIOType {
+    FILE_IO_READ,
+    FILE_IO_WRITE,
+    FILE_IO_FSYNC,
+};
+
+// A file I/O issued by a fiber which is suspended until `done' is set.
+struct FileIORequest {
+    FileIOType type;
+    int fd;
+    const iovec* iov;
+    int iovcnt;
+    off_t offset;
+    ssize_t result;
+    int error;
+    // Set to 1 on completion.
+    eabase::atomic<int>* done;
+    FileIORequest* next;
+};
+
+static ssize_t run_file_io(const FileIORequest& req) {
+    switch (req.type) {
+    case FILE_IO_READ:
+        return ::preadv(req.fd, req.iov, req.iovcnt, req.offset);
+    case FILE_IO_WRITE:
+        return ::pwritev(req.fd, req.iov, req.iovcnt, req.offset);
+    case FILE_IO_FSYNC:
+        return ::fsync(req.fd);
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+static void complete_file_io(FileIORequest* req, ssize_t result, int error) {
+    req->result = result;
+    req->error = error;
+    // `req' may be gone after setting done.
+    eabase::atomic<int>* done = req->done;
+    done->store(1, eabase::memory_order_release);
+    butex_wake(done);
+}
+
+static eabase::Adder<int64_t>* g_file_io_count = NULL;
+static eabase::Adder<int64_t>* g_file_io_offload_count = NULL;
+
+static void init_file_io_vars() {
+    g_file_io_count = new eabase::Adder<int64_t>("fiber_file_io_count");
+    g_file_io_offload_count =
+        new eabase::Adder<int64_t>("fiber_file_io_offload_count");
+}
+
+// Pthreads running blocking file I/O for fibers.
+class FileIOThreadPool {
+public:
+    FileIOThreadPool() : _head(NULL), _tail(NULL) {
+        pthread_mutex_init(&_mutex, NULL);
+        pthread_cond_init(&_cond, NULL);
+    }
+
+    int start(int nthread) {
+        for (int i = 0; i < nthread; ++i) {
+            pthread_t tid;
+            const int rc = pthread_create(&tid, NULL, run_this, this);
+            if (rc != 0) {
+                LOG(ERROR) << "Fail to create file io thread, " << berror(rc);
+                if (i == 0) {
+                    return rc;
+                }
+                break;
+            }
+            pthread_detach(tid);
+        }
+        return 0;
+    }
+
+    void submit(FileIORequest* req) {
+        req->next = NULL;
+        BAIDU_SCOPED_LOCK(_mutex);
+        if (_tail) {
+            _tail->next = req;
+        } else {
+            _head = req;
+        }
+        _tail = req;
+        pthread_cond_signal(&_cond);
+    }
+
+private:
+    static void* run_this(void* arg) {
+        eabase::PlatformThread::SetName("fiber_file_io");
+        return static_cast<FileIOThreadPool*>(arg)->run();
+    }
+
+    void* run() {
+        while (true) {
+            FileIORequest* req = NULL;
+            {
+                BAIDU_SCOPED_LOCK(_mutex);
+                while (_head == NULL) {
+                    pthread_cond_wait(&_cond, &_mutex);
+                }
+                req = _head;
+                _head = req->next;
+                if (_head == NULL) {
+                    _tail = NULL;
+                }
+            }
+            const ssize_t rc = run_file_io(*req);
+            complete_file_io(req, rc, (rc < 0 ? errno : 0));
+        }
+        return NULL;
+    }
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+    FileIORequest* _head;
+    FileIORequest* _tail;
+};
+
+static FileIOThreadPool* g_file_io_pool = NULL;
+static pthread_once_t g_file_io_pool_once = PTHREAD_ONCE_INIT;
+
+static void create_file_io_pool() {
+    FileIOThreadPool* pool = new FileIOThreadPool;
+    if (pool->start(FLAGS_fiber_file_io_thread_num) != 0) {
+        LOG(FATAL) << "Fail to start file io threads";
+        delete pool;
+        return;
+    }
+    g_file_io_pool = pool;
+}
+
+#ifdef FIBER_HAS_IO_URING
+
+static const unsigned FIBER_FILE_IO_URING_ENTRIES = 1024;
+
+// Submits file I/O into io_uring and completes them in a pthread reaping
+// the ring.
+class IoUringFileThread {
+public:
+    // Returns 0 on success, errno otherwise.
+    int start() {
+        int rc = _ring.init(FIBER_FILE_IO_URING_ENTRIES);
+        if (rc != 0) {
+            return rc;
+        }
+        pthread_t tid;
+        rc = pthread_create(&tid, NULL, run_this, this);
+        if (rc != 0) {
+            return rc;
+        }
+        pthread_detach(tid);
+        return 0;
+    }
+
+    // Returns 0 when `req' is queued into the ring and completed later,
+    // errno when it's not queued and must be run in another way.
+    int submit(FileIORequest* req) {
+        io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        switch (req->type) {
+        case FILE_IO_READ:
+            sqe.opcode = IORING_OP_READV;
+            break;
+        case FILE_IO_WRITE:
+            sqe.opcode = IORING_OP_WRITEV;
+            break;
+        case FILE_IO_FSYNC:
+            sqe.opcode = IORING_OP_FSYNC;
+            break;
+        }
+        sqe.fd = req->fd;
+        sqe.addr = (uint64_t)req->iov;
+        sqe.len = req->iovcnt;
+        sqe.off = req->offset;
+        sqe.user_data = (uint64_t)req;
+        return _ring.submit(sqe);
+    }
+
+private:
+    static void* run_this(void* arg) {
+        eabase::PlatformThread::SetName("fiber_file_uring");
+        return static_cast<IoUringFileThread*>(arg)->run();
+    }
+
+    void* run() {
+        while (true) {
+            if (_ring.reap(1, on_complete, NULL) < 0 && errno != EINTR) {
+                PLOG(FATAL) << "Fail to reap io_uring=" << _ring.fd();
+                return NULL;
+            }
+        }
+        return NULL;
+    }
+
+    static void on_complete(void*, const io_uring_cqe& cqe) {
+        FileIORequest* req = (FileIORequest*)cqe.user_data;
+        if (cqe.res < 0) {
+            complete_file_io(req, -1, -cqe.res);
+        } else {
+            complete_file_io(req, cqe.res, 0);
+        }
+    }
+
+    IoUring _ring;
+};
+
+static IoUringFileThread* g_io_uring_file_thread = NULL;
+static pthread_once_t g_io_uring_file_thread_once = PTHREAD_ONCE_INIT;
+
+static void create_io_uring_file_thread() {
+    IoUringFileThread* t = new IoUringFileThread;
+    const int rc = t->start();
+    if (rc != 0) {
+        LOG(WARNING) << "Fail to start io_uring for file io, " << berror(rc)
+                     << ", use offload threads instead";
+        delete t;
+        return;
+    }
+    g_io_uring_file_thread = t;
+}
+
+#endif  // FIBER_HAS_IO_URING
+
+static pthread_once_t g_file_io_vars_once = PTHREAD_ONCE_INIT;
+
+// Run `req' out of the calling worker and suspend the calling fiber until
+// it's done. The request can't be abandoned since the kernel may still be
+// using the buffers, so interruptions are ignored.
+static ssize_t fiber_file_io(FileIORequest* req) {
+    pthread_once(&g_file_io_vars_once, init_file_io_vars);
+    eabase::atomic<int>* done = butex_create_checked<eabase::atomic<int> >();
+    if (NULL == done) {
+        errno = ENOMEM;
+        return -1;
+    }
+    done->store(0, eabase::memory_order_relaxed);
+    req->done = done;
+    bool submitted = false;
+#ifdef FIBER_HAS_IO_URING
+    if (FLAGS_fiber_file_io_use_io_uring) {
+        pthread_once(&g_io_uring_file_thread_once, create_io_uring_file_thread);
+        // Once queued, the request must complete from the ring, running it
+        // again in the offload threads reads or writes twice.
+        if (g_io_uring_file_thread != NULL &&
+            g_io_uring_file_thread->submit(req) == 0) {
+            submitted = true;
+        }
+    }
+#endif
+    if (!submitted) {
+        pthread_once(&g_file_io_pool_once, create_file_io_pool);
+        if (NULL == g_file_io_pool) {
+            butex_destroy(done);
+            // Run in the worker, better than failing.
+            return run_file_io(*req);
+        }
+        g_file_io_pool->submit(req);
+        *g_file_io_offload_count << 1;
+    }
+    *g_file_io_count << 1;
+    while (done->load(eabase::memory_order_acquire) == 0) {
+        butex_wait(done, 0, NULL);
+    }
+    butex_destroy(done);
+    if (req->result < 0) {
+        errno = req->error;
+    }
+    return req->result;
+}
+
+inline bool in_fiber() {
+    TaskGroup* g = tls_task_group;
+    return NULL != g && !g->is_current_pthread_task();
+}
+
+}  // namespace eabase
+
+extern "C" {
+
+ssize_t fiber_preadv(int fd, const struct iovec* iov, int iovcnt,
+                     off_t offset) {
+    if (!eabase::in_fiber()) {
+        return ::preadv(fd, iov, iovcnt, offset);
+    }
+    if (offset < 0 || iovcnt < 0) {
+        // What preadv returns. Negative offsets mean the file position in
+        // io_uring.
+        errno = EINVAL;
+        return -1;
+    }
+    eabase::FileIORequest req = { eabase::FILE_IO_READ, fd, iov, iovcnt,
+                                  offset, 0, 0, NULL, NULL };
+    return eabase::fiber_file_io(&req);
+}
+
+ssize_t fiber_pwritev(int fd, const struct iovec* iov, int iovcnt,
+                      off_t offset) {
+    if (!eabase::in_fiber()) {
+        return ::pwritev(fd, iov, iovcnt, offset);
+    }
+    if (offset < 0 || iovcnt < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    eabase::FileIORequest req = { eabase::FILE_IO_WRITE, fd, iov, iovcnt,
+                                  offset, 0, 0, NULL, NULL };
+    return eabase::fiber_file_io(&req);
+}
+
+ssize_t fiber_pread(int fd, void* buf, size_t count, off_t offset) {
+    if (!eabase::in_fiber()) {
+        return ::pread(fd, buf, count, offset);
+    }
+    iovec vec = { buf, count };
+    return fiber_preadv(fd, &vec, 1, offset);
+}
+
+ssize_t fiber_pwrite(int fd, const void* buf, size_t count, off_t offset) {
+    if (!eabase::in_fiber()) {
+        return ::pwrite(fd, buf, count, offset);
+    }
+    iovec vec = { const_cast<void*>(buf), count };
+    return fiber_pwritev(fd, &vec, 1, offset);
+}
+
+int fiber_fsync(int fd) {
+    if (!eabase::in_fiber()) {
+        return ::fsync(fd);
+    }
+    eabase::FileIORequest req = { eabase::FILE_IO_FSYNC, fd, NULL, 0,
+                                  0, 0, 0, NULL, NULL };
+    return (int)eabase::fiber_file_io(&req);
+}
+
+}  // extern "C"
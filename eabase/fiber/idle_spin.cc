@@ -0,0 +1,147 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#include <stdlib.h>                               // strtol
+#include <algorithm>                              // std::min
+#include "eabase/fiber/cpu_affinity.h"            // split_tag_spec
+#include "eabase/fiber/idle_spin.h"
+
+namespace eabase {
+
+static const int MAX_SPIN_US = 10000;
+// Spin for at least so long when the worker just started or idle periods
+// are extremely short.
+static const int64_t MIN_SPIN_NS = 1000;
+// Unused credit is accumulated up to so many times of the max spinning.
+static const int64_t MAX_CREDIT_SPINS = 8;
+
+int TagSpinPolicy::from(const fiber_spin_policy_t& policy) {
+    if (policy.mode < FIBER_SPIN_NONE || policy.mode > FIBER_SPIN_ADAPTIVE ||
+        policy.max_spin_us < 1 || policy.max_spin_us > MAX_SPIN_US ||
+        policy.max_cpu_percent < 1 || policy.max_cpu_percent > 100) {
+        return -1;
+    }
+    mode = policy.mode;
+    max_spin_us = policy.max_spin_us;
+    max_cpu_percent = policy.max_cpu_percent;
+    return 0;
+}
+
+int64_t TagSpinPolicy::pack() const {
+    return ((int64_t)max_spin_us << 16) | (max_cpu_percent << 8) | mode;
+}
+
+TagSpinPolicy TagSpinPolicy::unpack(int64_t val) {
+    TagSpinPolicy p;
+    p.mode = (int)(val & 0xFF);
+    p.max_cpu_percent = (int)((val >> 8) & 0xFF);
+    p.max_spin_us = (int)(val >> 16);
+    return p;
+}
+
+static int parse_int(const std::string& s, int* val) {
+    if (s.empty()) {
+        return -1;
+    }
+    char* endptr = NULL;
+    const long v = strtol(s.c_str(), &endptr, 10);
+    if (*endptr != '\0') {
+        return -1;
+    }
+    *val = (int)v;
+    return 0;
+}
+
+// Entries are separated by ';', each of them is
+// <tag>:<mode>[:<max_spin_us>[:<max_cpu_percent>]]
+int parse_tag_spin_policy(
+    const std::string& spec,
+    std::vector<std::pair<fiber_tag_t, TagSpinPolicy> >* out) {
+    out->clear();
+    std::vector<std::vector<std::string> > entries;
+    split_tag_spec(spec, &entries);
+    for (size_t e = 0; e < entries.size(); ++e) {
+        const std::vector<std::string>& fields = entries[e];
+        if (fields.size() < 2 || fields.size() > 4) {
+            return -1;
+        }
+        int tag = 0;
+        if (parse_int(fields[0], &tag) != 0 || tag < FIBER_TAG_DEFAULT) {
+            return -1;
+        }
+        fiber_spin_policy_t p;
+        if (fields[1] == "none") {
+            p.mode = FIBER_SPIN_NONE;
+        } else if (fields[1] == "fixed") {
+            p.mode = FIBER_SPIN_FIXED;
+        } else if (fields[1] == "adaptive") {
+            p.mode = FIBER_SPIN_ADAPTIVE;
+        } else {
+            return -1;
+        }
+        const TagSpinPolicy defaults;
+        p.max_spin_us = defaults.max_spin_us;
+        p.max_cpu_percent = defaults.max_cpu_percent;
+        if (fields.size() > 2 && parse_int(fields[2], &p.max_spin_us) != 0) {
+            return -1;
+        }
+        if (fields.size() > 3 && parse_int(fields[3], &p.max_cpu_percent) != 0) {
+            return -1;
+        }
+        TagSpinPolicy policy;
+        if (policy.from(p) != 0) {
+            return -1;
+        }
+        out->push_back(std::make_pair((fiber_tag_t)tag, policy));
+    }
+    return 0;
+}
+
+IdleSpinner::IdleSpinner()
+    : _avg_idle_ns(0)
+    , _credit_ns(0)
+    , _last_refill_ns(0)
+    , _max_spin_ns(0) {
+}
+
+int64_t IdleSpinner::spin_budget_ns(const TagSpinPolicy& policy,
+                                    int64_t now_ns) {
+    const int64_t elapsed_ns = now_ns - _last_refill_ns;
+    _last_refill_ns = now_ns;
+    _max_spin_ns = policy.max_spin_us * 1000L;
+    if (policy.mode == FIBER_SPIN_NONE) {
+        return 0;
+    }
+    _credit_ns = std::min(_credit_ns + elapsed_ns / 100 * policy.max_cpu_percent,
+                          MAX_CREDIT_SPINS * _max_spin_ns);
+    int64_t budget_ns = _max_spin_ns;
+    if (policy.mode == FIBER_SPIN_ADAPTIVE) {
+        if (_avg_idle_ns > _max_spin_ns) {
+            // Likely to park anyway, don't waste cpu.
+            return 0;
+        }
+        budget_ns = std::min(budget_ns, std::max(_avg_idle_ns * 2, MIN_SPIN_NS));
+    }
+    return std::max(std::min(budget_ns, _credit_ns), (int64_t)0);
+}
+
+void IdleSpinner::on_idle_end(int64_t idle_ns, int64_t spin_ns) {
+    const int64_t sample_ns = std::min(idle_ns, _max_spin_ns * 2);
+    _avg_idle_ns += (sample_ns - _avg_idle_ns) / 8;
+    _credit_ns -= spin_ns;
+}
+
+}  // namespace eabase
@@ -0,0 +1,78 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#ifndef FIBER_IDLE_SPIN_H_
+#define FIBER_IDLE_SPIN_H_
+
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+#include "eabase/fiber/types.h"
+
+namespace eabase {
+
+// How idle workers of a tag spin before parking.
+struct TagSpinPolicy {
+    TagSpinPolicy()
+        : mode(FIBER_SPIN_NONE), max_spin_us(50), max_cpu_percent(10) {}
+
+    // Converted from the C struct, returns -1 if any field is out of range.
+    int from(const fiber_spin_policy_t& policy);
+
+    // Packed into one word so that workers read the policy without locking.
+    int64_t pack() const;
+    static TagSpinPolicy unpack(int64_t val);
+
+    int mode;
+    int max_spin_us;
+    int max_cpu_percent;
+};
+
+// Parse specs of -fiber_tag_spin_policy, see its description for the format.
+// Returns 0 on success, -1 otherwise.
+int parse_tag_spin_policy(
+    const std::string& spec,
+    std::vector<std::pair<fiber_tag_t, TagSpinPolicy> >* out);
+
+// Decides how long an idle worker spins. Owned by one worker, not thread-safe.
+class IdleSpinner {
+public:
+    IdleSpinner();
+
+    // Nanoseconds to spin for the idle period starting at `now_ns', 0 means
+    // parking directly.
+    int64_t spin_budget_ns(const TagSpinPolicy& policy, int64_t now_ns);
+
+    // Called when the worker got a task after being idle for `idle_ns', of
+    // which `spin_ns' were spent on spinning.
+    void on_idle_end(int64_t idle_ns, int64_t spin_ns);
+
+    int64_t average_idle_ns() const { return _avg_idle_ns; }
+
+private:
+    // Moving average of recent idle periods, each clamped to twice the max
+    // spinning time so that a long sleep does not hide following short ones.
+    int64_t _avg_idle_ns;
+    // Spinning time that is still allowed by max_cpu_percent.
+    int64_t _credit_ns;
+    int64_t _last_refill_ns;
+    int64_t _max_spin_ns;
+};
+
+}  // namespace eabase
+
+#endif  // FIBER_IDLE_SPIN_H_
@@ -0,0 +1,210 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#include "eabase/fiber/io_uring.h"
+
+#ifdef FIBER_HAS_IO_URING
+
+#include <errno.h>
+#include <sched.h>                          // sched_yield
+#include <string.h>                         // memset
+#include <unistd.h>                         // syscall, close
+#include <sys/mman.h>                       // mmap
+#include <sys/syscall.h>                    // __NR_io_uring_*
+#include "eabase/utility/logging.h"
+#include "eabase/utility/scoped_lock.h"
+
+namespace eabase {
+
+inline int sys_io_uring_setup(unsigned entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+inline int sys_io_uring_enter(int fd, unsigned to_submit,
+                              unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                   flags, NULL, 0);
+}
+
+IoUring::IoUring()
+    : _ring_fd(-1)
+    , _sq_ring(MAP_FAILED)
+    , _sq_ring_size(0)
+    , _cq_ring(MAP_FAILED)
+    , _cq_ring_size(0)
+    , _sqes((io_uring_sqe*)MAP_FAILED)
+    , _sqes_size(0)
+    , _sq_head(NULL)
+    , _sq_tail(NULL)
+    , _sq_mask(0)
+    , _sq_entries(0)
+    , _sq_array(NULL)
+    , _cq_head(NULL)
+    , _cq_tail(NULL)
+    , _cq_mask(0)
+    , _cqes(NULL)
+    , _nunsubmitted(0) {
+}
+
+IoUring::~IoUring() {
+    if (_sqes != MAP_FAILED) {
+        munmap(_sqes, _sqes_size);
+    }
+    if (_cq_ring != MAP_FAILED && _cq_ring != _sq_ring) {
+        munmap(_cq_ring, _cq_ring_size);
+    }
+    if (_sq_ring != MAP_FAILED) {
+        munmap(_sq_ring, _sq_ring_size);
+    }
+    if (_ring_fd >= 0) {
+        close(_ring_fd);
+    }
+}
+
+int IoUring::init(unsigned entries) {
+    if (initialized()) {
+        return EINVAL;
+    }
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    const int fd = sys_io_uring_setup(entries, &p);
+    if (fd < 0) {
+        return errno;
+    }
+    _ring_fd = fd;
+    _sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    _cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP);
+    if (single_mmap && _cq_ring_size > _sq_ring_size) {
+        _sq_ring_size = _cq_ring_size;
+    }
+    _sq_ring = mmap(NULL, _sq_ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) {
+        return errno;
+    }
+    if (single_mmap) {
+        _cq_ring = _sq_ring;
+    } else {
+        _cq_ring = mmap(NULL, _cq_ring_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (_cq_ring == MAP_FAILED) {
+            return errno;
+        }
+    }
+    _sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+    _sqes = (io_uring_sqe*)mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+        return errno;
+    }
+    char* sq = static_cast<char*>(_sq_ring);
+    _sq_head = (unsigned*)(sq + p.sq_off.head);
+    _sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    _sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    _sq_entries = p.sq_entries;
+    _sq_array = (unsigned*)(sq + p.sq_off.array);
+    char* cq = static_cast<char*>(_cq_ring);
+    _cq_head = (unsigned*)(cq + p.cq_off.head);
+    _cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    _cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    _cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+int IoUring::push(const io_uring_sqe& sqe) {
+    while (true) {
+        {
+            BAIDU_SCOPED_LOCK(_sq_mutex);
+            const unsigned tail = *_sq_tail;
+            const unsigned head = __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+            if (tail - head < _sq_entries) {
+                const unsigned index = tail & _sq_mask;
+                _sqes[index] = sqe;
+                _sq_array[index] = index;
+                __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        }
+        // Full of entries being submitted by another thread.
+        if (sched_yield() < 0) {
+            return errno;
+        }
+    }
+}
+
+int IoUring::flush() {
+    while (true) {
+        const int n = _nunsubmitted.load(eabase::memory_order_acquire);
+        // All entries visible to the kernel are submitted, including the
+        // ones pushed after loading `n'.
+        if (sys_io_uring_enter(_ring_fd, _sq_entries, 0, 0) < 0) {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                sched_yield();
+                continue;
+            }
+            const int saved_errno = errno;
+            PLOG(ERROR) << "Fail to submit to io_uring=" << _ring_fd;
+            // Left entries are submitted by later calls.
+            _nunsubmitted.fetch_sub(n, eabase::memory_order_relaxed);
+            return saved_errno;
+        }
+        if (_nunsubmitted.fetch_sub(n, eabase::memory_order_acq_rel) == n) {
+            return 0;
+        }
+    }
+}
+
+int IoUring::submit(const io_uring_sqe& sqe) {
+    const int rc = push(sqe);
+    if (rc != 0) {
+        return rc;
+    }
+    if (_nunsubmitted.fetch_add(1, eabase::memory_order_release) != 0) {
+        // The submitter in flush() takes this entry as well.
+        return 0;
+    }
+    // The entry is in the ring already, don't let the caller run it in
+    // another way. If flush() failed, it's submitted by later calls.
+    flush();
+    return 0;
+}
+
+int IoUring::reap(unsigned min_complete,
+                  void (*fn)(void* arg, const io_uring_cqe& cqe), void* arg) {
+    unsigned head = *_cq_head;
+    unsigned tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    // Entries left in the ring by a failed flush() are submitted as well.
+    const unsigned nqueued = __atomic_load_n(_sq_tail, __ATOMIC_ACQUIRE) -
+        __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+    if (tail - head < min_complete || nqueued != 0) {
+        if (sys_io_uring_enter(_ring_fd, nqueued, min_complete,
+                               IORING_ENTER_GETEVENTS) < 0) {
+            return -1;
+        }
+        tail = __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE);
+    }
+    int n = 0;
+    for (; head != tail; ++head, ++n) {
+        fn(arg, _cqes[head & _cq_mask]);
+    }
+    __atomic_store_n(_cq_head, head, __ATOMIC_RELEASE);
+    return n;
+}
+
+}  // namespace eabase
+
+#endif  // FIBER_HAS_IO_URING
@@ -0,0 +1,108 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#ifndef FIBER_IO_URING_H_
+#define FIBER_IO_URING_H_
+
+#include "eabase/utility/build_config.h"         // OS_LINUX
+
+#if defined(OS_LINUX) && defined(__has_include)
+# if __has_include(<linux/io_uring.h>)
+#  define FIBER_HAS_IO_URING 1
+# endif
+#endif
+
+#ifdef FIBER_HAS_IO_URING
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/macros.h"
+#include "eabase/fiber/mutex.h"
+
+namespace eabase {
+
+// A minimal io_uring talking to the kernel with raw syscalls, so that no
+// liburing is needed. Submission is thread-safe: concurrent submitters are
+// combined and entries queued meanwhile go into the kernel with one
+// io_uring_enter(). Completions are reaped by one thread.
+class IoUring {
+public:
+    IoUring();
+    ~IoUring();
+
+    // Set up a ring with at least `entries' submission entries.
+    // Returns 0 on success, errno otherwise, e.g. ENOSYS on kernels without
+    // io_uring and EPERM when it's disabled by sysctl or seccomp.
+    int init(unsigned entries);
+
+    bool initialized() const { return _ring_fd >= 0; }
+
+    // Queue a copy of `sqe' and submit all queued entries.
+    // Returns 0 when the entry is queued, its completion is reaped later
+    // even if submitting failed this time, since queued entries are
+    // submitted again by later submit() and reap(). Returns errno when the
+    // entry is not queued, in which case it never completes.
+    int submit(const io_uring_sqe& sqe);
+
+    // Submit queued entries and call fn(arg, cqe) for completions ready,
+    // waiting for at least `min_complete' of them first. Called by one
+    // thread at a time.
+    // Returns number of completions handled, -1 otherwise and errno is set.
+    int reap(unsigned min_complete,
+             void (*fn)(void* arg, const io_uring_cqe& cqe), void* arg);
+
+    int fd() const { return _ring_fd; }
+
+private:
+    EA_DISALLOW_COPY_AND_ASSIGN(IoUring);
+
+    // Copy `sqe' into the submission ring, waiting for free entries when
+    // the ring is full.
+    int push(const io_uring_sqe& sqe);
+    // Submit entries pushed but not submitted yet.
+    int flush();
+
+    int _ring_fd;
+    void* _sq_ring;
+    size_t _sq_ring_size;
+    void* _cq_ring;
+    size_t _cq_ring_size;
+    io_uring_sqe* _sqes;
+    size_t _sqes_size;
+
+    unsigned* _sq_head;
+    unsigned* _sq_tail;
+    unsigned _sq_mask;
+    unsigned _sq_entries;
+    unsigned* _sq_array;
+    unsigned* _cq_head;
+    unsigned* _cq_tail;
+    unsigned _cq_mask;
+    io_uring_cqe* _cqes;
+
+    // Serializes writers of the submission ring.
+    internal::FastPthreadMutex _sq_mutex;
+    // Entries pushed but not submitted. The submitter changing it from 0
+    // submits for others until it drops back to 0.
+    eabase::atomic<int> _nunsubmitted;
+};
+
+}  // namespace eabase
+
+#endif  // FIBER_HAS_IO_URING
+
+#endif  // FIBER_IO_URING_H_
@@ -51,7 +51,8 @@ const int ALLOW_UNUSED dummy_bt = GetStackTrace
     : backtrace(dummy_buf, arraysize(dummy_buf));
 
 // For controlling contentions collected per second.
-static eabase::CollectorSpeedLimit g_cp_sl = VAR_COLLECTOR_SPEED_LIMIT_INITIALIZER;
+// Also used by rwlock.cc.
+eabase::CollectorSpeedLimit g_cp_sl = VAR_COLLECTOR_SPEED_LIMIT_INITIALIZER;
 
 const size_t MAX_CACHED_CONTENTIONS = 512;
 // Skip frames which are always same: the unlock function and submit_contention()
@@ -258,8 +259,8 @@ void ContentionProfiler::flush_to_disk(bool ending) {
 }
 
 // If contention profiler is on, this variable will be set with a valid
-// instance. NULL otherwise.
-EA_CACHELINE_ALIGNMENT static ContentionProfiler* g_cp = NULL;
+// instance. NULL otherwise. Also used by rwlock.cc.
+EA_CACHELINE_ALIGNMENT ContentionProfiler* g_cp = NULL;
 // Need this version to solve an issue that non-empty entries left by
 // previous contention profilers should be detected and overwritten.
 static uint64_t g_cp_version = 0;
@@ -741,6 +742,11 @@ int fiber_mutex_lock_contended(fiber_mutex_t* m) {
     return eabase::mutex_lock_contended(m);
 }
 
+int fiber_mutex_timedlock_contended(fiber_mutex_t* __restrict m,
+                                    const struct timespec* __restrict abstime) {
+    return eabase::mutex_timedlock_contended(m, abstime);
+}
+
 int fiber_mutex_lock(fiber_mutex_t* m) {
     eabase::MutexInternal* split = (eabase::MutexInternal*)m->butex;
     if (!split->locked.exchange(1, eabase::memory_order_acquire)) {
@@ -30,6 +30,11 @@ extern int fiber_mutex_lock(fiber_mutex_t *mutex);
 extern int fiber_mutex_timedlock(fiber_mutex_t *__restrict mutex,
                                  const struct timespec *__restrict abstime);
 extern int fiber_mutex_unlock(fiber_mutex_t *mutex);
+// Lock a mutex which was just found locked, without being sampled by the
+// contention profiler. Used by other primitives built on fiber_mutex_t.
+extern int fiber_mutex_lock_contended(fiber_mutex_t *mutex);
+extern int fiber_mutex_timedlock_contended(
+    fiber_mutex_t *__restrict mutex, const struct timespec *__restrict abstime);
 __END_DECLS
 
 namespace eabase {
@@ -0,0 +1,217 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>                                // sched_getcpu
+#include <stdio.h>
+#include <stdlib.h>                               // strtol
+#include <unistd.h>                               // syscall, sysconf
+#include <sys/syscall.h>                          // SYS_mbind
+#include "eabase/utility/thread_local.h"
+#include "eabase/utility/memory/singleton_on_pthread_once.h"
+#include "eabase/fiber/numa.h"
+
+namespace eabase {
+
+int parse_cpulist(const std::string& cpulist, std::vector<int>* cpus) {
+    cpus->clear();
+    const char* p = cpulist.c_str();
+    while (*p) {
+        if (*p == ',' || *p == ' ' || *p == '\n') {
+            ++p;
+            continue;
+        }
+        char* end = NULL;
+        const long first = strtol(p, &end, 10);
+        if (end == p || first < 0) {
+            return -1;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-') {
+            ++p;
+            last = strtol(p, &end, 10);
+            if (end == p || last < first) {
+                return -1;
+            }
+            p = end;
+        }
+        for (long i = first; i <= last; ++i) {
+            cpus->push_back((int)i);
+        }
+    }
+    return 0;
+}
+
+static bool read_first_line(const char* path, std::string* line) {
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL) {
+        return false;
+    }
+    char buf[4096];
+    const bool ok = (fgets(buf, sizeof(buf), fp) != NULL);
+    fclose(fp);
+    if (ok) {
+        line->assign(buf);
+    }
+    return ok;
+}
+
+namespace {
+struct NumaTopology {
+    NumaTopology() {
+        std::string line;
+        std::vector<int> nodes;
+        if (read_first_line("/sys/devices/system/node/online", &line)) {
+            parse_cpulist(line, &nodes);
+        }
+        // Counts nodes with cpus only, so that folded nodes are spread
+        // evenly.
+        size_t ncpu_node = 0;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            char path[128];
+            snprintf(path, sizeof(path),
+                     "/sys/devices/system/node/node%d/cpulist", nodes[i]);
+            std::vector<int> cpus;
+            if (!read_first_line(path, &line) ||
+                parse_cpulist(line, &cpus) != 0 || cpus.empty()) {
+                // Memory-only nodes have no cpus to schedule on.
+                continue;
+            }
+            if ((int)node_cpus.size() < FIBER_MAX_NUMA_NODES) {
+                node_cpus.push_back(cpus);
+                physical_ids.push_back(nodes[i]);
+            } else {
+                std::vector<int>& folded =
+                    node_cpus[ncpu_node % FIBER_MAX_NUMA_NODES];
+                folded.insert(folded.end(), cpus.begin(), cpus.end());
+            }
+            ++ncpu_node;
+        }
+        if (node_cpus.empty()) {
+            const long ncpu = sysconf(_SC_NPROCESSORS_CONF);
+            std::vector<int> cpus;
+            for (long i = 0; i < ncpu; ++i) {
+                cpus.push_back((int)i);
+            }
+            node_cpus.push_back(cpus);
+            physical_ids.push_back(0);
+        }
+        for (size_t n = 0; n < node_cpus.size(); ++n) {
+            for (size_t i = 0; i < node_cpus[n].size(); ++i) {
+                const int cpu = node_cpus[n][i];
+                if (cpu >= (int)cpu_to_node.size()) {
+                    cpu_to_node.resize(cpu + 1, 0);
+                }
+                cpu_to_node[cpu] = (int)n;
+            }
+        }
+    }
+
+    std::vector<std::vector<int> > node_cpus;
+    std::vector<int> physical_ids;
+    std::vector<int> cpu_to_node;
+};
+
+const std::vector<int> s_no_cpus;
+BAIDU_THREAD_LOCAL int tls_numa_node = -1;
+}  // namespace
+
+static NumaTopology* get_topology() {
+    return get_leaky_singleton<NumaTopology>();
+}
+
+int numa_num_nodes() {
+    return (int)get_topology()->node_cpus.size();
+}
+
+int numa_node_of_cpu(int cpu) {
+    const NumaTopology* t = get_topology();
+    if (cpu < 0 || cpu >= (int)t->cpu_to_node.size()) {
+        return 0;
+    }
+    return t->cpu_to_node[cpu];
+}
+
+const std::vector<int>& numa_cpus_of_node(int node) {
+    const NumaTopology* t = get_topology();
+    if (node < 0 || node >= (int)t->node_cpus.size()) {
+        return s_no_cpus;
+    }
+    return t->node_cpus[node];
+}
+
+int numa_current_node() {
+    return numa_node_of_cpu(sched_getcpu());
+}
+
+int numa_local_node() {
+    return tls_numa_node;
+}
+
+void set_numa_local_node(int node) {
+    tls_numa_node = node;
+}
+
+int numa_bind_thread(int node) {
+    const std::vector<int>& cpus = numa_cpus_of_node(node);
+    if (cpus.empty()) {
+        return EINVAL;
+    }
+    cpu_set_t cs;
+    CPU_ZERO(&cs);
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        if (cpus[i] < CPU_SETSIZE) {
+            CPU_SET(cpus[i], &cs);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cs), &cs);
+}
+
+int numa_bind_memory(void* addr, size_t len, int node) {
+#if defined(SYS_mbind)
+    const NumaTopology* t = get_topology();
+    if (node < 0 || node >= (int)t->physical_ids.size()) {
+        errno = EINVAL;
+        return -1;
+    }
+    const int MPOL_PREFERRED_MODE = 1;
+    const size_t MAX_NODE_BITS = 1024;
+    const size_t BITS_PER_LONG = 8 * sizeof(unsigned long);
+    const size_t physical_id = t->physical_ids[node];
+    if (physical_id >= MAX_NODE_BITS) {
+        errno = EINVAL;
+        return -1;
+    }
+    unsigned long mask[MAX_NODE_BITS / BITS_PER_LONG] = { 0 };
+    mask[physical_id / BITS_PER_LONG] |= 1UL << (physical_id % BITS_PER_LONG);
+    // The kernel reads maxnode - 1 bits.
+    if (syscall(SYS_mbind, addr, len, MPOL_PREFERRED_MODE, mask,
+                MAX_NODE_BITS + 1, 0) != 0) {
+        return -1;
+    }
+    return 0;
+#else
+    (void)addr;
+    (void)len;
+    (void)node;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+}  // namespace eabase
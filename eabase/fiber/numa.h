@@ -0,0 +1,63 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#ifndef FIBER_NUMA_H_
+#define FIBER_NUMA_H_
+
+#include <stddef.h>                             // size_t
+#include <string>
+#include <vector>
+
+namespace eabase {
+
+// Nodes beyond this are folded into [0, FIBER_MAX_NUMA_NODES).
+static const int FIBER_MAX_NUMA_NODES = 16;
+
+// Parse a kernel cpulist like "0-3,8,10-11" into `cpus'.
+// Returns 0 on success, -1 otherwise.
+int parse_cpulist(const std::string& cpulist, std::vector<int>* cpus);
+
+// NUMA topology read from /sys/devices/system/node once. Nodes are
+// renumbered densely from 0 so that they can index arrays. A machine
+// without NUMA info is treated as a single node containing all cpus.
+int numa_num_nodes();
+
+// Dense node of `cpu', 0 if unknown.
+int numa_node_of_cpu(int cpu);
+
+// Cpus of the dense node `node'. Empty if `node' is out of range.
+const std::vector<int>& numa_cpus_of_node(int node);
+
+// Node of the cpu running the calling thread.
+int numa_current_node();
+
+// Node the calling thread is bound to by set_numa_local_node(), -1 if
+// the thread is not bound to any node.
+int numa_local_node();
+void set_numa_local_node(int node);
+
+// Pin the calling thread to cpus of `node'.
+// Returns 0 on success, error code otherwise.
+int numa_bind_thread(int node);
+
+// Prefer pages of [addr, addr + len) to be allocated from `node'. `addr'
+// must be page-aligned.
+// Returns 0 on success, -1 otherwise and errno is set.
+int numa_bind_memory(void* addr, size_t len, int node);
+
+}  // namespace eabase
+
+#endif  // FIBER_NUMA_H_
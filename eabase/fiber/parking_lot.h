@@ -51,8 +51,9 @@ public:
 
     // Wait for tasks.
     // If the `expected_state' does not match, wait() may finish directly.
-    void wait(const State& expected_state) {
-        futex_wait_private(&_pending_signal, expected_state.val, NULL);
+    // If `timeout' is not NULL, wait() finishes after the relative time.
+    void wait(const State& expected_state, const timespec* timeout = NULL) {
+        futex_wait_private(&_pending_signal, expected_state.val, timeout);
     }
 
     // Wakeup suspended wait() and make them unwaitable ever. 
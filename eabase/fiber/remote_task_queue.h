@@ -17,60 +17,171 @@
 #ifndef FIBER_REMOTE_TASK_QUEUE_H_
 #define FIBER_REMOTE_TASK_QUEUE_H_
 
-#include "eabase/utility/containers/bounded_queue.h"
+#include <stdlib.h>                          // malloc, free
+#include <new>                               // placement new
+#include "eabase/utility/atomicops.h"               // eabase::atomic
 #include "eabase/utility/macros.h"
+#include "eabase/fiber/types.h"                // fiber_t
 
 namespace eabase {
 
 class TaskGroup;
 
-// A queue for storing fibers created by non-workers. Since non-workers
-// randomly choose a TaskGroup to push which distributes the contentions,
-// this queue is simply implemented as a queue protected with a lock.
+// A queue for storing fibers created by non-workers. Pthreads outside the
+// pool may push at very high rates, so the queue is a lock-free bounded
+// MPMC ring (Dmitry Vyukov's algorithm): each cell carries a sequence number
+// telling producers and consumers whether the cell is writable or readable
+// in the current lap, and both ends are advanced with a single CAS.
 // The function names should be self-explanatory.
 class RemoteTaskQueue {
 public:
-    RemoteTaskQueue() {}
+    RemoteTaskQueue()
+        : _cells(NULL)
+        , _capacity(0)
+        , _mask(0)
+        , _enqueue_pos(0)
+        , _dequeue_pos(0) {}
 
+    ~RemoteTaskQueue() {
+        free(_cells);
+        _cells = NULL;
+    }
+
+    // `cap' is rounded up to power of 2.
     int init(size_t cap) {
-        const size_t memsize = sizeof(fiber_t) * cap;
-        void* q_mem = malloc(memsize);
-        if (q_mem == NULL) {
+        if (_cells != NULL || cap == 0) {
+            return -1;
+        }
+        size_t real_cap = 1;
+        while (real_cap < cap) {
+            real_cap <<= 1;
+        }
+        Cell* cells = static_cast<Cell*>(malloc(sizeof(Cell) * real_cap));
+        if (cells == NULL) {
             return -1;
         }
-        eabase::BoundedQueue<fiber_t> q(q_mem, memsize, eabase::OWNS_STORAGE);
-        _tasks.swap(q);
+        for (size_t i = 0; i < real_cap; ++i) {
+            new (&cells[i].sequence) eabase::atomic<size_t>(i);
+            cells[i].task = INVALID_FIBER;
+        }
+        _cells = cells;
+        _capacity = real_cap;
+        _mask = real_cap - 1;
         return 0;
     }
 
     bool pop(fiber_t* task) {
-        if (_tasks.empty()) {
-            return false;
+        size_t pos = _dequeue_pos.load(eabase::memory_order_relaxed);
+        while (true) {
+            Cell* cell = &_cells[pos & _mask];
+            const size_t seq = cell->sequence.load(eabase::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (_dequeue_pos.compare_exchange_weak(
+                        pos, pos + 1, eabase::memory_order_relaxed)) {
+                    *task = cell->task;
+                    // Make the cell writable in next lap.
+                    cell->sequence.store(pos + _mask + 1,
+                                         eabase::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // Empty.
+                return false;
+            } else {
+                pos = _dequeue_pos.load(eabase::memory_order_relaxed);
+            }
         }
-        _mutex.lock();
-        const bool result = _tasks.pop(task);
-        _mutex.unlock();
-        return result;
     }
 
     bool push(fiber_t task) {
-        _mutex.lock();
-        const bool res = push_locked(task);
-        _mutex.unlock();
-        return res;
+        size_t pos = _enqueue_pos.load(eabase::memory_order_relaxed);
+        while (true) {
+            Cell* cell = &_cells[pos & _mask];
+            const size_t seq = cell->sequence.load(eabase::memory_order_acquire);
+            const intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (_enqueue_pos.compare_exchange_weak(
+                        pos, pos + 1, eabase::memory_order_relaxed)) {
+                    cell->task = task;
+                    // Publish the task to consumers.
+                    cell->sequence.store(pos + 1, eabase::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                // Full.
+                return false;
+            } else {
+                pos = _enqueue_pos.load(eabase::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Push at most `n' tasks by claiming consecutive cells with one CAS.
+    // Returns # of tasks pushed, which is less than `n' when the queue
+    // becomes full.
+    size_t push_batch(const fiber_t* tasks, size_t n) {
+        size_t pos = _enqueue_pos.load(eabase::memory_order_relaxed);
+        while (true) {
+            // Count writable cells from `pos'. Cells are released by
+            // consumers out of order, so each of them has to be checked.
+            size_t k = 0;
+            bool stale = false;
+            for (; k < n; ++k) {
+                const size_t seq = _cells[(pos + k) & _mask].sequence.load(
+                    eabase::memory_order_acquire);
+                const intptr_t diff = (intptr_t)seq - (intptr_t)(pos + k);
+                if (diff != 0) {
+                    // diff > 0 means another producer took the cell.
+                    stale = (diff > 0);
+                    break;
+                }
+            }
+            if (stale) {
+                pos = _enqueue_pos.load(eabase::memory_order_relaxed);
+                continue;
+            }
+            if (k == 0) {
+                // Full.
+                return 0;
+            }
+            if (_enqueue_pos.compare_exchange_weak(
+                    pos, pos + k, eabase::memory_order_relaxed)) {
+                for (size_t i = 0; i < k; ++i) {
+                    Cell* cell = &_cells[(pos + i) & _mask];
+                    cell->task = tasks[i];
+                    cell->sequence.store(pos + i + 1,
+                                         eabase::memory_order_release);
+                }
+                return k;
+            }
+        }
     }
 
-    bool push_locked(fiber_t task) {
-        return _tasks.push(task);
+    // Approximate number of queued tasks, may be stale.
+    size_t volatile_size() const {
+        const size_t e = _enqueue_pos.load(eabase::memory_order_relaxed);
+        const size_t d = _dequeue_pos.load(eabase::memory_order_relaxed);
+        return (e <= d ? 0 : (e - d));
     }
 
-    size_t capacity() const { return _tasks.capacity(); }
+    size_t capacity() const { return _capacity; }
     
 private:
 friend class TaskGroup;
     EA_DISALLOW_COPY_AND_ASSIGN(RemoteTaskQueue);
-    eabase::BoundedQueue<fiber_t> _tasks;
-    eabase::Mutex _mutex;
+
+    struct Cell {
+        eabase::atomic<size_t> sequence;
+        fiber_t task;
+    };
+
+    Cell* _cells;
+    size_t _capacity;
+    size_t _mask;
+    // Producers and consumers spin on different cachelines.
+    EA_CACHELINE_ALIGNMENT eabase::atomic<size_t> _enqueue_pos;
+    EA_CACHELINE_ALIGNMENT eabase::atomic<size_t> _dequeue_pos;
 };
 
 }  // namespace eabase
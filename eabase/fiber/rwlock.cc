@@ -0,0 +1,356 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#include <errno.h>
+#include <new>                                   // std::nothrow
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/time.h"
+#include "eabase/utility/thread_local.h"
+#include "eabase/var/collector.h"
+#include "eabase/fiber/butex.h"                       // butex_*
+#include "eabase/fiber/mutex.h"                       // fiber_mutex_*
+#include "eabase/fiber/fiber.h"
+
+namespace eabase {
+
+// Defined in mutex.cc
+class ContentionProfiler;
+extern ContentionProfiler* g_cp;
+extern eabase::CollectorSpeedLimit g_cp_sl;
+extern void submit_contention(const fiber_contention_site_t& csite,
+                              int64_t now_ns);
+
+// Readers are counted in the counter of the calling thread instead of a
+// shared word, so that uncontended read locks in different threads don't
+// write a shared cacheline. A fiber may unlock in another thread than the
+// one it locked in, only the sum of the counters is meaningful.
+static const int RWLOCK_NSLOT = 32;
+
+struct EA_CACHELINE_ALIGNMENT ReaderCount {
+    ReaderCount() : value(0) {}
+    eabase::atomic<int64_t> value;
+};
+
+// Bits of fiber_rwlock_t::butex, only changed by the writer holding
+// writer_mutex.
+// A writer is checking whether readers are gone, new readers back off.
+static const unsigned RWLOCK_WRITER_WAITING = 1;
+// A writer holds the lock.
+static const unsigned RWLOCK_WRITER_LOCKED = 2;
+// The acquiring writer sleeps on writer_butex, leaving readers wake it up.
+static const unsigned RWLOCK_WRITER_SLEEPING = 4;
+
+static eabase::static_atomic<int> g_nreader_thread = BUTIL_STATIC_ATOMIC_INIT(0);
+static __thread int tls_reader_slot = -1;
+
+inline int reader_slot() {
+    int slot = tls_reader_slot;
+    if (slot < 0) {
+        slot = g_nreader_thread.fetch_add(1, eabase::memory_order_relaxed)
+            % RWLOCK_NSLOT;
+        tls_reader_slot = slot;
+    }
+    return slot;
+}
+
+inline eabase::atomic<unsigned>* rwlock_state(fiber_rwlock_t* rw) {
+    return (eabase::atomic<unsigned>*)rw->butex;
+}
+
+inline ReaderCount* reader_counts(fiber_rwlock_t* rw) {
+    return static_cast<ReaderCount*>(rw->reader_counts);
+}
+
+inline bool writer_preferred(const fiber_rwlock_t* rw) {
+    return rw->kind != FIBER_RWLOCK_PREFER_READER_NP;
+}
+
+// Returns sampling range if this contended locking should be sampled.
+inline size_t sample_contention(int64_t* start_ns) {
+    if (!g_cp) {
+        return 0;
+    }
+    const size_t sampling_range = eabase::is_collectable(&g_cp_sl);
+    if (sampling_range) {
+        *start_ns = eabase::cpuwide_time_ns();
+    }
+    return sampling_range;
+}
+
+inline void submit_contention_since(int64_t start_ns, size_t sampling_range) {
+    const int64_t end_ns = eabase::cpuwide_time_ns();
+    const fiber_contention_site_t csite = {end_ns - start_ns, sampling_range};
+    submit_contention(csite, end_ns);
+}
+
+static void reader_leave(fiber_rwlock_t* rw, int slot) {
+    // CAUTION: rw may be destroyed after the decrement, while butexes are
+    // never freed.
+    eabase::atomic<unsigned>* state = rwlock_state(rw);
+    eabase::atomic<unsigned>* seq = (eabase::atomic<unsigned>*)rw->writer_butex;
+    reader_counts(rw)[slot].value.fetch_sub(1, eabase::memory_order_release);
+    // Either the writer sums the decrement or we see it sleeping.
+    eabase::atomic_thread_fence(eabase::memory_order_seq_cst);
+    if (state->load(eabase::memory_order_relaxed) & RWLOCK_WRITER_SLEEPING) {
+        seq->fetch_add(1, eabase::memory_order_release);
+        butex_wake(seq);
+    }
+}
+
+static int rwlock_rdlock_impl(fiber_rwlock_t* rw, bool try_only,
+                              const timespec* abstime) {
+    eabase::atomic<unsigned>* state = rwlock_state(rw);
+    const int slot = reader_slot();
+    eabase::atomic<int64_t>& count = reader_counts(rw)[slot].value;
+    int64_t start_ns = 0;
+    size_t sampling_range = 0;
+    bool contended = false;
+    while (true) {
+        count.fetch_add(1, eabase::memory_order_relaxed);
+        // Either the writer sums the increment or we see the writer.
+        eabase::atomic_thread_fence(eabase::memory_order_seq_cst);
+        const unsigned s = state->load(eabase::memory_order_acquire);
+        if (!(s & (RWLOCK_WRITER_WAITING | RWLOCK_WRITER_LOCKED))) {
+            if (sampling_range) {
+                // Readers share the lock, there's no place to save the
+                // contention until unlock.
+                submit_contention_since(start_ns, sampling_range);
+            }
+            return 0;
+        }
+        reader_leave(rw, slot);
+        if (try_only) {
+            return EBUSY;
+        }
+        if (!contended) {
+            contended = true;
+            sampling_range = sample_contention(&start_ns);
+        }
+        if (butex_wait(state, s, abstime) < 0 &&
+            errno != EWOULDBLOCK && errno != EINTR) {
+            const int rc = errno;
+            if (rc == ETIMEDOUT && sampling_range) {
+                submit_contention_since(start_ns, sampling_range);
+            }
+            return rc;
+        }
+    }
+}
+
+// Called with writer_mutex held.
+static int writer_wait_readers(fiber_rwlock_t* rw, bool try_only,
+                               const timespec* abstime) {
+    eabase::atomic<unsigned>* state = rwlock_state(rw);
+    eabase::atomic<unsigned>* seq = (eabase::atomic<unsigned>*)rw->writer_butex;
+    ReaderCount* counts = reader_counts(rw);
+    while (true) {
+        state->store(RWLOCK_WRITER_WAITING |
+                     (try_only ? 0 : RWLOCK_WRITER_SLEEPING),
+                     eabase::memory_order_relaxed);
+        eabase::atomic_thread_fence(eabase::memory_order_seq_cst);
+        // Acquire pairs with the release increment of leaving readers, so
+        // that decrements before it are seen by the sum below. Otherwise the
+        // writer may keep summing stale counts on weak memory models.
+        const unsigned expected_seq = seq->load(eabase::memory_order_acquire);
+        int64_t nreader = 0;
+        for (int i = 0; i < RWLOCK_NSLOT; ++i) {
+            nreader += counts[i].value.load(eabase::memory_order_relaxed);
+        }
+        if (nreader == 0) {
+            // Synchronizes with the decrements of leaving readers.
+            eabase::atomic_thread_fence(eabase::memory_order_acquire);
+            state->store(RWLOCK_WRITER_LOCKED, eabase::memory_order_relaxed);
+            return 0;
+        }
+        if (try_only) {
+            state->store(0, eabase::memory_order_release);
+            butex_wake_all(state);
+            return EBUSY;
+        }
+        if (!writer_preferred(rw)) {
+            // Let new readers in while waiting.
+            state->store(RWLOCK_WRITER_SLEEPING, eabase::memory_order_release);
+            butex_wake_all(state);
+        }
+        if (butex_wait(seq, expected_seq, abstime) < 0 &&
+            errno != EWOULDBLOCK && errno != EINTR) {
+            const int rc = errno;
+            state->store(0, eabase::memory_order_release);
+            butex_wake_all(state);
+            return rc;
+        }
+    }
+}
+
+static int rwlock_wrlock_impl(fiber_rwlock_t* rw, bool try_only,
+                              const timespec* abstime) {
+    int64_t start_ns = 0;
+    size_t sampling_range = 0;
+    int rc = fiber_mutex_trylock(&rw->writer_mutex);
+    if (rc != 0) {
+        if (try_only) {
+            return EBUSY;
+        }
+        sampling_range = sample_contention(&start_ns);
+        rc = (abstime == NULL ?
+              fiber_mutex_lock_contended(&rw->writer_mutex) :
+              fiber_mutex_timedlock_contended(&rw->writer_mutex, abstime));
+        if (rc != 0) {
+            if (rc == ETIMEDOUT && sampling_range) {
+                submit_contention_since(start_ns, sampling_range);
+            }
+            return rc;
+        }
+    }
+    // Check readers without the clock if the lock is not contended.
+    if (!sampling_range && !try_only &&
+        writer_wait_readers(rw, true, NULL) == 0) {
+        return 0;
+    }
+    if (!sampling_range && !try_only) {
+        sampling_range = sample_contention(&start_ns);
+    }
+    rc = writer_wait_readers(rw, try_only, abstime);
+    if (rc != 0) {
+        fiber_mutex_unlock(&rw->writer_mutex);
+        if (rc == ETIMEDOUT && sampling_range) {
+            submit_contention_since(start_ns, sampling_range);
+        }
+        return rc;
+    }
+    if (sampling_range) {
+        // Inside lock, submitted at unlock.
+        rw->writer_csite.duration_ns = eabase::cpuwide_time_ns() - start_ns;
+        rw->writer_csite.sampling_range = sampling_range;
+    }
+    return 0;
+}
+
+static int rwlock_wrunlock(fiber_rwlock_t* rw) {
+    fiber_contention_site_t saved_csite = {0, 0};
+    if (rw->writer_csite.sampling_range) {
+        saved_csite = rw->writer_csite;
+        rw->writer_csite.sampling_range = 0;
+    }
+    const int64_t unlock_start_ns =
+        (saved_csite.sampling_range ? eabase::cpuwide_time_ns() : 0);
+    eabase::atomic<unsigned>* state = rwlock_state(rw);
+    state->store(0, eabase::memory_order_release);
+    butex_wake_all(state);
+    fiber_mutex_unlock(&rw->writer_mutex);
+    if (saved_csite.sampling_range) {
+        const int64_t unlock_end_ns = eabase::cpuwide_time_ns();
+        saved_csite.duration_ns += unlock_end_ns - unlock_start_ns;
+        submit_contention(saved_csite, unlock_end_ns);
+    }
+    return 0;
+}
+
+}  // namespace eabase
+
+extern "C" {
+
+int fiber_rwlock_init(fiber_rwlock_t* __restrict rw,
+                      const fiber_rwlockattr_t* __restrict attr) {
+    rw->butex = eabase::butex_create_checked<unsigned>();
+    rw->writer_butex = eabase::butex_create_checked<unsigned>();
+    rw->reader_counts =
+        new (std::nothrow) eabase::ReaderCount[eabase::RWLOCK_NSLOT];
+    if (!rw->butex || !rw->writer_butex || !rw->reader_counts ||
+        fiber_mutex_init(&rw->writer_mutex, NULL) != 0) {
+        eabase::butex_destroy(rw->butex);
+        eabase::butex_destroy(rw->writer_butex);
+        delete [] eabase::reader_counts(rw);
+        return ENOMEM;
+    }
+    *rw->butex = 0;
+    *rw->writer_butex = 0;
+    rw->writer_csite.duration_ns = 0;
+    rw->writer_csite.sampling_range = 0;
+    rw->kind = (attr ? attr->kind : FIBER_RWLOCK_PREFER_READER_NP);
+    return 0;
+}
+
+int fiber_rwlock_destroy(fiber_rwlock_t* rw) {
+    fiber_mutex_destroy(&rw->writer_mutex);
+    delete [] eabase::reader_counts(rw);
+    rw->reader_counts = NULL;
+    eabase::butex_destroy(rw->writer_butex);
+    eabase::butex_destroy(rw->butex);
+    return 0;
+}
+
+int fiber_rwlock_rdlock(fiber_rwlock_t* rw) {
+    return eabase::rwlock_rdlock_impl(rw, false, NULL);
+}
+
+int fiber_rwlock_tryrdlock(fiber_rwlock_t* rw) {
+    return eabase::rwlock_rdlock_impl(rw, true, NULL);
+}
+
+int fiber_rwlock_timedrdlock(fiber_rwlock_t* __restrict rw,
+                             const struct timespec* __restrict abstime) {
+    return eabase::rwlock_rdlock_impl(rw, false, abstime);
+}
+
+int fiber_rwlock_wrlock(fiber_rwlock_t* rw) {
+    return eabase::rwlock_wrlock_impl(rw, false, NULL);
+}
+
+int fiber_rwlock_trywrlock(fiber_rwlock_t* rw) {
+    return eabase::rwlock_wrlock_impl(rw, true, NULL);
+}
+
+int fiber_rwlock_timedwrlock(fiber_rwlock_t* __restrict rw,
+                             const struct timespec* __restrict abstime) {
+    return eabase::rwlock_wrlock_impl(rw, false, abstime);
+}
+
+int fiber_rwlock_unlock(fiber_rwlock_t* rw) {
+    // Readers never see RWLOCK_WRITER_LOCKED while holding the lock.
+    if (eabase::rwlock_state(rw)->load(eabase::memory_order_relaxed) &
+        eabase::RWLOCK_WRITER_LOCKED) {
+        return eabase::rwlock_wrunlock(rw);
+    }
+    eabase::reader_leave(rw, eabase::reader_slot());
+    return 0;
+}
+
+int fiber_rwlockattr_init(fiber_rwlockattr_t* attr) {
+    attr->kind = FIBER_RWLOCK_PREFER_READER_NP;
+    return 0;
+}
+
+int fiber_rwlockattr_destroy(fiber_rwlockattr_t*) {
+    return 0;
+}
+
+int fiber_rwlockattr_getkind_np(const fiber_rwlockattr_t* attr, int* pref) {
+    *pref = attr->kind;
+    return 0;
+}
+
+int fiber_rwlockattr_setkind_np(fiber_rwlockattr_t* attr, int pref) {
+    if (pref != FIBER_RWLOCK_PREFER_READER_NP &&
+        pref != FIBER_RWLOCK_PREFER_WRITER_NP &&
+        pref != FIBER_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP) {
+        return EINVAL;
+    }
+    attr->kind = pref;
+    return 0;
+}
+
+}  // extern "C"
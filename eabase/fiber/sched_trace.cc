@@ -0,0 +1,381 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+
+#include <stdlib.h>                               // malloc, free
+#include <unistd.h>                               // getpid, usleep
+#include <pthread.h>
+#include <algorithm>                              // std::min, std::max
+#include <iomanip>                                // std::setprecision
+#include <gflags/gflags.h>
+#include "eabase/utility/logging.h"
+#include "eabase/utility/scoped_lock.h"           // BAIDU_SCOPED_LOCK
+#include "eabase/utility/string_printf.h"         // string_printf
+#include "eabase/utility/time.h"                  // clock_cycles
+#include "eabase/fiber/task_group.h"              // TaskGroup
+#include "eabase/fiber/sched_trace.h"
+
+namespace eabase {
+
+static bool pass_bool(const char*, bool) { return true; }
+
+DEFINE_bool(fiber_trace, false, "Record creation, readiness, runs, steals, "
+            "butex waits/wakeups of fibers and parking of workers into "
+            "per-worker rings, which are dumped by fiber_trace_dump()");
+const bool ALLOW_UNUSED dummy_fiber_trace =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_trace, pass_bool);
+
+static bool validate_fiber_trace_ring_size(const char*, int32_t val) {
+    return val > 0 && (val & (val - 1)) == 0;
+}
+DEFINE_int32(fiber_trace_ring_size, 16384, "Number of events kept by each "
+             "worker when -fiber_trace is on, must be power of 2. Changes "
+             "only apply to workers recording their first events afterwards");
+const bool ALLOW_UNUSED dummy_fiber_trace_ring_size =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_trace_ring_size,
+                                       validate_fiber_trace_ring_size);
+
+extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
+
+// Protects all fields below.
+static pthread_mutex_t s_ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+// All rings ever created, indexed by id.
+static std::vector<SchedTraceRing*>* s_rings = NULL;
+static std::vector<SchedTraceRing*>* s_free_rings = NULL;
+// Taken when the first ring is created to convert cycles into time.
+static uint64_t s_anchor_tsc = 0;
+static int64_t s_anchor_ns = 0;
+
+// Serializes writers of the shared ring.
+static pthread_mutex_t s_shared_ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static SchedTraceRing* s_shared_ring = NULL;
+
+SchedTraceRing::SchedTraceRing(int id)
+    : main_tid(0)
+    , _id(id)
+    , _mask(0)
+    , _events(NULL)
+    , _pos(0) {
+}
+
+SchedTraceRing::~SchedTraceRing() {
+    free(_events);
+}
+
+int SchedTraceRing::init(size_t capacity) {
+    _events = (SchedTraceEvent*)malloc(capacity * sizeof(SchedTraceEvent));
+    if (_events == NULL) {
+        return -1;
+    }
+    _mask = capacity - 1;
+    return 0;
+}
+
+void SchedTraceRing::snapshot(std::vector<SchedTraceEvent>* out) const {
+    const uint64_t capacity = _mask + 1;
+    const uint64_t end = _pos.load(eabase::memory_order_acquire);
+    const uint64_t begin = (end > capacity ? end - capacity : 0);
+    const size_t old_size = out->size();
+    for (uint64_t i = begin; i < end; ++i) {
+        out->push_back(_events[i & _mask]);
+    }
+    eabase::atomic_thread_fence(eabase::memory_order_acquire);
+    // The writer overwrote events before `end2 - capacity' during copying
+    // and may be overwriting the one at `end2 - capacity'.
+    const uint64_t end2 = _pos.load(eabase::memory_order_relaxed);
+    if (end2 + 1 > capacity + begin) {
+        const size_t ndrop = std::min(end2 + 1 - capacity - begin, end - begin);
+        out->erase(out->begin() + old_size, out->begin() + old_size + ndrop);
+    }
+    for (size_t i = old_size; i < out->size(); ++i) {
+        (*out)[i].ring = _id;
+    }
+}
+
+// Must be called with s_ring_mutex held.
+static SchedTraceRing* create_ring() {
+    if (s_rings == NULL) {
+        s_rings = new std::vector<SchedTraceRing*>;
+        s_free_rings = new std::vector<SchedTraceRing*>;
+        s_anchor_ns = eabase::monotonic_time_ns();
+        s_anchor_tsc = detail::clock_cycles();
+    }
+    SchedTraceRing* r = new SchedTraceRing(s_rings->size());
+    if (r->init(FLAGS_fiber_trace_ring_size) != 0) {
+        LOG_EVERY_SECOND(ERROR) << "Fail to allocate ring of "
+                                << FLAGS_fiber_trace_ring_size << " events";
+        delete r;
+        return NULL;
+    }
+    s_rings->push_back(r);
+    return r;
+}
+
+SchedTraceRing* acquire_sched_trace_ring(fiber_tag_t tag, fiber_t main_tid) {
+    BAIDU_SCOPED_LOCK(s_ring_mutex);
+    SchedTraceRing* r = NULL;
+    if (s_free_rings != NULL && !s_free_rings->empty()) {
+        r = s_free_rings->back();
+        s_free_rings->pop_back();
+    } else {
+        r = create_ring();
+        if (r == NULL) {
+            return NULL;
+        }
+    }
+    r->name = eabase::string_printf("worker %d (tag %d)", r->id(), (int)tag);
+    r->main_tid = main_tid;
+    return r;
+}
+
+void release_sched_trace_ring(SchedTraceRing* r) {
+    if (r != NULL) {
+        BAIDU_SCOPED_LOCK(s_ring_mutex);
+        s_free_rings->push_back(r);
+    }
+}
+
+void record_sched_event(SchedTraceEventType type, fiber_t tid, uint64_t arg) {
+    SchedTraceEvent e;
+    e.tsc = detail::clock_cycles();
+    e.tid = tid;
+    e.arg = arg;
+    e.type = type;
+    e.ring = 0;
+    TaskGroup* g = tls_task_group;
+    if (g != NULL) {
+        SchedTraceRing* r = g->trace_ring();
+        if (r != NULL) {
+            r->record(e);
+        }
+        return;
+    }
+    BAIDU_SCOPED_LOCK(s_shared_ring_mutex);
+    if (s_shared_ring == NULL) {
+        BAIDU_SCOPED_LOCK(s_ring_mutex);
+        s_shared_ring = create_ring();
+        if (s_shared_ring == NULL) {
+            return;
+        }
+        s_shared_ring->name = "non-worker pthreads";
+    }
+    s_shared_ring->record(e);
+}
+
+static const char* const s_event_names[] = {
+    "create", "ready", "run", "switch_out", "steal",
+    "butex_wait", "butex_wake", "park", "unpark"
+};
+
+class TraceWriter {
+public:
+    TraceWriter(std::ostream& os, int64_t begin_us, int64_t end_us)
+        : _os(os), _pid(getpid()), _begin_us(begin_us), _end_us(end_us)
+        , _first(true) {}
+
+    // Write a complete event clipped by the window.
+    void complete(int ring, const char* name, fiber_t tid,
+                  double start_us, double stop_us) {
+        start_us = std::max(start_us, (double)_begin_us);
+        stop_us = std::min(stop_us, (double)_end_us);
+        if (start_us > stop_us) {
+            return;
+        }
+        begin_event();
+        _os << "{\"name\":\"" << name;
+        if (tid) {
+            _os << ' ' << tid;
+        }
+        _os << "\",\"cat\":\"fiber\",\"ph\":\"X\",\"ts\":" << start_us
+            << ",\"dur\":" << stop_us - start_us << ",\"pid\":" << _pid
+            << ",\"tid\":" << ring;
+        if (tid) {
+            _os << ",\"args\":{\"fiber\":" << tid << '}';
+        }
+        _os << '}';
+    }
+
+    // Write a run of `tid' in the worker whose scheduling loop runs in
+    // `main_tid'.
+    void run(int ring, fiber_t main_tid, fiber_t tid,
+             double start_us, double stop_us) {
+        if (tid == main_tid) {
+            complete(ring, "sched", 0, start_us, stop_us);
+        } else {
+            complete(ring, "fiber", tid, start_us, stop_us);
+        }
+    }
+
+    void instant(const SchedTraceEvent& e, double ts_us) {
+        if (ts_us < _begin_us || ts_us > _end_us) {
+            return;
+        }
+        begin_event();
+        _os << "{\"name\":\"" << s_event_names[e.type]
+            << "\",\"cat\":\"fiber\",\"ph\":\"i\",\"s\":\"t\",\"ts\":" << ts_us
+            << ",\"pid\":" << _pid << ",\"tid\":" << e.ring
+            << ",\"args\":{\"fiber\":" << e.tid;
+        switch (e.type) {
+        case SCHED_TRACE_CREATE:
+            _os << ",\"fn\":\"" << (void*)e.arg << '"';
+            break;
+        case SCHED_TRACE_READY:
+        case SCHED_TRACE_STEAL:
+            _os << ",\"priority\":" << e.arg;
+            break;
+        case SCHED_TRACE_BUTEX_WAIT:
+        case SCHED_TRACE_BUTEX_WAKE:
+            _os << ",\"butex\":\"" << (void*)e.arg << '"';
+            break;
+        }
+        _os << "}}";
+    }
+
+    void thread_name(int ring, const std::string& name) {
+        begin_event();
+        _os << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << _pid
+            << ",\"tid\":" << ring << ",\"args\":{\"name\":\"" << name
+            << "\"}}";
+    }
+
+private:
+    void begin_event() {
+        if (!_first) {
+            _os << ",\n";
+        }
+        _first = false;
+    }
+
+    std::ostream& _os;
+    const int _pid;
+    const int64_t _begin_us;
+    const int64_t _end_us;
+    bool _first;
+};
+
+struct RingInfo {
+    SchedTraceRing* ring;
+    // Copied since rings may be reused by other workers during dumping.
+    std::string name;
+    fiber_t main_tid;
+};
+
+int dump_sched_trace(std::ostream& os, int64_t begin_us, int64_t end_us) {
+    std::vector<RingInfo> rings;
+    uint64_t anchor_tsc = 0;
+    int64_t anchor_ns = 0;
+    {
+        BAIDU_SCOPED_LOCK(s_ring_mutex);
+        if (s_rings != NULL) {
+            rings.resize(s_rings->size());
+            for (size_t i = 0; i < s_rings->size(); ++i) {
+                rings[i].ring = (*s_rings)[i];
+                rings[i].name = (*s_rings)[i]->name;
+                rings[i].main_tid = (*s_rings)[i]->main_tid;
+            }
+        }
+        anchor_tsc = s_anchor_tsc;
+        anchor_ns = s_anchor_ns;
+    }
+    const std::ios_base::fmtflags saved_flags = os.flags();
+    const std::streamsize saved_precision = os.precision();
+    // Timestamps are in microseconds.
+    os << std::fixed << std::setprecision(3);
+    os << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    if (!rings.empty()) {
+        // Measure the rate of the cycle counter against the monotonic clock
+        // for at least 10ms.
+        int64_t now_ns = eabase::monotonic_time_ns();
+        if (now_ns - anchor_ns < 10000000L) {
+            ::usleep((10000000L - (now_ns - anchor_ns)) / 1000);
+            now_ns = eabase::monotonic_time_ns();
+        }
+        const uint64_t now_tsc = detail::clock_cycles();
+        const double ns_per_cycle =
+            (double)(now_ns - anchor_ns) / (int64_t)(now_tsc - anchor_tsc);
+        const double now_us = now_ns / 1000.0;
+
+        TraceWriter w(os, begin_us, end_us);
+        std::vector<SchedTraceEvent> events;
+        for (size_t i = 0; i < rings.size(); ++i) {
+            const int id = rings[i].ring->id();
+            const fiber_t main_tid = rings[i].main_tid;
+            w.thread_name(id, rings[i].name);
+            events.clear();
+            rings[i].ring->snapshot(&events);
+            if (events.empty()) {
+                continue;
+            }
+            // Runs or parking started before the oldest event are
+            // regarded as starting from it.
+            double first_us = -1;
+            double last_us = -1;
+            double run_start_us = -1;
+            fiber_t run_tid = 0;
+            double park_start_us = -1;
+            for (size_t j = 0; j < events.size(); ++j) {
+                const SchedTraceEvent& e = events[j];
+                const double ts_us = (anchor_ns + (int64_t)(e.tsc - anchor_tsc)
+                                      * ns_per_cycle) / 1000.0;
+                // Cycle counters of cpus may differ slightly, keep the
+                // events of a worker in order.
+                last_us = std::max(last_us, ts_us);
+                if (first_us < 0) {
+                    first_us = last_us;
+                }
+                switch (e.type) {
+                case SCHED_TRACE_RUN:
+                    if (run_start_us >= 0) {
+                        w.run(id, main_tid, run_tid, run_start_us, last_us);
+                    }
+                    run_start_us = last_us;
+                    run_tid = e.tid;
+                    break;
+                case SCHED_TRACE_SWITCH_OUT:
+                    w.run(id, main_tid, e.tid,
+                          (run_start_us >= 0 ? run_start_us : first_us),
+                          last_us);
+                    run_start_us = -1;
+                    break;
+                case SCHED_TRACE_PARK:
+                    park_start_us = last_us;
+                    break;
+                case SCHED_TRACE_UNPARK:
+                    w.complete(id, "park", 0,
+                               (park_start_us >= 0 ? park_start_us : first_us),
+                               last_us);
+                    park_start_us = -1;
+                    break;
+                default:
+                    w.instant(e, last_us);
+                    break;
+                }
+            }
+            if (run_start_us >= 0) {
+                w.run(id, main_tid, run_tid, run_start_us, now_us);
+            }
+            if (park_start_us >= 0) {
+                w.complete(id, "park", 0, park_start_us, now_us);
+            }
+        }
+    }
+    os << "\n]}\n";
+    os.flags(saved_flags);
+    os.precision(saved_precision);
+    return os.good() ? 0 : -1;
+}
+
+}  // namespace eabase
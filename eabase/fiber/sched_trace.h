@@ -0,0 +1,125 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+
+#ifndef FIBER_SCHED_TRACE_H_
+#define FIBER_SCHED_TRACE_H_
+
+#include <stdint.h>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <gflags/gflags_declare.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/macros.h"             // EA_DISALLOW_COPY_AND_ASSIGN
+#include "eabase/fiber/types.h"                 // fiber_t, fiber_tag_t
+
+namespace eabase {
+
+DECLARE_bool(fiber_trace);
+
+// Scheduling events recorded when -fiber_trace is on.
+enum SchedTraceEventType {
+    SCHED_TRACE_CREATE = 0,   // `tid' is created, arg: the entry function
+    SCHED_TRACE_READY,        // `tid' is pushed into a runqueue, arg: priority
+    SCHED_TRACE_RUN,          // the worker switches to `tid'
+    SCHED_TRACE_SWITCH_OUT,   // the worker switches away from `tid'
+    SCHED_TRACE_STEAL,        // `tid' is stolen from another worker, arg: priority
+    SCHED_TRACE_BUTEX_WAIT,   // `tid' (0 for pthreads) waits, arg: the butex
+    SCHED_TRACE_BUTEX_WAKE,   // `tid' (0 for pthreads) is woken, arg: the butex
+    SCHED_TRACE_PARK,         // the worker parks
+    SCHED_TRACE_UNPARK,       // the worker wakes up from parking
+    SCHED_TRACE_EVENT_NUM
+};
+
+struct SchedTraceEvent {
+    // Read by eabase::detail::clock_cycles().
+    uint64_t tsc;
+    fiber_t tid;
+    uint64_t arg;
+    uint32_t type;
+    // Index of the ring, filled by dumping.
+    int32_t ring;
+};
+
+// Fixed-size ring of events written by one worker, older events are
+// overwritten. Readers never block the writer, events overwritten during
+// reading are discarded instead.
+class SchedTraceRing {
+public:
+    explicit SchedTraceRing(int id);
+    ~SchedTraceRing();
+
+    // Returns 0 on success, -1 otherwise.
+    int init(size_t capacity);
+
+    // Called by one writer at a time.
+    void record(const SchedTraceEvent& e) {
+        const uint64_t pos = _pos.load(eabase::memory_order_relaxed);
+        _events[pos & _mask] = e;
+        _pos.store(pos + 1, eabase::memory_order_release);
+    }
+
+    // Append events still in the ring to `out', oldest first.
+    void snapshot(std::vector<SchedTraceEvent>* out) const;
+
+    int id() const { return _id; }
+
+    // Name of the track in dumped traces.
+    std::string name;
+    // The fiber running the scheduling loop of the worker.
+    fiber_t main_tid;
+
+private:
+    EA_DISALLOW_COPY_AND_ASSIGN(SchedTraceRing);
+
+    const int _id;
+    uint64_t _mask;
+    SchedTraceEvent* _events;
+    eabase::atomic<uint64_t> _pos;
+};
+
+// Get a ring for the worker of `tag' whose scheduling loop runs in
+// `main_tid', rings of quitted workers are reused. Returns NULL on error.
+SchedTraceRing* acquire_sched_trace_ring(fiber_tag_t tag, fiber_t main_tid);
+// Give back the ring got from acquire_sched_trace_ring(). Events recorded
+// are kept until they're overwritten by the next user.
+void release_sched_trace_ring(SchedTraceRing* ring);
+
+// Out-of-line part of trace_sched_event().
+void record_sched_event(SchedTraceEventType type, fiber_t tid, uint64_t arg);
+
+// Record an event into the ring of the calling worker, or into the ring
+// shared by non-worker pthreads. Costs one flag test when -fiber_trace is
+// off.
+inline void trace_sched_event(SchedTraceEventType type, fiber_t tid,
+                              uint64_t arg = 0) {
+    if (__builtin_expect(FLAGS_fiber_trace, 0)) {
+        record_sched_event(type, tid, arg);
+    }
+}
+
+// Write events recorded within [begin_us, end_us] of monotonic_time_us()
+// into `os' in the JSON format of Chrome trace events, which is loadable
+// by chrome://tracing as well as https://ui.perfetto.dev. Every worker is
+// a track in which runs of fibers and parking are complete events, other
+// events are instant ones.
+// Returns 0 on success, -1 otherwise.
+int dump_sched_trace(std::ostream& os, int64_t begin_us, int64_t end_us);
+
+}  // namespace eabase
+
+#endif  // FIBER_SCHED_TRACE_H_
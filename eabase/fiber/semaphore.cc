@@ -0,0 +1,118 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#include <errno.h>
+#include <limits.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/fiber/butex.h"                       // butex_*
+#include "eabase/fiber/fiber.h"
+
+namespace eabase {
+
+inline eabase::atomic<int>* sem_value(fiber_sem_t* sem) {
+    return (eabase::atomic<int>*)sem->butex;
+}
+
+inline eabase::atomic<int>* sem_nwaiter(fiber_sem_t* sem) {
+    return (eabase::atomic<int>*)&sem->nwaiter;
+}
+
+// Take a permit if there's one, with a single CAS when not contended.
+inline bool sem_try_take(eabase::atomic<int>* value) {
+    int num = value->load(eabase::memory_order_relaxed);
+    while (num > 0) {
+        if (value->compare_exchange_weak(num, num - 1,
+                                         eabase::memory_order_acquire,
+                                         eabase::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int sem_wait_impl(fiber_sem_t* sem, const timespec* abstime) {
+    eabase::atomic<int>* value = sem_value(sem);
+    if (sem_try_take(value)) {
+        return 0;
+    }
+    eabase::atomic<int>* nwaiter = sem_nwaiter(sem);
+    // Either the poster sees us or we see the permit.
+    nwaiter->fetch_add(1, eabase::memory_order_seq_cst);
+    int rc = 0;
+    while (!sem_try_take(value)) {
+        if (butex_wait(value, 0, abstime) < 0 &&
+            errno != EWOULDBLOCK && errno != EINTR) {
+            rc = errno;
+            break;
+        }
+    }
+    nwaiter->fetch_sub(1, eabase::memory_order_relaxed);
+    return rc;
+}
+
+}  // namespace eabase
+
+extern "C" {
+
+int fiber_sem_init(fiber_sem_t* sem, unsigned value) {
+    if (value > (unsigned)INT_MAX) {
+        return EINVAL;
+    }
+    sem->butex = eabase::butex_create_checked<unsigned>();
+    if (!sem->butex) {
+        return ENOMEM;
+    }
+    *sem->butex = value;
+    sem->nwaiter = 0;
+    return 0;
+}
+
+int fiber_sem_destroy(fiber_sem_t* sem) {
+    eabase::butex_destroy(sem->butex);
+    sem->butex = NULL;
+    return 0;
+}
+
+int fiber_sem_trywait(fiber_sem_t* sem) {
+    return eabase::sem_try_take(eabase::sem_value(sem)) ? 0 : EAGAIN;
+}
+
+int fiber_sem_wait(fiber_sem_t* sem) {
+    return eabase::sem_wait_impl(sem, NULL);
+}
+
+int fiber_sem_timedwait(fiber_sem_t* __restrict sem,
+                        const struct timespec* __restrict abstime) {
+    return eabase::sem_wait_impl(sem, abstime);
+}
+
+int fiber_sem_post_n(fiber_sem_t* sem, unsigned n) {
+    if (n == 0) {
+        return 0;
+    }
+    eabase::atomic<int>* value = eabase::sem_value(sem);
+    value->fetch_add(n, eabase::memory_order_seq_cst);
+    if (eabase::sem_nwaiter(sem)->load(eabase::memory_order_seq_cst) > 0) {
+        eabase::butex_wake_n(value, n);
+    }
+    return 0;
+}
+
+int fiber_sem_post(fiber_sem_t* sem) {
+    return fiber_sem_post_n(sem, 1);
+}
+
+}  // extern "C"
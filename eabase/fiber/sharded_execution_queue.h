@@ -0,0 +1,151 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#ifndef FIBER_SHARDED_EXECUTION_QUEUE_H_
+#define FIBER_SHARDED_EXECUTION_QUEUE_H_
+
+#include <algorithm>                              // std::max
+#include <memory>
+#include <vector>
+#include "eabase/utility/strings/string_piece.h"  // eabase::StringPiece
+#include "eabase/var/var.h"                       // eabase::Adder
+#include "eabase/fiber/execution_queue.h"
+
+namespace eabase {
+
+struct ShardedExecutionQueueOptions {
+    ShardedExecutionQueueOptions();
+
+    // Number of internal ExecutionQueues. 0 means the concurrency of
+    // |fiber_tag|, or fiber_getconcurrency() when the tag is not set.
+    // default: 0
+    size_t num_shards;
+
+    // Tag of the workers which consumers of all shards run on, overriding
+    // queue_options.fiber_attr.tag when it's not FIBER_TAG_INVALID.
+    // default: FIBER_TAG_INVALID
+    fiber_tag_t fiber_tag;
+
+    // Options of each shard. Note that queue_options.capacity limits every
+    // shard rather than the sum of them.
+    ExecutionQueueOptions queue_options;
+};
+
+struct ShardedExecutionQueueStats {
+    // Tasks accepted by all shards.
+    int64_t task_count;
+    // Tasks failed to be executed into any shard, e.g. rejected by a full
+    // shard.
+    int64_t rejected_count;
+    // Tasks accepted by each shard.
+    std::vector<int64_t> shard_task_count;
+};
+
+// Hash keys onto a fixed number of ExecutionQueues whose consumers run in
+// parallel. Tasks with the same key are executed in the FIFO order while
+// tasks with different keys may not, namely the ordering is kept per key
+// rather than globally.
+//
+// |execute| is shared by all shards and may be called concurrently by
+// consumers of different shards, but never concurrently for tasks of the
+// same key. It's called with TaskIterator::is_queue_stopped() being true
+// exactly once, after all shards are stopped and drained.
+//
+// Examples:
+//   eabase::ShardedExecutionQueue<Request> q;
+//   CHECK_EQ(0, q.start(NULL, handle_requests, &ctx));
+//   q.execute(request.user_id, request);
+//   ...
+//   q.stop();
+//   q.join();
+template <typename T>
+class ShardedExecutionQueue {
+public:
+    typedef int (*execute_func_t)(void* meta, TaskIterator<T>& iter);
+
+    ShardedExecutionQueue();
+    // Stop and join the queue if it's still running.
+    ~ShardedExecutionQueue();
+
+    // Start all the shards. If |options| is NULL, the queue will be created
+    // with the default options.
+    // Returns 0 on success, errno otherwise.
+    int start(const ShardedExecutionQueueOptions* options,
+              execute_func_t execute, void* meta);
+
+    // Stop all the shards, see execution_queue_stop().
+    // Returns 0 on success, errno otherwise.
+    int stop();
+
+    // Wait until all the shards are stopped and drained.
+    // Returns 0 on success, errno otherwise.
+    int join();
+
+    size_t shard_count() const { return _shards.size(); }
+
+    // Index of the shard that tasks of |key| go to.
+    size_t shard_of(uint64_t key) const;
+
+    // Execute |task| on the shard of |key|. TaskOptions.high_priority puts
+    // the task before pending normal tasks of the same shard, and
+    // TaskOptions.in_place_if_possible works as in ExecutionQueue.
+    // Keys of other types should be hashed into uint64_t by users.
+    // Returns what execution_queue_execute() returns.
+    int execute(uint64_t key,
+                typename eabase::add_const_reference<T>::type task,
+                const TaskOptions* options = NULL,
+                TaskHandle* handle = NULL);
+
+    int execute(uint64_t key, T&& task,
+                const TaskOptions* options = NULL,
+                TaskHandle* handle = NULL);
+
+    // Id of the |index|-th shard.
+    ExecutionQueueId<T> shard(size_t index) const { return _shards[index]; }
+
+    void get_stats(ShardedExecutionQueueStats* stats) const;
+
+    // Expose the stats as vars: <prefix>_task_count, <prefix>_rejected_count
+    // and <prefix>_shard_imbalance which is the ratio of tasks of the
+    // busiest shard to the average.
+    // Returns 0 on success, -1 otherwise.
+    int expose(const eabase::StringPiece& prefix);
+
+private:
+    EA_DISALLOW_COPY_AND_ASSIGN(ShardedExecutionQueue);
+
+    static int execute_shard(void* meta, TaskIterator<T>& iter);
+    static int64_t get_task_count(void* arg);
+    static double get_shard_imbalance(void* arg);
+
+    std::vector<ExecutionQueueId<T> > _shards;
+    execute_func_t _execute;
+    void* _meta;
+    // Shards which are not stopped and drained yet.
+    eabase::atomic<int> _nrunning;
+    bool _stopped;
+    bool _joined;
+    std::unique_ptr<eabase::Adder<int64_t>[]> _shard_task_count;
+    eabase::Adder<int64_t> _rejected_count;
+    eabase::PassiveStatus<int64_t> _task_count_var;
+    eabase::PassiveStatus<double> _shard_imbalance_var;
+};
+
+}  // namespace eabase
+
+#include "eabase/fiber/sharded_execution_queue_inl.h"
+
+#endif  // FIBER_SHARDED_EXECUTION_QUEUE_H_
@@ -0,0 +1,221 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#ifndef FIBER_SHARDED_EXECUTION_QUEUE_INL_H_
+#define FIBER_SHARDED_EXECUTION_QUEUE_INL_H_
+
+#include "eabase/utility/errno.h"                         // berror
+#include "eabase/utility/third_party/murmurhash3/murmurhash3.h"  // fmix64
+
+namespace eabase {
+
+inline ShardedExecutionQueueOptions::ShardedExecutionQueueOptions()
+    : num_shards(0)
+    , fiber_tag(FIBER_TAG_INVALID)
+{}
+
+template <typename T>
+ShardedExecutionQueue<T>::ShardedExecutionQueue()
+    : _execute(NULL)
+    , _meta(NULL)
+    , _nrunning(0)
+    , _stopped(false)
+    , _joined(false)
+    , _task_count_var(get_task_count, this)
+    , _shard_imbalance_var(get_shard_imbalance, this)
+{}
+
+template <typename T>
+ShardedExecutionQueue<T>::~ShardedExecutionQueue() {
+    if (!_shards.empty()) {
+        stop();
+        join();
+    }
+}
+
+template <typename T>
+int ShardedExecutionQueue<T>::start(
+        const ShardedExecutionQueueOptions* options,
+        execute_func_t execute, void* meta) {
+    if (execute == NULL || !_shards.empty()) {
+        return EINVAL;
+    }
+    ShardedExecutionQueueOptions opt;
+    if (options) {
+        opt = *options;
+    }
+    if (opt.fiber_tag != FIBER_TAG_INVALID) {
+        opt.queue_options.fiber_attr.tag = opt.fiber_tag;
+    }
+    size_t nshard = opt.num_shards;
+    if (nshard == 0) {
+        const int concurrency = (opt.fiber_tag != FIBER_TAG_INVALID ?
+                                 fiber_getconcurrency_by_tag(opt.fiber_tag) :
+                                 fiber_getconcurrency());
+        nshard = (concurrency > 0 ? concurrency : 1);
+    }
+    _execute = execute;
+    _meta = meta;
+    _stopped = false;
+    _joined = false;
+    _shard_task_count.reset(new eabase::Adder<int64_t>[nshard]);
+    _nrunning.store(nshard, eabase::memory_order_relaxed);
+    _shards.reserve(nshard);
+    for (size_t i = 0; i < nshard; ++i) {
+        ExecutionQueueId<T> id = { 0 };
+        const int rc = execution_queue_start(
+            &id, &opt.queue_options, execute_shard, this);
+        if (rc != 0) {
+            LOG(ERROR) << "Fail to start shard " << i << " of " << nshard
+                       << ": " << berror(rc);
+            // Stop tasks of shards never started are regarded as done so
+            // that |execute| still sees exactly one of them.
+            _nrunning.fetch_sub(nshard - i, eabase::memory_order_relaxed);
+            stop();
+            join();
+            _shards.clear();
+            return rc;
+        }
+        _shards.push_back(id);
+    }
+    return 0;
+}
+
+template <typename T>
+int ShardedExecutionQueue<T>::stop() {
+    if (_stopped) {
+        return 0;
+    }
+    _stopped = true;
+    int rc = 0;
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        const int rc2 = execution_queue_stop(_shards[i]);
+        if (rc == 0) {
+            rc = rc2;
+        }
+    }
+    return rc;
+}
+
+template <typename T>
+int ShardedExecutionQueue<T>::join() {
+    if (_joined) {
+        return 0;
+    }
+    _joined = true;
+    int rc = 0;
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        const int rc2 = execution_queue_join(_shards[i]);
+        if (rc == 0) {
+            rc = rc2;
+        }
+    }
+    return rc;
+}
+
+template <typename T>
+inline size_t ShardedExecutionQueue<T>::shard_of(uint64_t key) const {
+    // Mix the key so that sequential keys spread evenly.
+    return eabase::fmix64(key) % _shards.size();
+}
+
+template <typename T>
+inline int ShardedExecutionQueue<T>::execute(
+        uint64_t key,
+        typename eabase::add_const_reference<T>::type task,
+        const TaskOptions* options, TaskHandle* handle) {
+    return execute(key, std::forward<T>(const_cast<T&>(task)),
+                   options, handle);
+}
+
+template <typename T>
+inline int ShardedExecutionQueue<T>::execute(
+        uint64_t key, T&& task,
+        const TaskOptions* options, TaskHandle* handle) {
+    if (_shards.empty()) {
+        return EINVAL;
+    }
+    const size_t index = shard_of(key);
+    const int rc = execution_queue_execute(
+        _shards[index], std::forward<T>(task), options, handle);
+    if (rc == 0) {
+        _shard_task_count[index] << 1;
+    } else {
+        _rejected_count << 1;
+    }
+    return rc;
+}
+
+template <typename T>
+void ShardedExecutionQueue<T>::get_stats(
+        ShardedExecutionQueueStats* stats) const {
+    stats->task_count = 0;
+    stats->rejected_count = _rejected_count.get_value();
+    stats->shard_task_count.resize(_shards.size());
+    for (size_t i = 0; i < _shards.size(); ++i) {
+        stats->shard_task_count[i] = _shard_task_count[i].get_value();
+        stats->task_count += stats->shard_task_count[i];
+    }
+}
+
+template <typename T>
+int ShardedExecutionQueue<T>::expose(const eabase::StringPiece& prefix) {
+    if (_task_count_var.expose_as(prefix, "task_count") != 0 ||
+        _rejected_count.expose_as(prefix, "rejected_count") != 0 ||
+        _shard_imbalance_var.expose_as(prefix, "shard_imbalance") != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+template <typename T>
+int ShardedExecutionQueue<T>::execute_shard(void* meta,
+                                            TaskIterator<T>& iter) {
+    ShardedExecutionQueue* q = static_cast<ShardedExecutionQueue*>(meta);
+    if (iter.is_queue_stopped()) {
+        // Only the last drained shard passes the stop task on.
+        if (q->_nrunning.fetch_sub(1, eabase::memory_order_acq_rel) != 1) {
+            return 0;
+        }
+    }
+    return q->_execute(q->_meta, iter);
+}
+
+template <typename T>
+int64_t ShardedExecutionQueue<T>::get_task_count(void* arg) {
+    ShardedExecutionQueueStats stats;
+    static_cast<ShardedExecutionQueue*>(arg)->get_stats(&stats);
+    return stats.task_count;
+}
+
+template <typename T>
+double ShardedExecutionQueue<T>::get_shard_imbalance(void* arg) {
+    ShardedExecutionQueueStats stats;
+    static_cast<ShardedExecutionQueue*>(arg)->get_stats(&stats);
+    if (stats.task_count == 0) {
+        return 0;
+    }
+    int64_t max_count = 0;
+    for (size_t i = 0; i < stats.shard_task_count.size(); ++i) {
+        max_count = std::max(max_count, stats.shard_task_count[i]);
+    }
+    return (double)max_count * stats.shard_task_count.size()
+        / stats.task_count;
+}
+
+}  // namespace eabase
+
+#endif  // FIBER_SHARDED_EXECUTION_QUEUE_INL_H_
@@ -18,13 +18,19 @@
 #include <sys/mman.h>                             // mmap, munmap, mprotect
 #include <algorithm>                              // std::max
 #include <stdlib.h>                               // posix_memalign
+#include <pthread.h>
+#include <vector>
 #include "eabase/utility/macros.h"                          // BAIDU_CASSERT
 #include "eabase/utility/memory/singleton_on_pthread_once.h"
+#include "eabase/utility/scoped_lock.h"                    // BAIDU_SCOPED_LOCK
+#include "eabase/utility/thread_local.h"                   // BAIDU_THREAD_LOCAL
 #include "eabase/utility/third_party/dynamic_annotations/dynamic_annotations.h" // RunningOnValgrind
 #include "eabase/utility/third_party/valgrind/valgrind.h"   // VALGRIND_STACK_REGISTER
+#include "eabase/utility/third_party/murmurhash3/murmurhash3.h" // fmix64
 #include "eabase/var/passive_status.h"
 #include "eabase/fiber/types.h"
 #include "eabase/fiber/stack.h"
+#include "eabase/fiber/numa.h"
 
 DEFINE_int32(stack_size_small, 32768, "size of small stacks");
 DEFINE_int32(stack_size_normal, 1048576, "size of normal stacks");
@@ -32,6 +38,48 @@ DEFINE_int32(stack_size_large, 8388608, "size of large stacks");
 DEFINE_int32(guard_page_size, 4096, "size of guard page, allocate stacks by malloc if it's 0(not recommended)");
 DEFINE_int32(tc_stack_small, 32, "maximum small stacks cached by each thread");
 DEFINE_int32(tc_stack_normal, 8, "maximum normal stacks cached by each thread");
+DEFINE_bool(fiber_numa_local_stack, false, "Allocate stacks from memory of "
+            "the NUMA node that the allocating worker belongs to, "
+            "effective only with -fiber_numa_aware");
+
+DEFINE_bool(fiber_stack_huge_page, false, "Allocate stacks from 2MB "
+            "aligned regions advised with MADV_HUGEPAGE to save TLB misses. "
+            "Stacks not smaller than a huge page get regions of their own "
+            "with guard pages kept right below them. Smaller ones are "
+            "carved out of shared regions only when they have no guard "
+            "pages (-guard_page_size=0), since a guard page splits the huge "
+            "page shared with neighbours. Otherwise they're allocated as "
+            "usual");
+DEFINE_int32(fiber_stack_prefault_count, 0, "Normal stacks created and "
+             "pre-faulted before workers start, so that the first burst of "
+             "fibers does not pay page faults");
+DEFINE_int32(fiber_stack_prefault_bytes, 65536, "Bytes at the top of each "
+             "pre-faulted stack that are touched");
+
+static bool pass_bool(const char*, bool) { return true; }
+
+DEFINE_bool(fiber_stack_profile, false, "Measure how deep fiber stacks are "
+            "used when fibers quit and show histograms of each stack class "
+            "in /vars/fiber_stack_usage_<class>. Stacks are painted with a "
+            "pattern and mincore() skips the pages never touched");
+const bool ALLOW_UNUSED dummy_fiber_stack_profile =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_stack_profile, pass_bool);
+DEFINE_int32(fiber_stack_profile_interval, 16, "Paint the stack at one of "
+             "so many fiber exits in each worker, the next fiber quitting on "
+             "a painted stack is measured. Painting and measuring scan the "
+             "resident part of the stack, which may be the whole stack with "
+             "-fiber_stack_huge_page or -fiber_stack_prefault_count");
+DEFINE_bool(fiber_stack_auto_class, false, "Fibers created with "
+            "FIBER_STACKTYPE_NORMAL get the smallest stack class that fits "
+            "the observed stack usage of their entry functions plus "
+            "-fiber_stack_auto_class_headroom. Implies -fiber_stack_profile");
+const bool ALLOW_UNUSED dummy_fiber_stack_auto_class =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_stack_auto_class,
+                                       pass_bool);
+DEFINE_int32(fiber_stack_auto_class_min_samples, 64, "Entry functions "
+             "observed quitting fewer times than this keep the normal stack");
+DEFINE_int32(fiber_stack_auto_class_headroom, 100, "Percent of the max "
+             "observed stack usage added before choosing a stack class");
 
 namespace eabase {
 
@@ -50,6 +98,110 @@ namespace eabase {
     static eabase::PassiveStatus<int64_t> var_stack_count(
             "fiber_stack_count", get_stack_count, NULL);
 
+    static const size_t HUGE_PAGE_SIZE = 2UL * 1024 * 1024;
+    // Size of regions shared by stacks smaller than a huge page.
+    static const size_t HUGE_PAGE_REGION_SIZE = 16 * HUGE_PAGE_SIZE;
+
+    static pthread_mutex_t s_huge_page_region_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static char *s_huge_page_region_cur = NULL;
+    static char *s_huge_page_region_end = NULL;
+
+    // Map `len' bytes whose end is aligned by HUGE_PAGE_SIZE.
+    // Returns the beginning of the memory, NULL on error.
+    static char *map_huge_page_aligned(size_t len) {
+        const size_t memsize = len + HUGE_PAGE_SIZE;
+        char *const mem = (char *) mmap(NULL, memsize, (PROT_READ | PROT_WRITE),
+                                        (MAP_PRIVATE | MAP_ANONYMOUS), -1, 0);
+        if (MAP_FAILED == mem) {
+            PLOG_EVERY_SECOND(ERROR)
+                    << "Fail to mmap size=" << memsize << " stack_count="
+                    << s_stack_count.load(eabase::memory_order_relaxed)
+                    << ", possibly limited by /proc/sys/vm/max_map_count";
+            return NULL;
+        }
+        char *const end = (char *) ((uintptr_t) (mem + memsize) &
+                                    ~(uintptr_t) (HUGE_PAGE_SIZE - 1));
+        char *const begin = end - len;
+        // Trim both sides.
+        if (begin != mem) {
+            munmap(mem, begin - mem);
+        }
+        if (end != mem + memsize) {
+            munmap(end, mem + memsize - end);
+        }
+        return begin;
+    }
+
+    static void advise_huge_page(void *mem, size_t len) {
+#ifdef MADV_HUGEPAGE
+        if (madvise(mem, len, MADV_HUGEPAGE) != 0) {
+            PLOG_FIRST_N(WARNING, 1) << "Fail to madvise MADV_HUGEPAGE, is "
+                                  "transparent huge page disabled?";
+        }
+#else
+        (void) mem;
+        (void) len;
+#endif
+    }
+
+    // Allocate a stack of aligned `stacksize' whose top is aligned by
+    // HUGE_PAGE_SIZE. Stacks smaller than HUGE_PAGE_SIZE must have no guard
+    // and are carved out of shared regions.
+    static int allocate_huge_page_stack_storage(StackStorage *s, int stacksize,
+                                                int guardsize) {
+        char *bottom = NULL;
+        if ((size_t) stacksize < HUGE_PAGE_SIZE) {
+            guardsize = 0;
+            BAIDU_SCOPED_LOCK(s_huge_page_region_mutex);
+            if (s_huge_page_region_cur == NULL ||
+                s_huge_page_region_cur + stacksize > s_huge_page_region_end) {
+                char *const region = map_huge_page_aligned(HUGE_PAGE_REGION_SIZE);
+                if (region == NULL) {
+                    return -1;
+                }
+                advise_huge_page(region, HUGE_PAGE_REGION_SIZE);
+                s_huge_page_region_cur = region;
+                s_huge_page_region_end = region + HUGE_PAGE_REGION_SIZE;
+            }
+            s_huge_page_region_cur += stacksize;
+            bottom = s_huge_page_region_cur;
+        } else {
+            // The huge page holding the guard is split, the ones of the stack
+            // are not when stacksize is a multiple of HUGE_PAGE_SIZE.
+            char *const mem = map_huge_page_aligned(stacksize + guardsize);
+            if (mem == NULL) {
+                return -1;
+            }
+            if (mprotect(mem, guardsize, PROT_NONE) != 0) {
+                munmap(mem, stacksize + guardsize);
+                PLOG_EVERY_SECOND(ERROR) << "Fail to mprotect " << (void *) mem
+                                         << " length=" << guardsize;
+                return -1;
+            }
+            advise_huge_page(mem + guardsize, stacksize);
+            bottom = mem + guardsize + stacksize;
+        }
+        const int numa_node = numa_local_node();
+        if (FLAGS_fiber_numa_local_stack && numa_node >= 0 &&
+            numa_bind_memory(bottom - stacksize, stacksize, numa_node) != 0) {
+            PLOG_EVERY_SECOND(WARNING) << "Fail to bind stack to numa node="
+                                       << numa_node;
+        }
+        s_stack_count.fetch_add(1, eabase::memory_order_relaxed);
+        s->bottom = bottom;
+        s->stacksize = stacksize;
+        s->guardsize = guardsize;
+        s->painted = false;
+        s->carved = (guardsize == 0);
+        if (RunningOnValgrind()) {
+            s->valgrind_stack_id = VALGRIND_STACK_REGISTER(
+                    s->bottom, (char *) s->bottom - stacksize);
+        } else {
+            s->valgrind_stack_id = 0;
+        }
+        return 0;
+    }
+
     int allocate_stack_storage(StackStorage *s, int stacksize_in, int guardsize_in) {
         const static int PAGESIZE = getpagesize();
         const int PAGESIZE_M1 = PAGESIZE - 1;
@@ -61,6 +213,17 @@ namespace eabase {
                 (std::max(stacksize_in, MIN_STACKSIZE) + PAGESIZE_M1) &
                 ~PAGESIZE_M1;
 
+        // Stacks smaller than a huge page share huge pages with neighbours,
+        // which would be split by guard pages. Such stacks are carved only
+        // when they have no guard, otherwise they keep guard pages and are
+        // allocated as usual.
+        if (FLAGS_fiber_stack_huge_page &&
+            ((size_t) stacksize >= HUGE_PAGE_SIZE || guardsize_in <= 0)) {
+            const int guardsize =
+                    (std::max(guardsize_in, MIN_GUARDSIZE) + PAGESIZE_M1) &
+                    ~PAGESIZE_M1;
+            return allocate_huge_page_stack_storage(s, stacksize, guardsize);
+        }
         if (guardsize_in <= 0) {
             void *mem = malloc(stacksize);
             if (NULL == mem) {
@@ -72,6 +235,8 @@ namespace eabase {
             s->bottom = (char *) mem + stacksize;
             s->stacksize = stacksize;
             s->guardsize = 0;
+            s->painted = false;
+            s->carved = false;
             if (RunningOnValgrind()) {
                 s->valgrind_stack_id = VALGRIND_STACK_REGISTER(
                         s->bottom, (char *) s->bottom - stacksize);
@@ -112,11 +277,19 @@ namespace eabase {
                         << guardsize - offset;
                 return -1;
             }
+            const int numa_node = numa_local_node();
+            if (FLAGS_fiber_numa_local_stack && numa_node >= 0 &&
+                numa_bind_memory(aligned_mem, memsize - offset, numa_node) != 0) {
+                PLOG_EVERY_SECOND(WARNING) << "Fail to bind stack to numa node="
+                                           << numa_node;
+            }
 
             s_stack_count.fetch_add(1, eabase::memory_order_relaxed);
             s->bottom = (char *) mem + memsize;
             s->stacksize = stacksize;
             s->guardsize = guardsize;
+            s->painted = false;
+            s->carved = false;
             if (RunningOnValgrind()) {
                 s->valgrind_stack_id = VALGRIND_STACK_REGISTER(
                         s->bottom, (char *) s->bottom - stacksize);
@@ -136,6 +309,10 @@ namespace eabase {
             return;
         }
         s_stack_count.fetch_sub(1, eabase::memory_order_relaxed);
+        if (s->carved) {
+            // Shared regions are never unmapped.
+            return;
+        }
         if (s->guardsize <= 0) {
             free((char *) s->bottom - memsize);
         } else {
@@ -143,6 +320,229 @@ namespace eabase {
         }
     }
 
+    // Pattern filling unused part of profiled stacks. Bytes are different
+    // so that the painting loop is not turned into memset.
+    static const uint64_t STACK_PAINT = 0x5a17ed57ac4c0de5ULL;
+    // Bytes below the frame of profile_stack_usage() that are never painted,
+    // which cover the frame itself and the callees.
+    static const int STACK_PROFILE_MARGIN = 4096;
+    static const int STACK_USAGE_NBUCKET = 16;
+    static const size_t STACK_USAGE_NSLOT = 1024;
+    static const size_t STACK_USAGE_MAX_PROBE = 16;
+
+    struct StackUsageHistogram {
+        // Bucket i counts usages in (2^(i+11), 2^(i+12)] bytes, namely the
+        // first one is for usages not greater than 4KB.
+        eabase::atomic<int64_t> buckets[STACK_USAGE_NBUCKET];
+        eabase::atomic<int64_t> max_usage;
+    };
+
+    // Observed stack usages of an entry function.
+    struct StackUsageSlot {
+        eabase::atomic<void*> fn;
+        eabase::atomic<int> max_usage;
+        eabase::atomic<int> nsample;
+    };
+
+    // Indexed by StackType.
+    static StackUsageHistogram s_stack_usage[STACK_TYPE_LARGE + 1];
+    static StackUsageSlot s_stack_usage_slots[STACK_USAGE_NSLOT];
+
+    static void atomic_max(eabase::atomic<int64_t>* v, int64_t x) {
+        int64_t cur = v->load(eabase::memory_order_relaxed);
+        while (x > cur && !v->compare_exchange_weak(
+                   cur, x, eabase::memory_order_relaxed)) {}
+    }
+
+    static StackUsageSlot* find_stack_usage_slot(void* fn, bool create) {
+        size_t index = eabase::fmix64((uint64_t)fn) & (STACK_USAGE_NSLOT - 1);
+        for (size_t i = 0; i < STACK_USAGE_MAX_PROBE; ++i) {
+            StackUsageSlot* slot = &s_stack_usage_slots[index];
+            void* cur = slot->fn.load(eabase::memory_order_acquire);
+            if (cur == fn) {
+                return slot;
+            }
+            if (cur == NULL) {
+                if (!create) {
+                    return NULL;
+                }
+                if (slot->fn.compare_exchange_strong(
+                        cur, fn, eabase::memory_order_acq_rel) || cur == fn) {
+                    return slot;
+                }
+            }
+            index = (index + 1) & (STACK_USAGE_NSLOT - 1);
+        }
+        // Table is crowded, the function is not profiled.
+        return NULL;
+    }
+
+    static void record_stack_usage(StackType type, void* fn, int usage) {
+        StackUsageHistogram& h = s_stack_usage[type];
+        int bucket = 0;
+        while (bucket + 1 < STACK_USAGE_NBUCKET && usage > (4096 << bucket)) {
+            ++bucket;
+        }
+        h.buckets[bucket].fetch_add(1, eabase::memory_order_relaxed);
+        atomic_max(&h.max_usage, usage);
+        StackUsageSlot* slot = find_stack_usage_slot(fn, true);
+        if (slot != NULL) {
+            int cur = slot->max_usage.load(eabase::memory_order_relaxed);
+            while (usage > cur && !slot->max_usage.compare_exchange_weak(
+                       cur, usage, eabase::memory_order_relaxed)) {}
+            slot->nsample.fetch_add(1, eabase::memory_order_relaxed);
+        }
+    }
+
+    // Fiber exits in this thread since a stack was painted.
+    static BAIDU_THREAD_LOCAL int tls_nexit_since_paint = 0;
+
+    void __attribute__((noinline))
+    profile_stack_usage(ContextualStack* s, void* (*fn)(void*)) {
+        if (s == NULL || (s->stacktype != STACK_TYPE_SMALL &&
+                          s->stacktype != STACK_TYPE_NORMAL &&
+                          s->stacktype != STACK_TYPE_LARGE)) {
+            return;
+        }
+        const bool paint =
+            (++tls_nexit_since_paint >= FLAGS_fiber_stack_profile_interval);
+        if (!s->storage.painted && !paint) {
+            return;
+        }
+        const static int PAGESIZE = getpagesize();
+        char* const bottom = (char*)s->storage.bottom;
+        char* const low = (char*)(((uintptr_t)bottom - s->storage.stacksize
+                                   + PAGESIZE - 1) & ~(uintptr_t)(PAGESIZE - 1));
+        // Everything below is dead as the frames of fn are gone.
+        char* const limit = (char*)(((uintptr_t)__builtin_frame_address(0)
+                                     - STACK_PROFILE_MARGIN) & ~(uintptr_t)7);
+        if (limit <= low) {
+            return;
+        }
+        // Pages never touched are not resident and not painted either,
+        // find the deepest touched one.
+        char* first_resident = limit;
+        unsigned char vec[256];
+        for (char* p = low; p < limit; p += sizeof(vec) * PAGESIZE) {
+            const size_t len = std::min((size_t)(limit - p),
+                                        sizeof(vec) * PAGESIZE);
+            if (mincore(p, len, vec) != 0) {
+                return;
+            }
+            const size_t npage = (len + PAGESIZE - 1) / PAGESIZE;
+            size_t i = 0;
+            for (; i < npage && !(vec[i] & 1); ++i) {}
+            if (i < npage) {
+                first_resident = p + i * PAGESIZE;
+                break;
+            }
+        }
+        uint64_t* w = (uint64_t*)first_resident;
+        uint64_t* const end = (uint64_t*)limit;
+        // Only measurements on painted stacks are accurate. Fibers running
+        // on the stack later without being measured leave garbage, so the
+        // stack is not painted anymore unless it's repainted below.
+        if (s->storage.painted) {
+            for (; w < end && *w == STACK_PAINT; ++w) {}
+            record_stack_usage(s->stacktype, (void*)fn,
+                               bottom - (char*)w);
+            s->storage.painted = false;
+        }
+        if (!paint) {
+            return;
+        }
+        tls_nexit_since_paint = 0;
+        // Below `w' is still painted if it was just measured.
+        for (; w < end; ++w) {
+            *w = STACK_PAINT;
+        }
+        s->storage.painted = true;
+    }
+
+    StackType suggest_stack_type(void* (*fn)(void*)) {
+        StackUsageSlot* slot = find_stack_usage_slot((void*)fn, false);
+        if (slot == NULL || slot->nsample.load(eabase::memory_order_relaxed)
+            < FLAGS_fiber_stack_auto_class_min_samples) {
+            return STACK_TYPE_NORMAL;
+        }
+        const int64_t required =
+            (int64_t)slot->max_usage.load(eabase::memory_order_relaxed) *
+            (100 + std::max(FLAGS_fiber_stack_auto_class_headroom, 0)) / 100;
+        if (required <= FLAGS_stack_size_small) {
+            return STACK_TYPE_SMALL;
+        }
+        if (required <= FLAGS_stack_size_normal) {
+            return STACK_TYPE_NORMAL;
+        }
+        return STACK_TYPE_LARGE;
+    }
+
+    static void print_stack_usage(std::ostream& os, void* arg) {
+        const StackUsageHistogram& h = s_stack_usage[(intptr_t)arg];
+        bool first = true;
+        for (int i = 0; i < STACK_USAGE_NBUCKET; ++i) {
+            const int64_t n = h.buckets[i].load(eabase::memory_order_relaxed);
+            if (n == 0) {
+                continue;
+            }
+            if (!first) {
+                os << ' ';
+            }
+            first = false;
+            os << (i + 1 < STACK_USAGE_NBUCKET ? "<=" : ">")
+               << (4 << (i + 1 < STACK_USAGE_NBUCKET ? i : i - 1)) << "K:" << n;
+        }
+    }
+
+    static int64_t get_max_stack_usage(void* arg) {
+        return s_stack_usage[(intptr_t)arg].max_usage.load(
+            eabase::memory_order_relaxed);
+    }
+
+    static eabase::PassiveStatus<std::string> var_stack_usage_small(
+        "fiber_stack_usage_small", print_stack_usage,
+        (void*)(intptr_t)STACK_TYPE_SMALL);
+    static eabase::PassiveStatus<std::string> var_stack_usage_normal(
+        "fiber_stack_usage_normal", print_stack_usage,
+        (void*)(intptr_t)STACK_TYPE_NORMAL);
+    static eabase::PassiveStatus<std::string> var_stack_usage_large(
+        "fiber_stack_usage_large", print_stack_usage,
+        (void*)(intptr_t)STACK_TYPE_LARGE);
+    static eabase::PassiveStatus<int64_t> var_max_stack_usage_small(
+        "fiber_stack_usage_small_max", get_max_stack_usage,
+        (void*)(intptr_t)STACK_TYPE_SMALL);
+    static eabase::PassiveStatus<int64_t> var_max_stack_usage_normal(
+        "fiber_stack_usage_normal_max", get_max_stack_usage,
+        (void*)(intptr_t)STACK_TYPE_NORMAL);
+    static eabase::PassiveStatus<int64_t> var_max_stack_usage_large(
+        "fiber_stack_usage_large_max", get_max_stack_usage,
+        (void*)(intptr_t)STACK_TYPE_LARGE);
+
+    int prefault_stacks(StackType type, int n, void (*entry)(intptr_t)) {
+        const static int PAGESIZE = getpagesize();
+        std::vector<ContextualStack *> stacks;
+        stacks.reserve(n);
+        for (int i = 0; i < n; ++i) {
+            ContextualStack *stk = get_stack(type, entry);
+            if (stk == NULL) {
+                break;
+            }
+            stacks.push_back(stk);
+            char *const bottom = (char *) stk->storage.bottom;
+            char *low = bottom - std::min(stk->storage.stacksize,
+                                          FLAGS_fiber_stack_prefault_bytes);
+            // The initial context is at the top.
+            char *const high = (char *) stk->context - 256;
+            for (char *p = low; p < high; p += PAGESIZE) {
+                *(volatile char *) p = 0;
+            }
+        }
+        for (size_t i = 0; i < stacks.size(); ++i) {
+            return_stack(stacks[i]);
+        }
+        return (int) stacks.size();
+    }
+
     int *SmallStackClass::stack_size_flag = &FLAGS_stack_size_small;
     int *NormalStackClass::stack_size_flag = &FLAGS_stack_size_normal;
     int *LargeStackClass::stack_size_flag = &FLAGS_stack_size_large;
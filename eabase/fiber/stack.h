@@ -21,6 +21,7 @@
 #include <gflags/gflags.h>          // DECLARE_int32
 #include "eabase/fiber/types.h"
 #include "eabase/fiber/context.h"        // fiber_fcontext_t
+#include "eabase/utility/atomicops.h"
 #include "eabase/utility/object_pool.h"
 
 namespace eabase {
@@ -32,6 +33,11 @@ struct StackStorage {
     // http://www.boost.org/doc/libs/1_55_0/libs/context/doc/html/context/stack.html
     void* bottom;
     unsigned valgrind_stack_id;
+    // True when unused part of the stack is painted by profile_stack_usage().
+    bool painted;
+    // True when the stack is carved out of a region shared with other
+    // stacks, which is never unmapped.
+    bool carved;
 
     // Clears all members.
     void zeroize() {
@@ -39,6 +45,8 @@ struct StackStorage {
         guardsize = 0;
         bottom = NULL;
         valgrind_stack_id = 0;
+        painted = false;
+        carved = false;
     }
 };
  
@@ -60,6 +68,11 @@ struct ContextualStack {
     fiber_fcontext_t context;
     StackType stacktype;
     StackStorage storage;
+    // 0 when the stack is in use, -1 when the reclaimer is releasing its
+    // pages, otherwise g_stack_reclaim_clock_us when it was returned.
+    eabase::atomic<int64_t> idle_since_us;
+    // Increased every time the stack is got from the pool.
+    eabase::atomic<uint32_t> generation;
 };
 
 // Get a stack in the `type' and run `entry' at the first time that the
@@ -67,10 +80,23 @@ struct ContextualStack {
 ContextualStack* get_stack(StackType type, void (*entry)(intptr_t));
 // Recycle a stack. NULL does nothing.
 void return_stack(ContextualStack*);
+// Let the stack reclaimer track `s' which is just allocated.
+void register_stack(ContextualStack* s);
+// Create `n' stacks in the `type' running `entry', touch the top
+// -fiber_stack_prefault_bytes of them and return them to the pool.
+// Returns number of stacks pre-faulted.
+int prefault_stacks(StackType type, int n, void (*entry)(intptr_t));
 // Jump from stack `from' to stack `to'. `from' must be the stack of callsite
 // (to save contexts before jumping)
 void jump_stack(ContextualStack* from, ContextualStack* to);
 
+// Record how deep `s' was used by the fiber running `fn' which just quit,
+// called on `s' itself when -fiber_stack_profile is on.
+void profile_stack_usage(ContextualStack* s, void* (*fn)(void*));
+// Stack type for a new fiber running `fn' according to the stack usages
+// recorded by profile_stack_usage(), see -fiber_stack_auto_class.
+StackType suggest_stack_type(void* (*fn)(void*));
+
 }  // namespace eabase
 
 #include "eabase/fiber/stack_inl.h"
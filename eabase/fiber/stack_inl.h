@@ -17,12 +17,44 @@
 #ifndef FIBER_ALLOCATE_STACK_INL_H_
 #define FIBER_ALLOCATE_STACK_INL_H_
 
+#include <sched.h>                                // sched_yield
+
 DECLARE_int32(guard_page_size);
 DECLARE_int32(tc_stack_small);
 DECLARE_int32(tc_stack_normal);
+DECLARE_bool(fiber_stack_profile);
+DECLARE_bool(fiber_stack_auto_class);
+DECLARE_int32(fiber_stack_prefault_count);
 
 namespace eabase {
 
+// Coarse clock stamping stacks returned to pools, ticked by the stack
+// reclaimer. Never 0.
+extern eabase::static_atomic<int64_t> g_stack_reclaim_clock_us;
+
+// Called when `s' is got from the pool.
+inline void mark_stack_in_use(ContextualStack* s) {
+    int64_t idle_since = s->idle_since_us.load(eabase::memory_order_relaxed);
+    // Wait for the reclaimer if it's releasing pages of the stack.
+    while (idle_since < 0 || !s->idle_since_us.compare_exchange_weak(
+               idle_since, 0, eabase::memory_order_acquire,
+               eabase::memory_order_relaxed)) {
+        if (idle_since < 0) {
+            sched_yield();
+            idle_since = s->idle_since_us.load(eabase::memory_order_relaxed);
+        }
+    }
+    s->generation.store(s->generation.load(eabase::memory_order_relaxed) + 1,
+                        eabase::memory_order_relaxed);
+}
+
+// Called before `s' is returned to the pool.
+inline void mark_stack_idle(ContextualStack* s) {
+    s->idle_since_us.store(
+        g_stack_reclaim_clock_us.load(eabase::memory_order_relaxed),
+        eabase::memory_order_release);
+}
+
 struct MainStackClass {};
 
 struct SmallStackClass {
@@ -52,6 +84,10 @@ template <typename StackClass> struct StackFactory {
             }
             context = fiber_make_fcontext(storage.bottom, storage.stacksize, entry);
             stacktype = (StackType)StackClass::stacktype;
+            // In use by the one creating it.
+            idle_since_us.store(0, eabase::memory_order_relaxed);
+            generation.store(0, eabase::memory_order_relaxed);
+            register_stack(this);
         }
         ~Wrapper() {
             if (context) {
@@ -63,10 +99,15 @@ template <typename StackClass> struct StackFactory {
     };
     
     static ContextualStack* get_stack(void (*entry)(intptr_t)) {
-        return eabase::get_object<Wrapper>(entry);
+        Wrapper* s = eabase::get_object<Wrapper>(entry);
+        if (s != NULL) {
+            mark_stack_in_use(s);
+        }
+        return s;
     }
     
     static void return_stack(ContextualStack* sc) {
+        mark_stack_idle(sc);
         eabase::return_object(static_cast<Wrapper*>(sc));
     }
 };
@@ -80,6 +121,8 @@ template <> struct StackFactory<MainStackClass> {
         s->context = NULL;
         s->stacktype = STACK_TYPE_MAIN;
         s->storage.zeroize();
+        s->idle_since_us.store(0, eabase::memory_order_relaxed);
+        s->generation.store(0, eabase::memory_order_relaxed);
         return s;
     }
     
@@ -0,0 +1,289 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+
+#include <unistd.h>                               // getpagesize, usleep
+#include <algorithm>                              // std::min
+#include <pthread.h>
+#include <sys/mman.h>                             // madvise, mincore
+#include <gflags/gflags.h>
+#include "eabase/utility/errno.h"                 // berror
+#include "eabase/utility/logging.h"
+#include "eabase/utility/time.h"                  // cpuwide_time_us
+#include "eabase/utility/threading/platform_thread.h"
+#include "eabase/var/var.h"
+#include "eabase/fiber/stack.h"
+
+namespace eabase {
+static void start_stack_reclaimer();
+}  // namespace eabase
+
+static bool validate_fiber_stack_reclaim_idle_ms(const char*, int32_t val) {
+    if (val < 0) {
+        return false;
+    }
+    if (val > 0) {
+        eabase::start_stack_reclaimer();
+    }
+    return true;
+}
+
+static bool validate_fiber_stack_reclaim_max_bytes_per_second(
+    const char*, int64_t val) {
+    return val > 0;
+}
+
+DEFINE_int32(fiber_stack_reclaim_idle_ms, 0, "Pages of stacks staying in "
+             "pools for longer than so many milliseconds are given back to "
+             "the OS, except the ones holding the saved context. 0 disables "
+             "the reclaimer as well as /vars/fiber_stack_resident_bytes");
+const bool ALLOW_UNUSED dummy_fiber_stack_reclaim_idle_ms =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_stack_reclaim_idle_ms,
+                                       validate_fiber_stack_reclaim_idle_ms);
+
+DEFINE_int64(fiber_stack_reclaim_max_bytes_per_second, 256L * 1024 * 1024,
+             "Max resident bytes of idle stacks given back per second, "
+             "which bounds the page faults when the stacks are used again");
+const bool ALLOW_UNUSED dummy_fiber_stack_reclaim_max_bytes_per_second =
+    ::GFLAGS_NS::RegisterFlagValidator(
+        &FLAGS_fiber_stack_reclaim_max_bytes_per_second,
+        validate_fiber_stack_reclaim_max_bytes_per_second);
+
+DEFINE_bool(fiber_stack_reclaim_use_madv_free, false, "Give back pages of "
+            "idle stacks with MADV_FREE instead of MADV_DONTNEED, which is "
+            "cheaper but resident memory only drops under memory pressure");
+
+namespace eabase {
+
+eabase::static_atomic<int64_t> g_stack_reclaim_clock_us =
+    BUTIL_STATIC_ATOMIC_INIT(1);
+
+// Stacks are allocated by ObjectPool and never freed, so are the records.
+static const size_t STACK_RECORD_BLOCK_SIZE = 4096;
+static const size_t STACK_RECORD_MAX_BLOCK = 1024;
+static const int64_t STACK_RECLAIM_INTERVAL_US = 100000L;
+// Saved registers and the red zone right below the saved context are kept.
+static const int STACK_RECLAIM_CONTEXT_MARGIN = 256;
+
+struct StackRecord {
+    ContextualStack* stack;
+    // Fields below are only touched by the reclaimer thread.
+    // ContextualStack::generation when the record was updated.
+    uint32_t measured_generation;
+    uint32_t reclaimed_generation;
+    int64_t resident_bytes;
+};
+
+struct StackRecordBlock {
+    StackRecord records[STACK_RECORD_BLOCK_SIZE];
+};
+
+static pthread_mutex_t s_stack_record_mutex = PTHREAD_MUTEX_INITIALIZER;
+static StackRecordBlock* s_stack_record_blocks[STACK_RECORD_MAX_BLOCK];
+static eabase::static_atomic<size_t> s_nstack_record =
+    BUTIL_STATIC_ATOMIC_INIT(0);
+static eabase::static_atomic<int64_t> s_stack_resident_bytes =
+    BUTIL_STATIC_ATOMIC_INIT(0);
+
+static int64_t get_stack_resident_bytes(void*) {
+    return s_stack_resident_bytes.load(eabase::memory_order_relaxed);
+}
+
+static eabase::PassiveStatus<int64_t>* s_stack_resident_bytes_var = NULL;
+static eabase::Adder<int64_t>* s_stack_reclaimed_bytes = NULL;
+
+void register_stack(ContextualStack* s) {
+    pthread_mutex_lock(&s_stack_record_mutex);
+    const size_t n = s_nstack_record.load(eabase::memory_order_relaxed);
+    const size_t block_index = n / STACK_RECORD_BLOCK_SIZE;
+    if (block_index >= STACK_RECORD_MAX_BLOCK) {
+        pthread_mutex_unlock(&s_stack_record_mutex);
+        LOG_ONCE(WARNING) << "Too many stacks, new ones are not reclaimed";
+        return;
+    }
+    if (s_stack_record_blocks[block_index] == NULL) {
+        StackRecordBlock* b = new (std::nothrow) StackRecordBlock;
+        if (b == NULL) {
+            pthread_mutex_unlock(&s_stack_record_mutex);
+            return;
+        }
+        s_stack_record_blocks[block_index] = b;
+    }
+    StackRecord* r =
+        &s_stack_record_blocks[block_index]->records[n % STACK_RECORD_BLOCK_SIZE];
+    r->stack = s;
+    r->measured_generation = 0;
+    r->reclaimed_generation = 0;
+    r->resident_bytes = 0;
+    s_nstack_record.store(n + 1, eabase::memory_order_release);
+    pthread_mutex_unlock(&s_stack_record_mutex);
+}
+
+static int64_t count_resident_bytes(char* begin, char* end) {
+    const static int PAGESIZE = getpagesize();
+    int64_t nbytes = 0;
+    unsigned char vec[256];
+    for (char* p = begin; p < end; p += sizeof(vec) * PAGESIZE) {
+        const size_t len = std::min((size_t)(end - p), sizeof(vec) * PAGESIZE);
+        if (mincore(p, len, vec) != 0) {
+            return nbytes;
+        }
+        const size_t npage = (len + PAGESIZE - 1) / PAGESIZE;
+        for (size_t i = 0; i < npage; ++i) {
+            if (vec[i] & 1) {
+                nbytes += PAGESIZE;
+            }
+        }
+    }
+    return nbytes;
+}
+
+static char* stack_low(const ContextualStack* s) {
+    const static int PAGESIZE = getpagesize();
+    return (char*)(((uintptr_t)s->storage.bottom - s->storage.stacksize
+                    + PAGESIZE - 1) & ~(uintptr_t)(PAGESIZE - 1));
+}
+
+// Give back pages of idle `s' below the saved context.
+// Returns resident bytes released.
+static int64_t release_stack_pages(ContextualStack* s) {
+    const static int PAGESIZE = getpagesize();
+    char* const low = stack_low(s);
+    char* const high = (char*)(((uintptr_t)s->context
+                                - STACK_RECLAIM_CONTEXT_MARGIN)
+                               & ~(uintptr_t)(PAGESIZE - 1));
+    if (high <= low) {
+        return 0;
+    }
+    const int64_t nbytes = count_resident_bytes(low, high);
+    if (nbytes == 0) {
+        return 0;
+    }
+    int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+    if (FLAGS_fiber_stack_reclaim_use_madv_free) {
+        advice = MADV_FREE;
+    }
+#endif
+    if (madvise(low, high - low, advice) != 0) {
+        PLOG_EVERY_SECOND(WARNING) << "Fail to madvise stack=" << (void*)low
+                                   << " length=" << high - low;
+        return 0;
+    }
+    // Pages come back zero-filled, measuring them as painted is wrong.
+    s->storage.painted = false;
+    return nbytes;
+}
+
+// Whether pages of `s' are touched since the last measurement.
+static bool needs_measure(const StackRecord* r, const ContextualStack* s) {
+    return r->measured_generation !=
+        s->generation.load(eabase::memory_order_relaxed);
+}
+
+// Whether `s' has been idle long enough and is dirty since it was reclaimed
+// last time.
+static bool needs_reclaim(const StackRecord* r, const ContextualStack* s,
+                          int64_t idle_since, int64_t now_us, int64_t budget) {
+    return budget > 0 && FLAGS_fiber_stack_reclaim_idle_ms > 0 &&
+        now_us - idle_since >= FLAGS_fiber_stack_reclaim_idle_ms * 1000L &&
+        r->reclaimed_generation !=
+        s->generation.load(eabase::memory_order_relaxed);
+}
+
+static void reclaim_stacks(int64_t now_us, int64_t* budget) {
+    const size_t n = s_nstack_record.load(eabase::memory_order_acquire);
+    int64_t resident_bytes = 0;
+    for (size_t i = 0; i < n; ++i) {
+        StackRecord* r = &s_stack_record_blocks[i / STACK_RECORD_BLOCK_SIZE]
+            ->records[i % STACK_RECORD_BLOCK_SIZE];
+        ContextualStack* s = r->stack;
+        const int64_t idle_since =
+            s->idle_since_us.load(eabase::memory_order_acquire);
+        // Stacks in use keep the last measurement.
+        if (idle_since > 0 && (needs_measure(r, s) ||
+                               needs_reclaim(r, s, idle_since, now_us, *budget))) {
+            // Lock the stack against being got from the pool. Check again
+            // as the stack might be used and returned in the same tick.
+            int64_t expected = idle_since;
+            if (s->idle_since_us.compare_exchange_strong(
+                    expected, -1, eabase::memory_order_acquire)) {
+                const uint32_t generation =
+                    s->generation.load(eabase::memory_order_relaxed);
+                if (needs_measure(r, s)) {
+                    r->resident_bytes = count_resident_bytes(
+                        stack_low(s), (char*)s->storage.bottom);
+                    r->measured_generation = generation;
+                }
+                if (needs_reclaim(r, s, idle_since, now_us, *budget)) {
+                    const int64_t nbytes = release_stack_pages(s);
+                    r->reclaimed_generation = generation;
+                    r->resident_bytes -= nbytes;
+                    *budget -= nbytes;
+                    *s_stack_reclaimed_bytes << nbytes;
+                }
+                s->idle_since_us.store(idle_since,
+                                       eabase::memory_order_release);
+            }
+        }
+        resident_bytes += r->resident_bytes;
+    }
+    s_stack_resident_bytes.store(resident_bytes, eabase::memory_order_relaxed);
+}
+
+static void* run_stack_reclaimer(void*) {
+    eabase::PlatformThread::SetName("fiber_stack_reclaimer");
+    int64_t last_us = eabase::cpuwide_time_us();
+    int64_t budget = 0;
+    while (true) {
+        usleep(STACK_RECLAIM_INTERVAL_US);
+        const int64_t now_us = eabase::cpuwide_time_us();
+        g_stack_reclaim_clock_us.store(now_us, eabase::memory_order_relaxed);
+        const int64_t max_bytes = FLAGS_fiber_stack_reclaim_max_bytes_per_second;
+        // Unused budget accumulates up to one second.
+        budget = std::min(budget + max_bytes * (now_us - last_us) / 1000000L,
+                          max_bytes);
+        last_us = now_us;
+        if (FLAGS_fiber_stack_reclaim_idle_ms > 0) {
+            reclaim_stacks(now_us, &budget);
+        }
+    }
+    return NULL;
+}
+
+static pthread_once_t s_stack_reclaimer_once = PTHREAD_ONCE_INIT;
+
+static void create_stack_reclaimer() {
+    g_stack_reclaim_clock_us.store(eabase::cpuwide_time_us(),
+                                   eabase::memory_order_relaxed);
+    s_stack_reclaimed_bytes =
+        new eabase::Adder<int64_t>("fiber_stack_reclaimed_bytes");
+    s_stack_resident_bytes_var = new eabase::PassiveStatus<int64_t>(
+        "fiber_stack_resident_bytes", get_stack_resident_bytes, NULL);
+    pthread_t tid;
+    const int rc = pthread_create(&tid, NULL, run_stack_reclaimer, NULL);
+    if (rc != 0) {
+        LOG(ERROR) << "Fail to create stack reclaimer: " << berror(rc);
+        return;
+    }
+    pthread_detach(tid);
+}
+
+static void start_stack_reclaimer() {
+    pthread_once(&s_stack_reclaimer_once, create_stack_reclaimer);
+}
+
+}  // namespace eabase
@@ -14,6 +14,7 @@
 //
 //
 
+#include <limits.h>                                      // INT_MAX
 #include "eabase/utility/scoped_lock.h"             // BAIDU_SCOPED_LOCK
 #include "eabase/utility/errno.h"                   // berror
 #include "eabase/utility/logging.h"
@@ -25,6 +26,8 @@
 #include "eabase/fiber/task_group.h"           // TaskGroup
 #include "eabase/fiber/task_control.h"
 #include "eabase/fiber/timer_thread.h"         // global_timer_thread
+#include "eabase/fiber/numa.h"                 // numa_bind_thread
+#include "eabase/fiber/fiber.h"                // fiber_setconcurrency
 #include <gflags/gflags.h>
 #include "eabase/fiber/log.h"
 
@@ -32,14 +35,48 @@ DEFINE_int32(task_group_delete_delay, 1,
              "delay deletion of TaskGroup for so many seconds");
 DEFINE_int32(task_group_runqueue_capacity, 4096,
              "capacity of runqueue in each TaskGroup");
+DEFINE_int32(task_group_steal_batch, 16, "Idle workers steal up to half of "
+             "a runqueue but no more than so many tasks at once. 1 steals "
+             "one task at a time. Only read when TaskGroups are created");
+static bool validate_task_group_steal_batch(const char*, int32_t val) {
+    return val >= 1 && val <= (int32_t)eabase::TaskGroup::MAX_STEAL_BATCH;
+}
+const bool ALLOW_UNUSED dummy_task_group_steal_batch =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_task_group_steal_batch,
+                                       validate_task_group_steal_batch);
 DEFINE_int32(task_group_yield_before_idle, 0,
              "TaskGroup yields so many times before idle");
 DEFINE_int32(task_group_ntags, 1, "TaskGroup will be grouped by number ntags");
+DEFINE_bool(fiber_numa_aware, false, "Group workers by NUMA node: pin each "
+            "worker to cpus of one node so that its runqueue is allocated "
+            "from local memory, and steal from/wake up workers on the same "
+            "node first. Only read when fiber starts");
+DEFINE_bool(fiber_autoscale, false, "Grow workers when they're busy and "
+            "retire workers when they're idle according to "
+            "fiber_worker_usage. The autoscaler is only started if this flag "
+            "is on when fiber starts");
+DEFINE_int32(fiber_autoscale_interval_ms, 1000,
+             "Interval between two decisions of the autoscaler");
+DEFINE_int32(fiber_autoscale_min_concurrency, 0, "The autoscaler does not "
+             "retire workers below this value, FIBER_MIN_CONCURRENCY if "
+             "non-positive");
+DEFINE_int32(fiber_autoscale_max_concurrency, 0, "The autoscaler does not "
+             "add workers beyond this value, -fiber_concurrency when fiber "
+             "starts if non-positive");
+DEFINE_double(fiber_autoscale_high_usage, 0.8, "Add workers when average "
+              "usage of workers is higher than this value");
+DEFINE_double(fiber_autoscale_low_usage, 0.3, "Retire a worker when average "
+              "usage of workers is lower than this value");
 
 namespace eabase {
 
+// Workers running the same fiber for longer than this are not retired.
+static const int64_t FIBER_RETIRE_MAX_RUNNING_NS = 10000000L;
+
 DECLARE_int32(fiber_concurrency);
 DECLARE_int32(fiber_min_concurrency);
+DECLARE_string(fiber_tag_affinity);
+DECLARE_string(fiber_tag_spin_policy);
 
 extern pthread_mutex_t g_task_control_mutex;
 extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
@@ -75,14 +112,31 @@ void* TaskControl::worker_thread(void* arg) {
     auto c = dummy->c;
     auto tag = dummy->tag;
     delete dummy;
+    const int numa_node = c->next_numa_node(tag);
+    if (numa_node >= 0) {
+        const int rc = numa_bind_thread(numa_node);
+        if (rc) {
+            LOG(WARNING) << "Fail to bind worker to numa node=" << numa_node
+                         << ", " << berror(rc);
+        }
+        set_numa_local_node(numa_node);
+    }
     run_tagged_worker_startfn(tag);
 
     TaskGroup* g = c->create_group(tag);
+    if (c->_npending_workers.fetch_sub(1, eabase::memory_order_release) == 1) {
+        // Wake up remove_workers() waiting for workers being added.
+        futex_wake_private(&c->_npending_workers, INT_MAX);
+    }
     TaskStatistics stat;
     if (NULL == g) {
         LOG(ERROR) << "Fail to create TaskGroup in pthread=" << pthread_self();
         return NULL;
     }
+    {
+        BAIDU_SCOPED_LOCK(c->_modify_group_mutex);
+        c->apply_affinity(g, false);
+    }
     std::string worker_thread_name = eabase::string_printf(
         "fiber_wkr:%d-%d", g->tag(), c->_next_worker_id.fetch_add(1, eabase::memory_order_relaxed));
     eabase::PlatformThread::SetName(worker_thread_name.c_str());
@@ -98,7 +152,16 @@ void* TaskControl::worker_thread(void* arg) {
             << g->main_tid() << " idle=" << stat.cputime_ns / 1000000.0
             << "ms uptime=" << g->current_uptime_ns() / 1000000.0 << "ms";
     tls_task_group = NULL;
+    // Pending timeouts of this worker are fired by the timer thread instead.
+    g->_timer_queue.move_to(get_global_timer_thread());
+    const bool retired = g->_retiring.load(eabase::memory_order_relaxed);
+    if (retired) {
+        BT_VLOG << "Retiring worker=" << pthread_self() << " tag=" << g->tag();
+    }
     g->destroy_self();
+    if (retired) {
+        c->forward_tasks(g);
+    }
     c->_nworkers << -1;
     c->tag_nworkers(g->tag()) << -1;
     return NULL;
@@ -110,7 +173,9 @@ TaskGroup* TaskControl::create_group(fiber_tag_t tag) {
         LOG(FATAL) << "Fail to new TaskGroup";
         return NULL;
     }
-    if (g->init(FLAGS_task_group_runqueue_capacity) != 0) {
+    g->set_numa_node(_numa_nnodes > 0 ? numa_local_node() : -1);
+    if (g->init(FLAGS_task_group_runqueue_capacity,
+                FLAGS_task_group_steal_batch) != 0) {
         LOG(ERROR) << "Fail to init TaskGroup";
         delete g;
         return NULL;
@@ -127,6 +192,10 @@ static void print_rq_sizes_in_the_tc(std::ostream &os, void *arg) {
     tc->print_rq_sizes(os);
 }
 
+static void print_placement_in_the_tc(std::ostream &os, void *arg) {
+    static_cast<TaskControl*>(arg)->print_placement(os);
+}
+
 static double get_cumulated_worker_time_from_this(void *arg) {
     return static_cast<TaskControl*>(arg)->get_cumulated_worker_time();
 }
@@ -159,8 +228,17 @@ TaskControl::TaskControl()
     , _init(false)
     , _stop(false)
     , _concurrency(0)
+    , _tagged_nretiring(FLAGS_task_group_ntags)
+    , _retire_version(0)
+    , _npending_workers(0)
+    , _has_autoscaler(false)
     , _next_worker_id(0)
     , _nworkers("fiber_worker_count")
+    , _nsteal("fiber_steal_count")
+    , _nstolen("fiber_stolen_task_count")
+    , _nspin_hit("fiber_idle_spin_hit")
+    , _nspin_miss("fiber_idle_spin_miss")
+    , _nlocal_timer("fiber_worker_timer_count")
     , _pending_time(NULL)
       // Delay exposure of following two vars because they rely on TC which
       // is not initialized yet.
@@ -173,7 +251,26 @@ TaskControl::TaskControl()
     , _status(print_rq_sizes_in_the_tc, this)
     , _nfibers("fiber_count")
     , _pl(FLAGS_task_group_ntags)
-{}
+    , _tagged_nprio_tasks(FLAGS_task_group_ntags * TASK_PRIORITY_NUM)
+    , _tag_spin_policy(FLAGS_task_group_ntags)
+    , _tag_spin_enabled(FLAGS_task_group_ntags)
+    , _tagged_nspinning(FLAGS_task_group_ntags)
+    , _numa_nnodes(0)
+    , _placement(print_placement_in_the_tc, this)
+{
+    for (int i = 0; i < TASK_PRIORITY_NUM; ++i) {
+        _queue_latency[i].store(NULL, eabase::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < _tagged_nprio_tasks.size(); ++i) {
+        _tagged_nprio_tasks[i].store(0, eabase::memory_order_relaxed);
+    }
+    for (int i = 0; i < FLAGS_task_group_ntags; ++i) {
+        _tag_spin_policy[i].store(TagSpinPolicy().pack(),
+                                  eabase::memory_order_relaxed);
+        _tag_spin_enabled[i].store(false, eabase::memory_order_relaxed);
+        _tagged_nspinning[i].store(0, eabase::memory_order_relaxed);
+    }
+}
 
 int TaskControl::init(int concurrency) {
     if (_concurrency != 0) {
@@ -189,6 +286,7 @@ int TaskControl::init(int concurrency) {
     // task group group by tags
     for (int i = 0; i < FLAGS_task_group_ntags; ++i) {
         _tagged_ngroup[i].store(0, std::memory_order_relaxed);
+        _tagged_nretiring[i].store(0, std::memory_order_relaxed);
         auto tag_str = std::to_string(i);
         _tagged_nworkers.push_back(new eabase::Adder<int64_t>("fiber_worker_count", tag_str));
         _tagged_cumulated_worker_time.push_back(new eabase::PassiveStatus<double>(
@@ -198,17 +296,80 @@ int TaskControl::init(int concurrency) {
         _tagged_nfibers.push_back(new eabase::Adder<int64_t>("fiber_count", tag_str));
     }
 
+    if (FLAGS_fiber_numa_aware) {
+        _numa_nnodes = numa_num_nodes();
+        std::vector<TaggedGroups> groups(FLAGS_task_group_ntags * _numa_nnodes);
+        _numa_groups.swap(groups);
+        std::vector<eabase::atomic<size_t>> ngroup(FLAGS_task_group_ntags * _numa_nnodes);
+        _numa_ngroup.swap(ngroup);
+        std::vector<eabase::atomic<int>> next_node(FLAGS_task_group_ntags);
+        _numa_next_node.swap(next_node);
+        for (size_t i = 0; i < _numa_ngroup.size(); ++i) {
+            _numa_ngroup[i].store(0, eabase::memory_order_relaxed);
+        }
+        for (int i = 0; i < FLAGS_task_group_ntags; ++i) {
+            _numa_next_node[i].store(0, eabase::memory_order_relaxed);
+        }
+        for (int i = 0; i < _numa_nnodes; ++i) {
+            auto node_str = "node" + std::to_string(i);
+            _numa_local_steal.push_back(
+                new eabase::Adder<int64_t>("fiber_numa_local_steal", node_str));
+            _numa_remote_steal.push_back(
+                new eabase::Adder<int64_t>("fiber_numa_remote_steal", node_str));
+        }
+        LOG(INFO) << "Group fiber workers by " << _numa_nnodes << " numa nodes";
+    }
+
+    _tag_affinity.resize(FLAGS_task_group_ntags);
+    get_thread_cpus(pthread_self(), &_default_cpus);
+    std::vector<std::pair<fiber_tag_t, TagAffinity> > affinities;
+    if (parse_tag_affinity(FLAGS_fiber_tag_affinity, &affinities) != 0) {
+        LOG(ERROR) << "Invalid -fiber_tag_affinity=" << FLAGS_fiber_tag_affinity;
+        return -1;
+    }
+    for (size_t i = 0; i < affinities.size(); ++i) {
+        if (affinities[i].first >= FLAGS_task_group_ntags) {
+            LOG(ERROR) << "Invalid tag=" << affinities[i].first
+                       << " in -fiber_tag_affinity";
+            return -1;
+        }
+        _tag_affinity[affinities[i].first] = affinities[i].second;
+    }
+    std::vector<std::pair<fiber_tag_t, TagSpinPolicy> > spin_policies;
+    if (parse_tag_spin_policy(FLAGS_fiber_tag_spin_policy, &spin_policies) != 0) {
+        LOG(ERROR) << "Invalid -fiber_tag_spin_policy="
+                   << FLAGS_fiber_tag_spin_policy;
+        return -1;
+    }
+    for (size_t i = 0; i < spin_policies.size(); ++i) {
+        if (spin_policies[i].first >= FLAGS_task_group_ntags) {
+            LOG(ERROR) << "Invalid tag=" << spin_policies[i].first
+                       << " in -fiber_tag_spin_policy";
+            return -1;
+        }
+        set_tag_spin_policy(spin_policies[i].first, spin_policies[i].second);
+    }
+
     // Make sure TimerThread is ready.
     if (get_or_create_global_timer_thread() == NULL) {
         LOG(ERROR) << "Fail to get global_timer_thread";
         return -1;
     }
     
+    if (FLAGS_fiber_stack_prefault_count > 0) {
+        const int n = prefault_stacks(STACK_TYPE_NORMAL,
+                                      FLAGS_fiber_stack_prefault_count,
+                                      TaskGroup::task_runner);
+        LOG(INFO) << "Pre-faulted " << n << " normal stacks";
+    }
+
     _workers.resize(_concurrency);   
     for (int i = 0; i < _concurrency; ++i) {
         auto arg = new WorkerThreadArgs(this, i % FLAGS_task_group_ntags);
+        _npending_workers.fetch_add(1, eabase::memory_order_relaxed);
         const int rc = pthread_create(&_workers[i], NULL, worker_thread, arg);
         if (rc) {
+            _npending_workers.fetch_sub(1, eabase::memory_order_relaxed);
             delete arg;
             LOG(ERROR) << "Fail to create _workers[" << i << "], " << berror(rc);
             return -1;
@@ -218,6 +379,7 @@ int TaskControl::init(int concurrency) {
     _switch_per_second.expose("fiber_switch_second");
     _signal_per_second.expose("fiber_signal_second");
     _status.expose("fiber_group_status");
+    _placement.expose("fiber_worker_placement");
 
     // Wait for at least one group is added so that choose_one_group()
     // never returns NULL.
@@ -232,6 +394,17 @@ int TaskControl::init(int concurrency) {
 
     _init.store(true, eabase::memory_order_release);
 
+    if (FLAGS_fiber_autoscale) {
+        if (FLAGS_fiber_autoscale_max_concurrency <= 0) {
+            FLAGS_fiber_autoscale_max_concurrency = FLAGS_fiber_concurrency;
+        }
+        const int rc = pthread_create(&_autoscaler, NULL, autoscaler_thread, this);
+        if (rc) {
+            LOG(ERROR) << "Fail to create autoscaler, " << berror(rc);
+        } else {
+            _has_autoscaler = true;
+        }
+    }
     return 0;
 }
 
@@ -239,6 +412,7 @@ int TaskControl::add_workers(int num, fiber_tag_t tag) {
     if (num <= 0) {
         return 0;
     }
+    reap_retired_workers();
     try {
         _workers.resize(_concurrency + num);
     } catch (...) {
@@ -250,9 +424,11 @@ int TaskControl::add_workers(int num, fiber_tag_t tag) {
         // _concurrency before create a worker.
         _concurrency.fetch_add(1);
         auto arg = new WorkerThreadArgs(this, tag);
+        _npending_workers.fetch_add(1, eabase::memory_order_relaxed);
         const int rc = pthread_create(
                 &_workers[i + old_concurency], NULL, worker_thread, arg);
         if (rc) {
+            _npending_workers.fetch_sub(1, eabase::memory_order_relaxed);
             delete arg;
             LOG(WARNING) << "Fail to create _workers[" << i + old_concurency
                          << "], " << berror(rc);
@@ -265,12 +441,188 @@ int TaskControl::add_workers(int num, fiber_tag_t tag) {
     return _concurrency.load(eabase::memory_order_relaxed) - old_concurency;
 }
 
+int TaskControl::next_numa_node(fiber_tag_t tag) {
+    if (_numa_nnodes <= 0) {
+        return -1;
+    }
+    return _numa_next_node[tag].fetch_add(1, eabase::memory_order_relaxed) %
+        _numa_nnodes;
+}
+
+int TaskControl::caller_numa_node() const {
+    if (_numa_nnodes <= 0) {
+        return 0;
+    }
+    TaskGroup* g = tls_task_group;
+    if (g && g->_control == this && g->numa_node() >= 0) {
+        return g->numa_node();
+    }
+    const int node = numa_local_node();
+    return (node >= 0 && node < _numa_nnodes) ? node : numa_current_node();
+}
+
+int TaskControl::remove_workers(int num, fiber_tag_t tag) {
+    if (num <= 0) {
+        return 0;
+    }
+    reap_retired_workers();
+    // Workers just added may not be in groups yet.
+    int npending = 0;
+    while ((npending = _npending_workers.load(eabase::memory_order_acquire)) > 0) {
+        futex_wait_private(&_npending_workers, npending, NULL);
+    }
+    const int64_t now_ns = eabase::cpuwide_time_ns();
+    int removed = 0;
+    {
+        BAIDU_SCOPED_LOCK(_modify_group_mutex);
+        if (_stop) {
+            return 0;
+        }
+        auto& groups = tag_group(tag);
+        const size_t ngroup = tag_ngroup(tag).load(eabase::memory_order_relaxed);
+        // Retire from the back, newest workers are less likely to be
+        // running long-lived fibers (e.g. epoll threads).
+        for (size_t i = ngroup; i > 0 && removed < num; --i) {
+            TaskGroup* g = groups[i - 1];
+            if (g == NULL || g->_retiring.load(eabase::memory_order_relaxed)) {
+                continue;
+            }
+            // A worker only retires when it gets back to the scheduling
+            // loop, skip the ones stuck in long-running fibers (e.g. epoll
+            // fibers) which may never do so. Fields of `g' are read racily
+            // as hints.
+            const TaskMeta* cur = g->_cur_meta;
+            if (cur != NULL && cur->tid != g->_main_tid &&
+                now_ns - g->_last_run_ns > FIBER_RETIRE_MAX_RUNNING_NS) {
+                continue;
+            }
+            if (ngroup - _tagged_nretiring[tag].load(eabase::memory_order_relaxed) <= 1) {
+                break;
+            }
+            g->_retiring.store(true, eabase::memory_order_release);
+            _tagged_nretiring[tag].fetch_add(1, eabase::memory_order_relaxed);
+            auto it = std::find_if(_workers.begin(), _workers.end(),
+                                   [g](pthread_t th) {
+                                       return pthread_equal(th, g->_worker_pthread);
+                                   });
+            if (it != _workers.end()) {
+                _retired_workers.push_back(*it);
+                _workers.erase(it);
+            }
+            _concurrency.fetch_sub(1, eabase::memory_order_release);
+            ++removed;
+            // Wake up the worker if it's parked. Other workers sharing the
+            // parking lot just go back to sleep.
+            g->_pl->signal(FIBER_MAX_CONCURRENCY);
+        }
+    }
+    if (removed) {
+        _retire_version.fetch_add(1, eabase::memory_order_release);
+    }
+    return removed;
+}
+
+void TaskControl::reap_retired_workers() {
+    for (size_t i = 0; i < _retired_workers.size();) {
+        if (pthread_tryjoin_np(_retired_workers[i], NULL) == 0) {
+            _retired_workers[i] = _retired_workers.back();
+            _retired_workers.pop_back();
+        } else {
+            ++i;
+        }
+    }
+}
+
+void TaskControl::forward_tasks(TaskGroup* g) {
+    const fiber_tag_t tag = g->tag();
+    fiber_t tid = 0;
+    int nforwarded = 0;
+    for (int prio = 0; prio < TASK_PRIORITY_NUM; ++prio) {
+        while (g->_rq[prio].pop(&tid) || g->_remote_rq[prio].pop(&tid)) {
+            if (prio != TASK_PRIORITY_NORMAL) {
+                add_prio_tasks(tag, prio, -1);
+            }
+            if (tag_ngroup(tag).load(eabase::memory_order_acquire) == 0) {
+                // Stopping, nobody is going to run it anyway.
+                return;
+            }
+            choose_one_group(tag)->ready_to_run_remote(tid);
+            ++nforwarded;
+        }
+    }
+    if (nforwarded) {
+        BT_VLOG << "Forwarded " << nforwarded << " tasks of retired worker";
+    }
+}
+
+void* TaskControl::autoscaler_thread(void* arg) {
+    TaskControl* c = static_cast<TaskControl*>(arg);
+    eabase::PlatformThread::SetName("fiber_autoscaler");
+    int64_t last_ns = eabase::monotonic_time_ns();
+    double last_worker_time = c->get_cumulated_worker_time();
+    while (true) {
+        // Interrupted by stop_and_join().
+        ::usleep(std::max(FLAGS_fiber_autoscale_interval_ms, 10) * 1000L);
+        {
+            BAIDU_SCOPED_LOCK(c->_modify_group_mutex);
+            if (c->_stop) {
+                break;
+            }
+        }
+        const int64_t now_ns = eabase::monotonic_time_ns();
+        const double worker_time = c->get_cumulated_worker_time();
+        const double busy = (worker_time - last_worker_time) * 1e9 /
+            std::max(now_ns - last_ns, (int64_t)1);
+        last_ns = now_ns;
+        last_worker_time = worker_time;
+        // Cputime of retired workers disappears from the sum.
+        if (!FLAGS_fiber_autoscale || busy < 0) {
+            continue;
+        }
+        const int n = c->concurrency();
+        const int min_n = std::max(FLAGS_fiber_autoscale_min_concurrency,
+                                   FIBER_MIN_CONCURRENCY);
+        const int max_n = std::max(FLAGS_fiber_autoscale_max_concurrency, min_n);
+        int target = n;
+        if (busy > FLAGS_fiber_autoscale_high_usage * n) {
+            target = std::min(n + std::max(n / 4, 1), max_n);
+        } else if (busy < FLAGS_fiber_autoscale_low_usage * n) {
+            target = std::max(n - 1, min_n);
+        }
+        if (target != n) {
+            const int rc = fiber_setconcurrency(target);
+            BT_VLOG << "Autoscale workers from " << n << " to " << target
+                    << " usage=" << busy << " rc=" << rc;
+        }
+    }
+    return NULL;
+}
+
 TaskGroup* TaskControl::choose_one_group(fiber_tag_t tag) {
     CHECK(tag >= FIBER_TAG_DEFAULT && tag < FLAGS_task_group_ntags);
+    if (_numa_nnodes > 0) {
+        const int node = caller_numa_node();
+        auto& groups = numa_group(tag, node);
+        const auto ngroup = numa_ngroup(tag, node).load(eabase::memory_order_acquire);
+        if (ngroup != 0) {
+            TaskGroup* g = groups[eabase::fast_rand_less_than(ngroup)];
+            if (g) {
+                return g;
+            }
+        }
+    }
     auto& groups = tag_group(tag);
     const auto ngroup = tag_ngroup(tag).load(eabase::memory_order_acquire);
     if (ngroup != 0) {
-        return groups[eabase::fast_rand_less_than(ngroup)];
+        const size_t index = eabase::fast_rand_less_than(ngroup);
+        TaskGroup* g = groups[index];
+        // Avoid retiring workers, which still work if chosen though.
+        for (size_t i = 1; i < ngroup &&
+                 g->_retiring.load(eabase::memory_order_relaxed); ++i) {
+            TaskGroup* next = groups[(index + i) % ngroup];
+            g = (next ? next : g);
+        }
+        return g;
     }
     CHECK(false) << "Impossible: ngroup is 0";
     return NULL;
@@ -290,6 +642,9 @@ void TaskControl::stop_and_join() {
         std::for_each(
             _tagged_ngroup.begin(), _tagged_ngroup.end(),
             [](eabase::atomic<size_t>& index) { index.store(0, eabase::memory_order_relaxed); });
+        std::for_each(
+            _numa_ngroup.begin(), _numa_ngroup.end(),
+            [](eabase::atomic<size_t>& index) { index.store(0, eabase::memory_order_relaxed); });
     }
     for (int i = 0; i < FLAGS_task_group_ntags; ++i) {
         for (auto& pl : _pl[i]) {
@@ -300,20 +655,38 @@ void TaskControl::stop_and_join() {
     for (size_t i = 0; i < _workers.size(); ++i) {
         interrupt_pthread(_workers[i]);
     }
+    for (size_t i = 0; i < _retired_workers.size(); ++i) {
+        interrupt_pthread(_retired_workers[i]);
+    }
+    if (_has_autoscaler) {
+        interrupt_pthread(_autoscaler);
+    }
     // Join workers
     for (size_t i = 0; i < _workers.size(); ++i) {
         pthread_join(_workers[i], NULL);
     }
+    for (size_t i = 0; i < _retired_workers.size(); ++i) {
+        pthread_join(_retired_workers[i], NULL);
+    }
+    _retired_workers.clear();
+    if (_has_autoscaler) {
+        pthread_join(_autoscaler, NULL);
+        _has_autoscaler = false;
+    }
 }
 
 TaskControl::~TaskControl() {
     // NOTE: g_task_control is not destructed now because the situation
     //       is extremely racy.
     delete _pending_time.exchange(NULL, eabase::memory_order_relaxed);
+    for (int i = 0; i < TASK_PRIORITY_NUM; ++i) {
+        delete _queue_latency[i].exchange(NULL, eabase::memory_order_relaxed);
+    }
     _worker_usage_second.hide();
     _switch_per_second.hide();
     _signal_per_second.hide();
     _status.hide();
+    _placement.hide();
     
     stop_and_join();
 }
@@ -327,11 +700,12 @@ int TaskControl::_add_group(TaskGroup* g, fiber_tag_t tag) {
         return -1;
     }
     g->set_tag(tag);
-    g->set_pl(&_pl[tag][eabase::fmix64(pthread_numeric_id()) % PARKING_LOT_NUM]);
-    size_t ngroup = _tagged_ngroup[tag].load(eabase::memory_order_relaxed);
-    if (ngroup < (size_t)FIBER_MAX_CONCURRENCY) {
-        _tagged_groups[tag][ngroup] = g;
-        _tagged_ngroup[tag].store(ngroup + 1, eabase::memory_order_release);
+    const int node = std::max(g->numa_node(), 0);
+    g->set_pl(&_pl[tag][node * PARKING_LOT_NUM +
+                        eabase::fmix64(pthread_numeric_id()) % PARKING_LOT_NUM]);
+    add_to_groups(tag_group(tag), tag_ngroup(tag), g);
+    if (g->numa_node() >= 0) {
+        add_to_groups(numa_group(tag, node), numa_ngroup(tag, node), g);
     }
     mu.unlock();
     // See the comments in _destroy_group
@@ -340,8 +714,47 @@ int TaskControl::_add_group(TaskGroup* g, fiber_tag_t tag) {
     return 0;
 }
 
+void TaskControl::add_to_groups(TaggedGroups& groups,
+                                eabase::atomic<size_t>& ngroup, TaskGroup* g) {
+    const size_t n = ngroup.load(eabase::memory_order_relaxed);
+    if (n < (size_t)FIBER_MAX_CONCURRENCY) {
+        groups[n] = g;
+        ngroup.store(n + 1, eabase::memory_order_release);
+    }
+}
+
+bool TaskControl::remove_from_groups(TaggedGroups& groups,
+                                     eabase::atomic<size_t>& ngroup,
+                                     TaskGroup* g) {
+    const size_t n = ngroup.load(eabase::memory_order_relaxed);
+    for (size_t i = 0; i < n; ++i) {
+        if (groups[i] == g) {
+            // No need for atomic_thread_fence because lock did it.
+            groups[i] = groups[n - 1];
+            // Change ngroup and keep groups unchanged at last so that:
+            //  - If steal_task sees the newest ngroup, it would not touch
+            //    groups[n - 1]
+            //  - If steal_task sees old ngroup and is still iterating on
+            //    groups, it would not miss groups[n - 1] which was
+            //    swapped to groups[i]. Although adding new group would
+            //    overwrite it, since we do signal_task in _add_group(),
+            //    we think the pending tasks of groups[n - 1] would
+            //    not miss.
+            ngroup.store(n - 1, eabase::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
+
 void TaskControl::delete_task_group(void* arg) {
-    delete(TaskGroup*)arg;
+    TaskGroup* g = (TaskGroup*)arg;
+    if (g->_retiring.load(eabase::memory_order_relaxed)) {
+        // Tasks may still be pushed into the group by pthreads which chose
+        // it just before it was removed.
+        g->_control->forward_tasks(g);
+    }
+    delete g;
 }
 
 int TaskControl::_destroy_group(TaskGroup* g) {
@@ -358,26 +771,13 @@ int TaskControl::_destroy_group(TaskGroup* g) {
     {
         BAIDU_SCOPED_LOCK(_modify_group_mutex);
         auto tag = g->tag();
-        auto& groups = tag_group(tag);
-        const size_t ngroup = tag_ngroup(tag).load(eabase::memory_order_relaxed);
-        for (size_t i = 0; i < ngroup; ++i) {
-            if (groups[i] == g) {
-                // No need for atomic_thread_fence because lock did it.
-                groups[i] = groups[ngroup - 1];
-                // Change _ngroup and keep _groups unchanged at last so that:
-                //  - If steal_task sees the newest _ngroup, it would not touch
-                //    _groups[ngroup -1]
-                //  - If steal_task sees old _ngroup and is still iterating on
-                //    _groups, it would not miss _groups[ngroup - 1] which was 
-                //    swapped to _groups[i]. Although adding new group would
-                //    overwrite it, since we do signal_task in _add_group(),
-                //    we think the pending tasks of _groups[ngroup - 1] would
-                //    not miss.
-                tag_ngroup(tag).store(ngroup - 1, eabase::memory_order_release);
-                //_groups[ngroup - 1] = NULL;
-                erased = true;
-                break;
-            }
+        erased = remove_from_groups(tag_group(tag), tag_ngroup(tag), g);
+        if (erased && g->_retiring.load(eabase::memory_order_relaxed)) {
+            _tagged_nretiring[tag].fetch_sub(1, eabase::memory_order_relaxed);
+        }
+        if (g->numa_node() >= 0) {
+            remove_from_groups(numa_group(tag, g->numa_node()),
+                               numa_ngroup(tag, g->numa_node()), g);
         }
     }
 
@@ -394,38 +794,77 @@ int TaskControl::_destroy_group(TaskGroup* g) {
     return 0;
 }
 
-bool TaskControl::steal_task(fiber_t* tid, size_t* seed, size_t offset) {
-    auto tag = tls_task_group->tag();
-    // 1: Acquiring fence is paired with releasing fence in _add_group to
-    // avoid accessing uninitialized slot of _groups.
-    const size_t ngroup = tag_ngroup(tag).load(eabase::memory_order_acquire/*1*/);
-    if (0 == ngroup) {
-        return false;
-    }
-
+TaskGroup* TaskControl::steal_from_groups(TaggedGroups& groups, size_t ngroup,
+                                          fiber_t* tid, size_t* seed,
+                                          size_t offset, int prio) {
     // NOTE: Don't return inside `for' iteration since we need to update |seed|
-    bool stolen = false;
+    TaskGroup* const thief = tls_task_group;
+    TaskGroup* victim = NULL;
     size_t s = *seed;
-    auto& groups = tag_group(tag);
     for (size_t i = 0; i < ngroup; ++i, s += offset) {
         TaskGroup* g = groups[s % ngroup];
+        if (g == thief) {
+            // Local runqueues were checked before stealing.
+            continue;
+        }
         // g is possibly NULL because of concurrent _destroy_group
         if (g) {
-            if (g->_rq.steal(tid)) {
-                stolen = true;
+            fiber_t stolen[TaskGroup::MAX_STEAL_BATCH];
+            const size_t n = g->_rq[prio].steal_batch(
+                stolen, TaskGroup::MAX_STEAL_BATCH);
+            if (n) {
+                thief->keep_stolen_tasks(prio, stolen + 1, n - 1);
+                *tid = stolen[0];
+                victim = g;
                 break;
             }
-            if (g->_remote_rq.pop(tid)) {
-                stolen = true;
+            if (g->_remote_rq[prio].pop(tid)) {
+                thief->keep_stolen_tasks(prio, NULL, 0);
+                victim = g;
                 break;
             }
         }
     }
     *seed = s;
-    return stolen;
+    return victim;
 }
 
-void TaskControl::signal_task(int num_task, fiber_tag_t tag) {
+bool TaskControl::steal_task(fiber_t* tid, size_t* seed, size_t offset,
+                             int prio) {
+    auto tag = tls_task_group->tag();
+    const int node = tls_task_group->numa_node();
+    if (node >= 0) {
+        // Try victims on the same node before crossing the interconnect.
+        const size_t nlocal =
+            numa_ngroup(tag, node).load(eabase::memory_order_acquire);
+        if (steal_from_groups(numa_group(tag, node), nlocal, tid, seed,
+                              offset, prio)) {
+            *_numa_local_steal[node] << 1;
+            return true;
+        }
+    }
+    // 1: Acquiring fence is paired with releasing fence in _add_group to
+    // avoid accessing uninitialized slot of _groups.
+    const size_t ngroup = tag_ngroup(tag).load(eabase::memory_order_acquire/*1*/);
+    if (0 == ngroup) {
+        return false;
+    }
+    TaskGroup* victim = steal_from_groups(tag_group(tag), ngroup, tid, seed,
+                                          offset, prio);
+    if (victim == NULL) {
+        return false;
+    }
+    if (node >= 0) {
+        if (victim->numa_node() == node) {
+            *_numa_local_steal[node] << 1;
+        } else {
+            *_numa_remote_steal[node] << 1;
+        }
+    }
+    return true;
+}
+
+void TaskControl::signal_task(int num_task, fiber_tag_t tag, bool batch) {
     if (num_task <= 0) {
         return;
     }
@@ -433,18 +872,27 @@ void TaskControl::signal_task(int num_task, fiber_tag_t tag) {
     // be created to match caller's requests. But in another side, there's also
     // many useless signalings according to current impl. Capping the concurrency
     // is a good balance between performance and timeliness of scheduling.
-    if (num_task > 2) {
-        num_task = 2;
+    const int max_signal = (batch ? std::max(concurrency(tag), 2) : 2);
+    if (num_task > max_signal) {
+        num_task = max_signal;
+    }
+    // A spinning worker takes the task without being woken up. Workers
+    // still spinning after the policy was set to none just find the task
+    // by themselves.
+    if (_tag_spin_enabled[tag].load(eabase::memory_order_relaxed) &&
+        claim_spinning_worker(tag) && --num_task == 0) {
+        return;
     }
     auto& pl = tag_pl(tag);
-    int start_index = eabase::fmix64(pthread_numeric_id()) % PARKING_LOT_NUM;
-    num_task -= pl[start_index].signal(1);
-    if (num_task > 0) {
-        for (int i = 1; i < PARKING_LOT_NUM && num_task > 0; ++i) {
-            if (++start_index >= PARKING_LOT_NUM) {
-                start_index = 0;
-            }
-            num_task -= pl[start_index].signal(1);
+    // Wake up workers on the caller's node first.
+    const int nnode = std::max(_numa_nnodes, 1);
+    const int node = caller_numa_node();
+    const int start_index = eabase::fmix64(pthread_numeric_id()) % PARKING_LOT_NUM;
+    for (int n = 0; n < nnode && num_task > 0; ++n) {
+        const int base = ((node + n) % nnode) * PARKING_LOT_NUM;
+        for (int i = 0; i < PARKING_LOT_NUM && num_task > 0; ++i) {
+            num_task -= pl[base + (start_index + i) % PARKING_LOT_NUM].signal(
+                batch ? num_task : 1);
         }
     }
     if (num_task > 0 &&
@@ -458,6 +906,154 @@ void TaskControl::signal_task(int num_task, fiber_tag_t tag) {
     }
 }
 
+bool TaskControl::claim_spinning_worker(fiber_tag_t tag) {
+    eabase::atomic<int>& nspinning = _tagged_nspinning[tag];
+    // Pairs with the fence in end_spinning(): either the claim is seen by
+    // the spinning worker or tasks pushed before are seen by the worker.
+    eabase::atomic_thread_fence(eabase::memory_order_seq_cst);
+    int n = nspinning.load(eabase::memory_order_relaxed);
+    while (n > 0) {
+        if (nspinning.compare_exchange_weak(n, n - 1,
+                                            eabase::memory_order_seq_cst,
+                                            eabase::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TaskControl::end_spinning(fiber_tag_t tag) {
+    eabase::atomic<int>& nspinning = _tagged_nspinning[tag];
+    if (nspinning.fetch_sub(1, eabase::memory_order_seq_cst) > 0) {
+        return true;
+    }
+    // Claimed after all other spinning workers ended.
+    nspinning.fetch_add(1, eabase::memory_order_relaxed);
+    return false;
+}
+
+int TaskControl::apply_affinity(TaskGroup* g, bool force) {
+    const TagAffinity& a = _tag_affinity[g->tag()];
+    if (a.empty() && !force) {
+        return 0;
+    }
+    std::vector<int> cpus;
+    if (!a.cpus.empty()) {
+        cpus = a.cpus;
+    } else if (g->numa_node() >= 0) {
+        cpus = numa_cpus_of_node(g->numa_node());
+    } else {
+        cpus = _default_cpus;
+    }
+    if (a.exclude_service_cpus) {
+        const std::vector<int> excluded = service_cpus();
+        for (size_t i = 0; i < excluded.size(); ++i) {
+            cpus.erase(std::remove(cpus.begin(), cpus.end(), excluded[i]),
+                       cpus.end());
+        }
+    }
+    if (cpus.empty()) {
+        LOG(ERROR) << "No cpu left for workers of tag=" << g->tag();
+        return EINVAL;
+    }
+    g->_pinned_cpu = -1;
+    if (a.pin_per_core) {
+        // Pin to the cpu with fewest workers of this tag.
+        std::vector<int> nworker(cpus.size(), 0);
+        auto& groups = tag_group(g->tag());
+        const size_t ngroup = tag_ngroup(g->tag()).load(eabase::memory_order_relaxed);
+        for (size_t i = 0; i < ngroup; ++i) {
+            if (groups[i] == NULL || groups[i] == g) {
+                continue;
+            }
+            auto it = std::find(cpus.begin(), cpus.end(), groups[i]->_pinned_cpu);
+            if (it != cpus.end()) {
+                ++nworker[it - cpus.begin()];
+            }
+        }
+        const size_t best = std::min_element(nworker.begin(), nworker.end()) -
+            nworker.begin();
+        cpus.assign(1, cpus[best]);
+    }
+    const int rc = set_thread_cpus(g->_worker_pthread, cpus);
+    if (rc) {
+        LOG(WARNING) << "Fail to place worker of tag=" << g->tag()
+                     << " on cpus=" << format_cpulist(cpus) << ", " << berror(rc);
+        return rc;
+    }
+    if (a.pin_per_core) {
+        g->_pinned_cpu = cpus[0];
+    }
+    BT_VLOG << "Placed worker=" << g->_worker_pthread << " of tag=" << g->tag()
+            << " on cpus=" << format_cpulist(cpus);
+    return 0;
+}
+
+int TaskControl::set_tag_affinity(fiber_tag_t tag, const TagAffinity& affinity) {
+    if (tag < FIBER_TAG_DEFAULT || tag >= FLAGS_task_group_ntags) {
+        return EINVAL;
+    }
+    BAIDU_SCOPED_LOCK(_modify_group_mutex);
+    const TagAffinity old_affinity = _tag_affinity[tag];
+    _tag_affinity[tag] = affinity;
+    int rc = place_tag_workers(tag);
+    if (rc != 0) {
+        // Roll back so that workers added later are placed consistently.
+        _tag_affinity[tag] = old_affinity;
+        place_tag_workers(tag);
+    }
+    return rc;
+}
+
+int TaskControl::place_tag_workers(fiber_tag_t tag) {
+    auto& groups = tag_group(tag);
+    const size_t ngroup = tag_ngroup(tag).load(eabase::memory_order_relaxed);
+    for (size_t i = 0; i < ngroup; ++i) {
+        if (groups[i]) {
+            groups[i]->_pinned_cpu = -1;
+        }
+    }
+    for (size_t i = 0; i < ngroup; ++i) {
+        if (groups[i]) {
+            const int rc = apply_affinity(groups[i], true);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+    }
+    return 0;
+}
+
+void TaskControl::get_tag_placement(fiber_tag_t tag,
+                                    std::vector<std::vector<int> >* placement) {
+    placement->clear();
+    if (tag < FIBER_TAG_DEFAULT || tag >= FLAGS_task_group_ntags) {
+        return;
+    }
+    BAIDU_SCOPED_LOCK(_modify_group_mutex);
+    auto& groups = tag_group(tag);
+    const size_t ngroup = tag_ngroup(tag).load(eabase::memory_order_relaxed);
+    for (size_t i = 0; i < ngroup; ++i) {
+        std::vector<int> cpus;
+        if (groups[i]) {
+            get_thread_cpus(groups[i]->_worker_pthread, &cpus);
+        }
+        placement->push_back(cpus);
+    }
+}
+
+void TaskControl::print_placement(std::ostream& os) {
+    for (int tag = 0; tag < FLAGS_task_group_ntags; ++tag) {
+        std::vector<std::vector<int> > placement;
+        get_tag_placement(tag, &placement);
+        os << "tag" << tag << ':';
+        for (size_t i = 0; i < placement.size(); ++i) {
+            os << ' ' << format_cpulist(placement[i]);
+        }
+        os << '\n';
+    }
+}
+
 void TaskControl::print_rq_sizes(std::ostream& os) {
     size_t ngroup = 0;
     std::for_each(_tagged_ngroup.begin(), _tagged_ngroup.end(), [&](eabase::atomic<size_t>& index) {
@@ -470,7 +1066,11 @@ void TaskControl::print_rq_sizes(std::ostream& os) {
         // ngroup < _ngroup: just ignore _groups[_ngroup ... ngroup-1]
         int i = 0;
         for_each_task_group([&](TaskGroup* g) {
-            nums[i] = (g ? g->_rq.volatile_size() : 0);
+            int n = 0;
+            for (int prio = 0; g && prio < TASK_PRIORITY_NUM; ++prio) {
+                n += g->_rq[prio].volatile_size();
+            }
+            nums[i] = n;
             ++i;
         });
     }
@@ -519,7 +1119,8 @@ int64_t TaskControl::get_cumulated_signal_count() {
     BAIDU_SCOPED_LOCK(_modify_group_mutex);
     for_each_task_group([&](TaskGroup* g) {
         if (g) {
-            c += g->_nsignaled + g->_remote_nsignaled;
+            c += g->_nsignaled +
+                g->_remote_nsignaled.load(eabase::memory_order_relaxed);
         }
     });
     return c;
@@ -541,4 +1142,26 @@ eabase::LatencyRecorder* TaskControl::create_exposed_pending_time() {
     return pt;
 }
 
+eabase::LatencyRecorder* TaskControl::create_exposed_queue_latency(int prio) {
+    static const char* const names[TASK_PRIORITY_NUM] = {
+        "fiber_queue_latency_high",
+        "fiber_queue_latency_normal",
+        "fiber_queue_latency_low",
+    };
+    bool is_creator = false;
+    _pending_time_mutex.lock();
+    eabase::LatencyRecorder* ql =
+        _queue_latency[prio].load(eabase::memory_order_consume);
+    if (!ql) {
+        ql = new eabase::LatencyRecorder;
+        _queue_latency[prio].store(ql, eabase::memory_order_release);
+        is_creator = true;
+    }
+    _pending_time_mutex.unlock();
+    if (is_creator) {
+        ql->expose(names[prio]);
+    }
+    return ql;
+}
+
 }  // namespace eabase
@@ -30,6 +30,9 @@
 #include "eabase/utility/resource_pool.h"                 // ResourcePool
 #include "eabase/fiber/work_stealing_queue.h"        // WorkStealingQueue
 #include "eabase/fiber/parking_lot.h"
+#include "eabase/fiber/numa.h"
+#include "eabase/fiber/cpu_affinity.h"
+#include "eabase/fiber/idle_spin.h"
 
 DECLARE_int32(task_group_ntags);
 namespace eabase {
@@ -50,11 +53,26 @@ public:
     // Create a TaskGroup in this control.
     TaskGroup* create_group(fiber_tag_t tag);
 
-    // Steal a task from a "random" group.
-    bool steal_task(fiber_t* tid, size_t* seed, size_t offset);
+    // Steal a task of class `prio' from a "random" group.
+    bool steal_task(fiber_t* tid, size_t* seed, size_t offset, int prio);
 
-    // Tell other groups that `n' tasks was just added to caller's runqueue
-    void signal_task(int num_task, fiber_tag_t tag);
+    // Count tasks of class `prio' queued in `tag'. Only maintained for
+    // classes other than TASK_PRIORITY_NORMAL so that idle workers don't
+    // scan runqueues of unused classes.
+    void add_prio_tasks(fiber_tag_t tag, int prio, int n) {
+        _tagged_nprio_tasks[tag * TASK_PRIORITY_NUM + prio].fetch_add(
+            n, eabase::memory_order_relaxed);
+    }
+    bool has_prio_tasks(fiber_tag_t tag, int prio) const {
+        return _tagged_nprio_tasks[tag * TASK_PRIORITY_NUM + prio].load(
+            eabase::memory_order_relaxed) > 0;
+    }
+
+    // Tell other groups that `n' tasks was just added to caller's runqueue.
+    // At most 2 workers are woken up unless `batch' is true, in which case
+    // up to `num_task' workers of `tag' are woken up with one futex wake
+    // per parking lot.
+    void signal_task(int num_task, fiber_tag_t tag, bool batch = false);
 
     // Stop and join worker threads in TaskControl.
     void stop_and_join();
@@ -63,8 +81,10 @@ public:
     int concurrency() const 
     { return _concurrency.load(eabase::memory_order_acquire); }
 
-    int concurrency(fiber_tag_t tag) const
-    { return _tagged_ngroup[tag].load(eabase::memory_order_acquire); }
+    int concurrency(fiber_tag_t tag) const {
+        return _tagged_ngroup[tag].load(eabase::memory_order_acquire) -
+            _tagged_nretiring[tag].load(eabase::memory_order_acquire);
+    }
 
     void print_rq_sizes(std::ostream& os);
 
@@ -77,14 +97,61 @@ public:
     // Return the number of workers actually added, which may be less than |num|
     int add_workers(int num, fiber_tag_t tag);
 
-    // Choose one TaskGroup (randomly right now).
+    // [Not thread safe] Retire worker threads of `tag'. A retired worker
+    // stops taking new tasks and quits as soon as it runs out of local
+    // tasks, tasks left in its runqueues are moved to other workers. At
+    // least one worker is kept in each tag. Workers running one fiber for
+    // long are not retired since they may never get back to the scheduling
+    // loop.
+    // Return the number of workers being retired, which may be less
+    // than |num|
+    int remove_workers(int num, fiber_tag_t tag);
+
+    // Changed whenever workers are retired. Pthreads caching a TaskGroup
+    // should drop the cache when this value changes.
+    int64_t retire_version() const
+    { return _retire_version.load(eabase::memory_order_acquire); }
+
+    // Choose one TaskGroup (randomly right now). Groups on the NUMA node of
+    // the caller are preferred when -fiber_numa_aware is on.
     // If this method is called after init(), it never returns NULL.
     TaskGroup* choose_one_group(fiber_tag_t tag = FIBER_TAG_DEFAULT);
 
+    // # of NUMA nodes that workers are grouped by, 0 if -fiber_numa_aware
+    // was off at init().
+    int numa_nnodes() const { return _numa_nnodes; }
+
+    // Set cpu placement policy of workers in `tag'. Existing workers are
+    // placed again immediately, workers added later follow the policy.
+    // Returns 0 on success, error code otherwise.
+    int set_tag_affinity(fiber_tag_t tag, const TagAffinity& affinity);
+
+    // Get cpus that each worker of `tag' is allowed to run on, as reported
+    // by the kernel.
+    void get_tag_placement(fiber_tag_t tag,
+                           std::vector<std::vector<int> >* placement);
+
+    void print_placement(std::ostream& os);
+
+    // Get/Set how idle workers of `tag' spin before parking, applied to
+    // the next idle period of each worker.
+    TagSpinPolicy tag_spin_policy(fiber_tag_t tag) const {
+        return TagSpinPolicy::unpack(
+            _tag_spin_policy[tag].load(eabase::memory_order_relaxed));
+    }
+    void set_tag_spin_policy(fiber_tag_t tag, const TagSpinPolicy& policy) {
+        _tag_spin_policy[tag].store(policy.pack(), eabase::memory_order_relaxed);
+        _tag_spin_enabled[tag].store(policy.mode != FIBER_SPIN_NONE,
+                                     eabase::memory_order_relaxed);
+    }
+
 private:
     typedef std::array<TaskGroup*, FIBER_MAX_CONCURRENCY> TaggedGroups;
     static const int PARKING_LOT_NUM = 4;
-    typedef std::array<ParkingLot, PARKING_LOT_NUM> TaggedParkingLot;
+    // Each NUMA node owns PARKING_LOT_NUM consecutive lots. Only the first
+    // PARKING_LOT_NUM lots are used when workers are not grouped by node.
+    typedef std::array<ParkingLot, PARKING_LOT_NUM * FIBER_MAX_NUMA_NODES>
+        TaggedParkingLot;
     // Add/Remove a TaskGroup.
     // Returns 0 on success, -1 otherwise.
     int _add_group(TaskGroup*, fiber_tag_t tag);
@@ -99,15 +166,70 @@ private:
     // Tag parking slot
     TaggedParkingLot& tag_pl(fiber_tag_t tag) { return _pl[tag]; }
 
+    // Groups of `tag' on NUMA `node', only valid when _numa_nnodes > 0.
+    TaggedGroups& numa_group(fiber_tag_t tag, int node)
+    { return _numa_groups[tag * _numa_nnodes + node]; }
+    eabase::atomic<size_t>& numa_ngroup(fiber_tag_t tag, int node)
+    { return _numa_ngroup[tag * _numa_nnodes + node]; }
+
+    // Node that the next worker of `tag' should be placed on, -1 if workers
+    // are not grouped by node.
+    int next_numa_node(fiber_tag_t tag);
+
+    // Node of the calling thread, 0 if workers are not grouped by node.
+    int caller_numa_node() const;
+
+    // Place the worker of `g' according to affinity policy of its tag.
+    // Workers of tags without policy are left untouched unless `force' is
+    // true. _modify_group_mutex must be held.
+    // Returns 0 on success, error code otherwise.
+    int apply_affinity(TaskGroup* g, bool force);
+
+    // Place all workers of `tag' again. _modify_group_mutex must be held.
+    int place_tag_workers(fiber_tag_t tag);
+
+    // A worker of `tag' spinning for tasks may be claimed by signal_task()
+    // to run a new task instead of waking up a parked worker.
+    // end_spinning() returns false if the spinning worker was claimed, in
+    // which case it must look for tasks again before parking.
+    void begin_spinning(fiber_tag_t tag) {
+        _tagged_nspinning[tag].fetch_add(1, eabase::memory_order_seq_cst);
+    }
+    bool end_spinning(fiber_tag_t tag);
+    bool claim_spinning_worker(fiber_tag_t tag);
+
+    // Steal from one of groups[0...ngroup-1].
+    // Returns the group being stolen from, NULL if nothing was stolen.
+    static TaskGroup* steal_from_groups(TaggedGroups& groups, size_t ngroup,
+                                        fiber_t* tid, size_t* seed,
+                                        size_t offset, int prio);
+
+    // Add/Remove `g' to/from groups[0...ngroup-1].
+    static void add_to_groups(TaggedGroups& groups,
+                              eabase::atomic<size_t>& ngroup, TaskGroup* g);
+    static bool remove_from_groups(TaggedGroups& groups,
+                                   eabase::atomic<size_t>& ngroup, TaskGroup* g);
+
     static void delete_task_group(void* arg);
 
     static void* worker_thread(void* task_control);
 
+    // Move tasks left in runqueues of the retired `g' to other groups.
+    void forward_tasks(TaskGroup* g);
+
+    // Join retired workers which already quit.
+    void reap_retired_workers();
+
+    static void* autoscaler_thread(void* task_control);
+
     template <typename F>
     void for_each_task_group(F const& f);
 
     eabase::LatencyRecorder& exposed_pending_time();
     eabase::LatencyRecorder* create_exposed_pending_time();
+    // Time that tasks of class `prio' stayed in runqueues.
+    eabase::LatencyRecorder& exposed_queue_latency(int prio);
+    eabase::LatencyRecorder* create_exposed_queue_latency(int prio);
     eabase::Adder<int64_t>& tag_nworkers(fiber_tag_t tag);
     eabase::Adder<int64_t>& tag_nfibers(fiber_tag_t tag);
 
@@ -119,11 +241,28 @@ private:
     bool _stop;
     eabase::atomic<int> _concurrency;
     std::vector<pthread_t> _workers;
+    // Retired workers which may not quit yet.
+    std::vector<pthread_t> _retired_workers;
+    std::vector<eabase::atomic<size_t>> _tagged_nretiring;
+    eabase::atomic<int64_t> _retire_version;
+    // Workers created but not added into groups yet.
+    eabase::atomic<int> _npending_workers;
+    bool _has_autoscaler;
+    pthread_t _autoscaler;
     eabase::atomic<int> _next_worker_id;
 
     eabase::Adder<int64_t> _nworkers;
+    // Successful steals and tasks moved by them.
+    eabase::Adder<int64_t> _nsteal;
+    eabase::Adder<int64_t> _nstolen;
+    // Idle spinnings that found a task or ended up parking.
+    eabase::Adder<int64_t> _nspin_hit;
+    eabase::Adder<int64_t> _nspin_miss;
+    // Timeouts fired by TimerQueue of workers, see -fiber_worker_local_timer.
+    eabase::Adder<int64_t> _nlocal_timer;
     eabase::Mutex _pending_time_mutex;
     eabase::atomic<eabase::LatencyRecorder*> _pending_time;
+    eabase::atomic<eabase::LatencyRecorder*> _queue_latency[TASK_PRIORITY_NUM];
     eabase::PassiveStatus<double> _cumulated_worker_time;
     eabase::PerSecond<eabase::PassiveStatus<double> > _worker_usage_second;
     eabase::PassiveStatus<int64_t> _cumulated_switch_count;
@@ -139,6 +278,30 @@ private:
     std::vector<eabase::Adder<int64_t>*> _tagged_nfibers;
 
     std::vector<TaggedParkingLot> _pl;
+
+    // Indexed by tag * TASK_PRIORITY_NUM + prio, see add_prio_tasks().
+    std::vector<eabase::atomic<int64_t>> _tagged_nprio_tasks;
+
+    // Packed TagSpinPolicy of each tag, see -fiber_tag_spin_policy.
+    std::vector<eabase::atomic<int64_t>> _tag_spin_policy;
+    // False if the mode of _tag_spin_policy is FIBER_SPIN_NONE, checked by
+    // signal_task() before trying to claim a spinning worker.
+    std::vector<eabase::atomic<bool>> _tag_spin_enabled;
+    // Spinning workers of each tag minus claims by signal_task().
+    std::vector<eabase::atomic<int>> _tagged_nspinning;
+
+    // NUMA-aware grouping, see -fiber_numa_aware.
+    int _numa_nnodes;
+    std::vector<TaggedGroups> _numa_groups;
+    std::vector<eabase::atomic<size_t>> _numa_ngroup;
+    std::vector<eabase::atomic<int>> _numa_next_node;
+    std::vector<eabase::Adder<int64_t>*> _numa_local_steal;
+    std::vector<eabase::Adder<int64_t>*> _numa_remote_steal;
+
+    // Cpu placement of workers, see -fiber_tag_affinity.
+    std::vector<TagAffinity> _tag_affinity;
+    std::vector<int> _default_cpus;
+    eabase::PassiveStatus<std::string> _placement;
 };
 
 inline eabase::LatencyRecorder& TaskControl::exposed_pending_time() {
@@ -149,6 +312,15 @@ inline eabase::LatencyRecorder& TaskControl::exposed_pending_time() {
     return *pt;
 }
 
+inline eabase::LatencyRecorder& TaskControl::exposed_queue_latency(int prio) {
+    eabase::LatencyRecorder* ql =
+        _queue_latency[prio].load(eabase::memory_order_consume);
+    if (!ql) {
+        ql = create_exposed_queue_latency(prio);
+    }
+    return *ql;
+}
+
 inline eabase::Adder<int64_t>& TaskControl::tag_nworkers(fiber_tag_t tag) {
     return *_tagged_nworkers[tag];
 }
@@ -16,9 +16,10 @@
 
 #include <sys/types.h>
 #include <stddef.h>                         // size_t
+#include <limits>                           // std::numeric_limits
 #include <gflags/gflags.h>
 #include "eabase/utility/compat.h"                   // OS_MACOSX
-#include "eabase/utility/macros.h"                   // ARRAY_SIZE
+#include "eabase/utility/macros.h"                   // ARRAY_SIZE, DEFINE_SMALL_ARRAY
 #include "eabase/utility/scoped_lock.h"              // BAIDU_SCOPED_LOCK
 #include "eabase/utility/fast_rand.h"
 #include "eabase/utility/unique_ptr.h"
@@ -46,6 +47,34 @@ const bool ALLOW_UNUSED dummy_show_fiber_creation_in_vars =
     ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_show_fiber_creation_in_vars,
                                     pass_bool);
 
+DEFINE_bool(show_fiber_queue_latency_in_vars, false, "When this flags is on, "
+            "the time that fibers of each priority stay in runqueues will be "
+            "recorded and shown in /vars/fiber_queue_latency_<priority>");
+const bool ALLOW_UNUSED dummy_show_fiber_queue_latency_in_vars =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_show_fiber_queue_latency_in_vars,
+                                    pass_bool);
+
+static bool validate_fiber_priority_aging_rounds(const char*, int32_t val) {
+    return val >= 2;
+}
+DEFINE_int32(fiber_priority_aging_rounds, 16, "Every so many picks of a "
+             "worker, runqueues are tried from the lowest priority to the "
+             "highest instead, so that a lower priority gets at least one "
+             "pick out of so many when higher priorities are busy");
+const bool ALLOW_UNUSED dummy_fiber_priority_aging_rounds =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_priority_aging_rounds,
+                                    validate_fiber_priority_aging_rounds);
+
+DEFINE_bool(fiber_worker_local_timer, false, "Timeouts of fiber_usleep and "
+            "timed butex waits are run by the worker suspending the fiber "
+            "instead of the global timer thread, which saves the wakeup of "
+            "the timer thread and the handoff through remote runqueues. "
+            "Timeouts of a worker busy with running fibers are delayed until "
+            "it schedules next time");
+const bool ALLOW_UNUSED dummy_fiber_worker_local_timer =
+    ::GFLAGS_NS::RegisterFlagValidator(&FLAGS_fiber_worker_local_timer,
+                                    pass_bool);
+
 DEFINE_bool(show_per_worker_usage_in_vars, false,
             "Show per-worker usage in /vars/fiber_per_worker_usage_<tid>");
 const bool ALLOW_UNUSED dummy_show_per_worker_usage_in_vars =
@@ -111,13 +140,72 @@ bool TaskGroup::is_stopped(fiber_t tid) {
 }
 
 bool TaskGroup::wait_task(fiber_t* tid) {
+    const TagSpinPolicy policy = _control->tag_spin_policy(_tag);
+    if (policy.mode == FIBER_SPIN_NONE) {
+        return park_for_task(tid);
+    }
+    const int64_t begin_ns = eabase::cpuwide_time_ns();
+    const bool found = spin_for_task(policy, begin_ns, tid);
+    const int64_t spin_ns = eabase::cpuwide_time_ns() - begin_ns;
+    if (!found && !park_for_task(tid)) {
+        return false;
+    }
+    _idle_spinner.on_idle_end(eabase::cpuwide_time_ns() - begin_ns, spin_ns);
+    return true;
+}
+
+bool TaskGroup::spin_for_task(const TagSpinPolicy& policy, int64_t begin_ns,
+                              fiber_t* tid) {
+    const int64_t budget_ns = _idle_spinner.spin_budget_ns(policy, begin_ns);
+    if (budget_ns <= 0) {
+        return false;
+    }
+    const int64_t deadline_ns = begin_ns + budget_ns;
+    _control->begin_spinning(_tag);
+    bool found = false;
+    do {
+        for (int i = 0; i < 32; ++i) {
+            cpu_relax();
+        }
+        if (_retiring.load(eabase::memory_order_relaxed) ||
+            _pl->get_state().stopped()) {
+            break;
+        }
+        found = next_task(tid);
+    } while (!found && eabase::cpuwide_time_ns() < deadline_ns);
+    // signal_task() may have skipped waking up a worker because of this
+    // one, and signals sent while spinning did not change the state saved
+    // before. Look again with the parking-lot state read after giving up
+    // the spin slot, so that park_for_task() does not miss later signals.
+    _control->end_spinning(_tag);
+    if (!found) {
+#ifndef FIBER_DONT_SAVE_PARKING_STATE
+        _last_pl_state = _pl->get_state();
+#endif
+        found = next_task(tid);
+    }
+    if (found) {
+        _control->_nspin_hit << 1;
+    } else {
+        _control->_nspin_miss << 1;
+    }
+    return found;
+}
+
+bool TaskGroup::park_for_task(fiber_t* tid) {
     do {
+        if (_retiring.load(eabase::memory_order_relaxed)) {
+            return false;
+        }
 #ifndef FIBER_DONT_SAVE_PARKING_STATE
         if (_last_pl_state.stopped()) {
             return false;
         }
-        _pl->wait(_last_pl_state);
-        if (steal_task(tid)) {
+        timespec timeout;
+        trace_sched_event(SCHED_TRACE_PARK, 0);
+        _pl->wait(_last_pl_state, local_timer_timeout(&timeout));
+        trace_sched_event(SCHED_TRACE_UNPARK, 0);
+        if (next_task(tid)) {
             return true;
         }
 #else
@@ -125,14 +213,117 @@ bool TaskGroup::wait_task(fiber_t* tid) {
         if (st.stopped()) {
             return false;
         }
-        if (steal_task(tid)) {
+        if (next_task(tid)) {
             return true;
         }
-        _pl->wait(st);
+        timespec timeout;
+        trace_sched_event(SCHED_TRACE_PARK, 0);
+        _pl->wait(st, local_timer_timeout(&timeout));
+        trace_sched_event(SCHED_TRACE_UNPARK, 0);
 #endif
     } while (true);
 }
 
+bool TaskGroup::next_task(fiber_t* tid) {
+    if (!_timer_queue.empty() &&
+        eabase::cpuwide_time_ns() >= _next_timer_check_ns) {
+        run_local_timers();
+    }
+    bool reversed = false;
+    if (++_nround_since_aging >= FLAGS_fiber_priority_aging_rounds) {
+        _nround_since_aging = 0;
+        reversed = true;
+    }
+    // A retiring worker only drains its local runqueues.
+    const bool retiring = _retiring.load(eabase::memory_order_relaxed);
+#ifndef FIBER_DONT_SAVE_PARKING_STATE
+    bool saved_pl_state = false;
+#endif
+    for (int i = 0; i < TASK_PRIORITY_NUM; ++i) {
+        const int prio = (reversed ? TASK_PRIORITY_NUM - 1 - i : i);
+        if (prio != TASK_PRIORITY_NORMAL && !_control->has_prio_tasks(_tag, prio)) {
+            continue;
+        }
+        bool found = pop_rq(prio, tid);
+        if (!found && !retiring) {
+            found = _remote_rq[prio].pop(tid);
+            if (!found) {
+#ifndef FIBER_DONT_SAVE_PARKING_STATE
+                // Save the state before the first steal so that tasks of
+                // any priority signalled after it wake up the worker.
+                if (!saved_pl_state) {
+                    _last_pl_state = _pl->get_state();
+                    saved_pl_state = true;
+                }
+#endif
+                found = _control->steal_task(tid, &_steal_seed,
+                                             _steal_offset, prio);
+                if (found) {
+                    trace_sched_event(SCHED_TRACE_STEAL, *tid, prio);
+                }
+            }
+        }
+        if (found) {
+            if (prio != TASK_PRIORITY_NORMAL) {
+                _control->add_prio_tasks(_tag, prio, -1);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskGroup::run_local_timers() {
+    const int64_t now_us = eabase::gettimeofday_us();
+    if (_timer_queue.next_run_time() > now_us) {
+        update_next_timer_check(now_us);
+        return;
+    }
+    const size_t n = _timer_queue.run_expired(now_us);
+    update_next_timer_check(now_us);
+    if (n == 0) {
+        return;
+    }
+    _control->_nlocal_timer << n;
+    if (n > 1) {
+        // This worker runs one of them, let others steal the rest.
+        _control->signal_task(n - 1, _tag);
+    }
+}
+
+void TaskGroup::update_next_timer_check(int64_t now_us) {
+    const int64_t next_us = _timer_queue.next_run_time();
+    if (next_us == std::numeric_limits<int64_t>::max()) {
+        _next_timer_check_ns = std::numeric_limits<int64_t>::max();
+        return;
+    }
+    _next_timer_check_ns = eabase::cpuwide_time_ns() +
+        std::max(next_us - now_us, (int64_t)0) * 1000L;
+}
+
+const timespec* TaskGroup::local_timer_timeout(timespec* buf) {
+    if (_timer_queue.empty()) {
+        return NULL;
+    }
+    const int64_t next_us = _timer_queue.next_run_time();
+    if (next_us == std::numeric_limits<int64_t>::max()) {
+        return NULL;
+    }
+    const int64_t timeout_us = next_us - eabase::gettimeofday_us();
+    *buf = eabase::microseconds_to_timespec(std::max(timeout_us, (int64_t)0));
+    return buf;
+}
+
+TimerThread::TaskId TaskGroup::schedule_timer(
+    void (*fn)(void*), void* arg, const timespec& abstime) {
+    if (FLAGS_fiber_worker_local_timer) {
+        // May be earlier than the cached check time.
+        _next_timer_check_ns = 0;
+        return _timer_queue.schedule(fn, arg, abstime);
+    }
+    return get_global_timer_thread()->schedule(fn, arg, abstime);
+}
+
 static double get_cumulated_cputime_from_this(void* arg) {
     return static_cast<TaskGroup*>(arg)->cumulated_cputime_ns() / 1000000000.0;
 }
@@ -182,12 +373,21 @@ TaskGroup::TaskGroup(TaskControl* c)
     , _pl(NULL)
     , _main_stack(NULL)
     , _main_tid(0)
+    , _nround_since_aging(0)
+    , _next_timer_check_ns(0)
     , _remote_num_nosignal(0)
     , _remote_nsignaled(0)
 #ifndef NDEBUG
     , _sched_recursive_guard(0)
 #endif
     , _tag(FIBER_TAG_DEFAULT)
+    , _numa_node(-1)
+    // Groups are created by their worker pthreads.
+    , _worker_pthread(pthread_self())
+    , _pinned_cpu(-1)
+    , _retiring(false)
+    , _trace_ring(NULL)
+    , _cpu_accounting_table(NULL)
 {
     _steal_seed = eabase::fast_rand();
     _steal_offset = OFFSET_TABLE[_steal_seed % ARRAY_SIZE(OFFSET_TABLE)];
@@ -202,16 +402,20 @@ TaskGroup::~TaskGroup() {
         return_resource(get_slot(_main_tid));
         _main_tid = 0;
     }
+    release_sched_trace_ring(_trace_ring);
+    release_cpu_accounting_table(_cpu_accounting_table);
 }
 
-int TaskGroup::init(size_t runqueue_capacity) {
-    if (_rq.init(runqueue_capacity) != 0) {
-        LOG(FATAL) << "Fail to init _rq";
-        return -1;
-    }
-    if (_remote_rq.init(runqueue_capacity / 2) != 0) {
-        LOG(FATAL) << "Fail to init _remote_rq";
-        return -1;
+int TaskGroup::init(size_t runqueue_capacity, size_t max_steal_batch) {
+    for (int i = 0; i < TASK_PRIORITY_NUM; ++i) {
+        if (_rq[i].init(runqueue_capacity, max_steal_batch) != 0) {
+            LOG(FATAL) << "Fail to init _rq";
+            return -1;
+        }
+        if (_remote_rq[i].init(runqueue_capacity / 2) != 0) {
+            LOG(FATAL) << "Fail to init _remote_rq";
+            return -1;
+        }
     }
     ContextualStack* stk = get_stack(STACK_TYPE_MAIN, NULL);
     if (NULL == stk) {
@@ -231,7 +435,10 @@ int TaskGroup::init(size_t runqueue_capacity) {
     m->arg = NULL;
     m->local_storage = LOCAL_STORAGE_INIT;
     m->cpuwide_start_ns = eabase::cpuwide_time_ns();
+    m->ready_ns = 0;
+    m->queue_ns = -1;
     m->stat = EMPTY_STAT;
+    m->cpu_label = NULL;
     m->attr = FIBER_ATTR_TASKGROUP;
     m->tid = make_tid(*m->version_butex, slot);
     m->set_stack(stk);
@@ -295,6 +502,10 @@ void TaskGroup::task_runner(intptr_t skip_remained) {
         // Group is probably changed
         g =  BAIDU_GET_VOLATILE_THREAD_LOCAL(tls_task_group);
 
+        if (FLAGS_fiber_stack_profile || FLAGS_fiber_stack_auto_class) {
+            profile_stack_usage(m->stack, m->fn);
+        }
+
         // TODO: Save thread_return
         (void)thread_return;
 
@@ -351,6 +562,34 @@ void TaskGroup::_release_last_context(void* arg) {
     return_resource(get_slot(m->tid));
 }
 
+static void init_task_meta(TaskMeta* m, eabase::ResourceId<TaskMeta> slot,
+                           const fiber_attr_t& attr, void* (*fn)(void*),
+                           void* arg, int64_t start_ns) {
+    CHECK(m->current_waiter.load(eabase::memory_order_relaxed) == NULL);
+    m->stop = false;
+    m->interrupted = false;
+    m->about_to_quit = false;
+    m->fn = fn;
+    m->arg = arg;
+    CHECK(m->stack == NULL);
+    m->attr = attr;
+    if (FLAGS_fiber_stack_auto_class &&
+        attr.stack_type == FIBER_STACKTYPE_NORMAL) {
+        m->attr.stack_type = suggest_stack_type(fn);
+    }
+    m->local_storage = LOCAL_STORAGE_INIT;
+    if (attr.flags & FIBER_INHERIT_SPAN) {
+        m->local_storage.rpcz_parent_span = tls_bls.rpcz_parent_span;
+    }
+    m->cpuwide_start_ns = start_ns;
+    m->ready_ns = 0;
+    m->queue_ns = -1;
+    m->stat = EMPTY_STAT;
+    m->cpu_label = NULL;
+    m->tid = make_tid(*m->version_butex, slot);
+    trace_sched_event(SCHED_TRACE_CREATE, m->tid, (uint64_t)fn);
+}
+
 int TaskGroup::start_foreground(TaskGroup** pg,
                                 fiber_t* __restrict th,
                                 const fiber_attr_t* __restrict attr,
@@ -366,21 +605,7 @@ int TaskGroup::start_foreground(TaskGroup** pg,
     if (__builtin_expect(!m, 0)) {
         return ENOMEM;
     }
-    CHECK(m->current_waiter.load(eabase::memory_order_relaxed) == NULL);
-    m->stop = false;
-    m->interrupted = false;
-    m->about_to_quit = false;
-    m->fn = fn;
-    m->arg = arg;
-    CHECK(m->stack == NULL);
-    m->attr = using_attr;
-    m->local_storage = LOCAL_STORAGE_INIT;
-    if (using_attr.flags & FIBER_INHERIT_SPAN) {
-        m->local_storage.rpcz_parent_span = tls_bls.rpcz_parent_span;
-    }
-    m->cpuwide_start_ns = start_ns;
-    m->stat = EMPTY_STAT;
-    m->tid = make_tid(*m->version_butex, slot);
+    init_task_meta(m, slot, using_attr, fn, arg, start_ns);
     *th = m->tid;
     if (using_attr.flags & FIBER_LOG_START_AND_FINISH) {
         LOG(INFO) << "Started fiber " << m->tid;
@@ -425,21 +650,7 @@ int TaskGroup::start_background(fiber_t* __restrict th,
     if (__builtin_expect(!m, 0)) {
         return ENOMEM;
     }
-    CHECK(m->current_waiter.load(eabase::memory_order_relaxed) == NULL);
-    m->stop = false;
-    m->interrupted = false;
-    m->about_to_quit = false;
-    m->fn = fn;
-    m->arg = arg;
-    CHECK(m->stack == NULL);
-    m->attr = using_attr;
-    m->local_storage = LOCAL_STORAGE_INIT;
-    if (using_attr.flags & FIBER_INHERIT_SPAN) {
-        m->local_storage.rpcz_parent_span = tls_bls.rpcz_parent_span;
-    }
-    m->cpuwide_start_ns = start_ns;
-    m->stat = EMPTY_STAT;
-    m->tid = make_tid(*m->version_butex, slot);
+    init_task_meta(m, slot, using_attr, fn, arg, start_ns);
     *th = m->tid;
     if (using_attr.flags & FIBER_LOG_START_AND_FINISH) {
         LOG(INFO) << "Started fiber " << m->tid;
@@ -466,6 +677,107 @@ TaskGroup::start_background<false>(fiber_t* __restrict th,
                                    void * (*fn)(void*),
                                    void* __restrict arg);
 
+template <bool REMOTE>
+int TaskGroup::start_background_batch(size_t n,
+                                      fiber_t* __restrict tids,
+                                      const fiber_attr_t* __restrict attrs,
+                                      void* (*const* fns)(void*),
+                                      void* const* args) {
+    for (size_t i = 0; i < n; ++i) {
+        if (__builtin_expect(!fns[i], 0)) {
+            return EINVAL;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+    const int64_t start_ns = eabase::cpuwide_time_ns();
+    DEFINE_SMALL_ARRAY(eabase::ResourceId<TaskMeta>, slots, n, 64);
+    DEFINE_SMALL_ARRAY(TaskMeta*, metas, n, 64);
+    const size_t got = eabase::get_resources(slots, metas, n);
+    if (got < n) {
+        for (size_t i = 0; i < got; ++i) {
+            return_resource(slots[i]);
+        }
+        return ENOMEM;
+    }
+    int nsignal = 0;
+    int prio_mask = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const fiber_attr_t& attr = (attrs ? attrs[i] : FIBER_ATTR_NORMAL);
+        TaskMeta* m = metas[i];
+        init_task_meta(m, slots[i], attr, fns[i], args[i], start_ns);
+        tids[i] = m->tid;
+        if (attr.flags & FIBER_LOG_START_AND_FINISH) {
+            LOG(INFO) << "Started fiber " << m->tid;
+        }
+        nsignal += !(attr.flags & FIBER_NOSIGNAL);
+        prio_mask |= (1 << attr_priority(attr));
+    }
+    _control->_nfibers << n;
+    _control->tag_nfibers(tag()) << n;
+
+    // Push tasks of each class with one runqueue operation.
+    DEFINE_SMALL_ARRAY(fiber_t, buf, n, 64);
+    for (int prio = 0; prio < TASK_PRIORITY_NUM; ++prio) {
+        if (!(prio_mask & (1 << prio))) {
+            continue;
+        }
+        const fiber_t* batch = tids;
+        size_t k = n;
+        if (prio_mask != (1 << prio)) {
+            k = 0;
+            for (size_t i = 0; i < n; ++i) {
+                if (metas[i]->priority() == prio) {
+                    buf[k++] = tids[i];
+                }
+            }
+            batch = buf;
+        }
+        if (REMOTE) {
+            push_remote_rq_batch(prio, batch, k);
+        } else {
+            push_rq_batch(prio, batch, k);
+        }
+    }
+
+    const int nnosignal = (int)n - nsignal;
+    if (REMOTE) {
+        if (nsignal == 0) {
+            _remote_num_nosignal.fetch_add(nnosignal, eabase::memory_order_relaxed);
+            return 0;
+        }
+        const int additional_signal = nnosignal + _remote_num_nosignal.exchange(
+            0, eabase::memory_order_relaxed);
+        _remote_nsignaled.fetch_add(nsignal + additional_signal,
+                                    eabase::memory_order_relaxed);
+        _control->signal_task(nsignal + additional_signal, _tag, true);
+    } else {
+        if (nsignal == 0) {
+            _num_nosignal += nnosignal;
+            return 0;
+        }
+        const int additional_signal = nnosignal + _num_nosignal;
+        _num_nosignal = 0;
+        _nsignaled += nsignal + additional_signal;
+        _control->signal_task(nsignal + additional_signal, _tag, true);
+    }
+    return 0;
+}
+
+template int
+TaskGroup::start_background_batch<true>(size_t n,
+                                        fiber_t* __restrict tids,
+                                        const fiber_attr_t* __restrict attrs,
+                                        void* (*const* fns)(void*),
+                                        void* const* args);
+template int
+TaskGroup::start_background_batch<false>(size_t n,
+                                         fiber_t* __restrict tids,
+                                         const fiber_attr_t* __restrict attrs,
+                                         void* (*const* fns)(void*),
+                                         void* const* args);
+
 int TaskGroup::join(fiber_t tid, void** return_value) {
     if (__builtin_expect(!tid, 0)) {  // tid of fiber is never 0.
         return EINVAL;
@@ -512,15 +824,7 @@ void TaskGroup::ending_sched(TaskGroup** pg) {
     TaskGroup* g = *pg;
     fiber_t next_tid = 0;
     // Find next task to run, if none, switch to idle thread of the group.
-#ifndef FIBER_FAIR_WSQ
-    // When FIBER_FAIR_WSQ is defined, profiling shows that cpu cost of
-    // WSQ::steal() in example/multi_threaded_echo_c++ changes from 1.9%
-    // to 2.9%
-    const bool popped = g->_rq.pop(&next_tid);
-#else
-    const bool popped = g->_rq.steal(&next_tid);
-#endif
-    if (!popped && !g->steal_task(&next_tid)) {
+    if (!g->next_task(&next_tid)) {
         // Jump to main task if there's no task to run.
         next_tid = g->_main_tid;
     }
@@ -553,12 +857,7 @@ void TaskGroup::sched(TaskGroup** pg) {
     TaskGroup* g = *pg;
     fiber_t next_tid = 0;
     // Find next task to run, if none, switch to idle thread of the group.
-#ifndef FIBER_FAIR_WSQ
-    const bool popped = g->_rq.pop(&next_tid);
-#else
-    const bool popped = g->_rq.steal(&next_tid);
-#endif
-    if (!popped && !g->steal_task(&next_tid)) {
+    if (!g->next_task(&next_tid)) {
         // Jump to main task if there's no task to run.
         next_tid = g->_main_tid;
     }
@@ -584,9 +883,31 @@ void TaskGroup::sched_to(TaskGroup** pg, TaskMeta* next_meta) {
     cur_meta->stat.cputime_ns += elp_ns;
     if (cur_meta->tid != g->main_tid()) {
         g->_cumulated_cputime_ns += elp_ns;
+        if (FLAGS_fiber_cpu_accounting) {
+            CpuAccountingTable* t = g->cpu_accounting_table();
+            if (t != NULL) {
+                if (cur_meta->cpu_label != NULL) {
+                    t->add(cur_meta->cpu_label, true, elp_ns,
+                           cur_meta->queue_ns);
+                } else {
+                    t->add((const void*)cur_meta->fn, false, elp_ns,
+                           cur_meta->queue_ns);
+                }
+            }
+        }
     }
     ++cur_meta->stat.nswitch;
     ++ g->_nswitch;
+    if (next_meta->ready_ns) {
+        next_meta->queue_ns = now - next_meta->ready_ns;
+        if (FLAGS_show_fiber_queue_latency_in_vars) {
+            g->_control->exposed_queue_latency(next_meta->priority()) <<
+                next_meta->queue_ns / 1000L;
+        }
+        next_meta->ready_ns = 0;
+    } else {
+        next_meta->queue_ns = -1;
+    }
     // Switch to the task
     if (__builtin_expect(next_meta != cur_meta, 1)) {
         g->_cur_meta = next_meta;
@@ -594,6 +915,9 @@ void TaskGroup::sched_to(TaskGroup** pg, TaskMeta* next_meta) {
         cur_meta->local_storage = tls_bls;
         tls_bls = next_meta->local_storage;
 
+        trace_sched_event(SCHED_TRACE_SWITCH_OUT, cur_meta->tid);
+        trace_sched_event(SCHED_TRACE_RUN, next_meta->tid);
+
         // Logging must be done after switching the local storage, since the logging lib
         // use fiber local storage internally, or will cause memory leak.
         if ((cur_meta->attr.flags & FIBER_LOG_CONTEXT_SWITCH) ||
@@ -639,10 +963,29 @@ void TaskGroup::sched_to(TaskGroup** pg, TaskMeta* next_meta) {
     *pg = g;
 }
 
+SchedTraceRing* TaskGroup::trace_ring() {
+    // Runs of the main task are told from others in dumped traces.
+    if (_trace_ring == NULL && _main_tid != 0) {
+        _trace_ring = acquire_sched_trace_ring(_tag, _main_tid);
+    }
+    return _trace_ring;
+}
+
+CpuAccountingTable* TaskGroup::cpu_accounting_table() {
+    if (_cpu_accounting_table == NULL) {
+        _cpu_accounting_table = acquire_cpu_accounting_table();
+    }
+    return _cpu_accounting_table;
+}
+
 void TaskGroup::destroy_self() {
     if (_control) {
         _control->_destroy_group(this);
-        _control = NULL;
+        // Retired groups still need the control to forward tasks pushed
+        // into them afterwards, see TaskControl::delete_task_group().
+        if (!_retiring.load(eabase::memory_order_relaxed)) {
+            _control = NULL;
+        }
     } else {
         CHECK(false);
     }
@@ -670,36 +1013,103 @@ void TaskGroup::flush_nosignal_tasks() {
 }
 
 void TaskGroup::ready_to_run_remote(fiber_t tid, bool nosignal) {
-    _remote_rq._mutex.lock();
-    while (!_remote_rq.push_locked(tid)) {
-        flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+    TaskMeta* m = address_meta(tid);
+    const int prio = m->priority();
+    if (FLAGS_show_fiber_queue_latency_in_vars || FLAGS_fiber_cpu_accounting) {
+        m->ready_ns = eabase::cpuwide_time_ns();
+    }
+    trace_sched_event(SCHED_TRACE_READY, tid, prio);
+    if (prio != TASK_PRIORITY_NORMAL) {
+        _control->add_prio_tasks(_tag, prio, 1);
+    }
+    while (!_remote_rq[prio].push(tid)) {
+        flush_nosignal_tasks_remote();
         LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
-                                << _remote_rq.capacity();
+                                << _remote_rq[prio].capacity();
         ::usleep(1000);
-        _remote_rq._mutex.lock();
     }
     if (nosignal) {
-        ++_remote_num_nosignal;
-        _remote_rq._mutex.unlock();
+        _remote_num_nosignal.fetch_add(1, eabase::memory_order_relaxed);
     } else {
-        const int additional_signal = _remote_num_nosignal;
-        _remote_num_nosignal = 0;
-        _remote_nsignaled += 1 + additional_signal;
-        _remote_rq._mutex.unlock();
+        const int additional_signal = _remote_num_nosignal.exchange(
+            0, eabase::memory_order_relaxed);
+        _remote_nsignaled.fetch_add(1 + additional_signal,
+                                    eabase::memory_order_relaxed);
         _control->signal_task(1 + additional_signal, _tag);
     }
 }
 
-void TaskGroup::flush_nosignal_tasks_remote_locked(eabase::Mutex& locked_mutex) {
-    const int val = _remote_num_nosignal;
-    if (!val) {
-        locked_mutex.unlock();
+void TaskGroup::on_tasks_ready(int prio, const fiber_t* tids, size_t n) {
+    if (FLAGS_show_fiber_queue_latency_in_vars || FLAGS_fiber_cpu_accounting) {
+        const int64_t now = eabase::cpuwide_time_ns();
+        for (size_t i = 0; i < n; ++i) {
+            address_meta(tids[i])->ready_ns = now;
+        }
+    }
+    if (FLAGS_fiber_trace) {
+        for (size_t i = 0; i < n; ++i) {
+            record_sched_event(SCHED_TRACE_READY, tids[i], prio);
+        }
+    }
+    if (prio != TASK_PRIORITY_NORMAL) {
+        _control->add_prio_tasks(_tag, prio, n);
+    }
+}
+
+void TaskGroup::keep_stolen_tasks(int prio, const fiber_t* tids, size_t n) {
+    _control->_nsteal << 1;
+    _control->_nstolen << (1 + n);
+    if (n == 0) {
         return;
     }
-    _remote_num_nosignal = 0;
-    _remote_nsignaled += val;
-    locked_mutex.unlock();
-    _control->signal_task(val, _tag);
+    // The stolen tasks were counted and stamped when they were pushed
+    // into the victim, just move them.
+    const size_t pushed = _rq[prio].push_batch(tids, n);
+    for (size_t i = pushed; i < n; ++i) {
+        while (!_remote_rq[prio].push(tids[i])) {
+            LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
+                                    << _remote_rq[prio].capacity();
+            ::usleep(1000);
+        }
+    }
+    if (n > 1) {
+        // Let one more idle worker steal from here, so that a burst
+        // landing on one worker spreads quickly.
+        _control->signal_task(1, _tag);
+    }
+}
+
+void TaskGroup::push_rq_batch(int prio, const fiber_t* tids, size_t n) {
+    on_tasks_ready(prio, tids, n);
+    while (true) {
+        const size_t pushed = _rq[prio].push_batch(tids, n);
+        tids += pushed;
+        n -= pushed;
+        if (n == 0) {
+            break;
+        }
+        // Same as push_rq()
+        flush_nosignal_tasks();
+        LOG_EVERY_SECOND(ERROR) << "_rq is full, capacity="
+                                << _rq[prio].capacity();
+        ::usleep(1000);
+    }
+}
+
+void TaskGroup::push_remote_rq_batch(int prio, const fiber_t* tids, size_t n) {
+    on_tasks_ready(prio, tids, n);
+    while (true) {
+        const size_t pushed = _remote_rq[prio].push_batch(tids, n);
+        tids += pushed;
+        n -= pushed;
+        if (n == 0) {
+            break;
+        }
+        flush_nosignal_tasks_remote();
+        LOG_EVERY_SECOND(ERROR) << "_remote_rq is full, capacity="
+                                << _remote_rq[prio].capacity();
+        ::usleep(1000);
+    }
 }
 
 void TaskGroup::ready_to_run_general(fiber_t tid, bool nosignal) {
@@ -734,8 +1144,13 @@ struct SleepArgs {
 };
 
 static void ready_to_run_from_timer_thread(void* arg) {
-    CHECK(tls_task_group == NULL);
     const SleepArgs* e = static_cast<const SleepArgs*>(arg);
+    TaskGroup* local_group = tls_task_group;
+    if (local_group != NULL) {
+        // Run by TimerQueue of the worker which suspended the fiber.
+        local_group->push_rq(e->tid);
+        return;
+    }
     auto g = e->group;
     auto tag = g->tag();
     g->control()->choose_one_group(tag)->ready_to_run_remote(e->tid);
@@ -749,7 +1164,7 @@ void TaskGroup::_add_sleep_event(void* void_args) {
     TaskGroup* g = e.group;
 
     TimerThread::TaskId sleep_id;
-    sleep_id = get_global_timer_thread()->schedule(
+    sleep_id = g->schedule_timer(
         ready_to_run_from_timer_thread, void_args,
         eabase::microseconds_from_now(e.timeout_us));
 
@@ -17,6 +17,7 @@
 #ifndef FIBER_TASK_GROUP_H_
 #define FIBER_TASK_GROUP_H_
 
+#include <gflags/gflags_declare.h>
 #include "eabase/utility/time.h"                             // cpuwide_time_ns
 #include "eabase/fiber/task_control.h"
 #include "eabase/fiber/task_meta.h"                     // fiber_t, TaskMeta
@@ -24,9 +25,16 @@
 #include "eabase/fiber/remote_task_queue.h"             // RemoteTaskQueue
 #include "eabase/utility/resource_pool.h"                    // ResourceId
 #include "eabase/fiber/parking_lot.h"
+#include "eabase/fiber/idle_spin.h"                      // IdleSpinner
+#include "eabase/fiber/timer_thread.h"                   // TimerQueue
+#include "eabase/fiber/sched_trace.h"                    // SchedTraceRing
+#include "eabase/fiber/cpu_accounting.h"                 // CpuAccountingTable
 
 namespace eabase {
 
+DECLARE_bool(show_fiber_queue_latency_in_vars);
+DECLARE_bool(fiber_worker_local_timer);
+
 // For exiting a fiber.
 class ExitException : public std::exception {
 public:
@@ -48,6 +56,9 @@ private:
 // function are updated before returning.
 class TaskGroup {
 public:
+    // Upper bound of -task_group_steal_batch.
+    static const size_t MAX_STEAL_BATCH = 64;
+
     // Create task `fn(arg)' with attributes `attr' in TaskGroup *pg and put
     // the identifier into `tid'. Switch to the new task and schedule old task
     // to run.
@@ -69,6 +80,19 @@ public:
                          void * (*fn)(void*),
                          void* __restrict arg);
 
+    // Create `n' tasks `fns[i](args[i])' with attributes `attrs[i]' (all
+    // default if `attrs' is NULL) in this TaskGroup and put the identifiers
+    // into `tids'. TaskMetas are allocated in bulk, tasks are pushed into
+    // runqueues in batch and workers are signalled once. Either all tasks
+    // are created or none of them is.
+    // Return 0 on success, errno otherwise.
+    template <bool REMOTE>
+    int start_background_batch(size_t n,
+                               fiber_t* __restrict tids,
+                               const fiber_attr_t* __restrict attrs,
+                               void* (*const* fns)(void*),
+                               void* const* args);
+
     // Suspend caller and run next fiber in TaskGroup *pg.
     static void sched(TaskGroup** pg);
     static void ending_sched(TaskGroup** pg);
@@ -152,7 +176,6 @@ public:
 
     // Push a fiber into the runqueue from another non-worker thread.
     void ready_to_run_remote(fiber_t tid, bool nosignal = false);
-    void flush_nosignal_tasks_remote_locked(eabase::Mutex& locked_mutex);
     void flush_nosignal_tasks_remote();
 
     // Automatically decide the caller is remote or local, and call
@@ -160,6 +183,15 @@ public:
     void ready_to_run_general(fiber_t tid, bool nosignal = false);
     void flush_nosignal_tasks_general();
 
+    // Schedule |fn(arg)| to run at realtime |abstime| for timing out a fiber
+    // of this group. When -fiber_worker_local_timer is on, the task is run
+    // by the worker of this group, otherwise by the global TimerThread.
+    // Must be called in the worker of this group.
+    // Returns: identifier of the task which is unscheduled by
+    // TimerThread::unschedule(), INVALID_TASK_ID on error.
+    TimerThread::TaskId schedule_timer(void (*fn)(void*), void* arg,
+                                       const timespec& abstime);
+
     // The TaskControl that this TaskGroup belongs to.
     TaskControl* control() const { return _control; }
 
@@ -173,19 +205,34 @@ public:
     // Get the meta associate with the task.
     static TaskMeta* address_meta(fiber_t tid);
 
-    // Push a task into _rq, if _rq is full, retry after some time. This
-    // process make go on indefinitely.
+    // Push a task into _rq of its priority, if _rq is full, retry after some
+    // time. This process make go on indefinitely.
     void push_rq(fiber_t tid);
 
     fiber_tag_t tag() const { return _tag; }
 
+    // NUMA node of this group, -1 if workers are not grouped by node.
+    int numa_node() const { return _numa_node; }
+
+    // Ring recording scheduling events of this worker when -fiber_trace is
+    // on, created at the first call. Must be called in the worker of this
+    // group. Returns NULL on error.
+    SchedTraceRing* trace_ring();
+
+    // Usage of fibers run by this worker when -fiber_cpu_accounting is on,
+    // created at the first call. Must be called in the worker of this
+    // group. Returns NULL on error.
+    CpuAccountingTable* cpu_accounting_table();
+
 private:
 friend class TaskControl;
 
     // You shall use TaskControl::create_group to create new instance.
     explicit TaskGroup(TaskControl*);
 
-    int init(size_t runqueue_capacity);
+    // `max_steal_batch' is the max # of tasks that other groups steal from
+    // _rq at once.
+    int init(size_t runqueue_capacity, size_t max_steal_batch);
 
     // You shall call destroy_self() instead of destructor because deletion
     // of groups are postponed to avoid race.
@@ -201,6 +248,13 @@ friend class TaskControl;
         bool nosignal;
     };
     static void ready_to_run_in_worker(void*);
+    // Push `n' tasks of class `prio' into _rq or _remote_rq in batch.
+    void push_rq_batch(int prio, const fiber_t* tids, size_t n);
+    void push_remote_rq_batch(int prio, const fiber_t* tids, size_t n);
+    // Put tasks stolen in batch (except the one to run) into _rq.
+    void keep_stolen_tasks(int prio, const fiber_t* tids, size_t n);
+    // Stamp tasks pushed into runqueues of class `prio'.
+    void on_tasks_ready(int prio, const fiber_t* tids, size_t n);
     static void ready_to_run_in_worker_ignoresignal(void*);
 
     // Wait for a task to run.
@@ -208,20 +262,51 @@ friend class TaskControl;
     // loop calling this function should end.
     bool wait_task(fiber_t* tid);
 
-    bool steal_task(fiber_t* tid) {
-        if (_remote_rq.pop(tid)) {
-            return true;
-        }
-#ifndef FIBER_DONT_SAVE_PARKING_STATE
-        _last_pl_state = _pl->get_state();
+    // Look for tasks without parking as long as the spin policy of the tag
+    // allows, see -fiber_tag_spin_policy.
+    // Returns true if a task was found.
+    bool spin_for_task(const TagSpinPolicy& policy, int64_t begin_ns,
+                       fiber_t* tid);
+
+    // Park until a task is found. Returns false on permanent error.
+    bool park_for_task(fiber_t* tid);
+
+    // Find the next task to run from runqueues of this group and other
+    // groups. Classes of higher priority are tried first, except that every
+    // -fiber_priority_aging_rounds picks the order is reversed so that
+    // lower classes are never starved.
+    bool next_task(fiber_t* tid);
+
+    // Run expired tasks in _timer_queue, which push timed-out fibers into
+    // _rq of this group.
+    void run_local_timers();
+
+    // Timeout of parking so that the worker wakes up for the earliest task
+    // in _timer_queue. Returns NULL if there's no such task.
+    const timespec* local_timer_timeout(timespec* buf);
+
+    // Remember when the earliest task in _timer_queue expires in cpuwide
+    // time, so that next_task() checks timers without reading realtime.
+    void update_next_timer_check(int64_t now_us);
+
+    // Pop a task of class `prio' from the local runqueue.
+    bool pop_rq(int prio, fiber_t* tid) {
+#ifndef FIBER_FAIR_WSQ
+        // When FIBER_FAIR_WSQ is defined, profiling shows that cpu cost of
+        // WSQ::steal() in example/multi_threaded_echo_c++ changes from 1.9%
+        // to 2.9%
+        return _rq[prio].pop(tid);
+#else
+        return _rq[prio].steal(tid);
 #endif
-        return _control->steal_task(tid, &_steal_seed, _steal_offset);
     }
 
     void set_tag(fiber_tag_t tag) { _tag = tag; }
 
     void set_pl(ParkingLot* pl) { _pl = pl; }
 
+    void set_numa_node(int node) { _numa_node = node; }
+
     TaskMeta* _cur_meta;
     
     // the control that this group belongs to
@@ -244,14 +329,38 @@ friend class TaskControl;
     size_t _steal_offset;
     ContextualStack* _main_stack;
     fiber_t _main_tid;
-    WorkStealingQueue<fiber_t> _rq;
-    RemoteTaskQueue _remote_rq;
-    int _remote_num_nosignal;
-    int _remote_nsignaled;
+
+    // Runqueues indexed by TaskPriority.
+    WorkStealingQueue<fiber_t> _rq[TASK_PRIORITY_NUM];
+    RemoteTaskQueue _remote_rq[TASK_PRIORITY_NUM];
+    // # of tasks picked since the priority order was reversed last time.
+    int _nround_since_aging;
+    // Learns how long this worker usually stays idle.
+    IdleSpinner _idle_spinner;
+    // Timeouts of fibers suspended in this worker.
+    TimerQueue _timer_queue;
+    // cpuwide_time_ns() when run_local_timers() looks at _timer_queue again.
+    int64_t _next_timer_check_ns;
+    // Updated by non-worker pthreads concurrently since _remote_rq is
+    // lock-free.
+    eabase::atomic<int> _remote_num_nosignal;
+    eabase::atomic<int> _remote_nsignaled;
 
     int _sched_recursive_guard;
     // tag of this taskgroup
     fiber_tag_t _tag;
+    int _numa_node;
+    // The worker pthread running this group.
+    pthread_t _worker_pthread;
+    // Cpu that the worker was pinned to by TaskControl, -1 if not pinned.
+    int _pinned_cpu;
+    // Set by TaskControl::remove_workers(), the worker quits once it runs
+    // out of local tasks.
+    eabase::atomic<bool> _retiring;
+    // See trace_ring().
+    SchedTraceRing* _trace_ring;
+    // See cpu_accounting_table().
+    CpuAccountingTable* _cpu_accounting_table;
 };
 
 }  // namespace eabase
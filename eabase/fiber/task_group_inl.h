@@ -74,7 +74,16 @@ inline void TaskGroup::sched_to(TaskGroup** pg, fiber_t next_tid) {
 }
 
 inline void TaskGroup::push_rq(fiber_t tid) {
-    while (!_rq.push(tid)) {
+    TaskMeta* m = address_meta(tid);
+    const int prio = m->priority();
+    if (FLAGS_show_fiber_queue_latency_in_vars || FLAGS_fiber_cpu_accounting) {
+        m->ready_ns = eabase::cpuwide_time_ns();
+    }
+    trace_sched_event(SCHED_TRACE_READY, tid, prio);
+    if (prio != TASK_PRIORITY_NORMAL) {
+        _control->add_prio_tasks(_tag, prio, 1);
+    }
+    while (!_rq[prio].push(tid)) {
         // Created too many fibers: a promising approach is to insert the
         // task into another TaskGroup, but we don't use it because:
         // * There're already many fibers to run, inserting the fiber
@@ -83,7 +92,8 @@ inline void TaskGroup::push_rq(fiber_t tid) {
         //   are busy at creating fibers (proved by test_input_messenger in
         //   eabase)
         flush_nosignal_tasks();
-        LOG_EVERY_SECOND(ERROR) << "_rq is full, capacity=" << _rq.capacity();
+        LOG_EVERY_SECOND(ERROR) << "_rq is full, capacity="
+                                << _rq[prio].capacity();
         // TODO(gejun): May cause deadlock when all workers are spinning here.
         // A better solution is to pop and run existing fibers, however which
         // make set_remained()-callbacks do context switches and need extensive
@@ -93,9 +103,13 @@ inline void TaskGroup::push_rq(fiber_t tid) {
 }
 
 inline void TaskGroup::flush_nosignal_tasks_remote() {
-    if (_remote_num_nosignal) {
-        _remote_rq._mutex.lock();
-        flush_nosignal_tasks_remote_locked(_remote_rq._mutex);
+    if (_remote_num_nosignal.load(eabase::memory_order_relaxed)) {
+        const int val = _remote_num_nosignal.exchange(
+            0, eabase::memory_order_relaxed);
+        if (val) {
+            _remote_nsignaled.fetch_add(val, eabase::memory_order_relaxed);
+            _control->signal_task(val, _tag);
+        }
     }
 }
 
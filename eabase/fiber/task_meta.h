@@ -43,6 +43,23 @@ struct LocalStorage {
 
 const static LocalStorage LOCAL_STORAGE_INIT = FIBER_LOCAL_STORAGE_INITIALIZER;
 
+// Scheduling classes of tasks, smaller values are preferred. Each class has
+// its own runqueues in TaskGroup.
+enum TaskPriority {
+    TASK_PRIORITY_HIGH = 0,
+    TASK_PRIORITY_NORMAL = 1,
+    TASK_PRIORITY_LOW = 2,
+};
+static const int TASK_PRIORITY_NUM = 3;
+
+inline int attr_priority(const fiber_attr_t& attr) {
+    if (attr.flags & FIBER_HIGH_PRIORITY) {
+        return TASK_PRIORITY_HIGH;
+    }
+    return (attr.flags & FIBER_LOW_PRIORITY) ? TASK_PRIORITY_LOW
+                                             : TASK_PRIORITY_NORMAL;
+}
+
 struct TaskMeta {
     // [Not Reset]
     eabase::atomic<ButexWaiter*> current_waiter;
@@ -79,8 +96,19 @@ struct TaskMeta {
     
     // Statistics
     int64_t cpuwide_start_ns;
+    // When the task was pushed into a runqueue, 0 if not recorded. Only
+    // set when -show_fiber_queue_latency_in_vars or -fiber_cpu_accounting
+    // is on.
+    int64_t ready_ns;
+    // Time the task stayed in the runqueue before the current run, -1 if
+    // not recorded.
+    int64_t queue_ns;
     TaskStatistics stat;
 
+    // Usage of the task is accounted to this label instead of `fn' when
+    // it's not NULL, see fiber_set_cpu_label().
+    const char* cpu_label;
+
     // fiber local storage, sync with tls_bls (defined in task_group.cpp)
     // when the fiber is created or destroyed.
     // DO NOT use this field directly, use tls_bls instead.
@@ -117,6 +145,8 @@ public:
     StackType stack_type() const {
         return static_cast<StackType>(attr.stack_type);
     }
+
+    int priority() const { return attr_priority(attr); }
 };
 
 }  // namespace eabase
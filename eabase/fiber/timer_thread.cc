@@ -23,6 +23,20 @@
 #include "eabase/fiber/sys_futex.h"
 #include "eabase/fiber/timer_thread.h"
 #include "eabase/fiber/log.h"
+#include "eabase/fiber/numa.h"                  // parse_cpulist
+#include "eabase/fiber/cpu_affinity.h"          // set_thread_cpus
+#include "eabase/fiber/timing_wheel.h"
+#include <gflags/gflags.h>
+
+DECLARE_string(fiber_service_cpus);
+
+DEFINE_bool(fiber_timer_use_timing_wheel, false, "Order tasks of the global "
+            "timer thread with a hierarchical timing wheel instead of a heap, "
+            "see TimerThreadOptions.use_timing_wheel. Only read when fiber "
+            "starts");
+DEFINE_int32(fiber_timer_wheel_tick_us, 100, "Resolution of the timing wheel "
+             "of the global timer thread in microseconds. Only read when "
+             "fiber starts");
 
 namespace eabase {
 
@@ -32,11 +46,14 @@ void run_worker_startfn();
 const TimerThread::TaskId TimerThread::INVALID_TASK_ID = 0;
 
 TimerThreadOptions::TimerThreadOptions()
-    : num_buckets(13) {
+    : num_buckets(13)
+    , use_timing_wheel(false)
+    , timing_wheel_tick_us(100) {
 }
 
 // A task contains the necessary information for running fn(arg).
-// Tasks are created in Bucket::schedule and destroyed in TimerThread::run
+// Tasks are created in new_task and destroyed in TimerThread::run or
+// TimerQueue::run_expired
 struct EA_CACHELINE_ALIGNMENT TimerThread::Task {
     Task* next;                 // For linking tasks in a Bucket.
     int64_t run_time;           // run the task at this realtime
@@ -72,15 +89,9 @@ public:
 
     ~Bucket() {}
 
-    struct ScheduleResult {
-        TimerThread::TaskId task_id;
-        bool earlier;
-    };
-    
     // Schedule a task into this bucket.
-    // Returns the TaskId and if it has the nearest run time.
-    ScheduleResult schedule(void (*fn)(void*), void* arg,
-                            const timespec& abstime);
+    // Returns true if it has the nearest run time.
+    bool schedule(Task* task);
 
     // Pull all scheduled tasks.
     // This function is called in timer thread.
@@ -148,6 +159,11 @@ int TimerThread::start(const TimerThreadOptions* options_in) {
         LOG(ERROR) << "num_buckets=" << _options.num_buckets << " is too big";
         return EINVAL;
     }
+    if (_options.use_timing_wheel && _options.timing_wheel_tick_us <= 0) {
+        LOG(ERROR) << "Invalid timing_wheel_tick_us="
+                   << _options.timing_wheel_tick_us;
+        return EINVAL;
+    }
     _buckets = new (std::nothrow) Bucket[_options.num_buckets];
     if (NULL == _buckets) {
         LOG(ERROR) << "Fail to new _buckets";
@@ -177,14 +193,13 @@ TimerThread::Task* TimerThread::Bucket::consume_tasks() {
     return head;
 }
 
-TimerThread::Bucket::ScheduleResult
-TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
-                              const timespec& abstime) {
-    eabase::ResourceId<Task> slot_id;
-    Task* task = eabase::get_resource<Task>(&slot_id);
+// Allocate a task running fn(arg) at abstime, NULL on error.
+static TimerThread::Task* new_task(void (*fn)(void*), void* arg,
+                                   const timespec& abstime) {
+    eabase::ResourceId<TimerThread::Task> slot_id;
+    TimerThread::Task* task = eabase::get_resource<TimerThread::Task>(&slot_id);
     if (task == NULL) {
-        ScheduleResult result = { INVALID_TASK_ID, false };
-        return result;
+        return NULL;
     }
     task->next = NULL;
     task->fn = fn;
@@ -195,8 +210,11 @@ TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
         task->version.fetch_add(2, eabase::memory_order_relaxed);
         version = 2;
     }
-    const TaskId id = make_task_id(slot_id, version);
-    task->task_id = id;
+    task->task_id = make_task_id(slot_id, version);
+    return task;
+}
+
+bool TimerThread::Bucket::schedule(Task* task) {
     bool earlier = false;
     {
         BAIDU_SCOPED_LOCK(_mutex);
@@ -207,8 +225,7 @@ TimerThread::Bucket::schedule(void (*fn)(void*), void* arg,
             earlier = true;
         }
     }
-    ScheduleResult result = { id, earlier };
-    return result;
+    return earlier;
 }
 
 TimerThread::TaskId TimerThread::schedule(
@@ -217,13 +234,21 @@ TimerThread::TaskId TimerThread::schedule(
         // Not add tasks when TimerThread is about to stop.
         return INVALID_TASK_ID;
     }
+    Task* task = new_task(fn, arg, abstime);
+    if (task == NULL) {
+        return INVALID_TASK_ID;
+    }
+    const TaskId id = task->task_id;
+    schedule_task(task);
+    return id;
+}
+
+void TimerThread::schedule_task(Task* task) {
+    const int64_t run_time = task->run_time;
     // Hashing by pthread id is better for cache locality.
-    const Bucket::ScheduleResult result = 
-        _buckets[eabase::fmix64(pthread_numeric_id()) % _options.num_buckets]
-        .schedule(fn, arg, abstime);
-    if (result.earlier) {
+    if (_buckets[eabase::fmix64(pthread_numeric_id()) % _options.num_buckets]
+        .schedule(task)) {
         bool earlier = false;
-        const int64_t run_time = eabase::timespec_to_microseconds(abstime);
         {
             BAIDU_SCOPED_LOCK(_mutex);
             if (run_time < _nearest_run_time) {
@@ -236,7 +261,6 @@ TimerThread::TaskId TimerThread::schedule(
             futex_wake_private(&_nsignals, 1);
         }
     }
-    return result.task_id;
 }
 
 // Notice that we don't recycle the Task in this function, let TimerThread::run
@@ -313,12 +337,29 @@ void TimerThread::run() {
     logging::ComlogInitializer comlog_initializer;
 #endif
 
+    if (!_options.cpus.empty()) {
+        std::vector<int> cpus;
+        const int rc = (parse_cpulist(_options.cpus, &cpus) == 0 ?
+                        set_thread_cpus(pthread_self(), cpus) : EINVAL);
+        if (rc) {
+            LOG(WARNING) << "Fail to pin TimerThread to cpus="
+                         << _options.cpus << ", " << berror(rc);
+        }
+    }
+
     int64_t last_sleep_time = eabase::gettimeofday_us();
     BT_VLOG << "Started TimerThread=" << pthread_self();
 
     // min heap of tasks (ordered by run_time)
     std::vector<Task*> tasks;
-    tasks.reserve(4096);
+    // or the timing wheel when _options.use_timing_wheel is true.
+    TimingWheel<Task> wheel;
+    const bool use_wheel = _options.use_timing_wheel;
+    if (use_wheel) {
+        wheel.init(_options.timing_wheel_tick_us, last_sleep_time);
+    } else {
+        tasks.reserve(4096);
+    }
 
     // vars
     size_t nscheduled = 0;
@@ -354,8 +395,25 @@ void TimerThread::run() {
                 Task* next_task = p->next;
 
                 if (!p->try_delete()) { // remove the task if it's unscheduled
-                    tasks.push_back(p);
-                    std::push_heap(tasks.begin(), tasks.end(), task_greater);
+                    if (use_wheel) {
+                        wheel.add(p);
+                    } else {
+                        tasks.push_back(p);
+                        std::push_heap(tasks.begin(), tasks.end(), task_greater);
+                    }
+                }
+                p = next_task;
+            }
+        }
+
+        if (use_wheel) {
+            // Tasks scheduled during running are pulled in next round and
+            // run at ticks not earlier than theirs, no need to check
+            // _nearest_run_time before each of them.
+            for (Task* p = wheel.advance(eabase::gettimeofday_us()); p;) {
+                Task* next_task = p->next;
+                if (p->run_and_delete()) {
+                    ++ntriggered;
                 }
                 p = next_task;
             }
@@ -398,7 +456,9 @@ void TimerThread::run() {
 
         // The realtime to wait for.
         int64_t next_run_time = std::numeric_limits<int64_t>::max();
-        if (!tasks.empty()) {
+        if (use_wheel) {
+            next_run_time = wheel.next_run_time();
+        } else if (!tasks.empty()) {
             next_run_time = tasks[0]->run_time;
         }
         // Similarly with the situation before running tasks, we check
@@ -449,6 +509,95 @@ void TimerThread::stop_and_join() {
     }
 }
 
+// Unscheduled tasks are swept when the heap doubles since the last sweep
+// and has at least so many tasks.
+static const size_t TIMER_QUEUE_MIN_SWEEP_SIZE = 64;
+
+TimerQueue::TimerQueue() : _sweep_size(TIMER_QUEUE_MIN_SWEEP_SIZE) {}
+
+TimerQueue::~TimerQueue() {
+    move_to(get_global_timer_thread());
+}
+
+TimerThread::TaskId TimerQueue::schedule(
+    void (*fn)(void*), void* arg, const timespec& abstime) {
+    TimerThread::Task* task = new_task(fn, arg, abstime);
+    if (task == NULL) {
+        return TimerThread::INVALID_TASK_ID;
+    }
+    if (_tasks.size() >= _sweep_size) {
+        sweep();
+    }
+    _tasks.push_back(task);
+    std::push_heap(_tasks.begin(), _tasks.end(), task_greater);
+    return task->task_id;
+}
+
+void TimerQueue::sweep() {
+    size_t n = 0;
+    for (size_t i = 0; i < _tasks.size(); ++i) {
+        if (!_tasks[i]->try_delete()) {
+            _tasks[n++] = _tasks[i];
+        }
+    }
+    _tasks.resize(n);
+    std::make_heap(_tasks.begin(), _tasks.end(), task_greater);
+    _sweep_size = std::max(n * 2, TIMER_QUEUE_MIN_SWEEP_SIZE);
+}
+
+size_t TimerQueue::run_expired(int64_t now_us) {
+    size_t ntriggered = 0;
+    while (!_tasks.empty() && _tasks[0]->run_time <= now_us) {
+        TimerThread::Task* task = _tasks[0];
+        std::pop_heap(_tasks.begin(), _tasks.end(), task_greater);
+        _tasks.pop_back();
+        // fn(arg) may schedule new tasks into this queue.
+        if (task->run_and_delete()) {
+            ++ntriggered;
+        }
+    }
+    return ntriggered;
+}
+
+int64_t TimerQueue::next_run_time() {
+    while (!_tasks.empty() && _tasks[0]->try_delete()) {
+        std::pop_heap(_tasks.begin(), _tasks.end(), task_greater);
+        _tasks.pop_back();
+    }
+    if (_tasks.empty()) {
+        return std::numeric_limits<int64_t>::max();
+    }
+    return _tasks[0]->run_time;
+}
+
+void TimerQueue::move_to(TimerThread* tt) {
+    const bool running = (tt != NULL && tt->_started &&
+                          !tt->_stop.load(eabase::memory_order_relaxed));
+    for (size_t i = 0; i < _tasks.size(); ++i) {
+        TimerThread::Task* task = _tasks[i];
+        if (task->try_delete()) {
+            continue;
+        }
+        if (running) {
+            tt->schedule_task(task);
+        } else {
+            // Mark it as removed like unscheduling, later unschedule() of
+            // the id returns -1.
+            const uint32_t id_version = version_of_task_id(task->task_id);
+            uint32_t expected_version = id_version;
+            if (task->version.compare_exchange_strong(
+                    expected_version, id_version + 2,
+                    eabase::memory_order_relaxed)) {
+                eabase::return_resource(slot_of_task_id(task->task_id));
+            } else {
+                // Unscheduled just now.
+                task->try_delete();
+            }
+        }
+    }
+    _tasks.clear();
+}
+
 static pthread_once_t g_timer_thread_once = PTHREAD_ONCE_INIT;
 static TimerThread* g_timer_thread = NULL;
 static void init_global_timer_thread() {
@@ -459,6 +608,9 @@ static void init_global_timer_thread() {
     }
     TimerThreadOptions options;
     options.var_prefix = "fiber_timer";
+    options.cpus = FLAGS_fiber_service_cpus;
+    options.use_timing_wheel = FLAGS_fiber_timer_use_timing_wheel;
+    options.timing_wheel_tick_us = FLAGS_fiber_timer_wheel_tick_us;
     const int rc = g_timer_thread->start(&options);
     if (rc != 0) {
         LOG(FATAL) << "Fail to start timer_thread, " << berror(rc);
@@ -18,8 +18,10 @@
 #ifndef FIBER_TIMER_THREAD_H_
 #define FIBER_TIMER_THREAD_H_
 
+#include <limits>                     // std::numeric_limits
 #include <vector>                     // std::vector
 #include <pthread.h>                  // pthread_*
+#include "eabase/utility/macros.h"
 #include "eabase/utility/atomicops.h"
 #include "eabase/utility/time.h"                // time utilities
 #include "eabase/fiber/mutex.h"
@@ -40,6 +42,23 @@ struct TimerThreadOptions {
     // Default: ""
     std::string var_prefix;
 
+    // If this field is not empty, the timer thread is pinned to these cpus,
+    // in format of kernel cpulist like "0-1".
+    // Default: ""
+    std::string cpus;
+
+    // Order tasks in the timer thread with a hierarchical timing wheel
+    // instead of a heap. Both adding and dropping unscheduled tasks are O(1)
+    // for the timer thread, which matters when there're lots of pending
+    // tasks and most of them are unscheduled before running. Tasks run at
+    // most `timing_wheel_tick_us' later than the scheduled time.
+    // Default: false
+    bool use_timing_wheel;
+
+    // Resolution of the timing wheel in microseconds.
+    // Default: 100
+    int64_t timing_wheel_tick_us;
+
     // Constructed with default options.
     TimerThreadOptions();
 };
@@ -83,6 +102,10 @@ public:
     pthread_t thread_id() const { return _thread; }
     
 private:
+friend class TimerQueue;
+    // Add a task created by schedule() or TimerQueue::schedule().
+    void schedule_task(Task* task);
+
     // the timer thread will run this method.
     void run();
     static void* run_this(void* arg);
@@ -100,6 +123,54 @@ private:
     pthread_t _thread;       // all scheduled task will be run on this thread
 };
 
+// Tasks scheduled and run by one thread, typically a fiber worker checking
+// expired tasks in its scheduling loop, so that the callbacks run in that
+// thread without waking up the TimerThread. Ids returned by schedule() are
+// unscheduled by TimerThread::unschedule() from any thread just like the
+// ones returned by TimerThread::schedule().
+// Not thread-safe except unscheduling.
+class TimerQueue {
+public:
+    TimerQueue();
+    // Remaining tasks are moved to the global TimerThread.
+    ~TimerQueue();
+
+    // Schedule |fn(arg)| to run at realtime |abstime| approximately, when
+    // the owner calls run_expired() after that.
+    // Returns: identifier of the scheduled task, INVALID_TASK_ID on error.
+    TimerThread::TaskId schedule(void (*fn)(void*), void* arg,
+                                 const timespec& abstime);
+
+    // Run tasks whose run_time is not after `now_us'.
+    // Returns number of tasks that did run (not unscheduled).
+    size_t run_expired(int64_t now_us);
+
+    // Realtime in microseconds of the earliest task, std::numeric_limits<
+    // int64_t>::max() if there's no task. Unscheduled tasks at the top are
+    // deleted first.
+    int64_t next_run_time();
+
+    // Number of tasks, including unscheduled ones not deleted yet.
+    size_t size() const { return _tasks.size(); }
+    bool empty() const { return _tasks.empty(); }
+
+    // Move all tasks to `tt' which runs them at the same time instead.
+    // The tasks are dropped if `tt' is NULL or stopped.
+    void move_to(TimerThread* tt);
+
+private:
+    EA_DISALLOW_COPY_AND_ASSIGN(TimerQueue);
+
+    // Delete unscheduled tasks in the heap, which are otherwise kept until
+    // their run_time.
+    void sweep();
+
+    // min heap of tasks (ordered by run_time)
+    std::vector<TimerThread::Task*> _tasks;
+    // sweep() when _tasks grows to this size.
+    size_t _sweep_size;
+};
+
 // Get the global TimerThread which never quits.
 TimerThread* get_or_create_global_timer_thread();
 TimerThread* get_global_timer_thread();
@@ -0,0 +1,231 @@
+// Copyright 2023 The EA Authors.
+// part of Elastic AI Search
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//
+
+#ifndef FIBER_TIMING_WHEEL_H_
+#define FIBER_TIMING_WHEEL_H_
+
+#include <stdint.h>
+#include <string.h>                          // memset
+#include <limits>                            // std::numeric_limits
+#include "eabase/utility/logging.h"
+
+namespace eabase {
+
+// Hierarchical timing wheel ordering tasks by run time at the resolution of
+// one tick. Adding a task is O(1). A task is placed in the level covering
+// its distance and only moved to lower levels (cascaded) when the wheel
+// reaches its slot, so tasks unscheduled before then are dropped without
+// ever being sorted.
+// T must have:
+//   T* next;              // linking tasks in a slot
+//   int64_t run_time;     // in microseconds
+//   bool try_delete();    // delete the task and return true if cancelled
+// Not thread-safe, used by the timer thread only.
+template <typename T>
+class TimingWheel {
+public:
+    static const int SLOT_BITS = 8;
+    static const int NSLOT = (1 << SLOT_BITS);
+    static const int NLEVEL = 4;
+
+    TimingWheel()
+        : _tick_us(0)
+        , _current_tick(0)
+        , _size(0)
+        , _overdue(NULL) {
+        memset(_slots, 0, sizeof(_slots));
+    }
+
+    // `tick_us' is the resolution, tasks run at the first tick not earlier
+    // than their run_time. Ticks before `now_us' are treated as expired.
+    int init(int64_t tick_us, int64_t now_us) {
+        if (tick_us <= 0) {
+            LOG(ERROR) << "Invalid tick_us=" << tick_us;
+            return -1;
+        }
+        _tick_us = tick_us;
+        _current_tick = now_us / tick_us;
+        return 0;
+    }
+
+    void add(T* task) {
+        ++_size;
+        add_at_tick(task, tick_of(task->run_time));
+    }
+
+    // Move tasks whose ticks are not after `now_us' into a list linked by
+    // `next' and return its head, cancelled tasks are deleted while being
+    // cascaded.
+    T* advance(int64_t now_us) {
+        T* expired = _overdue;
+        _overdue = NULL;
+        const int64_t now_tick = now_us / _tick_us;
+        if (_size == 0) {
+            if (now_tick > _current_tick) {
+                _current_tick = now_tick;
+            }
+            return take(expired);
+        }
+        while (_current_tick < now_tick) {
+            if (now_tick - _current_tick > NSLOT) {
+                // Far behind after a long idle period or a clock jump, skip
+                // ticks reaching empty slots instead of walking one by one.
+                const int64_t busy_tick = next_busy_tick();
+                if (busy_tick > now_tick) {
+                    _current_tick = now_tick;
+                    break;
+                }
+                _current_tick = busy_tick - 1;
+            }
+            const int64_t t = _current_tick + 1;
+            if ((t & (NSLOT - 1)) == 0) {
+                // Cascade from the highest level so that tasks moved down
+                // are cascaded again by lower levels in the same tick.
+                int top = 1;
+                while (top + 1 < NLEVEL &&
+                       ((t >> (SLOT_BITS * top)) & (NSLOT - 1)) == 0) {
+                    ++top;
+                }
+                for (int level = top; level >= 1; --level) {
+                    cascade(level, t);
+                }
+            }
+            T*& slot = _slots[0][t & (NSLOT - 1)];
+            while (slot) {
+                T* task = slot;
+                slot = task->next;
+                task->next = expired;
+                expired = task;
+            }
+            _current_tick = t;
+        }
+        return take(expired);
+    }
+
+    // Realtime in microseconds when advance() should be called next,
+    // std::numeric_limits<int64_t>::max() if the wheel is empty.
+    int64_t next_run_time() const {
+        if (_overdue) {
+            return 0;
+        }
+        const int64_t next_tick = next_busy_tick();
+        if (next_tick == std::numeric_limits<int64_t>::max()) {
+            return next_tick;
+        }
+        return next_tick * _tick_us;
+    }
+
+    // # of tasks in the wheel, including cancelled ones not dropped yet.
+    size_t size() const { return _size; }
+
+    int64_t tick_us() const { return _tick_us; }
+
+private:
+    int64_t tick_of(int64_t run_time) const {
+        if (run_time > std::numeric_limits<int64_t>::max() - _tick_us) {
+            return std::numeric_limits<int64_t>::max() / _tick_us;
+        }
+        return (run_time + _tick_us - 1) / _tick_us;
+    }
+
+    void add_at_tick(T* task, int64_t tick) {
+        if (tick <= _current_tick) {
+            task->next = _overdue;
+            _overdue = task;
+            return;
+        }
+        // A slot of `level' is reached again after NSLOT slots of that
+        // level, use the lowest level that reaches the tick in time.
+        int level = 0;
+        while (level < NLEVEL &&
+               (tick >> (SLOT_BITS * level)) -
+               (_current_tick >> (SLOT_BITS * level)) > NSLOT) {
+            ++level;
+        }
+        if (level == NLEVEL) {
+            // Beyond the wheel, placed at the farthest slot and added again
+            // when it's cascaded.
+            level = NLEVEL - 1;
+            tick = ((_current_tick >> (SLOT_BITS * level)) + NSLOT)
+                << (SLOT_BITS * level);
+        }
+        T*& slot = _slots[level][(tick >> (SLOT_BITS * level)) & (NSLOT - 1)];
+        task->next = slot;
+        slot = task;
+    }
+
+    // The earliest tick reaching a non-empty slot of any level,
+    // std::numeric_limits<int64_t>::max() if the wheel is empty.
+    int64_t next_busy_tick() const {
+        int64_t next_tick = std::numeric_limits<int64_t>::max();
+        if (_size == 0) {
+            return next_tick;
+        }
+        for (int level = 0; level < NLEVEL; ++level) {
+            const int shift = SLOT_BITS * level;
+            const int64_t base = (_current_tick >> shift);
+            for (int64_t k = 1; k <= NSLOT; ++k) {
+                const int64_t tick = ((base + k) << shift);
+                if (tick >= next_tick) {
+                    break;
+                }
+                if (_slots[level][(base + k) & (NSLOT - 1)]) {
+                    next_tick = tick;
+                    break;
+                }
+            }
+        }
+        return next_tick;
+    }
+
+    // Move tasks in the slot of `level' reached at tick `t' to lower levels.
+    void cascade(int level, int64_t t) {
+        T*& slot = _slots[level][(t >> (SLOT_BITS * level)) & (NSLOT - 1)];
+        T* p = slot;
+        slot = NULL;
+        // _current_tick is t - 1, tasks at tick `t' go to _slots[0] which is
+        // taken right after.
+        while (p) {
+            T* next = p->next;
+            if (p->try_delete()) {
+                --_size;
+            } else {
+                add_at_tick(p, tick_of(p->run_time));
+            }
+            p = next;
+        }
+    }
+
+    // Count tasks leaving the wheel.
+    T* take(T* expired) {
+        for (T* p = expired; p; p = p->next) {
+            --_size;
+        }
+        return expired;
+    }
+
+    int64_t _tick_us;
+    // Ticks not after this one were expired.
+    int64_t _current_tick;
+    size_t _size;
+    // Tasks added after their ticks passed.
+    T* _overdue;
+    T* _slots[NLEVEL][NSLOT];
+};
+
+}  // namespace eabase
+
+#endif  // FIBER_TIMING_WHEEL_H_
@@ -47,6 +47,12 @@ static const fiber_attrflags_t FIBER_LOG_CONTEXT_SWITCH = 16;
 static const fiber_attrflags_t FIBER_NOSIGNAL = 32;
 static const fiber_attrflags_t FIBER_NEVER_QUIT = 64;
 static const fiber_attrflags_t FIBER_INHERIT_SPAN = 128;
+// Scheduling classes. Ready fibers of higher priority run before those of
+// lower priority, while low-priority fibers still get a guaranteed share of
+// the workers, see -fiber_priority_aging_rounds. Fibers without these flags
+// have normal priority.
+static const fiber_attrflags_t FIBER_HIGH_PRIORITY = 256;
+static const fiber_attrflags_t FIBER_LOW_PRIORITY = 512;
 
 // Key of thread-local data, created by fiber_key_create.
 typedef struct {
@@ -135,6 +141,37 @@ static const fiber_attr_t FIBER_ATTR_DEBUG = {
     FIBER_STACKTYPE_NORMAL, FIBER_LOG_START_AND_FINISH | FIBER_LOG_CONTEXT_SWITCH, NULL,
     FIBER_TAG_INVALID};
 
+// Cpu placement of worker pthreads of a tag, see fiber_set_tag_affinity().
+typedef struct {
+    // Cpus that workers may run on, in format of kernel cpulist like
+    // "0-3,8". NULL or "" means all cpus.
+    const char* cpus;
+    // Non-zero to pin each worker to a single cpu of `cpus', spreading
+    // workers over the cpus evenly.
+    int pin_per_core;
+    // Non-zero to keep workers off cpus of -fiber_service_cpus, where the
+    // timer thread runs.
+    int exclude_service_cpus;
+} fiber_affinity_t;
+
+// How idle workers of a tag spin before parking on futex, see
+// fiber_set_tag_spin_policy().
+// Park directly.
+static const int FIBER_SPIN_NONE = 0;
+// Spin for max_spin_us.
+static const int FIBER_SPIN_FIXED = 1;
+// Spin as long as idle periods of the worker usually last, up to
+// max_spin_us. Workers that are idle for long park directly.
+static const int FIBER_SPIN_ADAPTIVE = 2;
+
+typedef struct {
+    int mode;
+    // Max microseconds of one spinning, in [1, 10000].
+    int max_spin_us;
+    // Max share of a worker's time spent on spinning, in [1, 100].
+    int max_cpu_percent;
+} fiber_spin_policy_t;
+
 static const size_t FIBER_EPOLL_THREAD_NUM = 1;
 static const fiber_t FIBER_ATOMIC_INIT = 0;
 
@@ -175,13 +212,51 @@ typedef struct {
 } fiber_condattr_t;
 
 typedef struct {
+    // State of writers, readers wait on it while a writer holds or is
+    // acquiring the lock.
+    unsigned* butex;
+    // Sequence the acquiring writer waits on for readers to leave.
+    unsigned* writer_butex;
+    // Per-thread counters of readers, see rwlock.cc.
+    void* reader_counts;
+    // Serializes writers.
+    fiber_mutex_t writer_mutex;
+    fiber_contention_site_t writer_csite;
+    int kind;
 } fiber_rwlock_t;
 
+// Kinds of fiber_rwlockattr_setkind_np(), same values as
+// PTHREAD_RWLOCK_PREFER_*_NP of glibc.
+// New readers get in while a writer is waiting for readers to leave, the
+// writer may starve under continuous reads. Default.
+static const int FIBER_RWLOCK_PREFER_READER_NP = 0;
+// New readers wait behind the waiting writer. Both kinds prefer writers.
+static const int FIBER_RWLOCK_PREFER_WRITER_NP = 1;
+static const int FIBER_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP = 2;
+
 typedef struct {
+    int kind;
 } fiber_rwlockattr_t;
 
+typedef struct {
+    // Number of available permits, waiters sleep on it.
+    unsigned* butex;
+    // Number of threads that may be sleeping on the butex, posts skip the
+    // wakeup when it's 0.
+    unsigned nwaiter;
+} fiber_sem_t;
+
+// Returned by fiber_barrier_wait() to one of the threads of each round,
+// same as PTHREAD_BARRIER_SERIAL_THREAD.
+static const int FIBER_BARRIER_SERIAL_THREAD = -1;
+
 typedef struct {
     unsigned int count;
+    // Total number of arrivals. Waiters of adjacent rounds are released by
+    // different semaphores so that a fast thread entering the next round
+    // can't take permits of slow threads of the previous round.
+    uint64_t narrival;
+    fiber_sem_t sems[2];
 } fiber_barrier_t;
 
 typedef struct {
@@ -19,6 +19,8 @@
 
 #include <pthread.h>
 #include <sys/socket.h>
+#include <sys/types.h>                          // off_t
+#include <sys/uio.h>                            // iovec
 #include "eabase/fiber/types.h"
 #include "eabase/fiber/errno.h"
 
@@ -74,6 +76,21 @@ extern int fiber_close(int fd);
 extern int fiber_connect(int sockfd, const struct sockaddr* serv_addr,
                            socklen_t addrlen);
 
+// Replacements of pread(2), pwrite(2), preadv(2), pwritev(2) and fsync(2)
+// which suspend the calling fiber instead of the worker pthread. The I/O
+// is run by io_uring when -fiber_file_io_use_io_uring is on and supported,
+// by a bounded pool of pthreads otherwise. Called from pthreads, they're
+// same as the system calls. Not interruptible since the buffers may be
+// used by the kernel until the I/O is done.
+extern ssize_t fiber_pread(int fd, void* buf, size_t count, off_t offset);
+extern ssize_t fiber_pwrite(int fd, const void* buf, size_t count,
+                            off_t offset);
+extern ssize_t fiber_preadv(int fd, const struct iovec* iov, int iovcnt,
+                            off_t offset);
+extern ssize_t fiber_pwritev(int fd, const struct iovec* iov, int iovcnt,
+                             off_t offset);
+extern int fiber_fsync(int fd);
+
 // Add a startup function that each pthread worker will run at the beginning
 // To run code at the end, use eabase::thread_atexit()
 // Returns 0 on success, error code otherwise.
@@ -82,6 +99,52 @@ extern int fiber_set_worker_startfn(void (*start_fn)());
 // Add a startup function with tag
 extern int fiber_set_tagged_worker_startfn(void (*start_fn)(fiber_tag_t));
 
+// Set cpu placement of worker pthreads in `tag', see fiber_affinity_t.
+// Existing workers are placed again immediately and workers added later
+// follow the policy as well. The policy can also be set by
+// -fiber_tag_affinity.
+// Returns 0 on success, error code otherwise.
+extern int fiber_set_tag_affinity(fiber_tag_t tag,
+                                  const fiber_affinity_t* affinity);
+
+// Set how idle worker pthreads in `tag' spin before parking, see
+// fiber_spin_policy_t. Idle workers that are usually woken up within
+// microseconds find new tasks by spinning and save the futex syscalls of
+// parking and being woken up. The policy can also be set by
+// -fiber_tag_spin_policy.
+// Returns 0 on success, error code otherwise.
+extern int fiber_set_tag_spin_policy(fiber_tag_t tag,
+                                     const fiber_spin_policy_t* policy);
+
+// Write cpus that each worker of `tag' is actually allowed to run on into
+// `buf' as space-separated cpulists, e.g. "0 1 2 3" for 4 workers pinned
+// to cpu 0-3 respectively. At most len - 1 characters are written.
+// Returns length of the full placement, -1 otherwise and errno is set.
+extern int fiber_get_tag_placement(fiber_tag_t tag, char* buf, size_t len);
+
+// Account cpu time, runs and queueing delay of the calling fiber to
+// `label' instead of its entry function when -fiber_cpu_accounting is on,
+// so that fibers sharing a generic entry (e.g. consumers of different
+// ExecutionQueues) can be told apart. `label' must be valid until the
+// program exits, e.g. a string literal. NULL restores the default.
+// Returns 0 on success, EPERM if the caller is not a fiber.
+extern int fiber_set_cpu_label(const char* label);
+
+// Write the `top_n' entries consuming the most cpu time of fibers, see
+// -fiber_cpu_accounting, into `buf' as lines of
+//   cpu=<ms>ms(<percentage>) runs=<n> avg_queue=<us>us <function or label>
+// At most len - 1 characters are written.
+// Returns length of the full report, -1 otherwise and errno is set.
+extern int fiber_get_cpu_report(char* buf, size_t len, int top_n);
+
+// Write scheduling events recorded in the last `window_us' microseconds
+// into file `path' in the JSON format of Chrome trace events, which can be
+// opened by chrome://tracing or https://ui.perfetto.dev. Events are
+// recorded only when -fiber_trace is on, which can be switched at runtime.
+// Events of all recorded time are written if `window_us' is not positive.
+// Returns 0 on success, -1 otherwise and errno is set.
+extern int fiber_trace_dump(const char* path, int64_t window_us);
+
 // Stop all fiber and worker pthreads.
 // You should avoid calling this function which may cause fiber after main()
 // suspend indefinitely.
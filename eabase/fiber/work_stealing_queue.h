@@ -29,6 +29,7 @@ public:
     WorkStealingQueue()
         : _bottom(1)
         , _capacity(0)
+        , _max_steal_batch(1)
         , _buffer(NULL)
         , _top(1) {
     }
@@ -38,7 +39,11 @@ public:
         _buffer = NULL;
     }
 
-    int init(size_t capacity) {
+    // steal_batch() takes at most `max_steal_batch' items at once. pop()
+    // competes with stealers by CAS when no more than `max_steal_batch'
+    // items are left, otherwise a batch stealer may claim the same item.
+    // 1 keeps the classical behavior.
+    int init(size_t capacity, size_t max_steal_batch = 1) {
         if (_capacity != 0) {
             LOG(ERROR) << "Already initialized";
             return -1;
@@ -52,11 +57,16 @@ public:
                        << " which must be power of 2";
             return -1;
         }
+        if (max_steal_batch == 0 || max_steal_batch > capacity) {
+            LOG(ERROR) << "Invalid max_steal_batch=" << max_steal_batch;
+            return -1;
+        }
         _buffer = new(std::nothrow) T[capacity];
         if (NULL == _buffer) {
             return -1;
         }
         _capacity = capacity;
+        _max_steal_batch = max_steal_batch;
         return 0;
     }
 
@@ -75,6 +85,28 @@ public:
         return true;
     }
 
+    // Push at most `n' items into the queue, publishing all of them with
+    // one store.
+    // Returns # of items pushed, which is less than `n' when the queue
+    // becomes full.
+    // May run in parallel with steal().
+    // Never run in parallel with pop() or another push().
+    size_t push_batch(const T* xs, size_t n) {
+        const size_t b = _bottom.load(eabase::memory_order_relaxed);
+        const size_t t = _top.load(eabase::memory_order_acquire);
+        const size_t room = (b >= t + _capacity ? 0 : t + _capacity - b);
+        if (n > room) {
+            n = room;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            _buffer[(b + i) & (_capacity - 1)] = xs[i];
+        }
+        if (n) {
+            _bottom.store(b + n, eabase::memory_order_release);
+        }
+        return n;
+    }
+
     // Pop an item from the queue.
     // Returns true on popped and the item is written to `val'.
     // May run in parallel with steal().
@@ -96,12 +128,23 @@ public:
             return false;
         }
         *val = _buffer[newb & (_capacity - 1)];
-        if (t != newb) {
+        if (newb - t >= _max_steal_batch) {
+            // A stealer which read _bottom before us claims at most
+            // _max_steal_batch items from `t', the bottom one is out of its
+            // reach even if we popped several times in the meanwhile.
             return true;
         }
-        // Single last element, compete with steal()
+        // Close to the top, compete with steal() and steal_batch(). Owning
+        // _top makes all stale stealers fail, then the oldest item moves to
+        // the bottom slot we just took, so the newest one is still returned.
+        const T oldest = _buffer[t & (_capacity - 1)];
         const bool popped = _top.compare_exchange_strong(
             t, t + 1, eabase::memory_order_seq_cst, eabase::memory_order_relaxed);
+        if (popped && t != newb) {
+            _buffer[newb & (_capacity - 1)] = oldest;
+            _bottom.store(b, eabase::memory_order_release);
+            return true;
+        }
         _bottom.store(b, eabase::memory_order_relaxed);
         return popped;
     }
@@ -129,6 +172,41 @@ public:
         return true;
     }
 
+    // Steal up to half of the items (no more than `max_n' and
+    // max_steal_batch of init()) with one CAS. Stolen items are written to
+    // `out' from the oldest one.
+    // Returns # of items stolen.
+    // May run in parallel with push() pop() or another steal().
+    size_t steal_batch(T* out, size_t max_n) {
+        size_t t = _top.load(eabase::memory_order_acquire);
+        size_t b = _bottom.load(eabase::memory_order_acquire);
+        if (t >= b || max_n == 0) {
+            // Permit false negative for performance considerations.
+            return 0;
+        }
+        if (max_n > _max_steal_batch) {
+            max_n = _max_steal_batch;
+        }
+        size_t n = 0;
+        do {
+            eabase::atomic_thread_fence(eabase::memory_order_seq_cst);
+            b = _bottom.load(eabase::memory_order_acquire);
+            if (t >= b) {
+                return 0;
+            }
+            n = (b - t + 1) / 2;
+            if (n > max_n) {
+                n = max_n;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                out[i] = _buffer[(t + i) & (_capacity - 1)];
+            }
+        } while (!_top.compare_exchange_strong(t, t + n,
+                                               eabase::memory_order_seq_cst,
+                                               eabase::memory_order_relaxed));
+        return n;
+    }
+
     size_t volatile_size() const {
         const size_t b = _bottom.load(eabase::memory_order_relaxed);
         const size_t t = _top.load(eabase::memory_order_relaxed);
@@ -136,6 +214,7 @@ public:
     }
 
     size_t capacity() const { return _capacity; }
+    size_t max_steal_batch() const { return _max_steal_batch; }
 
 private:
     // Copying a concurrent structure makes no sense.
@@ -143,6 +222,7 @@ private:
 
     eabase::atomic<size_t> _bottom;
     size_t _capacity;
+    size_t _max_steal_batch;
     T* _buffer;
     EA_CACHELINE_ALIGNMENT eabase::atomic<size_t> _top;
 };
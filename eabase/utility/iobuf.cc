@@ -39,6 +39,15 @@
 #include "eabase/utility/fd_guard.h"                 // eabase::fd_guard
 #include "eabase/utility/iobuf.h"
 
+__BEGIN_DECLS
+// Defined in eabase/fiber/file_io.cc, suspending only the calling fiber
+// instead of the worker pthread.
+ssize_t EA_WEAK fiber_preadv(int fd, const struct iovec* iov, int iovcnt,
+                             off_t offset);
+ssize_t EA_WEAK fiber_pwritev(int fd, const struct iovec* iov, int iovcnt,
+                              off_t offset);
+__END_DECLS
+
 namespace eabase {
 namespace iobuf {
 
@@ -945,7 +954,8 @@ ssize_t IOBuf::pcut_into_file_descriptor(int fd, off_t offset, size_t size_hint)
     ssize_t nw = 0;
 
     if (offset >= 0) {
-        static iobuf::iov_function pwritev_func = iobuf::get_pwritev_func();
+        static iobuf::iov_function pwritev_func =
+            (fiber_pwritev != NULL ? fiber_pwritev : iobuf::get_pwritev_func());
         nw = pwritev_func(fd, vec, nvec, offset);
     } else {
         nw = ::writev(fd, vec, nvec);
@@ -1072,7 +1082,8 @@ ssize_t IOBuf::pcut_multiple_into_file_descriptor(
 
     ssize_t nw = 0;
     if (offset >= 0) {
-        static iobuf::iov_function pwritev_func = iobuf::get_pwritev_func();
+        static iobuf::iov_function pwritev_func =
+            (fiber_pwritev != NULL ? fiber_pwritev : iobuf::get_pwritev_func());
         nw = pwritev_func(fd, vec, nvec, offset);
     } else {
         nw = ::writev(fd, vec, nvec);
@@ -1613,7 +1624,8 @@ ssize_t IOPortal::pappend_from_file_descriptor(
     if (offset < 0) {
         nr = readv(fd, vec, nvec);
     } else {
-        static iobuf::iov_function preadv_func = iobuf::get_preadv_func();
+        static iobuf::iov_function preadv_func =
+            (fiber_preadv != NULL ? fiber_preadv : iobuf::get_preadv_func());
         nr = preadv_func(fd, vec, nvec, offset);
     }
     if (nr <= 0) {  // -1 or 0
@@ -163,6 +163,8 @@ public:
     // Cut at most `size_hint' bytes(approximately) into the file descriptor at
     // a given offset(from the start of the file). The file offset is not changed.
     // If `offset' is negative, does exactly what cut_into_file_descriptor does.
+    // Called in a fiber, only the fiber is suspended during the write, see
+    // fiber_pwritev in eabase/fiber/unstable.h.
     // Returns bytes cut on success, -1 otherwise and errno is set.
     //
     // NOTE: POSIX requires that a file open with the O_APPEND flag should
@@ -462,6 +464,8 @@ public:
     // Read at most `max_count' bytes from file descriptor `fd' at a given
     // offset and append to self. The file offset is not changed.
     // If `offset' is negative, does exactly what append_from_file_descriptor does.
+    // Called in a fiber, only the fiber is suspended during the read, see
+    // fiber_preadv in eabase/fiber/unstable.h.
     ssize_t pappend_from_file_descriptor(int fd, off_t offset, size_t max_count);
 
     // Read as many bytes as possible from SSL channel `ssl', and stop until `max_count'.
@@ -109,6 +109,16 @@ inline T* get_resource(ResourceId<T>* id, const A1& arg1, const A2& arg2) {
     return ResourcePool<T>::singleton()->get_resource(id, arg1, arg2);
 }
 
+// Get |n| objects typed |T| at once, write their identifiers into |ids| and
+// addresses into |objs|. Cheaper than calling get_resource<T> |n| times
+// since the thread-local pool is looked up only once.
+// Returns # of objects got, which is less than |n| only when memory is
+// exhausted.
+template <typename T>
+inline size_t get_resources(ResourceId<T>* ids, T** objs, size_t n) {
+    return ResourcePool<T>::singleton()->get_resources(ids, objs, n);
+}
+
 // Return the object associated with identifier |id| back. The object is NOT
 // destructed and will be returned by later get_resource<T>. Similar with
 // free/delete, validity of the id is not checked, user shall not return a
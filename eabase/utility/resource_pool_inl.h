@@ -303,6 +303,21 @@ public:
         return NULL;
     }
 
+    inline size_t get_resources(ResourceId<T>* ids, T** objs, size_t n) {
+        LocalPool* lp = get_or_new_local_pool();
+        if (__builtin_expect(lp == NULL, 0)) {
+            return 0;
+        }
+        size_t i = 0;
+        for (; i < n; ++i) {
+            objs[i] = lp->get(&ids[i]);
+            if (objs[i] == NULL) {
+                break;
+            }
+        }
+        return i;
+    }
+
     inline int return_resource(ResourceId<T> id) {
         LocalPool* lp = get_or_new_local_pool();
         if (__builtin_expect(lp != NULL, 1)) {
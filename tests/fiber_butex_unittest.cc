@@ -443,4 +443,173 @@ TEST(ButexTest, wait_with_signal_triggered) {
     eabase::butex_destroy(butex);
 }
 
+struct WaitAnyArg {
+    int* butexes[3];
+    int expected_result;
+    int expected_errno;
+    const timespec* abstime;
+    bool selector;
+};
+
+void* wait_any(void* void_arg) {
+    WaitAnyArg* arg = static_cast<WaitAnyArg*>(void_arg);
+    int rc = 0;
+    if (arg->selector) {
+        eabase::ButexSelector selector;
+        for (size_t i = 0; i < 3; ++i) {
+            EXPECT_EQ((int)i, selector.add(arg->butexes[i], *arg->butexes[i]));
+        }
+        rc = selector.wait(arg->abstime);
+    } else {
+        const int expected_values[3] = {
+            *arg->butexes[0], *arg->butexes[1], *arg->butexes[2] };
+        rc = eabase::butex_wait_any((void**)arg->butexes, expected_values, 3,
+                                    arg->abstime);
+    }
+    EXPECT_EQ(arg->expected_result, rc);
+    if (rc < 0) {
+        EXPECT_EQ(arg->expected_errno, errno);
+    }
+    return NULL;
+}
+
+TEST(ButexTest, wait_any) {
+    int* butexes[3];
+    for (int i = 0; i < 3; ++i) {
+        butexes[i] = eabase::butex_create_checked<int>();
+        *butexes[i] = i;
+    }
+    for (int pthread = 0; pthread < 2; ++pthread) {
+        for (int i = 0; i < 3; ++i) {
+            WaitAnyArg arg = { { butexes[0], butexes[1], butexes[2] },
+                               i, 0, NULL, i == 1 };
+            fiber_t th;
+            pthread_t pth;
+            if (pthread) {
+                ASSERT_EQ(0, pthread_create(&pth, NULL, wait_any, &arg));
+            } else {
+                ASSERT_EQ(0, fiber_start(&th, NULL, wait_any, &arg));
+            }
+            usleep(10000);
+            ASSERT_EQ(1, eabase::butex_wake(butexes[i]));
+            if (pthread) {
+                ASSERT_EQ(0, pthread_join(pth, NULL));
+            } else {
+                ASSERT_EQ(0, fiber_join(th, NULL));
+            }
+            // Removed from the other butexes as well.
+            for (int j = 0; j < 3; ++j) {
+                ASSERT_EQ(0, eabase::butex_wake(butexes[j]));
+            }
+        }
+    }
+    // Unmatched value.
+    const int expected_values[3] = { 0, 2, 2 };
+    ASSERT_EQ(1, eabase::butex_wait_any((void**)butexes, expected_values, 3,
+                                        NULL));
+    ASSERT_EQ(-1, eabase::butex_wait_any((void**)butexes, expected_values, 0,
+                                         NULL));
+    ASSERT_EQ(EINVAL, errno);
+    for (int i = 0; i < 3; ++i) {
+        eabase::butex_destroy(butexes[i]);
+    }
+}
+
+TEST(ButexTest, wait_any_timeout_and_interrupt) {
+    int* butexes[3];
+    for (int i = 0; i < 3; ++i) {
+        butexes[i] = eabase::butex_create_checked<int>();
+        *butexes[i] = 0;
+    }
+    for (int pthread = 0; pthread < 2; ++pthread) {
+        eabase::Timer tm;
+        const timespec abstime = eabase::milliseconds_from_now(20);
+        WaitAnyArg arg = { { butexes[0], butexes[1], butexes[2] },
+                           -1, ETIMEDOUT, &abstime, false };
+        fiber_t th;
+        tm.start();
+        if (pthread) {
+            ASSERT_EQ(0, fiber_start(&th, &FIBER_ATTR_PTHREAD,
+                                     wait_any, &arg));
+        } else {
+            ASSERT_EQ(0, fiber_start(&th, NULL, wait_any, &arg));
+        }
+        ASSERT_EQ(0, fiber_join(th, NULL));
+        tm.stop();
+        ASSERT_GE(tm.m_elapsed(), 15);
+        for (int j = 0; j < 3; ++j) {
+            ASSERT_EQ(0, eabase::butex_wake(butexes[j]));
+        }
+
+        WaitAnyArg arg2 = { { butexes[0], butexes[1], butexes[2] },
+                            -1, EINTR, NULL, true };
+        if (pthread) {
+            ASSERT_EQ(0, fiber_start(&th, &FIBER_ATTR_PTHREAD,
+                                     wait_any, &arg2));
+        } else {
+            ASSERT_EQ(0, fiber_start(&th, NULL, wait_any, &arg2));
+        }
+        usleep(10000);
+        ASSERT_EQ(0, fiber_interrupt(th));
+        ASSERT_EQ(0, fiber_join(th, NULL));
+        for (int j = 0; j < 3; ++j) {
+            ASSERT_EQ(0, eabase::butex_wake(butexes[j]));
+        }
+    }
+    for (int i = 0; i < 3; ++i) {
+        eabase::butex_destroy(butexes[i]);
+    }
+}
+
+const int WAIT_ANY_ROUNDS = 2000;
+
+struct WaitAnyStressArg {
+    int* butexes[2];
+    eabase::atomic<int>* nwoken;
+};
+
+void* wait_any_repeatedly(void* void_arg) {
+    WaitAnyStressArg* arg = static_cast<WaitAnyStressArg*>(void_arg);
+    const int expected_values[2] = { 0, 0 };
+    for (int i = 0; i < WAIT_ANY_ROUNDS; ) {
+        const int rc = eabase::butex_wait_any(
+            (void**)arg->butexes, expected_values, 2, NULL);
+        EXPECT_TRUE(rc == 0 || rc == 1) << rc;
+        if (rc >= 0) {
+            arg->nwoken->fetch_add(1);
+            ++i;
+        }
+    }
+    return NULL;
+}
+
+TEST(ButexTest, wait_any_wakes_exactly_one_per_wakeup) {
+    // Every wakeup reported by butex_wake must be consumed by exactly one
+    // butex_wait_any(), otherwise the waiters hang or wake up too often.
+    const int N = 8;
+    int* butexes[2];
+    for (int i = 0; i < 2; ++i) {
+        butexes[i] = eabase::butex_create_checked<int>();
+        *butexes[i] = 0;
+    }
+    eabase::atomic<int> nwoken(0);
+    WaitAnyStressArg arg = { { butexes[0], butexes[1] }, &nwoken };
+    fiber_t th[N];
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_start_lazy(&th[i], NULL,
+                                      wait_any_repeatedly, &arg));
+    }
+    int nwakeup = 0;
+    for (int i = 0; nwakeup < N * WAIT_ANY_ROUNDS; ++i) {
+        nwakeup += eabase::butex_wake(butexes[i & 1]);
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+    }
+    ASSERT_EQ(N * WAIT_ANY_ROUNDS, nwoken.load());
+    for (int i = 0; i < 2; ++i) {
+        eabase::butex_destroy(butexes[i]);
+    }
+}
+
 } // namespace
@@ -0,0 +1,342 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <memory>
+#include <gtest/gtest.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/time.h"
+#include "eabase/fiber/channel.h"
+#include "eabase/fiber/execution_queue.h"
+#include "eabase/fiber/fiber.h"
+
+namespace {
+TEST(ChannelTest, sanity) {
+    eabase::Channel<int> chan(2);
+    ASSERT_EQ(2u, chan.capacity());
+    ASSERT_EQ(0, chan.send(1));
+    ASSERT_EQ(0, chan.try_send(2));
+    ASSERT_EQ(EAGAIN, chan.try_send(3));
+    ASSERT_EQ(2u, chan.size());
+    int v = 0;
+    ASSERT_EQ(0, chan.recv(&v));
+    ASSERT_EQ(1, v);
+    ASSERT_EQ(0, chan.try_recv(&v));
+    ASSERT_EQ(2, v);
+    ASSERT_EQ(EAGAIN, chan.try_recv(&v));
+
+    ASSERT_EQ(0, chan.send(3));
+    chan.close();
+    ASSERT_TRUE(chan.closed());
+    ASSERT_EQ(EPIPE, chan.send(4));
+    ASSERT_EQ(EPIPE, chan.try_send(4));
+    // Remaining values are still received.
+    ASSERT_EQ(0, chan.recv(&v));
+    ASSERT_EQ(3, v);
+    ASSERT_EQ(EPIPE, chan.recv(&v));
+    ASSERT_EQ(EPIPE, chan.try_recv(&v));
+}
+
+TEST(ChannelTest, move_only) {
+    eabase::Channel<std::unique_ptr<int> > chan(1);
+    ASSERT_EQ(0, chan.send(std::unique_ptr<int>(new int(7))));
+    std::unique_ptr<int> p(new int(8));
+    ASSERT_EQ(EAGAIN, chan.try_send(std::move(p)));
+    // Not moved from when failed.
+    ASSERT_TRUE(p != NULL);
+    std::unique_ptr<int> q;
+    ASSERT_EQ(0, chan.recv(&q));
+    ASSERT_EQ(7, *q);
+}
+
+TEST(ChannelTest, timed) {
+    eabase::Channel<int> chan(1);
+    int v = 0;
+    eabase::Timer tm;
+    tm.start();
+    ASSERT_EQ(ETIMEDOUT, chan.timed_recv(&v, eabase::milliseconds_from_now(20)));
+    tm.stop();
+    ASSERT_GE(tm.m_elapsed(), 15);
+    ASSERT_EQ(0, chan.timed_send(1, eabase::milliseconds_from_now(20)));
+    tm.start();
+    ASSERT_EQ(ETIMEDOUT, chan.timed_send(2, eabase::milliseconds_from_now(20)));
+    tm.stop();
+    ASSERT_GE(tm.m_elapsed(), 15);
+    ASSERT_EQ(0, chan.timed_recv(&v, eabase::milliseconds_from_now(20)));
+    ASSERT_EQ(1, v);
+}
+
+struct CloseArg {
+    eabase::Channel<int>* chan;
+    int rc;
+};
+
+void* blocking_recv(void* void_arg) {
+    CloseArg* arg = static_cast<CloseArg*>(void_arg);
+    int v = 0;
+    arg->rc = arg->chan->recv(&v);
+    return NULL;
+}
+
+void* blocking_send(void* void_arg) {
+    CloseArg* arg = static_cast<CloseArg*>(void_arg);
+    arg->rc = arg->chan->send(1);
+    return NULL;
+}
+
+TEST(ChannelTest, close_wakes_up_blocked) {
+    eabase::Channel<int> empty_chan(1);
+    eabase::Channel<int> full_chan(1);
+    ASSERT_EQ(0, full_chan.send(0));
+    CloseArg args[4] = { { &empty_chan, -1 }, { &empty_chan, -1 },
+                         { &full_chan, -1 }, { &full_chan, -1 } };
+    fiber_t th[4];
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_EQ(0, fiber_start(&th[i], NULL,
+                                 i < 2 ? blocking_recv : blocking_send,
+                                 &args[i]));
+    }
+    usleep(10000);
+    empty_chan.close();
+    full_chan.close();
+    for (int i = 0; i < 4; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+        ASSERT_EQ(EPIPE, args[i].rc);
+    }
+}
+
+const int NPRODUCER = 4;
+const int NCONSUMER = 4;
+const int NITEM_PER_PRODUCER = 100000;
+const size_t BATCH = 32;
+
+struct PipelineArg {
+    eabase::Channel<int64_t>* chan;
+    eabase::atomic<int64_t>* sum;
+    eabase::atomic<int64_t>* count;
+};
+
+void* produce(void* void_arg) {
+    PipelineArg* arg = static_cast<PipelineArg*>(void_arg);
+    for (int i = 1; i <= NITEM_PER_PRODUCER; ++i) {
+        EXPECT_EQ(0, arg->chan->send(i));
+    }
+    return NULL;
+}
+
+void* consume(void* void_arg) {
+    PipelineArg* arg = static_cast<PipelineArg*>(void_arg);
+    int64_t values[BATCH];
+    size_t n = 0;
+    int64_t sum = 0;
+    int64_t count = 0;
+    while (arg->chan->recv_batch(values, BATCH, &n) == 0) {
+        for (size_t i = 0; i < n; ++i) {
+            sum += values[i];
+        }
+        count += n;
+    }
+    arg->sum->fetch_add(sum);
+    arg->count->fetch_add(count);
+    return NULL;
+}
+
+int64_t run_channel_pipeline(int nconsumer, size_t capacity) {
+    eabase::Channel<int64_t> chan(capacity);
+    eabase::atomic<int64_t> sum(0);
+    eabase::atomic<int64_t> count(0);
+    PipelineArg arg = { &chan, &sum, &count };
+    fiber_t producers[NPRODUCER];
+    fiber_t consumers[NCONSUMER];
+    eabase::Timer tm;
+    tm.start();
+    for (int i = 0; i < nconsumer; ++i) {
+        EXPECT_EQ(0, fiber_start(&consumers[i], NULL, consume, &arg));
+    }
+    for (int i = 0; i < NPRODUCER; ++i) {
+        EXPECT_EQ(0, fiber_start(&producers[i], NULL, produce, &arg));
+    }
+    for (int i = 0; i < NPRODUCER; ++i) {
+        EXPECT_EQ(0, fiber_join(producers[i], NULL));
+    }
+    chan.close();
+    for (int i = 0; i < nconsumer; ++i) {
+        EXPECT_EQ(0, fiber_join(consumers[i], NULL));
+    }
+    tm.stop();
+    EXPECT_EQ((int64_t)NPRODUCER * NITEM_PER_PRODUCER, count.load());
+    EXPECT_EQ((int64_t)NPRODUCER * NITEM_PER_PRODUCER *
+              (NITEM_PER_PRODUCER + 1) / 2, sum.load());
+    return tm.n_elapsed() / (NPRODUCER * NITEM_PER_PRODUCER);
+}
+
+TEST(ChannelTest, mpmc) {
+    std::cout << "channel capacity=1 consumers=" << NCONSUMER << ": "
+              << run_channel_pipeline(NCONSUMER, 1) << "ns per item"
+              << std::endl;
+    std::cout << "channel capacity=1024 consumers=" << NCONSUMER << ": "
+              << run_channel_pipeline(NCONSUMER, 1024) << "ns per item"
+              << std::endl;
+}
+
+struct QueueArg {
+    eabase::ExecutionQueueId<int64_t> id;
+};
+
+int sum_tasks(void* meta, eabase::TaskIterator<int64_t>& iter) {
+    int64_t* sum = static_cast<int64_t*>(meta);
+    for (; iter; ++iter) {
+        *sum += *iter;
+    }
+    return 0;
+}
+
+void* produce_to_queue(void* void_arg) {
+    QueueArg* arg = static_cast<QueueArg*>(void_arg);
+    for (int i = 1; i <= NITEM_PER_PRODUCER; ++i) {
+        EXPECT_EQ(0, eabase::execution_queue_execute(arg->id, (int64_t)i));
+    }
+    return NULL;
+}
+
+TEST(ChannelTest, benchmark_against_execution_queue) {
+    // ExecutionQueue has exactly one consumer.
+    std::cout << "channel capacity=1024 consumers=1: "
+              << run_channel_pipeline(1, 1024) << "ns per item" << std::endl;
+
+    int64_t sum = 0;
+    QueueArg arg;
+    ASSERT_EQ(0, eabase::execution_queue_start(&arg.id, NULL, sum_tasks, &sum));
+    fiber_t producers[NPRODUCER];
+    eabase::Timer tm;
+    tm.start();
+    for (int i = 0; i < NPRODUCER; ++i) {
+        ASSERT_EQ(0, fiber_start(&producers[i], NULL, produce_to_queue, &arg));
+    }
+    for (int i = 0; i < NPRODUCER; ++i) {
+        ASSERT_EQ(0, fiber_join(producers[i], NULL));
+    }
+    ASSERT_EQ(0, eabase::execution_queue_stop(arg.id));
+    ASSERT_EQ(0, eabase::execution_queue_join(arg.id));
+    tm.stop();
+    ASSERT_EQ((int64_t)NPRODUCER * NITEM_PER_PRODUCER *
+              (NITEM_PER_PRODUCER + 1) / 2, sum);
+    std::cout << "execution_queue: "
+              << tm.n_elapsed() / (NPRODUCER * NITEM_PER_PRODUCER)
+              << "ns per item" << std::endl;
+}
+
+TEST(ChannelTest, select) {
+    eabase::Channel<int> a(1);
+    eabase::Channel<std::string> b(1);
+    int va = 0;
+    std::string vb;
+    eabase::ChannelSelector selector;
+    ASSERT_EQ(0, selector.add_recv(&a, &va));
+    ASSERT_EQ(1, selector.add_recv(&b, &vb));
+    ASSERT_EQ(-1, selector.try_select());
+    ASSERT_EQ(EAGAIN, errno);
+    const timespec abstime = eabase::milliseconds_from_now(10);
+    ASSERT_EQ(-1, selector.select(&abstime));
+    ASSERT_EQ(ETIMEDOUT, errno);
+
+    ASSERT_EQ(0, b.send("hello"));
+    ASSERT_EQ(1, selector.select());
+    ASSERT_EQ(0, selector.last_error());
+    ASSERT_EQ("hello", vb);
+    ASSERT_EQ(0, a.send(3));
+    ASSERT_EQ(0, selector.select());
+    ASSERT_EQ(3, va);
+
+    // A send operation is ready when the channel has room.
+    eabase::ChannelSelector send_selector;
+    int one = 1;
+    ASSERT_EQ(0, send_selector.add_send(&a, &one));
+    ASSERT_EQ(0, send_selector.select());
+    ASSERT_EQ(EAGAIN, a.try_send(2));
+
+    // Either of the ready operations is picked.
+    b.close();
+    int rc = selector.select();
+    if (rc == 0) {
+        ASSERT_EQ(0, selector.last_error());
+        ASSERT_EQ(1, va);
+        rc = selector.select();
+    }
+    ASSERT_EQ(1, rc);
+    ASSERT_EQ(EPIPE, selector.last_error());
+}
+
+struct SelectArg {
+    eabase::Channel<int>* chans[2];
+    eabase::atomic<int>* nrecv;
+};
+
+void* select_until_closed(void* void_arg) {
+    SelectArg* arg = static_cast<SelectArg*>(void_arg);
+    int v[2];
+    eabase::ChannelSelector selector;
+    selector.add_recv(arg->chans[0], &v[0]);
+    selector.add_recv(arg->chans[1], &v[1]);
+    while (true) {
+        const int rc = selector.select();
+        EXPECT_GE(rc, 0);
+        if (rc < 0 || selector.last_error() == EPIPE) {
+            break;
+        }
+        arg->nrecv->fetch_add(1);
+    }
+    return NULL;
+}
+
+void* recv_until_closed(void* void_arg) {
+    SelectArg* arg = static_cast<SelectArg*>(void_arg);
+    int v = 0;
+    while (arg->chans[0]->recv(&v) == 0) {
+        arg->nrecv->fetch_add(1);
+    }
+    return NULL;
+}
+
+TEST(ChannelTest, select_with_plain_receivers) {
+    // Selectors and plain receivers share channels, no value is left
+    // behind with receivers blocking.
+    const int N = 4;
+    const int NITEM = 20000;
+    eabase::Channel<int> a(4);
+    eabase::Channel<int> b(4);
+    eabase::atomic<int> nrecv(0);
+    SelectArg arg = { { &a, &b }, &nrecv };
+    fiber_t th[N * 2];
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_start(&th[i], NULL, select_until_closed, &arg));
+        ASSERT_EQ(0, fiber_start(&th[N + i], NULL, recv_until_closed, &arg));
+    }
+    for (int i = 0; i < NITEM; ++i) {
+        ASSERT_EQ(0, (i % 3 ? a : b).send(i));
+    }
+    // All values are consumed without closing.
+    for (int i = 0; i < 1000 && nrecv.load() != NITEM; ++i) {
+        usleep(1000);
+    }
+    ASSERT_EQ(NITEM, nrecv.load());
+    a.close();
+    b.close();
+    for (int i = 0; i < N * 2; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+    }
+}
+} // namespace
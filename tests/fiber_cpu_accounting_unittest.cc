@@ -0,0 +1,115 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include "eabase/utility/time.h"
+#include "eabase/var/var.h"
+#include "eabase/fiber/fiber.h"
+#include "eabase/fiber/unstable.h"
+#include "eabase/fiber/cpu_accounting.h"
+
+namespace {
+void* burn_cpu(void* arg) {
+    const char* label = static_cast<const char*>(arg);
+    if (label != NULL) {
+        EXPECT_EQ(0, fiber_set_cpu_label(label));
+    }
+    for (int i = 0; i < 10; ++i) {
+        const int64_t deadline_us = eabase::cpuwide_time_us() + 1000;
+        while (eabase::cpuwide_time_us() < deadline_us) {}
+        fiber_yield();
+    }
+    return NULL;
+}
+
+const eabase::FiberCpuUsage* find_usage(
+    const std::vector<eabase::FiberCpuUsage>& usages, const std::string& name) {
+    for (size_t i = 0; i < usages.size(); ++i) {
+        if (usages[i].name.find(name) != std::string::npos) {
+            return &usages[i];
+        }
+    }
+    return NULL;
+}
+
+TEST(CpuAccountingTest, by_function_and_label) {
+    eabase::FLAGS_fiber_cpu_accounting = true;
+    fiber_t th[4];
+    ASSERT_EQ(0, fiber_start_lazy(&th[0], NULL, burn_cpu, NULL));
+    ASSERT_EQ(0, fiber_start_lazy(&th[1], NULL, burn_cpu, NULL));
+    ASSERT_EQ(0, fiber_start_lazy(&th[2], NULL, burn_cpu,
+                                  (void*)"cpu_accounting_label"));
+    ASSERT_EQ(0, fiber_start_lazy(&th[3], NULL, burn_cpu,
+                                  (void*)"cpu_accounting_label"));
+    for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+        fiber_join(th[i], NULL);
+    }
+    eabase::FLAGS_fiber_cpu_accounting = false;
+
+    std::vector<eabase::FiberCpuUsage> usages;
+    eabase::get_fiber_cpu_usage(&usages);
+    ASSERT_FALSE(usages.empty());
+    for (size_t i = 1; i < usages.size(); ++i) {
+        ASSERT_GE(usages[i - 1].cputime_ns, usages[i].cputime_ns);
+    }
+    const eabase::FiberCpuUsage* by_label =
+        find_usage(usages, "cpu_accounting_label");
+    ASSERT_TRUE(by_label != NULL);
+    // burn_cpu is not exported, which is named by its offset in the binary.
+    const eabase::FiberCpuUsage* by_fn =
+        find_usage(usages, "fiber_cpu_accounting_unittest+0x");
+    ASSERT_TRUE(by_fn != NULL);
+    for (const eabase::FiberCpuUsage* u : { by_fn, by_label }) {
+        // Each fiber runs 11 times and burns 10ms.
+        ASSERT_GE(u->nrun, 22) << u->name;
+        ASSERT_GE(u->cputime_ns, 20000000L) << u->name;
+        ASSERT_LT(u->cputime_ns, 2000000000L) << u->name;
+        ASSERT_GE(u->nqueue, 20) << u->name;
+        ASSERT_GE(u->queue_ns, 0) << u->name;
+    }
+
+    // Nothing is accounted after it's switched off.
+    const int64_t saved_nrun = by_label->nrun;
+    fiber_t th2;
+    ASSERT_EQ(0, fiber_start_lazy(&th2, NULL, burn_cpu,
+                                  (void*)"cpu_accounting_label"));
+    fiber_join(th2, NULL);
+    eabase::get_fiber_cpu_usage(&usages);
+    ASSERT_EQ(saved_nrun, find_usage(usages, "cpu_accounting_label")->nrun);
+}
+
+TEST(CpuAccountingTest, report) {
+    char buf[4096];
+    const int len = fiber_get_cpu_report(buf, sizeof(buf), 100);
+    ASSERT_GT(len, 0);
+    ASSERT_TRUE(strstr(buf, "cpu_accounting_label") != NULL) << buf;
+    ASSERT_TRUE(strstr(buf, "runs=") != NULL) << buf;
+    char small[8];
+    ASSERT_EQ(len, fiber_get_cpu_report(small, sizeof(small), 100));
+    ASSERT_EQ(sizeof(small) - 1, strlen(small));
+    ASSERT_EQ(-1, fiber_get_cpu_report(buf, sizeof(buf), 0));
+    ASSERT_EQ(EINVAL, errno);
+
+    const std::string top = eabase::Variable::describe_exposed("fiber_cpu_top");
+    ASSERT_TRUE(top.find("cpu_accounting_label") != std::string::npos) << top;
+
+    ASSERT_EQ(EPERM, fiber_set_cpu_label("not_in_fiber"));
+}
+}  // namespace
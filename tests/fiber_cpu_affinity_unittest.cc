@@ -0,0 +1,138 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "eabase/fiber/fiber.h"
+#include "eabase/fiber/unstable.h"
+#include "eabase/fiber/numa.h"
+#include "eabase/fiber/cpu_affinity.h"
+
+DECLARE_string(fiber_service_cpus);
+
+namespace {
+TEST(CpuAffinityTest, parse_tag_affinity) {
+    std::vector<std::pair<fiber_tag_t, eabase::TagAffinity> > out;
+    ASSERT_EQ(0, eabase::parse_tag_affinity("", &out));
+    ASSERT_TRUE(out.empty());
+    ASSERT_EQ(0, eabase::parse_tag_affinity(
+                  "0:0-3;1:4-5,8:pin:exclude_service;2::pin", &out));
+    ASSERT_EQ(3u, out.size());
+    ASSERT_EQ(0, out[0].first);
+    ASSERT_EQ("0-3", eabase::format_cpulist(out[0].second.cpus));
+    ASSERT_FALSE(out[0].second.pin_per_core);
+    ASSERT_FALSE(out[0].second.exclude_service_cpus);
+    ASSERT_EQ(1, out[1].first);
+    ASSERT_EQ("4-5,8", eabase::format_cpulist(out[1].second.cpus));
+    ASSERT_TRUE(out[1].second.pin_per_core);
+    ASSERT_TRUE(out[1].second.exclude_service_cpus);
+    ASSERT_EQ(2, out[2].first);
+    ASSERT_TRUE(out[2].second.cpus.empty());
+    ASSERT_TRUE(out[2].second.pin_per_core);
+
+    ASSERT_EQ(-1, eabase::parse_tag_affinity("0", &out));
+    ASSERT_EQ(-1, eabase::parse_tag_affinity("x:0-3", &out));
+    ASSERT_EQ(-1, eabase::parse_tag_affinity("0:3-0", &out));
+    ASSERT_EQ(-1, eabase::parse_tag_affinity("0:0-3:unknown", &out));
+}
+
+TEST(CpuAffinityTest, format_cpulist) {
+    const int cpus[] = { 8, 0, 1, 2, 3, 10, 11, 2 };
+    ASSERT_EQ("0-3,8,10-11",
+              eabase::format_cpulist(std::vector<int>(cpus, cpus + 8)));
+    ASSERT_EQ("", eabase::format_cpulist(std::vector<int>()));
+}
+
+std::vector<std::string> get_placement() {
+    char buf[4096];
+    const int len = fiber_get_tag_placement(FIBER_TAG_DEFAULT, buf, sizeof(buf));
+    EXPECT_GE(len, 0);
+    EXPECT_LT(len, (int)sizeof(buf));
+    std::vector<std::string> placement;
+    std::string all(buf);
+    size_t begin = 0;
+    while (begin < all.size()) {
+        size_t end = all.find(' ', begin);
+        if (end == std::string::npos) {
+            end = all.size();
+        }
+        placement.push_back(all.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return placement;
+}
+
+void* dummy(void*) {
+    return NULL;
+}
+
+TEST(CpuAffinityTest, pin_per_core) {
+    std::vector<int> allowed;
+    ASSERT_EQ(0, eabase::get_thread_cpus(pthread_self(), &allowed));
+    ASSERT_FALSE(allowed.empty());
+    const std::string allowed_str = eabase::format_cpulist(allowed);
+
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, NULL, dummy, NULL));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    const size_t nworker = get_placement().size();
+    ASSERT_GT(nworker, 0u);
+
+    fiber_affinity_t affinity = { allowed_str.c_str(), 1, 0 };
+    ASSERT_EQ(0, fiber_set_tag_affinity(FIBER_TAG_DEFAULT, &affinity));
+    std::vector<std::string> placement = get_placement();
+    ASSERT_EQ(nworker, placement.size());
+    std::map<std::string, size_t> nworker_per_cpu;
+    for (size_t i = 0; i < placement.size(); ++i) {
+        std::vector<int> cpus;
+        ASSERT_EQ(0, eabase::parse_cpulist(placement[i], &cpus));
+        ASSERT_EQ(1u, cpus.size()) << placement[i];
+        ASSERT_NE(allowed.end(),
+                  std::find(allowed.begin(), allowed.end(), cpus[0]));
+        ++nworker_per_cpu[placement[i]];
+    }
+    // Workers are spread evenly.
+    for (auto it = nworker_per_cpu.begin(); it != nworker_per_cpu.end(); ++it) {
+        ASSERT_LE(it->second, (nworker + allowed.size() - 1) / allowed.size());
+    }
+
+    // Clearing the policy gives all cpus back.
+    fiber_affinity_t none = { NULL, 0, 0 };
+    ASSERT_EQ(0, fiber_set_tag_affinity(FIBER_TAG_DEFAULT, &none));
+    placement = get_placement();
+    ASSERT_EQ(nworker, placement.size());
+    for (size_t i = 0; i < placement.size(); ++i) {
+        ASSERT_EQ(allowed_str, placement[i]);
+    }
+}
+
+TEST(CpuAffinityTest, invalid_policy) {
+    fiber_affinity_t bad_cpus = { "3-1", 0, 0 };
+    ASSERT_EQ(EINVAL, fiber_set_tag_affinity(FIBER_TAG_DEFAULT, &bad_cpus));
+    ASSERT_EQ(EINVAL, fiber_set_tag_affinity(FIBER_TAG_DEFAULT, NULL));
+    ASSERT_EQ(EINVAL, fiber_set_tag_affinity(-1, &bad_cpus));
+
+    // Nothing is left after excluding service cpus.
+    std::vector<int> allowed;
+    ASSERT_EQ(0, eabase::get_thread_cpus(pthread_self(), &allowed));
+    const std::string allowed_str = eabase::format_cpulist(allowed);
+    FLAGS_fiber_service_cpus = allowed_str;
+    fiber_affinity_t no_cpu_left = { allowed_str.c_str(), 0, 1 };
+    ASSERT_EQ(EINVAL, fiber_set_tag_affinity(FIBER_TAG_DEFAULT, &no_cpu_left));
+    FLAGS_fiber_service_cpus = "";
+}
+} // namespace
@@ -0,0 +1,110 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <sys/epoll.h>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "eabase/utility/fd_utility.h"
+#include "eabase/utility/string_printf.h"
+#include "eabase/utility/time.h"
+#include "eabase/var/var.h"
+#include "eabase/fiber/fiber.h"
+#include "eabase/fiber/unstable.h"
+
+DECLARE_int32(fiber_epoll_thread_num);
+
+namespace {
+struct PipePingPong {
+    int in;
+    int out;
+    int rounds;
+};
+
+void* pipe_ponger(void* arg) {
+    PipePingPong* p = static_cast<PipePingPong*>(arg);
+    char c = 0;
+    for (int i = 0; i < p->rounds; ++i) {
+        while (read(p->in, &c, 1) != 1) {
+            EXPECT_EQ(EAGAIN, errno);
+            EXPECT_EQ(0, fiber_fd_wait(p->in, EPOLLIN));
+        }
+        EXPECT_EQ(1, write(p->out, &c, 1));
+    }
+    return NULL;
+}
+
+int64_t get_var(const std::string& name) {
+    return atoll(eabase::Variable::describe_exposed(name).c_str());
+}
+
+TEST(EpollShardTest, sharded_by_fd) {
+    // Read when fiber_fd_wait is called for the first time.
+    FLAGS_fiber_epoll_thread_num = 4;
+    const int NPAIR = 32;
+    const int ROUNDS = 500;
+    int fds[NPAIR * 2][2];
+    PipePingPong args[NPAIR * 2];
+    fiber_t th[NPAIR * 2];
+    for (int i = 0; i < NPAIR * 2; ++i) {
+        ASSERT_EQ(0, pipe(fds[i]));
+        eabase::make_non_blocking(fds[i][0]);
+    }
+    for (int i = 0; i < NPAIR; ++i) {
+        args[2 * i] = { fds[2 * i][0], fds[2 * i + 1][1], ROUNDS };
+        args[2 * i + 1] = { fds[2 * i + 1][0], fds[2 * i][1], ROUNDS };
+    }
+    eabase::Timer tm;
+    tm.start();
+    for (int i = 0; i < NPAIR * 2; ++i) {
+        ASSERT_EQ(0, fiber_start(&th[i], NULL, pipe_ponger, &args[i]));
+    }
+    for (int i = 0; i < NPAIR; ++i) {
+        ASSERT_EQ(1, write(fds[2 * i][1], "x", 1));
+    }
+    for (int i = 0; i < NPAIR * 2; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+    }
+    tm.stop();
+    for (int i = 0; i < NPAIR * 2; ++i) {
+        ASSERT_EQ(0, fiber_close(fds[i][0]));
+        ASSERT_EQ(0, fiber_close(fds[i][1]));
+    }
+    std::cout << "round trip=" << tm.n_elapsed() / (NPAIR * ROUNDS) << "ns"
+              << std::endl;
+    // 64 fds are likely spread over all of the epoll threads.
+    int nstarted = 0;
+    int64_t nwakeup = 0;
+    for (int i = 0; i < 4; ++i) {
+        const std::string prefix = eabase::string_printf(
+            "fiber_epoll_thread_%d", i);
+        if (eabase::Variable::describe_exposed(prefix + "_event_second")
+            .empty()) {
+            continue;
+        }
+        ++nstarted;
+        const int64_t n = get_var(prefix + "_wakeup_count");
+        nwakeup += n;
+        std::cout << prefix << " wakeups=" << n << " latency="
+                  << eabase::Variable::describe_exposed(prefix + "_wakeup_latency")
+                  << "us" << std::endl;
+    }
+    ASSERT_EQ(4, nstarted);
+    ASSERT_GT(nwakeup, 0);
+    ASSERT_TRUE(eabase::Variable::describe_exposed(
+                    "fiber_epoll_thread_4_event_second").empty());
+}
+} // namespace
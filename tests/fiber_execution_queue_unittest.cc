@@ -917,4 +917,129 @@ TEST_F(ExecutionQueueTest, cancel_unexecuted_high_priority_task) {
         test_cancel_unexecuted_high_priority_task(i);
     }
 }
+void test_capacity_reject(bool use_pthread) {
+    eabase::ExecutionQueueId<LongIntTask> queue_id = { 0 };
+    eabase::ExecutionQueueOptions options;
+    options.use_pthread = use_pthread;
+    options.capacity = 2;
+    options.full_policy = eabase::EXECUTION_QUEUE_FULL_REJECT;
+    int64_t result = 0;
+    ASSERT_EQ(0, eabase::execution_queue_start(&queue_id, &options,
+                                                add_with_suspend2, &result));
+    g_suspending = false;
+    ASSERT_EQ(0, eabase::execution_queue_execute(queue_id, -100));
+    while (!g_suspending) {
+        usleep(10);
+    }
+    ASSERT_EQ(0, eabase::execution_queue_execute(queue_id, 1));
+    ASSERT_EQ(EAGAIN, eabase::execution_queue_execute(queue_id, 2));
+    ASSERT_EQ(EAGAIN, eabase::execution_queue_execute(queue_id, 4));
+    g_suspending = false;
+    // Slots are given back once the consumer is done with the tasks.
+    int rc = 0;
+    while ((rc = eabase::execution_queue_execute(queue_id, 8)) == EAGAIN) {
+        usleep(100);
+    }
+    ASSERT_EQ(0, rc);
+    ASSERT_EQ(0, eabase::execution_queue_stop(queue_id));
+    ASSERT_EQ(0, eabase::execution_queue_join(queue_id));
+    ASSERT_EQ(9, result);
+}
+
+TEST_F(ExecutionQueueTest, capacity_reject) {
+    for (int i = 0; i < 2; ++i) {
+        test_capacity_reject(i);
+    }
+}
+
+struct BlockedProducerArg {
+    eabase::ExecutionQueueId<LongIntTask> queue_id;
+    int64_t value;
+    int rc;
+    eabase::atomic<bool> done;
+};
+
+void* blocked_producer(void* void_arg) {
+    BlockedProducerArg* arg = (BlockedProducerArg*)void_arg;
+    arg->rc = eabase::execution_queue_execute(arg->queue_id, arg->value);
+    arg->done.store(true);
+    return NULL;
+}
+
+void test_capacity_block(bool use_pthread) {
+    eabase::ExecutionQueueId<LongIntTask> queue_id = { 0 };
+    eabase::ExecutionQueueOptions options;
+    options.use_pthread = use_pthread;
+    options.capacity = 1;
+    options.full_policy = eabase::EXECUTION_QUEUE_FULL_BLOCK;
+    int64_t result = 0;
+    ASSERT_EQ(0, eabase::execution_queue_start(&queue_id, &options,
+                                                add_with_suspend2, &result));
+    g_suspending = false;
+    ASSERT_EQ(0, eabase::execution_queue_execute(queue_id, -100));
+    while (!g_suspending) {
+        usleep(10);
+    }
+    BlockedProducerArg arg;
+    arg.queue_id = queue_id;
+    arg.value = 7;
+    arg.rc = -1;
+    arg.done.store(false);
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, NULL, blocked_producer, &arg));
+    usleep(20000);
+    // The producer must wait for the suspended task to finish.
+    ASSERT_FALSE(arg.done.load());
+    g_suspending = false;
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    ASSERT_EQ(0, arg.rc);
+    ASSERT_EQ(0, eabase::execution_queue_stop(queue_id));
+    ASSERT_EQ(0, eabase::execution_queue_join(queue_id));
+    ASSERT_EQ(7, result);
+}
+
+TEST_F(ExecutionQueueTest, capacity_block) {
+    for (int i = 0; i < 2; ++i) {
+        test_capacity_block(i);
+    }
+}
+
+TEST_F(ExecutionQueueTest, stop_wakes_blocked_producers) {
+    eabase::ExecutionQueueId<LongIntTask> queue_id = { 0 };
+    eabase::ExecutionQueueOptions options;
+    options.capacity = 1;
+    options.full_policy = eabase::EXECUTION_QUEUE_FULL_BLOCK;
+    int64_t result = 0;
+    ASSERT_EQ(0, eabase::execution_queue_start(&queue_id, &options,
+                                                add_with_suspend2, &result));
+    g_suspending = false;
+    ASSERT_EQ(0, eabase::execution_queue_execute(queue_id, -100));
+    while (!g_suspending) {
+        usleep(10);
+    }
+    BlockedProducerArg arg;
+    arg.queue_id = queue_id;
+    arg.value = 7;
+    arg.rc = -1;
+    arg.done.store(false);
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, NULL, blocked_producer, &arg));
+    usleep(20000);
+    ASSERT_FALSE(arg.done.load());
+    ASSERT_EQ(0, eabase::execution_queue_stop(queue_id));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    ASSERT_EQ(EINVAL, arg.rc);
+    g_suspending = false;
+    ASSERT_EQ(0, eabase::execution_queue_join(queue_id));
+    ASSERT_EQ(0, result);
+}
+
+TEST_F(ExecutionQueueTest, invalid_capacity) {
+    eabase::ExecutionQueueId<LongIntTask> queue_id = { 0 };
+    eabase::ExecutionQueueOptions options;
+    options.capacity = (size_t)1 << 40;
+    int64_t result = 0;
+    ASSERT_EQ(EINVAL, eabase::execution_queue_start(&queue_id, &options,
+                                                     add, &result));
+}
 } // namespace
@@ -21,6 +21,7 @@
 #include <sys/utsname.h>                           // uname
 #include <fcntl.h>
 #include <gtest/gtest.h>
+#include <gflags/gflags.h>
 #include <pthread.h>
 #include "eabase/utility/gperftools_profiler.h"
 #include "eabase/utility/time.h"
@@ -37,6 +38,9 @@
 #include <sys/event.h>                           // kevent(), kqueue()
 #endif
 
+DECLARE_bool(fiber_fd_wait_use_io_uring);
+DECLARE_bool(fiber_fd_wait_edge_triggered);
+
 #ifndef NDEBUG
 namespace eabase {
 extern eabase::atomic<int> break_nums;
@@ -555,4 +559,183 @@ TEST(FDTest, double_close) {
     ASSERT_EQ(-1, fiber_close(fds[1]));
     ASSERT_EQ(ec, errno);
 }
+#if defined(OS_LINUX)
+void* wait_readable(void* arg) {
+    return (void*)(intptr_t)fiber_fd_wait(*(int*)arg, EPOLLIN);
+}
+
+void* wait_writable(void* arg) {
+    return (void*)(intptr_t)fiber_fd_wait(*(int*)arg, EPOLLOUT);
+}
+
+TEST(FDTest, io_uring_wait) {
+    FLAGS_fiber_fd_wait_use_io_uring = true;
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, NULL, wait_readable, &fds[0]));
+    usleep(10000);
+    ASSERT_EQ(1, write(fds[1], "a", 1));
+    void* ret = NULL;
+    ASSERT_EQ(0, fiber_join(th, &ret));
+    ASSERT_EQ(0, (intptr_t)ret);
+    char c;
+    ASSERT_EQ(1, read(fds[0], &c, 1));
+
+    // Timed out.
+    ASSERT_EQ(0, fiber_start(&th, NULL, wait_for_the_fd, &fds[0]));
+    eabase::Timer tm;
+    tm.start();
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    tm.stop();
+    ASSERT_GE(tm.m_elapsed(), 40);
+    ASSERT_LT(tm.m_elapsed(), 80);
+
+    // Closing wakes up the waiter.
+    ASSERT_EQ(0, fiber_start(&th, NULL, wait_readable, &fds[0]));
+    usleep(10000);
+    tm.start();
+    ASSERT_EQ(0, fiber_close(fds[0]));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    tm.stop();
+    ASSERT_LT(tm.m_elapsed(), 5);
+    ASSERT_EQ(0, fiber_close(fds[1]));
+
+    errno = 0;
+    ASSERT_EQ(-1, fiber_fd_wait(0, EPOLLET));
+    ASSERT_EQ(EINVAL, errno);
+    FLAGS_fiber_fd_wait_use_io_uring = false;
+}
+
+struct PipePingPong {
+    int in;
+    int out;
+    int rounds;
+};
+
+void* pipe_ponger(void* arg) {
+    PipePingPong* p = static_cast<PipePingPong*>(arg);
+    char c = 0;
+    for (int i = 0; i < p->rounds; ++i) {
+        while (read(p->in, &c, 1) != 1) {
+            EXPECT_EQ(EAGAIN, errno);
+            EXPECT_EQ(0, fiber_fd_wait(p->in, EPOLLIN));
+        }
+        EXPECT_EQ(1, write(p->out, &c, 1));
+    }
+    return NULL;
+}
+
+// Round trips between pairs of fibers through non-blocking pipes, every
+// read is preceded by a fiber_fd_wait.
+int64_t fd_wait_round_trip_ns(bool use_io_uring, bool edge_triggered) {
+    FLAGS_fiber_fd_wait_use_io_uring = use_io_uring;
+    FLAGS_fiber_fd_wait_edge_triggered = edge_triggered;
+    const int NPAIR = 8;
+    const int ROUNDS = 2000;
+    int fds[NPAIR * 2][2];
+    PipePingPong args[NPAIR * 2];
+    fiber_t th[NPAIR * 2];
+    for (int i = 0; i < NPAIR * 2; ++i) {
+        EXPECT_EQ(0, pipe(fds[i]));
+        eabase::make_non_blocking(fds[i][0]);
+    }
+    for (int i = 0; i < NPAIR; ++i) {
+        args[2 * i] = { fds[2 * i][0], fds[2 * i + 1][1], ROUNDS };
+        args[2 * i + 1] = { fds[2 * i + 1][0], fds[2 * i][1], ROUNDS };
+    }
+    eabase::Timer tm;
+    tm.start();
+    for (int i = 0; i < NPAIR * 2; ++i) {
+        EXPECT_EQ(0, fiber_start(&th[i], NULL, pipe_ponger, &args[i]));
+    }
+    for (int i = 0; i < NPAIR; ++i) {
+        EXPECT_EQ(1, write(fds[2 * i][1], "x", 1));
+    }
+    for (int i = 0; i < NPAIR * 2; ++i) {
+        EXPECT_EQ(0, fiber_join(th[i], NULL));
+    }
+    tm.stop();
+    for (int i = 0; i < NPAIR * 2; ++i) {
+        EXPECT_EQ(0, fiber_close(fds[i][0]));
+        EXPECT_EQ(0, fiber_close(fds[i][1]));
+    }
+    FLAGS_fiber_fd_wait_use_io_uring = false;
+    FLAGS_fiber_fd_wait_edge_triggered = false;
+    return tm.n_elapsed() / (NPAIR * ROUNDS);
+}
+
+TEST(FDTest, fd_wait_backend_performance) {
+    const int64_t epoll_ns = fd_wait_round_trip_ns(false, false);
+    const int64_t et_ns = fd_wait_round_trip_ns(false, true);
+    const int64_t io_uring_ns = fd_wait_round_trip_ns(true, false);
+    const int64_t epoll_ns2 = fd_wait_round_trip_ns(false, false);
+    const int64_t et_ns2 = fd_wait_round_trip_ns(false, true);
+    const int64_t io_uring_ns2 = fd_wait_round_trip_ns(true, false);
+    std::cout << "round trip through pipes: epoll=" << epoll_ns << "/"
+              << epoll_ns2 << "ns epoll_et=" << et_ns << "/" << et_ns2
+              << "ns io_uring=" << io_uring_ns << "/"
+              << io_uring_ns2 << "ns" << std::endl;
+}
+
+TEST(FDTest, edge_triggered_wait) {
+    FLAGS_fiber_fd_wait_edge_triggered = true;
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    eabase::make_non_blocking(fds[0]);
+    fiber_t th;
+    void* ret = NULL;
+    // Writable since being added.
+    ASSERT_EQ(0, fiber_start(&th, NULL, wait_writable, &fds[1]));
+    ASSERT_EQ(0, fiber_join(th, &ret));
+    ASSERT_EQ(0, (intptr_t)ret);
+
+    ASSERT_EQ(0, fiber_start(&th, NULL, wait_readable, &fds[0]));
+    usleep(10000);
+    ASSERT_EQ(1, write(fds[1], "a", 1));
+    ASSERT_EQ(0, fiber_join(th, &ret));
+    ASSERT_EQ(0, (intptr_t)ret);
+    char c;
+    ASSERT_EQ(1, read(fds[0], &c, 1));
+
+    // Readiness arriving between waits is latched and consumed by the
+    // next wait without blocking.
+    ASSERT_EQ(1, write(fds[1], "b", 1));
+    usleep(10000);
+    // Not re-armed, the flag doesn't matter any more.
+    FLAGS_fiber_fd_wait_edge_triggered = false;
+    eabase::Timer tm;
+    tm.start();
+    ASSERT_EQ(0, fiber_start(&th, NULL, wait_readable, &fds[0]));
+    ASSERT_EQ(0, fiber_join(th, &ret));
+    tm.stop();
+    ASSERT_EQ(0, (intptr_t)ret);
+    ASSERT_LT(tm.m_elapsed(), 5);
+    ASSERT_EQ(1, read(fds[0], &c, 1));
+
+    // Consumed, wait until timeout.
+    ASSERT_EQ(0, fiber_start(&th, NULL, wait_for_the_fd, &fds[0]));
+    tm.start();
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    tm.stop();
+    ASSERT_GE(tm.m_elapsed(), 40);
+
+    // Closing wakes up the waiter and resets the registration.
+    ASSERT_EQ(0, fiber_start(&th, NULL, wait_readable, &fds[0]));
+    usleep(10000);
+    ASSERT_EQ(0, fiber_close(fds[0]));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    ASSERT_EQ(0, fiber_close(fds[1]));
+
+    // The fd numbers are likely reused and waited in level-triggered way.
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_EQ(0, fiber_start(&th, NULL, wait_readable, &fds[0]));
+    usleep(10000);
+    ASSERT_EQ(1, write(fds[1], "c", 1));
+    ASSERT_EQ(0, fiber_join(th, &ret));
+    ASSERT_EQ(0, (intptr_t)ret);
+    ASSERT_EQ(0, fiber_close(fds[0]));
+    ASSERT_EQ(0, fiber_close(fds[1]));
+}
+#endif
 } // namespace
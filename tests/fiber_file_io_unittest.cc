@@ -0,0 +1,177 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "eabase/utility/fd_guard.h"
+#include "eabase/utility/iobuf.h"
+#include "eabase/utility/time.h"
+#include "eabase/var/var.h"
+#include "eabase/fiber/fiber.h"
+#include "eabase/fiber/unstable.h"
+
+DECLARE_bool(fiber_file_io_use_io_uring);
+
+namespace {
+const char* const FILE_PATH = "fiber_file_io_unittest.data";
+const int NFIBER = 8;
+const int BLOCK = 4096;
+const int NBLOCK_PER_FIBER = 32;
+
+struct FileArg {
+    int fd;
+    int index;
+};
+
+void fill_block(char* buf, int index, int block) {
+    for (int i = 0; i < BLOCK; ++i) {
+        buf[i] = (char)(index * 31 + block * 7 + i);
+    }
+}
+
+// Each fiber writes and reads back its own blocks of the file.
+void* write_and_read(void* void_arg) {
+    FileArg* arg = static_cast<FileArg*>(void_arg);
+    char buf[BLOCK];
+    char buf2[BLOCK];
+    for (int b = 0; b < NBLOCK_PER_FIBER; ++b) {
+        const off_t offset =
+            (off_t)(arg->index * NBLOCK_PER_FIBER + b) * BLOCK;
+        fill_block(buf, arg->index, b);
+        EXPECT_EQ(BLOCK, fiber_pwrite(arg->fd, buf, BLOCK, offset));
+    }
+    EXPECT_EQ(0, fiber_fsync(arg->fd));
+    for (int b = 0; b < NBLOCK_PER_FIBER; ++b) {
+        const off_t offset =
+            (off_t)(arg->index * NBLOCK_PER_FIBER + b) * BLOCK;
+        fill_block(buf, arg->index, b);
+        EXPECT_EQ(BLOCK, fiber_pread(arg->fd, buf2, BLOCK, offset));
+        EXPECT_EQ(0, memcmp(buf, buf2, BLOCK));
+    }
+    return NULL;
+}
+
+int64_t get_var(const char* name) {
+    return atoll(eabase::Variable::describe_exposed(name).c_str());
+}
+
+void run_read_write(bool use_io_uring) {
+    FLAGS_fiber_file_io_use_io_uring = use_io_uring;
+    eabase::fd_guard fd(open(FILE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644));
+    ASSERT_GE(fd, 0);
+    FileArg args[NFIBER];
+    fiber_t th[NFIBER];
+    eabase::Timer tm;
+    tm.start();
+    for (int i = 0; i < NFIBER; ++i) {
+        args[i].fd = fd;
+        args[i].index = i;
+        ASSERT_EQ(0, fiber_start(&th[i], NULL, write_and_read, &args[i]));
+    }
+    for (int i = 0; i < NFIBER; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+    }
+    tm.stop();
+    std::cout << (use_io_uring ? "io_uring: " : "threads: ")
+              << tm.n_elapsed() / (NFIBER * NBLOCK_PER_FIBER * 2)
+              << "ns per 4KB io" << std::endl;
+    unlink(FILE_PATH);
+    FLAGS_fiber_file_io_use_io_uring = true;
+}
+
+TEST(FileIOTest, read_write_io_uring) {
+    run_read_write(true);
+}
+
+TEST(FileIOTest, read_write_offload_threads) {
+    const int64_t noffload0 = get_var("fiber_file_io_offload_count");
+    run_read_write(false);
+    ASSERT_EQ(NFIBER * (NBLOCK_PER_FIBER * 2 + 1),
+              get_var("fiber_file_io_offload_count") - noffload0);
+}
+
+struct ErrorArg {
+    ssize_t rc;
+    int error;
+};
+
+void* read_bad_fd(void* void_arg) {
+    ErrorArg* arg = static_cast<ErrorArg*>(void_arg);
+    char buf[16];
+    arg->rc = fiber_pread(-1, buf, sizeof(buf), 0);
+    arg->error = errno;
+    return NULL;
+}
+
+TEST(FileIOTest, error) {
+    for (int i = 0; i < 2; ++i) {
+        FLAGS_fiber_file_io_use_io_uring = (i == 0);
+        ErrorArg arg = { 0, 0 };
+        fiber_t th;
+        ASSERT_EQ(0, fiber_start(&th, NULL, read_bad_fd, &arg));
+        ASSERT_EQ(0, fiber_join(th, NULL));
+        ASSERT_EQ(-1, arg.rc);
+        ASSERT_EQ(EBADF, arg.error);
+    }
+    FLAGS_fiber_file_io_use_io_uring = true;
+}
+
+void* iobuf_to_file(void* arg) {
+    const int fd = *static_cast<int*>(arg);
+    eabase::IOBuf buf;
+    for (int i = 0; i < 10000; ++i) {
+        buf.append("0123456789");
+    }
+    const std::string expected = buf.to_string();
+    off_t offset = 0;
+    while (!buf.empty()) {
+        const ssize_t nw = buf.pcut_into_file_descriptor(fd, offset);
+        EXPECT_GT(nw, 0);
+        if (nw <= 0) {
+            return NULL;
+        }
+        offset += nw;
+    }
+    eabase::IOPortal portal;
+    offset = 0;
+    while (true) {
+        const ssize_t nr = portal.pappend_from_file_descriptor(
+            fd, offset, 8192);
+        EXPECT_GE(nr, 0);
+        if (nr <= 0) {
+            break;
+        }
+        offset += nr;
+    }
+    EXPECT_EQ(expected, portal.to_string());
+    return NULL;
+}
+
+TEST(FileIOTest, iobuf) {
+    const int64_t nio0 = get_var("fiber_file_io_count");
+    eabase::fd_guard fd(open(FILE_PATH, O_RDWR | O_CREAT | O_TRUNC, 0644));
+    ASSERT_GE(fd, 0);
+    int raw_fd = fd;
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, NULL, iobuf_to_file, &raw_fd));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    unlink(FILE_PATH);
+    // Went through fiber_pwritev/fiber_preadv.
+    ASSERT_GT(get_var("fiber_file_io_count"), nio0);
+}
+} // namespace
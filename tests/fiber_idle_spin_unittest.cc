@@ -0,0 +1,205 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/time.h"
+#include "eabase/var/var.h"
+#include "eabase/fiber/fiber.h"
+#include "eabase/fiber/unstable.h"
+#include "eabase/fiber/butex.h"
+#include "eabase/fiber/idle_spin.h"
+
+namespace {
+TEST(IdleSpinTest, parse_tag_spin_policy) {
+    std::vector<std::pair<fiber_tag_t, eabase::TagSpinPolicy> > out;
+    ASSERT_EQ(0, eabase::parse_tag_spin_policy("", &out));
+    ASSERT_TRUE(out.empty());
+    ASSERT_EQ(0, eabase::parse_tag_spin_policy(
+                  "0:adaptive;1:fixed:20;2:none;3:adaptive:100:50", &out));
+    ASSERT_EQ(4u, out.size());
+    ASSERT_EQ(0, out[0].first);
+    ASSERT_EQ(FIBER_SPIN_ADAPTIVE, out[0].second.mode);
+    ASSERT_EQ(eabase::TagSpinPolicy().max_spin_us, out[0].second.max_spin_us);
+    ASSERT_EQ(FIBER_SPIN_FIXED, out[1].second.mode);
+    ASSERT_EQ(20, out[1].second.max_spin_us);
+    ASSERT_EQ(FIBER_SPIN_NONE, out[2].second.mode);
+    ASSERT_EQ(3, out[3].first);
+    ASSERT_EQ(100, out[3].second.max_spin_us);
+    ASSERT_EQ(50, out[3].second.max_cpu_percent);
+
+    ASSERT_EQ(-1, eabase::parse_tag_spin_policy("0", &out));
+    ASSERT_EQ(-1, eabase::parse_tag_spin_policy("x:fixed", &out));
+    ASSERT_EQ(-1, eabase::parse_tag_spin_policy("0:busy", &out));
+    ASSERT_EQ(-1, eabase::parse_tag_spin_policy("0:fixed:0", &out));
+    ASSERT_EQ(-1, eabase::parse_tag_spin_policy("0:fixed:20:101", &out));
+    ASSERT_EQ(-1, eabase::parse_tag_spin_policy("0:fixed:20:10:1", &out));
+}
+
+TEST(IdleSpinTest, pack) {
+    eabase::TagSpinPolicy p;
+    p.mode = FIBER_SPIN_ADAPTIVE;
+    p.max_spin_us = 10000;
+    p.max_cpu_percent = 100;
+    const eabase::TagSpinPolicy p2 = eabase::TagSpinPolicy::unpack(p.pack());
+    ASSERT_EQ(p.mode, p2.mode);
+    ASSERT_EQ(p.max_spin_us, p2.max_spin_us);
+    ASSERT_EQ(p.max_cpu_percent, p2.max_cpu_percent);
+}
+
+TEST(IdleSpinTest, adaptive_budget) {
+    eabase::TagSpinPolicy p;
+    p.mode = FIBER_SPIN_ADAPTIVE;
+    p.max_spin_us = 50;
+    p.max_cpu_percent = 100;
+    eabase::IdleSpinner s;
+    int64_t now = 1000000000L;
+    // Short idle periods, spin about twice as long as they last.
+    for (int i = 0; i < 100; ++i) {
+        now += 1000000;
+        ASSERT_GT(s.spin_budget_ns(p, now), 0);
+        s.on_idle_end(5000, 5000);
+    }
+    int64_t budget = s.spin_budget_ns(p, now += 1000000);
+    ASSERT_GE(budget, 8000);
+    ASSERT_LE(budget, 12000);
+    // Long idle periods, park directly.
+    for (int i = 0; i < 100; ++i) {
+        s.spin_budget_ns(p, now += 1000000);
+        s.on_idle_end(10000000, 0);
+    }
+    ASSERT_EQ(0, s.spin_budget_ns(p, now += 1000000));
+    // Back to short ones.
+    for (int i = 0; i < 100; ++i) {
+        s.spin_budget_ns(p, now += 1000000);
+        s.on_idle_end(3000, 0);
+    }
+    ASSERT_GT(s.spin_budget_ns(p, now += 1000000), 0);
+
+    // Fixed mode always spins for max_spin_us.
+    p.mode = FIBER_SPIN_FIXED;
+    ASSERT_EQ(50000, s.spin_budget_ns(p, now += 1000000));
+    p.mode = FIBER_SPIN_NONE;
+    ASSERT_EQ(0, s.spin_budget_ns(p, now += 1000000));
+}
+
+TEST(IdleSpinTest, cpu_cap) {
+    eabase::TagSpinPolicy p;
+    p.mode = FIBER_SPIN_FIXED;
+    p.max_spin_us = 50;
+    p.max_cpu_percent = 10;
+    eabase::IdleSpinner s;
+    int64_t now = 1000000000L;
+    s.spin_budget_ns(p, now);
+    // Idle again and again: spinning 50us per 100us is capped to 10%.
+    int64_t total_spin = 0;
+    for (int i = 0; i < 10000; ++i) {
+        now += 100000;
+        const int64_t budget = s.spin_budget_ns(p, now);
+        total_spin += budget;
+        s.on_idle_end(budget, budget);
+    }
+    const int64_t total = 10000 * 100000L;
+    ASSERT_LE(total_spin, total / 10 + 8 * 50000);
+    ASSERT_GE(total_spin, total / 10 - 8 * 50000);
+}
+
+TEST(IdleSpinTest, set_policy) {
+    fiber_spin_policy_t p = { FIBER_SPIN_ADAPTIVE, 50, 10 };
+    ASSERT_EQ(EINVAL, fiber_set_tag_spin_policy(-1, &p));
+    ASSERT_EQ(EINVAL, fiber_set_tag_spin_policy(FIBER_TAG_DEFAULT, NULL));
+    p.max_spin_us = 0;
+    ASSERT_EQ(EINVAL, fiber_set_tag_spin_policy(FIBER_TAG_DEFAULT, &p));
+    p.max_spin_us = 50;
+    p.mode = 3;
+    ASSERT_EQ(EINVAL, fiber_set_tag_spin_policy(FIBER_TAG_DEFAULT, &p));
+}
+
+struct PingPong {
+    int* ping;
+    int* pong;
+    int rounds;
+};
+
+void* pinger(void* arg) {
+    PingPong* pp = static_cast<PingPong*>(arg);
+    for (int i = 1; i <= pp->rounds; ++i) {
+        *pp->ping = i;
+        eabase::butex_wake(pp->ping);
+        while (*(volatile int*)pp->pong != i) {
+            eabase::butex_wait(pp->pong, i - 1, NULL);
+        }
+    }
+    return NULL;
+}
+
+void* ponger(void* arg) {
+    PingPong* pp = static_cast<PingPong*>(arg);
+    for (int i = 1; i <= pp->rounds; ++i) {
+        while (*(volatile int*)pp->ping != i) {
+            eabase::butex_wait(pp->ping, i - 1, NULL);
+        }
+        *pp->pong = i;
+        eabase::butex_wake(pp->pong);
+    }
+    return NULL;
+}
+
+int64_t ping_pong_ns(int rounds) {
+    PingPong pp;
+    pp.ping = eabase::butex_create_checked<int>();
+    pp.pong = eabase::butex_create_checked<int>();
+    *pp.ping = 0;
+    *pp.pong = 0;
+    pp.rounds = rounds;
+    eabase::Timer tm;
+    tm.start();
+    fiber_t th[2];
+    EXPECT_EQ(0, fiber_start(&th[0], NULL, ponger, &pp));
+    EXPECT_EQ(0, fiber_start(&th[1], NULL, pinger, &pp));
+    fiber_join(th[0], NULL);
+    fiber_join(th[1], NULL);
+    tm.stop();
+    eabase::butex_destroy(pp.ping);
+    eabase::butex_destroy(pp.pong);
+    return tm.n_elapsed() / rounds;
+}
+
+int64_t get_var(const char* name) {
+    return atoll(eabase::Variable::describe_exposed(name).c_str());
+}
+
+TEST(IdleSpinTest, ping_pong) {
+    const int64_t none_ns = ping_pong_ns(20000);
+    const int64_t hit0 = get_var("fiber_idle_spin_hit");
+    const int64_t miss0 = get_var("fiber_idle_spin_miss");
+    fiber_spin_policy_t p = { FIBER_SPIN_ADAPTIVE, 50, 20 };
+    ASSERT_EQ(0, fiber_set_tag_spin_policy(FIBER_TAG_DEFAULT, &p));
+    const int64_t adaptive_ns = ping_pong_ns(20000);
+    p.mode = FIBER_SPIN_FIXED;
+    ASSERT_EQ(0, fiber_set_tag_spin_policy(FIBER_TAG_DEFAULT, &p));
+    const int64_t fixed_ns = ping_pong_ns(20000);
+    p.mode = FIBER_SPIN_NONE;
+    ASSERT_EQ(0, fiber_set_tag_spin_policy(FIBER_TAG_DEFAULT, &p));
+    const int64_t hit = get_var("fiber_idle_spin_hit") - hit0;
+    const int64_t miss = get_var("fiber_idle_spin_miss") - miss0;
+    std::cout << "ping-pong round trip: none=" << none_ns
+              << "ns adaptive=" << adaptive_ns << "ns fixed=" << fixed_ns
+              << "ns spin_hit=" << hit << " spin_miss=" << miss << std::endl;
+    ASSERT_GT(hit + miss, 0);
+}
+} // namespace
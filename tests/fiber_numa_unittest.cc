@@ -0,0 +1,94 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <sched.h>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/thread_local.h"
+#include "eabase/fiber/fiber.h"
+#include "eabase/fiber/numa.h"
+#include "eabase/fiber/task_control.h"
+#include "eabase/fiber/task_group.h"
+
+DECLARE_bool(fiber_numa_aware);
+
+namespace eabase {
+extern TaskControl* g_task_control;
+extern BAIDU_THREAD_LOCAL TaskGroup* tls_task_group;
+}
+
+namespace {
+TEST(NumaTest, parse_cpulist) {
+    std::vector<int> cpus;
+    ASSERT_EQ(0, eabase::parse_cpulist("0-3,8,10-11\n", &cpus));
+    const int expected[] = { 0, 1, 2, 3, 8, 10, 11 };
+    ASSERT_EQ(std::vector<int>(expected, expected + 7), cpus);
+    ASSERT_EQ(0, eabase::parse_cpulist("", &cpus));
+    ASSERT_TRUE(cpus.empty());
+    ASSERT_EQ(-1, eabase::parse_cpulist("3-1", &cpus));
+    ASSERT_EQ(-1, eabase::parse_cpulist("a", &cpus));
+}
+
+TEST(NumaTest, topology) {
+    const int nnode = eabase::numa_num_nodes();
+    ASSERT_GE(nnode, 1);
+    ASSERT_LE(nnode, eabase::FIBER_MAX_NUMA_NODES);
+    for (int n = 0; n < nnode; ++n) {
+        const std::vector<int>& cpus = eabase::numa_cpus_of_node(n);
+        ASSERT_FALSE(cpus.empty());
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            ASSERT_EQ(n, eabase::numa_node_of_cpu(cpus[i]));
+        }
+    }
+    ASSERT_TRUE(eabase::numa_cpus_of_node(nnode).empty());
+    const int cur = eabase::numa_current_node();
+    ASSERT_TRUE(cur >= 0 && cur < nnode);
+    ASSERT_EQ(-1, eabase::numa_local_node());
+}
+
+const int N = 1000;
+eabase::atomic<int> g_nbad(0);
+eabase::atomic<int> g_ndone(0);
+
+void* check_placement(void*) {
+    eabase::TaskGroup* g = eabase::tls_task_group;
+    const int node = g->numa_node();
+    if (node < 0 || node >= eabase::numa_num_nodes() ||
+        node != eabase::numa_local_node() ||
+        node != eabase::numa_node_of_cpu(sched_getcpu())) {
+        g_nbad.fetch_add(1);
+    }
+    fiber_usleep(100);
+    g_ndone.fetch_add(1);
+    return NULL;
+}
+
+TEST(NumaTest, workers_are_grouped_by_node) {
+    FLAGS_fiber_numa_aware = true;
+    std::vector<fiber_t> th(N);
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_start_lazy(&th[i], NULL, check_placement, NULL));
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+    }
+    ASSERT_EQ(N, g_ndone.load());
+    ASSERT_EQ(0, g_nbad.load());
+    ASSERT_EQ(eabase::numa_num_nodes(), eabase::g_task_control->numa_nnodes());
+}
+} // namespace
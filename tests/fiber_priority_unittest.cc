@@ -0,0 +1,145 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/time.h"
+#include "eabase/var/var.h"
+#include "eabase/fiber/fiber.h"
+
+namespace eabase {
+DECLARE_int32(fiber_priority_aging_rounds);
+DECLARE_bool(show_fiber_queue_latency_in_vars);
+}
+
+namespace {
+const int N = 100;
+pthread_mutex_t g_order_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector<int> g_order;
+
+void* record_priority(void* arg) {
+    pthread_mutex_lock(&g_order_mutex);
+    g_order.push_back((int)(intptr_t)arg);
+    pthread_mutex_unlock(&g_order_mutex);
+    return NULL;
+}
+
+void* start_mixed_fibers(void* arg) {
+    std::vector<fiber_t>* th = static_cast<std::vector<fiber_t>*>(arg);
+    fiber_attr_t low = FIBER_ATTR_NORMAL | FIBER_LOW_PRIORITY | FIBER_NOSIGNAL;
+    fiber_attr_t high = FIBER_ATTR_NORMAL | FIBER_HIGH_PRIORITY | FIBER_NOSIGNAL;
+    // Low-priority fibers are queued first.
+    for (int i = 0; i < N; ++i) {
+        fiber_start_lazy(&(*th)[i], &low, record_priority, (void*)1);
+    }
+    for (int i = 0; i < N; ++i) {
+        fiber_start_lazy(&(*th)[N + i], &high, record_priority, (void*)0);
+    }
+    // Not signalled, tasks are run by this worker after this fiber quits.
+    return NULL;
+}
+
+TEST(PriorityTest, high_priority_runs_first) {
+    const int saved_rounds = eabase::FLAGS_fiber_priority_aging_rounds;
+    eabase::FLAGS_fiber_priority_aging_rounds = 100000;
+    std::vector<fiber_t> th(2 * N);
+    fiber_t starter;
+    ASSERT_EQ(0, fiber_start(&starter, NULL, start_mixed_fibers, &th));
+    ASSERT_EQ(0, fiber_join(starter, NULL));
+    for (size_t i = 0; i < th.size(); ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+    }
+    eabase::FLAGS_fiber_priority_aging_rounds = saved_rounds;
+    ASSERT_EQ(2u * N, g_order.size());
+    // Other workers may be woken up by unrelated events and steal a few
+    // low-priority fibers, most of high-priority fibers still run first.
+    int nhigh_in_front = 0;
+    for (int i = 0; i < N; ++i) {
+        nhigh_in_front += (g_order[i] == 0);
+    }
+    ASSERT_GT(nhigh_in_front, N * 9 / 10);
+}
+
+volatile bool g_stop_spinning = false;
+
+void* spin_with_yield(void*) {
+    while (!g_stop_spinning) {
+        fiber_yield();
+    }
+    return NULL;
+}
+
+eabase::atomic<bool> g_low_ran(false);
+
+void* mark_low_ran(void*) {
+    g_low_ran.store(true);
+    return NULL;
+}
+
+TEST(PriorityTest, low_priority_is_not_starved) {
+    const int saved_rounds = eabase::FLAGS_fiber_priority_aging_rounds;
+    eabase::FLAGS_fiber_priority_aging_rounds = 4;
+    // Keep all workers busy with high-priority fibers that never block.
+    const int nspinner = fiber_getconcurrency() * 2;
+    std::vector<fiber_t> spinners(nspinner);
+    fiber_attr_t high = FIBER_ATTR_NORMAL | FIBER_HIGH_PRIORITY;
+    for (int i = 0; i < nspinner; ++i) {
+        ASSERT_EQ(0, fiber_start(&spinners[i], &high, spin_with_yield, NULL));
+    }
+    usleep(10000);
+    fiber_attr_t low = FIBER_ATTR_NORMAL | FIBER_LOW_PRIORITY;
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, &low, mark_low_ran, NULL));
+    const int64_t deadline = eabase::gettimeofday_us() + 5000000L;
+    while (!g_low_ran.load() && eabase::gettimeofday_us() < deadline) {
+        usleep(1000);
+    }
+    const bool low_ran = g_low_ran.load();
+    g_stop_spinning = true;
+    for (int i = 0; i < nspinner; ++i) {
+        ASSERT_EQ(0, fiber_join(spinners[i], NULL));
+    }
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    eabase::FLAGS_fiber_priority_aging_rounds = saved_rounds;
+    ASSERT_TRUE(low_ran);
+}
+
+void* dummy(void*) {
+    return NULL;
+}
+
+TEST(PriorityTest, queue_latency_vars) {
+    eabase::FLAGS_show_fiber_queue_latency_in_vars = true;
+    const unsigned flags[] = {
+        FIBER_HIGH_PRIORITY, 0, FIBER_LOW_PRIORITY
+    };
+    const char* names[] = {
+        "fiber_queue_latency_high_count",
+        "fiber_queue_latency_normal_count",
+        "fiber_queue_latency_low_count",
+    };
+    for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); ++i) {
+        fiber_attr_t attr = FIBER_ATTR_NORMAL | flags[i];
+        fiber_t th;
+        ASSERT_EQ(0, fiber_start(&th, &attr, dummy, NULL));
+        ASSERT_EQ(0, fiber_join(th, NULL));
+        ASSERT_NE("", eabase::Variable::describe_exposed(names[i])) << names[i];
+    }
+    eabase::FLAGS_show_fiber_queue_latency_in_vars = false;
+}
+} // namespace
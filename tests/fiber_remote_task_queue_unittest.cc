@@ -0,0 +1,320 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <algorithm>                        // std::sort
+#include <gtest/gtest.h>
+#include "eabase/utility/time.h"
+#include "eabase/utility/macros.h"
+#include "eabase/utility/containers/bounded_queue.h"
+#include "eabase/fiber/mutex.h"
+#include "eabase/fiber/remote_task_queue.h"
+#include "eabase/fiber/fiber.h"
+
+namespace {
+const size_t CAP = 2048;
+
+// The previous implementation of RemoteTaskQueue, kept as the baseline
+// of the benchmarks below.
+class LockedRemoteTaskQueue {
+public:
+    int init(size_t cap) {
+        const size_t memsize = sizeof(fiber_t) * cap;
+        void* q_mem = malloc(memsize);
+        if (q_mem == NULL) {
+            return -1;
+        }
+        eabase::BoundedQueue<fiber_t> q(q_mem, memsize, eabase::OWNS_STORAGE);
+        _tasks.swap(q);
+        return 0;
+    }
+    bool pop(fiber_t* task) {
+        if (_tasks.empty()) {
+            return false;
+        }
+        _mutex.lock();
+        const bool result = _tasks.pop(task);
+        _mutex.unlock();
+        return result;
+    }
+    bool push(fiber_t task) {
+        _mutex.lock();
+        const bool res = _tasks.push(task);
+        _mutex.unlock();
+        return res;
+    }
+private:
+    eabase::BoundedQueue<fiber_t> _tasks;
+    eabase::Mutex _mutex;
+};
+
+template <typename Queue>
+struct BenchArgs {
+    Queue* q;
+    size_t begin;
+    size_t end;
+    eabase::atomic<size_t>* npopped;
+    size_t total;
+    std::vector<fiber_t>* out;
+};
+
+template <typename Queue>
+void* push_thread(void* void_arg) {
+    BenchArgs<Queue>* a = (BenchArgs<Queue>*)void_arg;
+    for (size_t i = a->begin; i < a->end; ++i) {
+        while (!a->q->push((fiber_t)i + 1)) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+template <typename Queue>
+void* pop_thread(void* void_arg) {
+    BenchArgs<Queue>* a = (BenchArgs<Queue>*)void_arg;
+    fiber_t val;
+    while (a->npopped->load(eabase::memory_order_relaxed) < a->total) {
+        if (a->q->pop(&val)) {
+            a->npopped->fetch_add(1, eabase::memory_order_relaxed);
+            if (a->out) {
+                a->out->push_back(val);
+            }
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// Returns nanoseconds per task.
+template <typename Queue>
+double run_queue(Queue* q, int nproducer, int nconsumer, size_t total,
+                 std::vector<fiber_t>* collected) {
+    eabase::atomic<size_t> npopped(0);
+    std::vector<BenchArgs<Queue> > pargs(nproducer);
+    std::vector<BenchArgs<Queue> > cargs(nconsumer);
+    std::vector<std::vector<fiber_t> > outs(nconsumer);
+    std::vector<pthread_t> pth(nproducer);
+    std::vector<pthread_t> cth(nconsumer);
+    eabase::Timer tm;
+    tm.start();
+    for (int i = 0; i < nconsumer; ++i) {
+        BenchArgs<Queue> a = { q, 0, 0, &npopped, total,
+                               collected ? &outs[i] : NULL };
+        cargs[i] = a;
+        EXPECT_EQ(0, pthread_create(&cth[i], NULL, pop_thread<Queue>, &cargs[i]));
+    }
+    const size_t per = total / nproducer;
+    for (int i = 0; i < nproducer; ++i) {
+        BenchArgs<Queue> a = { q, per * i,
+                               (i == nproducer - 1 ? total : per * (i + 1)),
+                               &npopped, total, NULL };
+        pargs[i] = a;
+        EXPECT_EQ(0, pthread_create(&pth[i], NULL, push_thread<Queue>, &pargs[i]));
+    }
+    for (int i = 0; i < nproducer; ++i) {
+        pthread_join(pth[i], NULL);
+    }
+    for (int i = 0; i < nconsumer; ++i) {
+        pthread_join(cth[i], NULL);
+    }
+    tm.stop();
+    if (collected) {
+        for (int i = 0; i < nconsumer; ++i) {
+            collected->insert(collected->end(), outs[i].begin(), outs[i].end());
+        }
+    }
+    return tm.n_elapsed() / (double)total;
+}
+
+TEST(RemoteTaskQueueTest, capacity_is_power_of_2) {
+    eabase::RemoteTaskQueue q;
+    ASSERT_EQ(0, q.init(1000));
+    ASSERT_EQ(1024u, q.capacity());
+    ASSERT_NE(0, q.init(1000));
+    for (size_t i = 0; i < q.capacity(); ++i) {
+        ASSERT_TRUE(q.push(i + 1));
+    }
+    ASSERT_FALSE(q.push(0));
+    ASSERT_EQ(q.capacity(), q.volatile_size());
+    fiber_t val = 0;
+    for (size_t i = 0; i < q.capacity(); ++i) {
+        ASSERT_TRUE(q.pop(&val));
+        ASSERT_EQ(i + 1, val);
+    }
+    ASSERT_FALSE(q.pop(&val));
+    ASSERT_EQ(0u, q.volatile_size());
+}
+
+TEST(RemoteTaskQueueTest, push_batch) {
+    eabase::RemoteTaskQueue q;
+    ASSERT_EQ(0, q.init(16));
+    fiber_t items[10];
+    for (size_t i = 0; i < 10; ++i) {
+        items[i] = i + 1;
+    }
+    ASSERT_EQ(10u, q.push_batch(items, 10));
+    ASSERT_EQ(6u, q.push_batch(items, 10));
+    ASSERT_EQ(0u, q.push_batch(items, 10));
+    fiber_t val = 0;
+    for (size_t i = 0; i < 16; ++i) {
+        ASSERT_TRUE(q.pop(&val));
+        ASSERT_EQ(i % 10 + 1, val);
+    }
+    ASSERT_FALSE(q.pop(&val));
+}
+
+struct BatchPushArgs {
+    eabase::RemoteTaskQueue* q;
+    size_t begin;
+    size_t end;
+};
+
+void* push_batch_thread(void* void_arg) {
+    BatchPushArgs* a = (BatchPushArgs*)void_arg;
+    fiber_t buf[7];
+    for (size_t i = a->begin; i < a->end;) {
+        size_t n = 0;
+        for (; n < ARRAY_SIZE(buf) && i + n < a->end; ++n) {
+            buf[n] = i + n + 1;
+        }
+        size_t pushed = 0;
+        while (pushed < n) {
+            const size_t k = a->q->push_batch(buf + pushed, n - pushed);
+            if (k == 0) {
+                sched_yield();
+            }
+            pushed += k;
+        }
+        i += n;
+    }
+    return NULL;
+}
+
+TEST(RemoteTaskQueueTest, mpmc_push_batch) {
+    const size_t N = 200000;
+    const int NPRODUCER = 4;
+    const int NCONSUMER = 4;
+    eabase::RemoteTaskQueue q;
+    ASSERT_EQ(0, q.init(64));
+    eabase::atomic<size_t> npopped(0);
+    std::vector<std::vector<fiber_t> > outs(NCONSUMER);
+    BenchArgs<eabase::RemoteTaskQueue> cargs[NCONSUMER];
+    pthread_t cth[NCONSUMER];
+    for (int i = 0; i < NCONSUMER; ++i) {
+        BenchArgs<eabase::RemoteTaskQueue> a = { &q, 0, 0, &npopped, N, &outs[i] };
+        cargs[i] = a;
+        ASSERT_EQ(0, pthread_create(&cth[i], NULL,
+                                    pop_thread<eabase::RemoteTaskQueue>, &cargs[i]));
+    }
+    BatchPushArgs pargs[NPRODUCER];
+    pthread_t pth[NPRODUCER];
+    for (int i = 0; i < NPRODUCER; ++i) {
+        BatchPushArgs a = { &q, N / NPRODUCER * i, N / NPRODUCER * (i + 1) };
+        pargs[i] = a;
+        ASSERT_EQ(0, pthread_create(&pth[i], NULL, push_batch_thread, &pargs[i]));
+    }
+    for (int i = 0; i < NPRODUCER; ++i) {
+        pthread_join(pth[i], NULL);
+    }
+    for (int i = 0; i < NCONSUMER; ++i) {
+        pthread_join(cth[i], NULL);
+    }
+    std::vector<fiber_t> values;
+    for (int i = 0; i < NCONSUMER; ++i) {
+        values.insert(values.end(), outs[i].begin(), outs[i].end());
+    }
+    ASSERT_EQ(N, values.size());
+    std::sort(values.begin(), values.end());
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_EQ(i + 1, values[i]);
+    }
+}
+
+TEST(RemoteTaskQueueTest, mpmc_sanity) {
+    const size_t N = 200000;
+    eabase::RemoteTaskQueue q;
+    ASSERT_EQ(0, q.init(64));
+    std::vector<fiber_t> values;
+    values.reserve(N);
+    run_queue(&q, 8, 4, N, &values);
+    ASSERT_EQ(N, values.size());
+    std::sort(values.begin(), values.end());
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_EQ(i + 1, values[i]);
+    }
+}
+
+TEST(RemoteTaskQueueTest, queue_performance) {
+    const size_t N = 200000;
+    const int nproducers[] = { 1, 2, 4, 8, 16, 32, 64 };
+    for (size_t i = 0; i < ARRAY_SIZE(nproducers); ++i) {
+        LockedRemoteTaskQueue lq;
+        ASSERT_EQ(0, lq.init(CAP));
+        const double locked_ns = run_queue(&lq, nproducers[i], 1, N, NULL);
+        eabase::RemoteTaskQueue q;
+        ASSERT_EQ(0, q.init(CAP));
+        const double lockfree_ns = run_queue(&q, nproducers[i], 1, N, NULL);
+        std::cout << "producers=" << nproducers[i]
+                  << " locked=" << locked_ns << "ns/task"
+                  << " lockfree=" << lockfree_ns << "ns/task" << std::endl;
+    }
+}
+
+eabase::atomic<size_t> g_nrun(0);
+
+void* count_fn(void*) {
+    g_nrun.fetch_add(1, eabase::memory_order_relaxed);
+    return NULL;
+}
+
+void* start_from_pthread(void* arg) {
+    const size_t n = (size_t)arg;
+    for (size_t i = 0; i < n; ++i) {
+        fiber_t th;
+        while (fiber_start_lazy(&th, NULL, count_fn, NULL) != 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+TEST(RemoteTaskQueueTest, remote_start_performance) {
+    const size_t N = 100000;
+    const int nproducers[] = { 1, 2, 4, 8, 16, 32, 64 };
+    for (size_t i = 0; i < ARRAY_SIZE(nproducers); ++i) {
+        const int np = nproducers[i];
+        g_nrun.store(0, eabase::memory_order_relaxed);
+        std::vector<pthread_t> th(np);
+        eabase::Timer tm;
+        tm.start();
+        for (int j = 0; j < np; ++j) {
+            ASSERT_EQ(0, pthread_create(&th[j], NULL, start_from_pthread,
+                                        (void*)(N / np)));
+        }
+        for (int j = 0; j < np; ++j) {
+            pthread_join(th[j], NULL);
+        }
+        while (g_nrun.load(eabase::memory_order_relaxed) < (N / np) * np) {
+            usleep(100);
+        }
+        tm.stop();
+        std::cout << "producers=" << np << " remote start "
+                  << tm.n_elapsed() / (double)((N / np) * np)
+                  << "ns/fiber" << std::endl;
+    }
+}
+} // namespace
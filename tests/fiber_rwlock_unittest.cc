@@ -22,6 +22,14 @@
 #include <gtest/gtest.h>
 #include "eabase/utility/time.h"
 #include "eabase/utility/macros.h"
+#include "eabase/utility/logging.h"
+#include "eabase/fiber/fiber.h"
+#include "eabase/fiber/mutex.h"
+
+namespace eabase {
+bool ContentionProfilerStart(const char* filename);
+void ContentionProfilerStop();
+}
 
 namespace {
 void* read_thread(void* arg) {
@@ -76,4 +84,263 @@ TEST(RWLockTest, rdlock_performance) {
     pthread_mutex_destroy(&lock1);
 #endif
 }
+
+TEST(RWLockTest, sanity) {
+    fiber_rwlock_t rw;
+    ASSERT_EQ(0, fiber_rwlock_init(&rw, NULL));
+    ASSERT_EQ(0, fiber_rwlock_rdlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_rdlock(&rw));
+    ASSERT_EQ(EBUSY, fiber_rwlock_trywrlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_tryrdlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+
+    ASSERT_EQ(0, fiber_rwlock_wrlock(&rw));
+    ASSERT_EQ(EBUSY, fiber_rwlock_tryrdlock(&rw));
+    ASSERT_EQ(EBUSY, fiber_rwlock_trywrlock(&rw));
+    timespec abstime = eabase::milliseconds_from_now(20);
+    ASSERT_EQ(ETIMEDOUT, fiber_rwlock_timedrdlock(&rw, &abstime));
+    abstime = eabase::milliseconds_from_now(20);
+    ASSERT_EQ(ETIMEDOUT, fiber_rwlock_timedwrlock(&rw, &abstime));
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+
+    ASSERT_EQ(0, fiber_rwlock_trywrlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_unlock(&rw));
+    ASSERT_EQ(0, fiber_rwlock_destroy(&rw));
+}
+
+TEST(RWLockTest, attr) {
+    fiber_rwlockattr_t attr;
+    ASSERT_EQ(0, fiber_rwlockattr_init(&attr));
+    int kind = -1;
+    ASSERT_EQ(0, fiber_rwlockattr_getkind_np(&attr, &kind));
+    ASSERT_EQ(FIBER_RWLOCK_PREFER_READER_NP, kind);
+    ASSERT_EQ(EINVAL, fiber_rwlockattr_setkind_np(&attr, 3));
+    ASSERT_EQ(0, fiber_rwlockattr_setkind_np(
+                  &attr, FIBER_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP));
+    ASSERT_EQ(0, fiber_rwlockattr_getkind_np(&attr, &kind));
+    ASSERT_EQ(FIBER_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP, kind);
+    ASSERT_EQ(0, fiber_rwlockattr_destroy(&attr));
+}
+
+void* write_locker(void* arg) {
+    fiber_rwlock_t* rw = static_cast<fiber_rwlock_t*>(arg);
+    EXPECT_EQ(0, fiber_rwlock_wrlock(rw));
+    EXPECT_EQ(0, fiber_rwlock_unlock(rw));
+    return NULL;
+}
+
+struct TryReadArg {
+    fiber_rwlock_t* rw;
+    int rc;
+};
+
+void* try_read_locker(void* void_arg) {
+    TryReadArg* arg = static_cast<TryReadArg*>(void_arg);
+    arg->rc = fiber_rwlock_tryrdlock(arg->rw);
+    if (arg->rc == 0) {
+        fiber_rwlock_unlock(arg->rw);
+    }
+    return NULL;
+}
+
+// Whether a new reader gets in while a writer is waiting for the reader
+// holding the lock.
+int try_read_with_waiting_writer(int kind) {
+    fiber_rwlockattr_t attr;
+    fiber_rwlockattr_init(&attr);
+    fiber_rwlockattr_setkind_np(&attr, kind);
+    fiber_rwlock_t rw;
+    EXPECT_EQ(0, fiber_rwlock_init(&rw, &attr));
+    EXPECT_EQ(0, fiber_rwlock_rdlock(&rw));
+    fiber_t writer;
+    EXPECT_EQ(0, fiber_start(&writer, NULL, write_locker, &rw));
+    usleep(20000);
+    // From another thread so that the holding reader isn't involved.
+    TryReadArg arg = { &rw, -1 };
+    fiber_t reader;
+    EXPECT_EQ(0, fiber_start(&reader, NULL, try_read_locker, &arg));
+    EXPECT_EQ(0, fiber_join(reader, NULL));
+    EXPECT_EQ(0, fiber_rwlock_unlock(&rw));
+    EXPECT_EQ(0, fiber_join(writer, NULL));
+    EXPECT_EQ(0, fiber_rwlock_destroy(&rw));
+    return arg.rc;
+}
+
+TEST(RWLockTest, preference) {
+    ASSERT_EQ(0, try_read_with_waiting_writer(FIBER_RWLOCK_PREFER_READER_NP));
+    ASSERT_EQ(EBUSY, try_read_with_waiting_writer(
+                  FIBER_RWLOCK_PREFER_WRITER_NP));
+}
+
+struct MixArg {
+    fiber_rwlock_t* rw;
+    // Written by writers only, two halves equal outside the lock.
+    int64_t* values;
+    int read_per_mille;
+    volatile bool* stop;
+    int64_t nread;
+    int64_t nwrite;
+    int64_t nbroken;
+};
+
+void* mix_locker(void* void_arg) {
+    MixArg* arg = static_cast<MixArg*>(void_arg);
+    uint32_t seed = (uint32_t)(uintptr_t)arg;
+    while (!*arg->stop) {
+        seed = seed * 1103515245 + 12345;
+        if ((int)((seed >> 16) % 1000) < arg->read_per_mille) {
+            fiber_rwlock_rdlock(arg->rw);
+            if (arg->values[0] != arg->values[1]) {
+                ++arg->nbroken;
+            }
+            fiber_rwlock_unlock(arg->rw);
+            ++arg->nread;
+        } else {
+            fiber_rwlock_wrlock(arg->rw);
+            ++arg->values[0];
+            ++arg->values[1];
+            fiber_rwlock_unlock(arg->rw);
+            ++arg->nwrite;
+        }
+    }
+    return NULL;
+}
+
+struct MixResult {
+    int64_t nread;
+    int64_t nwrite;
+    int64_t nbroken;
+    int64_t elapsed_ns;
+};
+
+MixResult run_mix(int kind, int read_per_mille, int nfiber, int duration_ms) {
+    fiber_rwlockattr_t attr;
+    fiber_rwlockattr_init(&attr);
+    fiber_rwlockattr_setkind_np(&attr, kind);
+    fiber_rwlock_t rw;
+    EXPECT_EQ(0, fiber_rwlock_init(&rw, &attr));
+    int64_t values[2] = { 0, 0 };
+    volatile bool stop = false;
+    std::vector<MixArg> args(nfiber);
+    std::vector<fiber_t> th(nfiber);
+    eabase::Timer tm;
+    tm.start();
+    for (int i = 0; i < nfiber; ++i) {
+        MixArg a = { &rw, values, read_per_mille, &stop, 0, 0, 0 };
+        args[i] = a;
+        EXPECT_EQ(0, fiber_start(&th[i], NULL, mix_locker, &args[i]));
+    }
+    usleep(duration_ms * 1000);
+    stop = true;
+    MixResult r = { 0, 0, 0, 0 };
+    for (int i = 0; i < nfiber; ++i) {
+        EXPECT_EQ(0, fiber_join(th[i], NULL));
+        r.nread += args[i].nread;
+        r.nwrite += args[i].nwrite;
+        r.nbroken += args[i].nbroken;
+    }
+    tm.stop();
+    r.elapsed_ns = tm.n_elapsed();
+    EXPECT_EQ(r.nwrite, values[0]);
+    EXPECT_EQ(0, fiber_rwlock_destroy(&rw));
+    return r;
+}
+
+TEST(RWLockTest, mix_reads_and_writes) {
+    const int kinds[] = { FIBER_RWLOCK_PREFER_READER_NP,
+                          FIBER_RWLOCK_PREFER_WRITER_NP };
+    for (size_t i = 0; i < arraysize(kinds); ++i) {
+        const MixResult r = run_mix(kinds[i], 500, 16, 200);
+        ASSERT_EQ(0, r.nbroken);
+        ASSERT_GT(r.nread, 0);
+        ASSERT_GT(r.nwrite, 0);
+    }
+}
+
+TEST(RWLockTest, contention_profiler) {
+    const char* const prof_name = "fiber_rwlock_unittest.contention";
+    ASSERT_TRUE(eabase::ContentionProfilerStart(prof_name));
+    const MixResult r = run_mix(FIBER_RWLOCK_PREFER_WRITER_NP, 900, 16, 200);
+    eabase::ContentionProfilerStop();
+    ASSERT_EQ(0, r.nbroken);
+    unlink(prof_name);
+}
+
+struct MutexArg {
+    fiber_mutex_t* m;
+    int64_t* value;
+    int read_per_mille;
+    volatile bool* stop;
+    int64_t nop;
+};
+
+void* mix_mutex_locker(void* void_arg) {
+    MutexArg* arg = static_cast<MutexArg*>(void_arg);
+    uint32_t seed = (uint32_t)(uintptr_t)arg;
+    int64_t sink = 0;
+    while (!*arg->stop) {
+        seed = seed * 1103515245 + 12345;
+        const bool read = (int)((seed >> 16) % 1000) < arg->read_per_mille;
+        fiber_mutex_lock(arg->m);
+        if (read) {
+            sink += *arg->value;
+        } else {
+            ++*arg->value;
+        }
+        fiber_mutex_unlock(arg->m);
+        ++arg->nop;
+    }
+    return (void*)(intptr_t)sink;
+}
+
+int64_t mutex_ops_per_second(int read_per_mille, int nfiber, int duration_ms) {
+    fiber_mutex_t m;
+    fiber_mutex_init(&m, NULL);
+    int64_t value = 0;
+    volatile bool stop = false;
+    std::vector<MutexArg> args(nfiber);
+    std::vector<fiber_t> th(nfiber);
+    eabase::Timer tm;
+    tm.start();
+    for (int i = 0; i < nfiber; ++i) {
+        MutexArg a = { &m, &value, read_per_mille, &stop, 0 };
+        args[i] = a;
+        EXPECT_EQ(0, fiber_start(&th[i], NULL, mix_mutex_locker, &args[i]));
+    }
+    usleep(duration_ms * 1000);
+    stop = true;
+    int64_t nop = 0;
+    for (int i = 0; i < nfiber; ++i) {
+        EXPECT_EQ(0, fiber_join(th[i], NULL));
+        nop += args[i].nop;
+    }
+    tm.stop();
+    fiber_mutex_destroy(&m);
+    return nop * 1000000000L / tm.n_elapsed();
+}
+
+TEST(RWLockTest, read_ratio_performance) {
+    const int nfiber = 16;
+    const int duration_ms = 300;
+    const int read_per_milles[] = { 900, 990, 999 };
+    for (size_t i = 0; i < arraysize(read_per_milles); ++i) {
+        const int rpm = read_per_milles[i];
+        const MixResult rp = run_mix(FIBER_RWLOCK_PREFER_READER_NP, rpm,
+                                     nfiber, duration_ms);
+        const MixResult wp = run_mix(FIBER_RWLOCK_PREFER_WRITER_NP, rpm,
+                                     nfiber, duration_ms);
+        const int64_t mutex_ops = mutex_ops_per_second(rpm, nfiber,
+                                                       duration_ms);
+        ASSERT_EQ(0, rp.nbroken);
+        ASSERT_EQ(0, wp.nbroken);
+        std::cout << "reads=" << rpm / 10.0 << "%"
+                  << " rwlock(prefer reader)="
+                  << (rp.nread + rp.nwrite) * 1000000000L / rp.elapsed_ns
+                  << "/s rwlock(prefer writer)="
+                  << (wp.nread + wp.nwrite) * 1000000000L / wp.elapsed_ns
+                  << "/s mutex=" << mutex_ops << "/s" << std::endl;
+    }
+}
 } // namespace
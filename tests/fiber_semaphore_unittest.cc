@@ -0,0 +1,221 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/time.h"
+#include "eabase/fiber/fiber.h"
+
+namespace {
+TEST(SemaphoreTest, sanity) {
+    fiber_sem_t sem;
+    ASSERT_EQ(0, fiber_sem_init(&sem, 2));
+    ASSERT_EQ(0, fiber_sem_trywait(&sem));
+    ASSERT_EQ(0, fiber_sem_wait(&sem));
+    ASSERT_EQ(EAGAIN, fiber_sem_trywait(&sem));
+    ASSERT_EQ(0, fiber_sem_post_n(&sem, 3));
+    for (int i = 0; i < 3; ++i) {
+        ASSERT_EQ(0, fiber_sem_trywait(&sem));
+    }
+    ASSERT_EQ(EAGAIN, fiber_sem_trywait(&sem));
+    ASSERT_EQ(0, fiber_sem_destroy(&sem));
+}
+
+TEST(SemaphoreTest, timedwait) {
+    fiber_sem_t sem;
+    ASSERT_EQ(0, fiber_sem_init(&sem, 0));
+    eabase::Timer tm;
+    tm.start();
+    const timespec abstime = eabase::milliseconds_from_now(20);
+    ASSERT_EQ(ETIMEDOUT, fiber_sem_timedwait(&sem, &abstime));
+    tm.stop();
+    ASSERT_GE(tm.m_elapsed(), 15);
+    ASSERT_EQ(0, fiber_sem_post(&sem));
+    const timespec abstime2 = eabase::milliseconds_from_now(20);
+    ASSERT_EQ(0, fiber_sem_timedwait(&sem, &abstime2));
+    ASSERT_EQ(0, fiber_sem_destroy(&sem));
+}
+
+struct SemArg {
+    fiber_sem_t* sem;
+    eabase::atomic<int>* nacquired;
+};
+
+void* acquire(void* void_arg) {
+    SemArg* arg = static_cast<SemArg*>(void_arg);
+    EXPECT_EQ(0, fiber_sem_wait(arg->sem));
+    arg->nacquired->fetch_add(1);
+    return NULL;
+}
+
+TEST(SemaphoreTest, post_n_wakes_n) {
+    const int N = 8;
+    fiber_sem_t sem;
+    ASSERT_EQ(0, fiber_sem_init(&sem, 0));
+    eabase::atomic<int> nacquired(0);
+    SemArg arg = { &sem, &nacquired };
+    fiber_t th[N];
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_start(&th[i], NULL, acquire, &arg));
+    }
+    usleep(10000);
+    ASSERT_EQ(0, nacquired.load());
+    ASSERT_EQ(0, fiber_sem_post_n(&sem, 3));
+    usleep(10000);
+    ASSERT_EQ(3, nacquired.load());
+    ASSERT_EQ(0, fiber_sem_post_n(&sem, N - 3));
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+    }
+    ASSERT_EQ(N, nacquired.load());
+    ASSERT_EQ(EAGAIN, fiber_sem_trywait(&sem));
+    ASSERT_EQ(0, fiber_sem_destroy(&sem));
+}
+
+const int LIMIT = 4;
+
+struct LimiterArg {
+    fiber_sem_t* sem;
+    eabase::atomic<int>* nrunning;
+    eabase::atomic<int>* max_running;
+};
+
+void* limited(void* void_arg) {
+    LimiterArg* arg = static_cast<LimiterArg*>(void_arg);
+    for (int i = 0; i < 1000; ++i) {
+        EXPECT_EQ(0, fiber_sem_wait(arg->sem));
+        const int n = arg->nrunning->fetch_add(1) + 1;
+        int m = arg->max_running->load();
+        while (n > m && !arg->max_running->compare_exchange_weak(m, n)) {}
+        if (i % 100 == 0) {
+            fiber_yield();
+        }
+        arg->nrunning->fetch_sub(1);
+        EXPECT_EQ(0, fiber_sem_post(arg->sem));
+    }
+    return NULL;
+}
+
+TEST(SemaphoreTest, limiter) {
+    fiber_sem_t sem;
+    ASSERT_EQ(0, fiber_sem_init(&sem, LIMIT));
+    eabase::atomic<int> nrunning(0);
+    eabase::atomic<int> max_running(0);
+    LimiterArg arg = { &sem, &nrunning, &max_running };
+    const int N = 16;
+    fiber_t th[N];
+    eabase::Timer tm;
+    tm.start();
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_start(&th[i], NULL, limited, &arg));
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+    }
+    tm.stop();
+    ASSERT_LE(max_running.load(), LIMIT);
+    std::cout << "acquire/release=" << tm.n_elapsed() / (N * 1000) << "ns"
+              << std::endl;
+    for (int i = 0; i < LIMIT; ++i) {
+        ASSERT_EQ(0, fiber_sem_trywait(&sem));
+    }
+    ASSERT_EQ(EAGAIN, fiber_sem_trywait(&sem));
+    ASSERT_EQ(0, fiber_sem_destroy(&sem));
+}
+
+TEST(BarrierTest, invalid_count) {
+    fiber_barrier_t barrier;
+    ASSERT_EQ(EINVAL, fiber_barrier_init(&barrier, NULL, 0));
+}
+
+const int NROUND = 100;
+
+struct BarrierArg {
+    fiber_barrier_t* barrier;
+    eabase::atomic<int>* arrived;    // per round
+    eabase::atomic<int>* nserial;    // per round
+    int count;
+};
+
+void* barrier_waiter(void* void_arg) {
+    BarrierArg* arg = static_cast<BarrierArg*>(void_arg);
+    for (int r = 0; r < NROUND; ++r) {
+        arg->arrived[r].fetch_add(1);
+        const int rc = fiber_barrier_wait(arg->barrier);
+        if (rc == FIBER_BARRIER_SERIAL_THREAD) {
+            arg->nserial[r].fetch_add(1);
+        } else {
+            EXPECT_EQ(0, rc);
+        }
+        // Nobody passes the barrier before everyone arrived.
+        EXPECT_EQ(arg->count, arg->arrived[r].load());
+    }
+    return NULL;
+}
+
+TEST(BarrierTest, rounds) {
+    const int N = 8;
+    fiber_barrier_t barrier;
+    ASSERT_EQ(0, fiber_barrier_init(&barrier, NULL, N));
+    eabase::atomic<int> arrived[NROUND];
+    eabase::atomic<int> nserial[NROUND];
+    for (int r = 0; r < NROUND; ++r) {
+        arrived[r].store(0);
+        nserial[r].store(0);
+    }
+    BarrierArg arg = { &barrier, arrived, nserial, N };
+    fiber_t th[N];
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_start(&th[i], NULL, barrier_waiter, &arg));
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+    }
+    for (int r = 0; r < NROUND; ++r) {
+        ASSERT_EQ(N, arrived[r].load());
+        ASSERT_EQ(1, nserial[r].load());
+    }
+    ASSERT_EQ(0, fiber_barrier_destroy(&barrier));
+}
+
+TEST(BarrierTest, pthreads_and_fibers) {
+    const int N = 4;
+    fiber_barrier_t barrier;
+    ASSERT_EQ(0, fiber_barrier_init(&barrier, NULL, N * 2));
+    eabase::atomic<int> arrived[NROUND];
+    eabase::atomic<int> nserial[NROUND];
+    for (int r = 0; r < NROUND; ++r) {
+        arrived[r].store(0);
+        nserial[r].store(0);
+    }
+    BarrierArg arg = { &barrier, arrived, nserial, N * 2 };
+    fiber_t th[N];
+    pthread_t pth[N];
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_start(&th[i], NULL, barrier_waiter, &arg));
+        ASSERT_EQ(0, pthread_create(&pth[i], NULL, barrier_waiter, &arg));
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+        ASSERT_EQ(0, pthread_join(pth[i], NULL));
+    }
+    for (int r = 0; r < NROUND; ++r) {
+        ASSERT_EQ(1, nserial[r].load());
+    }
+    ASSERT_EQ(0, fiber_barrier_destroy(&barrier));
+}
+} // namespace
@@ -52,8 +52,9 @@ TEST(FiberTest, setconcurrency) {
     ASSERT_EQ(FIBER_MIN_CONCURRENCY + 1, fiber_getconcurrency());
     ASSERT_EQ(0, fiber_setconcurrency(FIBER_MIN_CONCURRENCY + 5));
     ASSERT_EQ(FIBER_MIN_CONCURRENCY + 5, fiber_getconcurrency());
-    ASSERT_EQ(EPERM, fiber_setconcurrency(FIBER_MIN_CONCURRENCY + 1));
-    ASSERT_EQ(FIBER_MIN_CONCURRENCY + 5, fiber_getconcurrency());
+    ASSERT_EQ(0, fiber_setconcurrency(FIBER_MIN_CONCURRENCY + 1));
+    ASSERT_EQ(FIBER_MIN_CONCURRENCY + 1, fiber_getconcurrency());
+    ASSERT_EQ(FIBER_MIN_CONCURRENCY + 1, eabase::g_task_control->concurrency());
 }
 
 static eabase::atomic<int> *odd;
@@ -125,6 +126,82 @@ TEST(FiberTest, setconcurrency_with_running_fiber) {
     LOG(INFO) << "Touched pthreads=" << npthreads;
 }
 
+static eabase::atomic<int> nyield_done(0);
+
+static void* yield_thread(void*) {
+    for (int i = 0; i < 100; ++i) {
+        fiber_yield();
+        fiber_usleep(100);
+    }
+    nyield_done.fetch_add(1);
+    return NULL;
+}
+
+TEST(FiberTest, shrink_with_running_fiber) {
+    std::vector<fiber_t> tids;
+    const int N = 1000;
+    for (int i = 0; i < N; ++i) {
+        fiber_t tid;
+        ASSERT_EQ(0, fiber_start_lazy(&tid, &FIBER_ATTR_SMALL, yield_thread, NULL));
+        tids.push_back(tid);
+    }
+    const int concurrency = fiber_getconcurrency();
+    for (int round = 0; round < 3; ++round) {
+        ASSERT_EQ(0, fiber_setconcurrency(FIBER_MIN_CONCURRENCY));
+        ASSERT_EQ(FIBER_MIN_CONCURRENCY, fiber_getconcurrency());
+        ASSERT_EQ(FIBER_MIN_CONCURRENCY, eabase::g_task_control->concurrency());
+        usleep(10000);
+        ASSERT_EQ(0, fiber_setconcurrency(concurrency));
+        ASSERT_EQ(concurrency, fiber_getconcurrency());
+        usleep(10000);
+    }
+    ASSERT_EQ(0, fiber_setconcurrency(FIBER_MIN_CONCURRENCY));
+    for (size_t i = 0; i < tids.size(); ++i) {
+        ASSERT_EQ(0, fiber_join(tids[i], NULL));
+    }
+    ASSERT_EQ(N, nyield_done.load());
+    // Retired workers quit once they're idle.
+    for (int i = 0; i < 1000 &&
+             eabase::g_task_control->_nworkers.get_value() != FIBER_MIN_CONCURRENCY; ++i) {
+        usleep(1000);
+    }
+    ASSERT_EQ(FIBER_MIN_CONCURRENCY, eabase::g_task_control->_nworkers.get_value());
+    ASSERT_EQ(0, fiber_setconcurrency(concurrency));
+}
+
+static eabase::atomic<bool> stop_spinning(false);
+static eabase::atomic<int> nspinning(0);
+
+// Never gets back to the scheduling loop, like epoll fibers.
+static void* spin_thread(void*) {
+    nspinning.fetch_add(1);
+    while (!stop_spinning.load()) {
+        usleep(1000);
+    }
+    return NULL;
+}
+
+TEST(FiberTest, shrink_skips_long_running_fiber) {
+    const int concurrency = fiber_getconcurrency();
+    ASSERT_LT(FIBER_MIN_CONCURRENCY, concurrency);
+    fiber_t tid;
+    ASSERT_EQ(0, fiber_start_lazy(&tid, NULL, spin_thread, NULL));
+    while (nspinning.load() == 0) {
+        usleep(1000);
+    }
+    usleep(20000);
+    ASSERT_EQ(0, fiber_setconcurrency(FIBER_MIN_CONCURRENCY));
+    // All retired workers quit although one worker is stuck.
+    for (int i = 0; i < 1000 &&
+             eabase::g_task_control->_nworkers.get_value() != FIBER_MIN_CONCURRENCY; ++i) {
+        usleep(1000);
+    }
+    ASSERT_EQ(FIBER_MIN_CONCURRENCY, eabase::g_task_control->_nworkers.get_value());
+    stop_spinning.store(true);
+    ASSERT_EQ(0, fiber_join(tid, NULL));
+    ASSERT_EQ(0, fiber_setconcurrency(concurrency));
+}
+
 void* sleep_proc(void*) {
     usleep(100000);
     return NULL;
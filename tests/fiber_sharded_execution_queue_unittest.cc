@@ -0,0 +1,230 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "eabase/utility/time.h"
+#include "eabase/var/var.h"
+#include "eabase/fiber/sharded_execution_queue.h"
+
+namespace {
+const int NKEY = 64;
+const int NPRODUCER = 8;
+
+struct KeyedTask {
+    int key;
+    int64_t seq;
+};
+
+struct OrderChecker {
+    // Only touched by the shard of each key.
+    int64_t next_seq[NKEY];
+    eabase::atomic<int64_t> ntask;
+    eabase::atomic<int> disorder;
+    eabase::atomic<int> nstop;
+    eabase::atomic<int> nconcurrent;
+    eabase::atomic<int> max_concurrent;
+    int spin_ns;
+};
+
+void init_checker(OrderChecker* c, int spin_ns) {
+    memset(c->next_seq, 0, sizeof(c->next_seq));
+    c->ntask.store(0);
+    c->disorder.store(0);
+    c->nstop.store(0);
+    c->nconcurrent.store(0);
+    c->max_concurrent.store(0);
+    c->spin_ns = spin_ns;
+}
+
+void spin_for(int ns) {
+    if (ns > 0) {
+        const int64_t end = eabase::cpuwide_time_ns() + ns;
+        while (eabase::cpuwide_time_ns() < end) {}
+    }
+}
+
+int check_order(void* meta, eabase::TaskIterator<KeyedTask>& iter) {
+    OrderChecker* c = static_cast<OrderChecker*>(meta);
+    if (iter.is_queue_stopped()) {
+        c->nstop.fetch_add(1);
+        return 0;
+    }
+    const int n = c->nconcurrent.fetch_add(1) + 1;
+    int cur_max = c->max_concurrent.load();
+    while (n > cur_max && !c->max_concurrent.compare_exchange_weak(cur_max, n)) {}
+    for (; iter; ++iter) {
+        if (c->next_seq[iter->key] != iter->seq) {
+            c->disorder.fetch_add(1);
+        }
+        c->next_seq[iter->key] = iter->seq + 1;
+        spin_for(c->spin_ns);
+        c->ntask.fetch_add(1, eabase::memory_order_relaxed);
+    }
+    c->nconcurrent.fetch_sub(1);
+    return 0;
+}
+
+struct ProducerArg {
+    eabase::ShardedExecutionQueue<KeyedTask>* q;
+    int index;
+    int ntask_per_key;
+    const eabase::TaskOptions* options;
+};
+
+// Every key is owned by exactly one producer so that it sees the FIFO
+// order of its own tasks.
+void* produce(void* void_arg) {
+    ProducerArg* arg = static_cast<ProducerArg*>(void_arg);
+    for (int64_t seq = 0; seq < arg->ntask_per_key; ++seq) {
+        for (int key = arg->index; key < NKEY; key += NPRODUCER) {
+            KeyedTask t = { key, seq };
+            EXPECT_EQ(0, arg->q->execute(key, t, arg->options));
+        }
+    }
+    return NULL;
+}
+
+void run_producers(eabase::ShardedExecutionQueue<KeyedTask>* q,
+                   int ntask_per_key, const eabase::TaskOptions* options) {
+    pthread_t th[NPRODUCER];
+    ProducerArg args[NPRODUCER];
+    for (int i = 0; i < NPRODUCER; ++i) {
+        args[i].q = q;
+        args[i].index = i;
+        args[i].ntask_per_key = ntask_per_key;
+        args[i].options = options;
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, produce, &args[i]));
+    }
+    for (int i = 0; i < NPRODUCER; ++i) {
+        pthread_join(th[i], NULL);
+    }
+}
+
+TEST(ShardedExecutionQueueTest, order_per_key) {
+    const eabase::TaskOptions* all_options[] = {
+        NULL, &eabase::TASK_OPTIONS_URGENT, &eabase::TASK_OPTIONS_INPLACE };
+    for (size_t i = 0; i < ARRAY_SIZE(all_options); ++i) {
+        OrderChecker c;
+        init_checker(&c, 0);
+        eabase::ShardedExecutionQueueOptions options;
+        options.num_shards = 4;
+        eabase::ShardedExecutionQueue<KeyedTask> q;
+        ASSERT_EQ(0, q.start(&options, check_order, &c));
+        ASSERT_EQ(4u, q.shard_count());
+        run_producers(&q, 2000, all_options[i]);
+        ASSERT_EQ(0, q.stop());
+        ASSERT_EQ(0, q.join());
+        ASSERT_EQ(NKEY * 2000, c.ntask.load());
+        ASSERT_EQ(0, c.disorder.load());
+        // The stop task is passed on exactly once for all shards.
+        ASSERT_EQ(1, c.nstop.load());
+
+        eabase::ShardedExecutionQueueStats stats;
+        q.get_stats(&stats);
+        ASSERT_EQ(NKEY * 2000, stats.task_count);
+        ASSERT_EQ(0, stats.rejected_count);
+        ASSERT_EQ(4u, stats.shard_task_count.size());
+        for (size_t j = 0; j < stats.shard_task_count.size(); ++j) {
+            ASSERT_GT(stats.shard_task_count[j], 0);
+        }
+        ASSERT_EQ(EINVAL, q.execute(0, KeyedTask()));
+    }
+}
+
+TEST(ShardedExecutionQueueTest, same_key_same_shard) {
+    OrderChecker c;
+    init_checker(&c, 0);
+    eabase::ShardedExecutionQueue<KeyedTask> q;
+    ASSERT_EQ(EINVAL, q.execute(0, KeyedTask()));
+    ASSERT_EQ(0, q.start(NULL, check_order, &c));
+    ASSERT_EQ((size_t)fiber_getconcurrency(), q.shard_count());
+    for (uint64_t key = 0; key < 1000; ++key) {
+        ASSERT_EQ(q.shard_of(key), q.shard_of(key));
+        ASSERT_LT(q.shard_of(key), q.shard_count());
+    }
+    ASSERT_EQ(EINVAL, q.start(NULL, check_order, &c));
+    // Stopped and joined by the destructor.
+}
+
+fiber_tag_t g_consumer_tag = FIBER_TAG_INVALID;
+
+int record_tag(void*, eabase::TaskIterator<KeyedTask>& iter) {
+    for (; iter; ++iter) {
+        g_consumer_tag = fiber_self_tag();
+    }
+    return 0;
+}
+
+TEST(ShardedExecutionQueueTest, fiber_tag) {
+    eabase::ShardedExecutionQueueOptions options;
+    options.num_shards = 2;
+    options.fiber_tag = FIBER_TAG_DEFAULT;
+    eabase::ShardedExecutionQueue<KeyedTask> q;
+    ASSERT_EQ(0, q.start(&options, record_tag, NULL));
+    ASSERT_EQ(0, q.execute(1, KeyedTask()));
+    ASSERT_EQ(0, q.stop());
+    ASSERT_EQ(0, q.join());
+    ASSERT_EQ(FIBER_TAG_DEFAULT, g_consumer_tag);
+}
+
+TEST(ShardedExecutionQueueTest, expose) {
+    OrderChecker c;
+    init_checker(&c, 0);
+    eabase::ShardedExecutionQueueOptions options;
+    options.num_shards = 3;
+    eabase::ShardedExecutionQueue<KeyedTask> q;
+    ASSERT_EQ(0, q.start(&options, check_order, &c));
+    ASSERT_EQ(0, q.expose("sharded_execq_unittest"));
+    for (int i = 0; i < 30; ++i) {
+        KeyedTask t = { 7, i };
+        ASSERT_EQ(0, q.execute(7, t));
+    }
+    ASSERT_EQ(0, q.stop());
+    ASSERT_EQ(0, q.join());
+    ASSERT_EQ("30", eabase::Variable::describe_exposed(
+                  "sharded_execq_unittest_task_count"));
+    ASSERT_EQ("0", eabase::Variable::describe_exposed(
+                  "sharded_execq_unittest_rejected_count"));
+    // All tasks went to one of the 3 shards.
+    ASSERT_EQ("3", eabase::Variable::describe_exposed(
+                  "sharded_execq_unittest_shard_imbalance"));
+}
+
+TEST(ShardedExecutionQueueTest, performance) {
+    const int NTASK_PER_KEY = 500;
+    const int SPIN_NS = 2000;
+    for (int nshard = 1; nshard <= 4; nshard *= 2) {
+        OrderChecker c;
+        init_checker(&c, SPIN_NS);
+        eabase::ShardedExecutionQueueOptions options;
+        options.num_shards = nshard;
+        eabase::ShardedExecutionQueue<KeyedTask> q;
+        ASSERT_EQ(0, q.start(&options, check_order, &c));
+        eabase::Timer tm;
+        tm.start();
+        run_producers(&q, NTASK_PER_KEY, NULL);
+        ASSERT_EQ(0, q.stop());
+        ASSERT_EQ(0, q.join());
+        tm.stop();
+        ASSERT_EQ(0, c.disorder.load());
+        std::cout << "shards=" << nshard << " "
+                  << tm.n_elapsed() / (NKEY * NTASK_PER_KEY)
+                  << "ns per task of " << SPIN_NS << "ns, max_concurrent="
+                  << c.max_concurrent.load() << std::endl;
+    }
+}
+} // namespace
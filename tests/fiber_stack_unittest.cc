@@ -0,0 +1,252 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <alloca.h>
+#include <vector>
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "eabase/utility/macros.h"                  // ARRAY_SIZE
+#include "eabase/var/var.h"
+#include "eabase/fiber/fiber.h"
+#include "eabase/fiber/stack.h"
+
+DECLARE_bool(fiber_stack_profile);
+DECLARE_int32(fiber_stack_profile_interval);
+DECLARE_bool(fiber_stack_auto_class);
+DECLARE_int32(fiber_stack_auto_class_min_samples);
+DECLARE_bool(fiber_stack_huge_page);
+DECLARE_int32(fiber_stack_prefault_count);
+
+namespace {
+struct UsageArg {
+    size_t nbytes;
+    unsigned stack_type;
+};
+
+void touch_stack(UsageArg* arg) {
+    volatile char* buf = (volatile char*)alloca(arg->nbytes);
+    for (size_t i = 0; i < arg->nbytes; i += 64) {
+        buf[i] = 1;
+    }
+    fiber_attr_t attr;
+    ASSERT_EQ(0, fiber_getattr(fiber_self(), &attr));
+    arg->stack_type = attr.stack_type;
+}
+
+// Different entry functions are profiled separately.
+void* shallow_fiber(void* void_arg) {
+    touch_stack(static_cast<UsageArg*>(void_arg));
+    return NULL;
+}
+
+void* deep_fiber(void* void_arg) {
+    touch_stack(static_cast<UsageArg*>(void_arg));
+    return NULL;
+}
+
+void* profiled_fiber(void* void_arg) {
+    touch_stack(static_cast<UsageArg*>(void_arg));
+    return NULL;
+}
+
+void run_fiber(void* (*fn)(void*), UsageArg* arg) {
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, NULL, fn, arg));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+}
+
+int64_t get_var(const char* name) {
+    return atoll(eabase::Variable::describe_exposed(name).c_str());
+}
+
+// Runs first, before workers start.
+TEST(StackTest, prefault) {
+    FLAGS_fiber_stack_prefault_count = 16;
+    UsageArg arg = { 1024, 0 };
+    run_fiber(shallow_fiber, &arg);
+    FLAGS_fiber_stack_prefault_count = 0;
+    ASSERT_GE(get_var("fiber_stack_count"), 16);
+}
+
+TEST(StackTest, huge_page_allocation) {
+    const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+    FLAGS_fiber_stack_huge_page = true;
+    // Small stacks without guard pages are packed into shared regions.
+    eabase::StackStorage small[4];
+    for (size_t i = 0; i < ARRAY_SIZE(small); ++i) {
+        ASSERT_EQ(0, eabase::allocate_stack_storage(&small[i], 32768, 0));
+        ASSERT_EQ(32768, small[i].stacksize);
+        ASSERT_EQ(0, small[i].guardsize);
+        ASSERT_TRUE(small[i].carved);
+        memset((char*)small[i].bottom - 32768, 1, 32768);
+    }
+    // Small stacks with guard pages keep them.
+    eabase::StackStorage guarded;
+    ASSERT_EQ(0, eabase::allocate_stack_storage(&guarded, 32768, 4096));
+    ASSERT_EQ(4096, guarded.guardsize);
+    ASSERT_FALSE(guarded.carved);
+    memset((char*)guarded.bottom - 32768, 1, 32768);
+    // Large stacks keep guard pages and their tops are aligned.
+    eabase::StackStorage large;
+    ASSERT_EQ(0, eabase::allocate_stack_storage(&large, 8 * 1024 * 1024, 4096));
+    ASSERT_EQ(4096, large.guardsize);
+    ASSERT_FALSE(large.carved);
+    ASSERT_EQ(0u, (uintptr_t)large.bottom % HUGE_PAGE_SIZE);
+    memset((char*)large.bottom - large.stacksize, 1, large.stacksize);
+    FLAGS_fiber_stack_huge_page = false;
+
+    for (size_t i = 0; i < ARRAY_SIZE(small); ++i) {
+        eabase::deallocate_stack_storage(&small[i]);
+    }
+    eabase::deallocate_stack_storage(&guarded);
+    eabase::deallocate_stack_storage(&large);
+}
+
+TEST(StackTest, profile_usage) {
+    FLAGS_fiber_stack_profile = true;
+    FLAGS_fiber_stack_profile_interval = 1;
+    UsageArg arg = { 200 * 1024, 0 };
+    for (int i = 0; i < 20; ++i) {
+        run_fiber(profiled_fiber, &arg);
+    }
+    FLAGS_fiber_stack_profile_interval = 16;
+    FLAGS_fiber_stack_profile = false;
+    const int64_t max_usage = get_var("fiber_stack_usage_normal_max");
+    ASSERT_GE(max_usage, 200 * 1024);
+    ASSERT_LE(max_usage, 1024 * 1024);
+    const std::string hist =
+        eabase::Variable::describe_exposed("fiber_stack_usage_normal");
+    ASSERT_NE(std::string::npos, hist.find("<=256K:")) << hist;
+    std::cout << "fiber_stack_usage_normal: " << hist << std::endl;
+}
+
+TEST(StackTest, auto_class) {
+    FLAGS_fiber_stack_auto_class = true;
+    FLAGS_fiber_stack_auto_class_min_samples = 4;
+    FLAGS_fiber_stack_profile_interval = 1;
+    UsageArg shallow = { 2 * 1024, 0 };
+    UsageArg deep = { 600 * 1024, 0 };
+    for (int i = 0; i < 20; ++i) {
+        run_fiber(shallow_fiber, &shallow);
+        run_fiber(deep_fiber, &deep);
+    }
+    // Enough samples are collected to choose a class other than normal.
+    ASSERT_EQ((unsigned)FIBER_STACKTYPE_SMALL, shallow.stack_type);
+    // 600KB plus 100% headroom does not fit in a normal stack.
+    ASSERT_EQ((unsigned)FIBER_STACKTYPE_LARGE, deep.stack_type);
+
+    // Explicitly chosen classes are kept.
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, &FIBER_ATTR_LARGE, shallow_fiber, &shallow));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    ASSERT_EQ((unsigned)FIBER_STACKTYPE_LARGE, shallow.stack_type);
+
+    FLAGS_fiber_stack_auto_class = false;
+    FLAGS_fiber_stack_profile_interval = 16;
+    run_fiber(shallow_fiber, &shallow);
+    ASSERT_EQ((unsigned)FIBER_STACKTYPE_NORMAL, shallow.stack_type);
+}
+int recurse_and_sleep(int depth) {
+    volatile char buf[512];
+    buf[0] = (char)depth;
+    if (depth == 0) {
+        fiber_usleep(100);
+        return buf[0];
+    }
+    return recurse_and_sleep(depth - 1) + buf[0];
+}
+
+void* busy_fiber(void* arg) {
+    const int depth = (int)(intptr_t)arg;
+    for (int i = 0; i < 10; ++i) {
+        EXPECT_EQ(depth * (depth + 1) / 2, recurse_and_sleep(depth));
+        fiber_yield();
+    }
+    return NULL;
+}
+
+// Painting never touches frames of fibers running on or switched out of
+// the same worker.
+TEST(StackTest, profile_under_load) {
+    FLAGS_fiber_stack_profile = true;
+    for (int round = 0; round < 5; ++round) {
+        fiber_t th[64];
+        for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+            ASSERT_EQ(0, fiber_start_lazy(&th[i], NULL, busy_fiber,
+                                          (void*)(intptr_t)(i % 40)));
+        }
+        for (size_t i = 0; i < ARRAY_SIZE(th); ++i) {
+            ASSERT_EQ(0, fiber_join(th[i], NULL));
+        }
+    }
+    FLAGS_fiber_stack_profile = false;
+}
+void* touch_and_sleep(void* arg) {
+    touch_stack(static_cast<UsageArg*>(arg));
+    fiber_usleep(10000);
+    return NULL;
+}
+
+// Make `n' stacks dirty and return them to pools.
+void dirty_stacks(int n, size_t nbytes) {
+    std::vector<fiber_t> th(n);
+    std::vector<UsageArg> args(n);
+    for (int i = 0; i < n; ++i) {
+        args[i].nbytes = nbytes;
+        ASSERT_EQ(0, fiber_start_lazy(&th[i], NULL, touch_and_sleep, &args[i]));
+    }
+    for (int i = 0; i < n; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+    }
+}
+
+TEST(StackTest, reclaim_idle_stacks) {
+    const int NFIBER = 32;
+    const size_t NBYTES = 256 * 1024;
+    dirty_stacks(NFIBER, NBYTES);
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "fiber_stack_reclaim_max_bytes_per_second", "1048576").empty());
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "fiber_stack_reclaim_idle_ms", "50").empty());
+    usleep(500000);
+    // Bounded by the rate plus one stack released before running out of
+    // the budget.
+    ASSERT_LE(get_var("fiber_stack_reclaimed_bytes"),
+              (int64_t)(1048576 + NBYTES + 4096));
+
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "fiber_stack_reclaim_max_bytes_per_second", "1073741824").empty());
+    const int64_t expected = NFIBER * (NBYTES - 16 * 1024);
+    for (int i = 0; i < 50 &&
+             get_var("fiber_stack_reclaimed_bytes") < expected; ++i) {
+        usleep(100000);
+    }
+    const int64_t reclaimed = get_var("fiber_stack_reclaimed_bytes");
+    const int64_t resident = get_var("fiber_stack_resident_bytes");
+    std::cout << "reclaimed=" << reclaimed << " resident=" << resident
+              << std::endl;
+    ASSERT_GE(reclaimed, expected);
+    ASSERT_LT(resident, NFIBER * (int64_t)NBYTES);
+
+    // Saved contexts survive, stacks are still good to run fibers.
+    FLAGS_fiber_stack_profile = true;
+    dirty_stacks(NFIBER, NBYTES);
+    FLAGS_fiber_stack_profile = false;
+    ASSERT_FALSE(GFLAGS_NS::SetCommandLineOption(
+        "fiber_stack_reclaim_idle_ms", "0").empty());
+}
+} // namespace
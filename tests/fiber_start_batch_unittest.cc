@@ -0,0 +1,200 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <gtest/gtest.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/time.h"
+#include "eabase/fiber/fiber.h"
+#include "eabase/fiber/unstable.h"
+
+namespace {
+eabase::atomic<int> g_nrun(0);
+eabase::atomic<intptr_t> g_sum(0);
+
+void* add_arg(void* arg) {
+    g_sum.fetch_add((intptr_t)arg);
+    g_nrun.fetch_add(1);
+    return NULL;
+}
+
+void start_and_join_batch(size_t n, const fiber_attr_t* attrs) {
+    std::vector<fiber_t> tids(n);
+    std::vector<void* (*)(void*)> fns(n, add_arg);
+    std::vector<void*> args(n);
+    intptr_t expected_sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        args[i] = (void*)(intptr_t)(i + 1);
+        expected_sum += i + 1;
+    }
+    g_nrun.store(0);
+    g_sum.store(0);
+    ASSERT_EQ(0, fiber_start_batch(n, &tids[0], attrs, &fns[0], &args[0]));
+    if (attrs && (attrs[0].flags & FIBER_NOSIGNAL)) {
+        fiber_flush();
+    }
+    for (size_t i = 0; i < n; ++i) {
+        ASSERT_NE(INVALID_FIBER, tids[i]);
+        ASSERT_EQ(0, fiber_join(tids[i], NULL));
+    }
+    ASSERT_EQ((int)n, g_nrun.load());
+    ASSERT_EQ(expected_sum, g_sum.load());
+}
+
+TEST(StartBatchTest, from_pthread) {
+    start_and_join_batch(1, NULL);
+    start_and_join_batch(1000, NULL);
+}
+
+TEST(StartBatchTest, nosignal_and_priorities) {
+    const size_t N = 300;
+    std::vector<fiber_attr_t> attrs(N);
+    const unsigned prio_flags[] = {
+        FIBER_HIGH_PRIORITY, 0, FIBER_LOW_PRIORITY
+    };
+    for (size_t i = 0; i < N; ++i) {
+        attrs[i] = FIBER_ATTR_NORMAL | FIBER_NOSIGNAL | prio_flags[i % 3];
+    }
+    start_and_join_batch(N, &attrs[0]);
+    for (size_t i = 0; i < N; ++i) {
+        attrs[i] = FIBER_ATTR_NORMAL | prio_flags[i % 3];
+    }
+    start_and_join_batch(N, &attrs[0]);
+}
+
+void* start_batch_in_fiber(void*) {
+    start_and_join_batch(1000, NULL);
+    return NULL;
+}
+
+TEST(StartBatchTest, from_fiber) {
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, NULL, start_batch_in_fiber, NULL));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+}
+
+TEST(StartBatchTest, invalid_arguments) {
+    fiber_t tids[2];
+    void* (*fns[2])(void*) = { add_arg, NULL };
+    void* args[2] = { NULL, NULL };
+    ASSERT_EQ(0, fiber_start_batch(0, NULL, NULL, NULL, NULL));
+    ASSERT_EQ(EINVAL, fiber_start_batch(2, tids, NULL, fns, args));
+    fns[1] = add_arg;
+    fiber_attr_t attrs[2] = { FIBER_ATTR_NORMAL, FIBER_ATTR_NORMAL };
+    attrs[1].tag = FIBER_TAG_DEFAULT;
+    ASSERT_EQ(EINVAL, fiber_start_batch(2, tids, attrs, fns, args));
+}
+
+void* noop(void*) {
+    return NULL;
+}
+
+eabase::atomic<int> g_nquit(0);
+
+void* count_quit(void*) {
+    g_nquit.fetch_add(1, eabase::memory_order_relaxed);
+    return NULL;
+}
+
+struct BenchResult {
+    int64_t start_ns;
+    int64_t finish_ns;
+};
+
+BenchResult run_lazy(size_t n, int rep) {
+    std::vector<fiber_t> tids(n);
+    BenchResult r = { 0, 0 };
+    for (int k = 0; k < rep; ++k) {
+        g_nquit.store(0);
+        eabase::Timer tm;
+        tm.start();
+        for (size_t i = 0; i < n; ++i) {
+            fiber_start_lazy(&tids[i], NULL, count_quit, NULL);
+        }
+        tm.stop();
+        r.start_ns += tm.n_elapsed();
+        while (g_nquit.load(eabase::memory_order_relaxed) != (int)n) {
+            sched_yield();
+        }
+        tm.stop();
+        r.finish_ns += tm.n_elapsed();
+        for (size_t i = 0; i < n; ++i) {
+            fiber_join(tids[i], NULL);
+        }
+    }
+    r.start_ns /= rep;
+    r.finish_ns /= rep;
+    return r;
+}
+
+BenchResult run_batch(size_t n, int rep) {
+    std::vector<fiber_t> tids(n);
+    std::vector<void* (*)(void*)> fns(n, count_quit);
+    std::vector<void*> args(n, NULL);
+    BenchResult r = { 0, 0 };
+    for (int k = 0; k < rep; ++k) {
+        g_nquit.store(0);
+        eabase::Timer tm;
+        tm.start();
+        fiber_start_batch(n, &tids[0], NULL, &fns[0], &args[0]);
+        tm.stop();
+        r.start_ns += tm.n_elapsed();
+        while (g_nquit.load(eabase::memory_order_relaxed) != (int)n) {
+            sched_yield();
+        }
+        tm.stop();
+        r.finish_ns += tm.n_elapsed();
+        for (size_t i = 0; i < n; ++i) {
+            fiber_join(tids[i], NULL);
+        }
+    }
+    r.start_ns /= rep;
+    r.finish_ns /= rep;
+    return r;
+}
+
+void print_bench(const char* where) {
+    const size_t sizes[] = { 100, 1000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        const size_t n = sizes[i];
+        const BenchResult lazy = run_lazy(n, 20);
+        const BenchResult batch = run_batch(n, 20);
+        std::cout << where << " n=" << n
+                  << " fiber_start_lazy: start=" << lazy.start_ns / n
+                  << "ns/fiber all_done=" << lazy.finish_ns / 1000
+                  << "us | fiber_start_batch: start=" << batch.start_ns / n
+                  << "ns/fiber all_done=" << batch.finish_ns / 1000
+                  << "us" << std::endl;
+    }
+}
+
+void* bench_in_fiber(void*) {
+    print_bench("in fiber");
+    return NULL;
+}
+
+TEST(StartBatchTest, performance) {
+    // Warm up the workers and TaskMeta pool.
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, NULL, noop, NULL));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    run_batch(1000, 1);
+
+    print_bench("in pthread");
+    ASSERT_EQ(0, fiber_start(&th, NULL, bench_in_fiber, NULL));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+}
+} // namespace
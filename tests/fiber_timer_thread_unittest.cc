@@ -15,12 +15,16 @@
 // specific language governing permissions and limitations
 // under the License.
 
+#include <sys/resource.h>                    // getrusage
 #include <gtest/gtest.h>
 #include <gflags/gflags.h>
 #include "eabase/fiber/sys_futex.h"
 #include "eabase/fiber/timer_thread.h"
+#include "eabase/fiber/timing_wheel.h"
 #include "eabase/fiber/fiber.h"
 #include "eabase/utility/logging.h"
+#include "eabase/utility/fast_rand.h"
+#include "eabase/utility/time.h"
 
 namespace {
 
@@ -254,4 +258,241 @@ TEST(TimerThreadTest, schedule_and_unschedule_in_task) {
     keeper5.expect_first_run();
 }
 
+struct WheelTask {
+    WheelTask* next;
+    int64_t run_time;
+    bool cancelled;
+    int64_t expired_at;
+    bool deleted;
+    bool try_delete() {
+        if (cancelled) {
+            deleted = true;
+        }
+        return cancelled;
+    }
+};
+
+TEST(TimingWheelTest, expire_in_order) {
+    const int64_t tick_us = 100;
+    int64_t now = 1000000000L;
+    eabase::TimingWheel<WheelTask> wheel;
+    ASSERT_NE(0, wheel.init(0, now));
+    ASSERT_EQ(0, wheel.init(tick_us, now));
+    ASSERT_EQ(std::numeric_limits<int64_t>::max(), wheel.next_run_time());
+
+    const size_t N = 20000;
+    std::vector<WheelTask> tasks(N);
+    for (size_t i = 0; i < N; ++i) {
+        WheelTask& t = tasks[i];
+        t.next = NULL;
+        // From the past to beyond the wheel.
+        switch (i % 4) {
+        case 0: t.run_time = now - 100 + eabase::fast_rand_less_than(30000); break;
+        case 1: t.run_time = now + eabase::fast_rand_less_than(10000000); break;
+        case 2: t.run_time = now + eabase::fast_rand_less_than(3000000000L); break;
+        default: t.run_time = std::numeric_limits<int64_t>::max(); break;
+        }
+        t.cancelled = (i % 3 == 0);
+        t.expired_at = -1;
+        t.deleted = false;
+        wheel.add(&t);
+    }
+    ASSERT_EQ(N, wheel.size());
+    const int64_t start = now;
+    const int64_t end = now + 4000000000L;
+    while (now < end) {
+        const int64_t next = wheel.next_run_time();
+        // Jump to the next run time or advance a random step.
+        now = std::max(now, std::min(std::min(next, end), now + 1 +
+                       (int64_t)eabase::fast_rand_less_than(50000000)));
+        for (WheelTask* p = wheel.advance(now); p; p = p->next) {
+            ASSERT_EQ(-1, p->expired_at);
+            p->expired_at = now;
+        }
+    }
+    for (size_t i = 0; i < N; ++i) {
+        const WheelTask& t = tasks[i];
+        if (t.run_time == std::numeric_limits<int64_t>::max()) {
+            ASSERT_EQ(-1, t.expired_at);
+            continue;
+        }
+        if (t.deleted) {
+            ASSERT_EQ(-1, t.expired_at);
+            continue;
+        }
+        ASSERT_NE(-1, t.expired_at) << i;
+        // Not earlier than run_time, and at the first tick after it since
+        // the wheel is always advanced by next_run_time().
+        ASSERT_GE(t.expired_at, t.run_time) << i;
+        ASSERT_EQ(std::max(start, (t.run_time + tick_us - 1) / tick_us * tick_us),
+                  t.expired_at) << i;
+    }
+    // Tasks beyond the wheel are still there.
+    ASSERT_GE(wheel.size(), N / 4);
+}
+
+TEST(TimingWheelTest, overdue_and_next_run_time) {
+    eabase::TimingWheel<WheelTask> wheel;
+    ASSERT_EQ(0, wheel.init(1000, 1000000));
+    WheelTask past = { NULL, 0, false, -1, false };
+    wheel.add(&past);
+    ASSERT_EQ(0, wheel.next_run_time());
+    ASSERT_EQ(&past, wheel.advance(1000000));
+    WheelTask t1 = { NULL, 1000001, false, -1, false };
+    WheelTask t2 = { NULL, 1300000, false, -1, false };
+    wheel.add(&t1);
+    wheel.add(&t2);
+    ASSERT_EQ(1001000, wheel.next_run_time());
+    ASSERT_EQ(NULL, wheel.advance(1000999));
+    ASSERT_EQ(&t1, wheel.advance(1001000));
+    ASSERT_EQ(NULL, t1.next);
+    // t2 is in level 1, woken up when it's cascaded.
+    ASSERT_EQ(1280000, wheel.next_run_time());
+    ASSERT_EQ(NULL, wheel.advance(1280000));
+    ASSERT_EQ(1300000, wheel.next_run_time());
+    ASSERT_EQ(&t2, wheel.advance(1300000));
+    ASSERT_EQ(0u, wheel.size());
+}
+
+TEST(TimingWheelTest, advance_over_long_gap) {
+    eabase::TimingWheel<WheelTask> wheel;
+    ASSERT_EQ(0, wheel.init(1, 0));
+    WheelTask t1 = { NULL, 5000000000L, false, -1, false };
+    WheelTask t2 = { NULL, 3000000000000L, false, -1, false };
+    wheel.add(&t1);
+    wheel.add(&t2);
+    // Billions of ticks are skipped instead of being walked one by one.
+    eabase::Timer tm;
+    tm.start();
+    ASSERT_EQ(NULL, wheel.advance(4999999999L));
+    ASSERT_EQ(&t1, wheel.advance(1000000000000L));
+    ASSERT_EQ(NULL, wheel.advance(2999999999999L));
+    ASSERT_EQ(&t2, wheel.advance(3000000000000L));
+    tm.stop();
+    ASSERT_LT(tm.m_elapsed(), 100);
+    ASSERT_EQ(0u, wheel.size());
+    ASSERT_EQ(NULL, wheel.advance(4000000000000L));
+}
+
+TEST(TimerThreadTest, timing_wheel_run_tasks) {
+    eabase::TimerThread timer_thread;
+    eabase::TimerThreadOptions options;
+    options.use_timing_wheel = true;
+    options.timing_wheel_tick_us = 0;
+    ASSERT_EQ(EINVAL, timer_thread.start(&options));
+    options.timing_wheel_tick_us = 1000;
+    ASSERT_EQ(0, timer_thread.start(&options));
+
+    TimeKeeper keeper1(eabase::milliseconds_from_now(500), "keeper1");
+    keeper1.schedule(&timer_thread);
+    TimeKeeper keeper2(eabase::milliseconds_from_now(500), "keeper2");
+    keeper2.schedule(&timer_thread);
+    TimeKeeper keeper3(eabase::milliseconds_from_now(100), "keeper3");
+    keeper3.schedule(&timer_thread);
+    TimeKeeper keeper4(eabase::seconds_from_now(10), "keeper4");
+    keeper4.schedule(&timer_thread);
+    timespec old_time = { 0, 0 };
+    TimeKeeper keeper5(old_time, "keeper5");
+    keeper5.schedule(&timer_thread);
+    const timespec keeper5_addtime = eabase::seconds_from_now(0);
+    ASSERT_EQ(0, timer_thread.unschedule(keeper2._task_id));
+    usleep(700000);
+    ASSERT_EQ(0, timer_thread.unschedule(keeper4._task_id));
+    timer_thread.stop_and_join();
+
+    keeper1.expect_first_run();
+    keeper2.expect_not_run();
+    keeper3.expect_first_run();
+    keeper4.expect_not_run();
+    keeper5.expect_first_run(keeper5_addtime);
+}
+
+eabase::atomic<int> g_nrun(0);
+
+void count_run(void*) {
+    g_nrun.fetch_add(1, eabase::memory_order_relaxed);
+}
+
+void set_flag(void* arg) {
+    static_cast<eabase::atomic<bool>*>(arg)->store(true);
+}
+
+// Wait until the timer thread pulled all tasks scheduled before.
+void wait_pulled(eabase::TimerThread* tt) {
+    eabase::atomic<bool> done(false);
+    tt->schedule(set_flag, &done, eabase::seconds_from_now(0));
+    while (!done.load()) {
+        usleep(100);
+    }
+}
+
+void get_thread_cputime(void* arg) {
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    *static_cast<int64_t*>(arg) =
+        (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000L +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000L;
+}
+
+// Cpu time consumed by the timer thread so far.
+int64_t timer_cputime_ns(eabase::TimerThread* tt) {
+    int64_t ns = -1;
+    tt->schedule(get_thread_cputime, &ns, eabase::seconds_from_now(0));
+    while (*(volatile int64_t*)&ns == -1) {
+        usleep(100);
+    }
+    return ns;
+}
+
+// Lots of pending deadlines, most of them are cancelled after the timer
+// thread pulled them, like timeouts of RPC.
+void bench_schedule_and_cancel(bool use_wheel, size_t n) {
+    eabase::TimerThread tt;
+    eabase::TimerThreadOptions options;
+    options.use_timing_wheel = use_wheel;
+    ASSERT_EQ(0, tt.start(&options));
+    g_nrun.store(0);
+    std::vector<eabase::TimerThread::TaskId> ids(n);
+    const int64_t start_cpu = timer_cputime_ns(&tt);
+    eabase::Timer tm;
+    tm.start();
+    const size_t ROUNDS = 10;
+    for (size_t r = 0; r < ROUNDS; ++r) {
+        const size_t begin = n / ROUNDS * r;
+        const size_t end = n / ROUNDS * (r + 1);
+        for (size_t i = begin; i < end; ++i) {
+            // Deadlines in 100ms ~ 1.1s
+            ids[i] = tt.schedule(count_run, NULL, eabase::microseconds_from_now(
+                                     100000 + eabase::fast_rand_less_than(1000000)));
+        }
+        wait_pulled(&tt);
+        for (size_t i = begin; i < end; ++i) {
+            if (i % 20 != 0) {
+                tt.unschedule(ids[i]);
+            }
+        }
+    }
+    tm.stop();
+    const int64_t caller_ns = tm.n_elapsed();
+    const int expected = (int)((n + 19) / 20);
+    while (g_nrun.load() != expected) {
+        usleep(10000);
+    }
+    const int64_t timer_cpu_ns = timer_cputime_ns(&tt) - start_cpu;
+    tt.stop_and_join();
+    std::cout << (use_wheel ? "timing wheel" : "heap") << " n=" << n
+              << " caller=" << caller_ns / n << "ns/task"
+              << " timer_thread_cpu=" << timer_cpu_ns / n << "ns/task"
+              << std::endl;
+}
+
+TEST(TimerThreadTest, schedule_and_cancel_performance) {
+    // Callers of the first run get fresh Tasks while later runs reuse
+    // returned ones, compare the timer thread cpu mainly.
+    for (int i = 0; i < 2; ++i) {
+        bench_schedule_and_cancel(false, 500000);
+        bench_schedule_and_cancel(true, 500000);
+    }
+}
+
 } // end namespace
@@ -0,0 +1,148 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <stdio.h>
+#include <inttypes.h>                      // PRIu64
+#include <unistd.h>                        // unlink
+#include <sstream>
+#include <string>
+#include <gtest/gtest.h>
+#include "eabase/utility/time.h"
+#include "eabase/fiber/fiber.h"
+#include "eabase/fiber/butex.h"
+#include "eabase/fiber/unstable.h"
+#include "eabase/fiber/sched_trace.h"
+
+namespace {
+struct PingPongArg {
+    eabase::atomic<int>* butex;
+    int rounds;
+};
+
+void* ping_pong(void* void_arg) {
+    PingPongArg* arg = static_cast<PingPongArg*>(void_arg);
+    for (int i = 0; i < arg->rounds; ++i) {
+        arg->butex->fetch_add(1);
+        eabase::butex_wake(arg->butex);
+        fiber_usleep(100);
+    }
+    return NULL;
+}
+
+void* wait_butex(void* void_arg) {
+    PingPongArg* arg = static_cast<PingPongArg*>(void_arg);
+    int expected = 0;
+    while (expected < arg->rounds) {
+        const int val = arg->butex->load();
+        if (val == expected) {
+            eabase::butex_wait(arg->butex, val, NULL);
+        } else {
+            expected = val;
+        }
+    }
+    return NULL;
+}
+
+size_t count_of(const std::string& s, const std::string& pattern) {
+    size_t n = 0;
+    for (size_t pos = s.find(pattern); pos != std::string::npos;
+         pos = s.find(pattern, pos + 1)) {
+        ++n;
+    }
+    return n;
+}
+
+TEST(SchedTraceTest, ring_keeps_latest_events) {
+    eabase::SchedTraceRing ring(1);
+    ASSERT_EQ(0, ring.init(8));
+    for (int i = 0; i < 20; ++i) {
+        eabase::SchedTraceEvent e = { (uint64_t)i, (fiber_t)i, 0,
+                                      eabase::SCHED_TRACE_READY, 0 };
+        ring.record(e);
+    }
+    std::vector<eabase::SchedTraceEvent> events;
+    ring.snapshot(&events);
+    // The oldest slot may be being overwritten, which is skipped.
+    ASSERT_EQ(7u, events.size());
+    for (size_t i = 0; i < events.size(); ++i) {
+        ASSERT_EQ(13 + i, events[i].tid);
+        ASSERT_EQ(1, events[i].ring);
+    }
+}
+
+TEST(SchedTraceTest, dump_chrome_trace) {
+    const int64_t begin_us = eabase::monotonic_time_us();
+    eabase::FLAGS_fiber_trace = true;
+    eabase::atomic<int>* butex = eabase::butex_create_checked<eabase::atomic<int> >();
+    butex->store(0);
+    PingPongArg arg = { butex, 100 };
+    fiber_t waiter;
+    fiber_t waker;
+    ASSERT_EQ(0, fiber_start_lazy(&waiter, NULL, wait_butex, &arg));
+    ASSERT_EQ(0, fiber_start_lazy(&waker, NULL, ping_pong, &arg));
+    fiber_join(waker, NULL);
+    fiber_join(waiter, NULL);
+    eabase::FLAGS_fiber_trace = false;
+    const int64_t end_us = eabase::monotonic_time_us();
+    eabase::butex_destroy(butex);
+
+    std::ostringstream os;
+    ASSERT_EQ(0, eabase::dump_sched_trace(os, begin_us, end_us));
+    const std::string json = os.str();
+    ASSERT_EQ(0u, json.find("{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+    ASSERT_EQ(json.size() - 3, json.rfind("]}"));
+    char name[64];
+    snprintf(name, sizeof(name), "\"fiber %" PRIu64 "\"", waiter);
+    ASSERT_LE(50u, count_of(json, name));
+    ASSERT_LE(1u, count_of(json, "\"name\":\"create\""));
+    ASSERT_LE(50u, count_of(json, "\"name\":\"butex_wait\""));
+    ASSERT_LE(50u, count_of(json, "\"name\":\"butex_wake\""));
+    ASSERT_LE(50u, count_of(json, "\"name\":\"ready\""));
+    ASSERT_LE(1u, count_of(json, "\"name\":\"thread_name\""));
+    ASSERT_EQ(count_of(json, "{"), count_of(json, "}"));
+
+    // Nothing is recorded after the tracing is switched off.
+    fiber_t th;
+    const int64_t off_us = eabase::monotonic_time_us();
+    ASSERT_EQ(0, fiber_start_lazy(&th, NULL, ping_pong, &arg));
+    fiber_join(th, NULL);
+    std::ostringstream os2;
+    ASSERT_EQ(0, eabase::dump_sched_trace(os2, off_us,
+                                          eabase::monotonic_time_us()));
+    ASSERT_EQ(0u, count_of(os2.str(), "\"name\":\"create\""));
+}
+
+TEST(SchedTraceTest, dump_to_file) {
+    eabase::FLAGS_fiber_trace = true;
+    fiber_t th;
+    PingPongArg arg = { NULL, 0 };
+    ASSERT_EQ(0, fiber_start_lazy(&th, NULL, ping_pong, &arg));
+    fiber_join(th, NULL);
+    eabase::FLAGS_fiber_trace = false;
+    const char* path = "fiber_trace_unittest.json";
+    ASSERT_EQ(0, fiber_trace_dump(path, 1000000));
+    FILE* fp = fopen(path, "r");
+    ASSERT_TRUE(fp != NULL);
+    char buf[64];
+    ASSERT_TRUE(fgets(buf, sizeof(buf), fp) != NULL);
+    fclose(fp);
+    unlink(path);
+    ASSERT_EQ(0, strncmp(buf, "{\"displayTimeUnit\"", 18));
+    ASSERT_EQ(-1, fiber_trace_dump(NULL, 0));
+    ASSERT_EQ(EINVAL, errno);
+}
+}  // namespace
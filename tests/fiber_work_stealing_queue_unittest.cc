@@ -18,6 +18,7 @@
 #include <algorithm>                        // std::sort
 #include <gtest/gtest.h>
 #include "eabase/utility/time.h"
+#include "eabase/utility/atomicops.h"
 #include "eabase/utility/macros.h"
 #include "eabase/utility/scoped_lock.h"
 #include "eabase/fiber/work_stealing_queue.h"
@@ -133,4 +134,167 @@ TEST(WSQTest, sanity) {
               << " popped=" << npopped
               << " left=" << (N - nstolen - npopped)  << std::endl;
 }
+
+TEST(WSQTest, push_batch) {
+    eabase::WorkStealingQueue<value_type> q;
+    ASSERT_EQ(0, q.init(CAP));
+    const value_type items[] = { 1, 2, 3, 4, 5 };
+    ASSERT_EQ(5u, q.push_batch(items, 5));
+    // Only 3 slots left.
+    ASSERT_EQ(3u, q.push_batch(items, 5));
+    ASSERT_EQ(0u, q.push_batch(items, 5));
+    ASSERT_EQ(CAP, q.volatile_size());
+    value_type val;
+    ASSERT_TRUE(q.steal(&val));
+    ASSERT_EQ(1u, val);
+    ASSERT_TRUE(q.pop(&val));
+    ASSERT_EQ(3u, val);
+    while (q.pop(&val)) {}
+    ASSERT_EQ(0u, q.push_batch(items, 0));
+    ASSERT_EQ(0u, q.volatile_size());
+}
+
+TEST(WSQTest, steal_batch) {
+    eabase::WorkStealingQueue<value_type> q;
+    ASSERT_EQ(0, q.init(64, 4));
+    ASSERT_NE(0, eabase::WorkStealingQueue<value_type>().init(64, 0));
+    ASSERT_NE(0, eabase::WorkStealingQueue<value_type>().init(4, 8));
+    for (value_type i = 1; i <= 20; ++i) {
+        ASSERT_TRUE(q.push(i));
+    }
+    value_type out[8];
+    // Capped by max_steal_batch of init().
+    ASSERT_EQ(4u, q.steal_batch(out, 8));
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_EQ(i + 1, out[i]);
+    }
+    ASSERT_EQ(2u, q.steal_batch(out, 2));
+    ASSERT_EQ(5u, out[0]);
+    // Enough items left, pop() takes the newest one.
+    value_type val;
+    ASSERT_TRUE(q.pop(&val));
+    ASSERT_EQ(20u, val);
+    // 13 left: 7...19
+    while (q.volatile_size() > 4) {
+        ASSERT_TRUE(q.pop(&val));
+    }
+    // No more than max_steal_batch left, pop() still takes the newest one
+    // and the oldest one moves to the bottom: 8 9 7
+    ASSERT_TRUE(q.pop(&val));
+    ASSERT_EQ(10u, val);
+    ASSERT_TRUE(q.pop(&val));
+    ASSERT_EQ(7u, val);
+    // Half of 2 items.
+    ASSERT_EQ(1u, q.steal_batch(out, 8));
+    ASSERT_EQ(9u, out[0]);
+    ASSERT_EQ(1u, q.steal_batch(out, 8));
+    ASSERT_EQ(8u, out[0]);
+    ASSERT_EQ(0u, q.steal_batch(out, 8));
+    ASSERT_FALSE(q.pop(&val));
+}
+
+struct BatchWorker {
+    eabase::WorkStealingQueue<value_type> q;
+    std::vector<value_type> done;
+    size_t nsteal;
+    int64_t first_run_ns;
+};
+
+const size_t NWORKER = 4;
+BatchWorker* g_workers = NULL;
+size_t g_burst_size = 0;
+size_t g_max_steal = 1;
+eabase::atomic<size_t> g_ndone(0);
+int64_t g_burst_start_ns = 0;
+
+void* batch_worker(void* arg) {
+    const size_t self = (size_t)arg;
+    BatchWorker& w = g_workers[self];
+    value_type stolen[64];
+    size_t victim = self;
+    while (g_ndone.load(eabase::memory_order_relaxed) < g_burst_size) {
+        value_type val;
+        if (!w.q.pop(&val)) {
+            victim = (victim + 1) % NWORKER;
+            if (victim == self) {
+                continue;
+            }
+            size_t n = 0;
+            if (g_max_steal == 1) {
+                n = g_workers[victim].q.steal(&stolen[0]);
+            } else {
+                n = g_workers[victim].q.steal_batch(stolen, g_max_steal);
+            }
+            if (n == 0) {
+                sched_yield();
+                continue;
+            }
+            ++w.nsteal;
+            val = stolen[0];
+            w.q.push_batch(stolen + 1, n - 1);
+        }
+        if (w.first_run_ns == 0) {
+            w.first_run_ns = eabase::cpuwide_time_ns() - g_burst_start_ns;
+        }
+        // Simulate a short task.
+        const int64_t end_ns = eabase::cpuwide_time_ns() + 200;
+        while (eabase::cpuwide_time_ns() < end_ns) {}
+        w.done.push_back(val);
+        g_ndone.fetch_add(1, eabase::memory_order_relaxed);
+    }
+    return NULL;
+}
+
+// A burst lands on worker 0, other workers steal with batches of at most
+// `max_steal' tasks.
+void run_burst(size_t burst_size, size_t max_steal) {
+    BatchWorker workers[NWORKER];
+    for (size_t i = 0; i < NWORKER; ++i) {
+        ASSERT_EQ(0, workers[i].q.init(32768, std::max(max_steal, (size_t)1)));
+        workers[i].nsteal = 0;
+        workers[i].first_run_ns = 0;
+    }
+    g_workers = workers;
+    g_burst_size = burst_size;
+    g_max_steal = max_steal;
+    g_ndone.store(0);
+    for (size_t i = 0; i < burst_size; ++i) {
+        ASSERT_TRUE(workers[0].q.push(i));
+    }
+    g_burst_start_ns = eabase::cpuwide_time_ns();
+    pthread_t th[NWORKER];
+    for (size_t i = 0; i < NWORKER; ++i) {
+        ASSERT_EQ(0, pthread_create(&th[i], NULL, batch_worker, (void*)i));
+    }
+    for (size_t i = 0; i < NWORKER; ++i) {
+        pthread_join(th[i], NULL);
+    }
+    const int64_t elapsed_ns = eabase::cpuwide_time_ns() - g_burst_start_ns;
+
+    std::vector<value_type> all;
+    size_t nsteal = 0;
+    int64_t converge_ns = 0;
+    for (size_t i = 0; i < NWORKER; ++i) {
+        all.insert(all.end(), workers[i].done.begin(), workers[i].done.end());
+        nsteal += workers[i].nsteal;
+        converge_ns = std::max(converge_ns, workers[i].first_run_ns);
+    }
+    std::sort(all.begin(), all.end());
+    ASSERT_EQ(burst_size, all.size());
+    for (size_t i = 0; i < burst_size; ++i) {
+        ASSERT_EQ(i, all[i]);
+    }
+    std::cout << "burst=" << burst_size << " max_steal=" << max_steal
+              << " all_workers_busy=" << converge_ns / 1000 << "us"
+              << " all_done=" << elapsed_ns / 1000 << "us"
+              << " steal_cas_per_task=" << (double)nsteal / burst_size
+              << std::endl;
+}
+
+TEST(WSQTest, steal_batch_burst_performance) {
+    const size_t max_steals[] = { 1, 4, 16, 64 };
+    for (size_t i = 0; i < ARRAY_SIZE(max_steals); ++i) {
+        run_burst(20000, max_steals[i]);
+    }
+}
 } // namespace
@@ -0,0 +1,260 @@
+// Licensed to the Apache Software Foundation (ASF) under one
+// or more contributor license agreements.  See the NOTICE file
+// distributed with this work for additional information
+// regarding copyright ownership.  The ASF licenses this file
+// to you under the Apache License, Version 2.0 (the
+// "License"); you may not use this file except in compliance
+// with the License.  You may obtain a copy of the License at
+//
+//   http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing,
+// software distributed under the License is distributed on an
+// "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+// KIND, either express or implied.  See the License for the
+// specific language governing permissions and limitations
+// under the License.
+
+#include <sys/resource.h>                    // getrusage
+#include <gtest/gtest.h>
+#include <gflags/gflags.h>
+#include "eabase/utility/atomicops.h"
+#include "eabase/utility/time.h"
+#include "eabase/var/var.h"
+#include "eabase/fiber/fiber.h"
+#include "eabase/fiber/butex.h"
+#include "eabase/fiber/timer_thread.h"
+
+namespace eabase {
+DECLARE_bool(fiber_worker_local_timer);
+}
+
+namespace {
+int g_nrun = 0;
+
+void inc_nrun(void*) {
+    ++g_nrun;
+}
+
+TEST(TimerQueueTest, run_expired_and_unschedule) {
+    eabase::TimerQueue q;
+    ASSERT_TRUE(q.empty());
+    ASSERT_EQ(std::numeric_limits<int64_t>::max(), q.next_run_time());
+    const int64_t now_us = eabase::gettimeofday_us();
+    eabase::TimerThread::TaskId ids[10];
+    for (int i = 9; i >= 0; --i) {
+        ids[i] = q.schedule(inc_nrun, NULL,
+                            eabase::microseconds_to_timespec(now_us + i * 1000));
+        ASSERT_NE(eabase::TimerThread::INVALID_TASK_ID, ids[i]);
+    }
+    ASSERT_EQ(10u, q.size());
+    ASSERT_EQ(now_us, q.next_run_time());
+    // Ids of TimerQueue are unscheduled by any TimerThread.
+    eabase::TimerThread* tt = eabase::get_or_create_global_timer_thread();
+    ASSERT_EQ(0, tt->unschedule(ids[3]));
+    ASSERT_EQ(-1, tt->unschedule(ids[3]));
+
+    g_nrun = 0;
+    ASSERT_EQ(0u, q.run_expired(now_us - 1));
+    ASSERT_EQ(5u, q.run_expired(now_us + 5000));
+    ASSERT_EQ(5, g_nrun);
+    ASSERT_EQ(-1, tt->unschedule(ids[4]));
+    ASSERT_EQ(now_us + 6000, q.next_run_time());
+    ASSERT_EQ(4u, q.size());
+
+    // Moved to the timer thread which runs them instead.
+    ASSERT_EQ(0, tt->unschedule(ids[9]));
+    q.move_to(tt);
+    ASSERT_TRUE(q.empty());
+    for (int i = 0; i < 1000 && g_nrun != 8; ++i) {
+        usleep(1000);
+    }
+    ASSERT_EQ(8, g_nrun);
+}
+
+TEST(TimerQueueTest, drop_unscheduled) {
+    eabase::TimerQueue q;
+    eabase::TimerThread* tt = eabase::get_or_create_global_timer_thread();
+    const int64_t now_us = eabase::gettimeofday_us();
+    // Long timeouts cancelled soon don't pile up in the heap.
+    for (int i = 0; i < 100000; ++i) {
+        const eabase::TimerThread::TaskId id = q.schedule(
+            inc_nrun, NULL, eabase::microseconds_to_timespec(now_us + 1000000 + i));
+        ASSERT_EQ(0, tt->unschedule(id));
+    }
+    ASSERT_LT(q.size(), 200u);
+    // Unscheduled tasks at the top don't hide the earliest live one.
+    const eabase::TimerThread::TaskId id = q.schedule(
+        inc_nrun, NULL, eabase::microseconds_to_timespec(now_us));
+    q.schedule(inc_nrun, NULL, eabase::microseconds_to_timespec(now_us + 10));
+    ASSERT_EQ(0, tt->unschedule(id));
+    ASSERT_EQ(now_us + 10, q.next_run_time());
+    g_nrun = 0;
+    ASSERT_EQ(1u, q.run_expired(now_us + 10));
+    ASSERT_EQ(1, g_nrun);
+    q.move_to(NULL);
+}
+
+struct SleepArg {
+    int64_t timeout_us;
+    int nloop;
+    int64_t oversleep_us;
+};
+
+void* sleeper(void* arg) {
+    SleepArg* a = static_cast<SleepArg*>(arg);
+    for (int i = 0; i < a->nloop; ++i) {
+        const int64_t begin_us = eabase::gettimeofday_us();
+        EXPECT_EQ(0, fiber_usleep(a->timeout_us));
+        const int64_t elapsed_us = eabase::gettimeofday_us() - begin_us;
+        EXPECT_GE(elapsed_us, a->timeout_us);
+        a->oversleep_us += elapsed_us - a->timeout_us;
+    }
+    return NULL;
+}
+
+int64_t get_var(const char* name) {
+    return atoll(eabase::Variable::describe_exposed(name).c_str());
+}
+
+TEST(WorkerTimerTest, usleep) {
+    eabase::FLAGS_fiber_worker_local_timer = true;
+    const int64_t nfired0 = get_var("fiber_worker_timer_count");
+    const int N = 16;
+    SleepArg args[N];
+    fiber_t th[N];
+    for (int i = 0; i < N; ++i) {
+        args[i].timeout_us = 1000 + i * 300;
+        args[i].nloop = 20;
+        args[i].oversleep_us = 0;
+        ASSERT_EQ(0, fiber_start(&th[i], NULL, sleeper, &args[i]));
+    }
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+    }
+    eabase::FLAGS_fiber_worker_local_timer = false;
+    ASSERT_EQ(N * 20, get_var("fiber_worker_timer_count") - nfired0);
+}
+
+void* interrupted_sleeper(void* arg) {
+    const int64_t begin_us = eabase::gettimeofday_us();
+    EXPECT_EQ(-1, fiber_usleep(10000000));
+    EXPECT_EQ(EINTR, errno);
+    *static_cast<int64_t*>(arg) = eabase::gettimeofday_us() - begin_us;
+    return NULL;
+}
+
+TEST(WorkerTimerTest, interrupt) {
+    eabase::FLAGS_fiber_worker_local_timer = true;
+    int64_t elapsed_us = 0;
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, NULL, interrupted_sleeper, &elapsed_us));
+    usleep(10000);
+    ASSERT_EQ(0, fiber_interrupt(th));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    eabase::FLAGS_fiber_worker_local_timer = false;
+    ASSERT_LT(elapsed_us, 1000000);
+}
+
+struct WaitArg {
+    int* butex;
+    int64_t timeout_us;
+    int rc;
+    int error;
+    int64_t elapsed_us;
+};
+
+void* timed_waiter(void* arg) {
+    WaitArg* a = static_cast<WaitArg*>(arg);
+    const int64_t begin_us = eabase::gettimeofday_us();
+    const timespec abstime = eabase::microseconds_from_now(a->timeout_us);
+    a->rc = eabase::butex_wait(a->butex, 0, &abstime);
+    a->error = errno;
+    a->elapsed_us = eabase::gettimeofday_us() - begin_us;
+    return NULL;
+}
+
+TEST(WorkerTimerTest, butex_timed_wait) {
+    eabase::FLAGS_fiber_worker_local_timer = true;
+    int* butex = eabase::butex_create_checked<int>();
+    *butex = 0;
+    // Timed out.
+    WaitArg a = { butex, 5000, 0, 0, 0 };
+    fiber_t th;
+    ASSERT_EQ(0, fiber_start(&th, NULL, timed_waiter, &a));
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    ASSERT_EQ(-1, a.rc);
+    ASSERT_EQ(ETIMEDOUT, a.error);
+    ASSERT_GE(a.elapsed_us, 5000);
+
+    // Woken up before the timeout which is unscheduled.
+    const int64_t nfired0 = get_var("fiber_worker_timer_count");
+    WaitArg b = { butex, 1000000, 0, 0, 0 };
+    ASSERT_EQ(0, fiber_start(&th, NULL, timed_waiter, &b));
+    while (eabase::butex_wake(butex) == 0) {
+        usleep(1000);
+    }
+    ASSERT_EQ(0, fiber_join(th, NULL));
+    ASSERT_EQ(0, b.rc);
+    ASSERT_LT(b.elapsed_us, 1000000);
+    ASSERT_EQ(nfired0, get_var("fiber_worker_timer_count"));
+    eabase::FLAGS_fiber_worker_local_timer = false;
+    eabase::butex_destroy(butex);
+}
+
+void get_thread_cputime(void* arg) {
+    rusage usage;
+    getrusage(RUSAGE_THREAD, &usage);
+    *static_cast<int64_t*>(arg) =
+        (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000L +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000L;
+}
+
+// Cpu time consumed by the global timer thread so far.
+int64_t timer_cputime_ns() {
+    int64_t ns = -1;
+    eabase::get_or_create_global_timer_thread()->schedule(
+        get_thread_cputime, &ns, eabase::seconds_from_now(0));
+    while (*(volatile int64_t*)&ns == -1) {
+        usleep(100);
+    }
+    return ns;
+}
+
+void bench_usleep(bool local_timer) {
+    eabase::FLAGS_fiber_worker_local_timer = local_timer;
+    const int N = 64;
+    const int NLOOP = 100;
+    SleepArg args[N];
+    fiber_t th[N];
+    const int64_t start_cpu = timer_cputime_ns();
+    eabase::Timer tm;
+    tm.start();
+    for (int i = 0; i < N; ++i) {
+        args[i].timeout_us = 500 + i * 10;
+        args[i].nloop = NLOOP;
+        args[i].oversleep_us = 0;
+        ASSERT_EQ(0, fiber_start(&th[i], NULL, sleeper, &args[i]));
+    }
+    int64_t oversleep_us = 0;
+    for (int i = 0; i < N; ++i) {
+        ASSERT_EQ(0, fiber_join(th[i], NULL));
+        oversleep_us += args[i].oversleep_us;
+    }
+    tm.stop();
+    const int64_t timer_cpu_ns = timer_cputime_ns() - start_cpu;
+    eabase::FLAGS_fiber_worker_local_timer = false;
+    std::cout << (local_timer ? "worker timers:" : "global timer: ")
+              << " elapsed=" << tm.m_elapsed() << "ms"
+              << " oversleep=" << oversleep_us / (N * NLOOP) << "us"
+              << " timer_thread_cpu=" << timer_cpu_ns / (N * NLOOP)
+              << "ns/sleep" << std::endl;
+}
+
+TEST(WorkerTimerTest, usleep_performance) {
+    bench_usleep(false);
+    bench_usleep(true);
+    bench_usleep(false);
+    bench_usleep(true);
+}
+} // namespace
@@ -173,6 +173,28 @@ TEST_F(ResourcePoolTest, sanity) {
     ASSERT_TRUE(ptr_set.empty()) << ptr_set.size();
 }
 
+TEST_F(ResourcePoolTest, get_resources) {
+    const size_t N = 1000;
+    std::vector<ResourceId<int> > ids(N);
+    std::vector<int*> objs(N);
+    ASSERT_EQ(N, get_resources(&ids[0], &objs[0], N));
+    std::set<int*> distinct;
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_EQ(objs[i], address_resource(ids[i]));
+        distinct.insert(objs[i]);
+    }
+    ASSERT_EQ(N, distinct.size());
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_EQ(0, return_resource(ids[i]));
+    }
+    // Returned objects are reused.
+    ASSERT_EQ(N, get_resources(&ids[0], &objs[0], N));
+    for (size_t i = 0; i < N; ++i) {
+        ASSERT_TRUE(distinct.count(objs[i]));
+        ASSERT_EQ(0, return_resource(ids[i]));
+    }
+}
+
 TEST_F(ResourcePoolTest, validator) {
     nfoo_dtor = 0;
     int nfoo = 0;